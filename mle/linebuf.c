@@ -1,8 +1,8 @@
-#define INCL_DOSERRORS
 #include <os2.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <memory.h>
+#include "textseq.h"
 #include "linebuf.h"
 
 
@@ -13,6 +13,12 @@
 #define LB_INITIAL_SIZE         256     // initial size of the line-offset buffer
 #define LB_DEFAULT_INC          128     // default increment size
 
+// Bytes allocated for each item: its value and the fields of its line record
+#define LB_ITEM_BYTES   ( sizeof( ULONG ) + sizeof( LONG ) + sizeof( ULONG ) + sizeof( USHORT ))
+
+// Width which an address not holding an item counts as in the widest-line tree
+#define LB_NO_EXTENT    -1L
+
 
 // ---------------------------------------------------------------------------
 // MACROS
@@ -29,7 +35,294 @@
 #define ITEMEND( buf ) \
   ( (buf).ulSp1Len + (buf).ulGapLen + (buf).ulSp2Len )
 
+// Return the value of the item at a (valid) logical index
+#define ITEMVALUE( buf, pos ) \
+  (( (pos) < (buf).ulSp1Len ) ? (buf).pulItems[ (pos) ] : \
+                                (buf).pulItems[ (buf).ulGapLen + (pos) ] + (buf).lSp2Shift )
+
+// Return the width of the line at a buffer address (LB_NO_EXTENT if none)
+#define LINEEXTENT( buf, addr ) \
+  ((( (addr) < (buf).ulSp1Len ) || \
+    (( (addr) >= (buf).ulSp1Len + (buf).ulGapLen ) && ( (addr) < ITEMEND( buf )))) ? \
+   (buf).plExtents[ (addr) ] : LB_NO_EXTENT )
+
+// Return the address of the widest line below a node of the widest-line tree
+#define WINNER( buf, node ) \
+  (( (node) >= (buf).ulLeaves ) ? (node) - (buf).ulLeaves : (buf).pulWinners[ (node) ] )
+
+
+// ---------------------------------------------------------------------------
+// FUNCTION DECLARATIONS
+//
+
+void  LineBuffer_AttachArrays( PLBOBUFFER pBuf, PULONG pulBlock, ULONG ulSize );
+ULONG LineBuffer_BlockSize( ULONG ulSize );
+void  LineBuffer_BuildTree( PLBOBUFFER pBuf );
+void  LineBuffer_MoveLines( PLBOBUFFER pBuf, ULONG ulTarget, ULONG ulSource, ULONG ulCount );
+void  LineBuffer_PutLines( PLBOBUFFER pBuf, ULONG ulAddress, PLBLINEINFO pInfo, ULONG ulCount );
+ULONG LineBuffer_TreeLeaves( ULONG ulSize );
+void  LineBuffer_UpdateTree( PLBOBUFFER pBuf, ULONG ulAddress, ULONG ulCount );
+
+
+// ===========================================================================
+// INTERNAL FUNCTIONS
+// ===========================================================================
+
+/* ------------------------------------------------------------------------- *
+ * LineBuffer_AttachArrays()                                                 *
+ *                                                                           *
+ * Points the item array, the line record arrays and the widest-line tree    *
+ * into a newly-allocated block of LineBuffer_BlockSize( ulSize ) bytes.     *
+ * The item array comes first, so that pulItems is also the address of the   *
+ * block, and the flags come last, so that every array is aligned for its    *
+ * type.  The tree is not built here.                                        *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PLBOBUFFER pBuf    : Pointer to buffer object                           *
+ *   PULONG     pulBlock: The allocated block                                *
+ *   ULONG      ulSize  : Number of items the block holds                    *
+ *                                                                           *
+ * RETURNS: N/A                                                              *
+ * ------------------------------------------------------------------------- */
+void LineBuffer_AttachArrays( PLBOBUFFER pBuf, PULONG pulBlock, ULONG ulSize )
+{
+    pBuf->ulLeaves   = LineBuffer_TreeLeaves( ulSize );
+    pBuf->pulItems   = pulBlock;
+    pBuf->pulRuns    = pBuf->pulItems + ulSize;
+    pBuf->pulWinners = pBuf->pulRuns + ulSize;
+    pBuf->plExtents  = (PLONG) ( pBuf->pulWinners + pBuf->ulLeaves );
+    pBuf->pfsFlags   = (PUSHORT) ( pBuf->plExtents + ulSize );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * LineBuffer_BlockSize()                                                    *
+ *                                                                           *
+ * Returns the number of bytes to allocate for a buffer of ulSize items,     *
+ * including their line records and the widest-line tree.                    *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   ULONG ulSize: Number of items the buffer is to hold                     *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ * ------------------------------------------------------------------------- */
+ULONG LineBuffer_BlockSize( ULONG ulSize )
+{
+    return ( ulSize * LB_ITEM_BYTES ) + ( LineBuffer_TreeLeaves( ulSize ) * sizeof( ULONG ));
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * LineBuffer_BuildTree()                                                    *
+ *                                                                           *
+ * Builds the widest-line tree from scratch.  The nodes are first set to an  *
+ * address which no line can have, so that LineBuffer_UpdateTree() finds     *
+ * every one of them changed and does not stop early.                        *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PLBOBUFFER pBuf: Pointer to buffer object                               *
+ *                                                                           *
+ * RETURNS: N/A                                                              *
+ * ------------------------------------------------------------------------- */
+void LineBuffer_BuildTree( PLBOBUFFER pBuf )
+{
+    memset( pBuf->pulWinners, 0xFF, pBuf->ulLeaves * sizeof( ULONG ));
+    LineBuffer_UpdateTree( pBuf, 0, pBuf->ulLeaves );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * LineBuffer_MoveLines()                                                    *
+ *                                                                           *
+ * Moves the line records of a range of items to another place in the        *
+ * buffer, to follow the items themselves.  The ranges may overlap.          *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PLBOBUFFER pBuf    : Pointer to buffer object                           *
+ *   ULONG      ulTarget: Buffer address to move the records to              *
+ *   ULONG      ulSource: Buffer address of the first record to move         *
+ *   ULONG      ulCount : Number of records to move                          *
+ *                                                                           *
+ * RETURNS: N/A                                                              *
+ * ------------------------------------------------------------------------- */
+void LineBuffer_MoveLines( PLBOBUFFER pBuf, ULONG ulTarget, ULONG ulSource, ULONG ulCount )
+{
+    if ( !ulCount || ( ulTarget == ulSource )) return;
+    memmove( pBuf->plExtents + ulTarget, pBuf->plExtents + ulSource, ulCount * sizeof( LONG ));
+    memmove( pBuf->pulRuns + ulTarget, pBuf->pulRuns + ulSource, ulCount * sizeof( ULONG ));
+    memmove( pBuf->pfsFlags + ulTarget, pBuf->pfsFlags + ulSource, ulCount * sizeof( USHORT ));
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * LineBuffer_PutLines()                                                     *
+ *                                                                           *
+ * Stores the line records for a range of items, or blank records if none    *
+ * are given.                                                                *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PLBOBUFFER  pBuf     : Pointer to buffer object                         *
+ *   ULONG       ulAddress: Buffer address of the first record to store      *
+ *   PLBLINEINFO pInfo    : The records to store (NULL = blank)              *
+ *   ULONG       ulCount  : Number of records to store                       *
+ *                                                                           *
+ * RETURNS: N/A                                                              *
+ * ------------------------------------------------------------------------- */
+void LineBuffer_PutLines( PLBOBUFFER pBuf, ULONG ulAddress, PLBLINEINFO pInfo, ULONG ulCount )
+{
+    ULONG i;
+
+    if ( !pInfo ) {
+        memset( pBuf->plExtents + ulAddress, 0, ulCount * sizeof( LONG ));
+        memset( pBuf->pulRuns + ulAddress, 0, ulCount * sizeof( ULONG ));
+        memset( pBuf->pfsFlags + ulAddress, 0, ulCount * sizeof( USHORT ));
+        return;
+    }
+    for ( i = 0; i < ulCount; i++ ) {
+        pBuf->plExtents[ ulAddress+i ] = pInfo[ i ].lExtent;
+        pBuf->pulRuns[ ulAddress+i ]   = pInfo[ i ].ulRun;
+        pBuf->pfsFlags[ ulAddress+i ]  = pInfo[ i ].fsFlags;
+    }
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * LineBuffer_TreeLeaves()                                                   *
+ *                                                                           *
+ * Returns the number of leaves in the widest-line tree for a buffer of      *
+ * ulSize items: the smallest power of two which is at least ulSize (and at  *
+ * least 2, so that the tree has a top node).  The tree has one node fewer   *
+ * than this, numbered from 1 (the top); the children of node n are nodes    *
+ * 2n and 2n+1, and the leaf for buffer address a is node ulLeaves + a.      *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   ULONG ulSize: Number of items the buffer holds                          *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ * ------------------------------------------------------------------------- */
+ULONG LineBuffer_TreeLeaves( ULONG ulSize )
+{
+    ULONG ulLeaves;
+
+    for ( ulLeaves = 2; ulLeaves < ulSize; ulLeaves *= 2 );
+    return ulLeaves;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * LineBuffer_UpdateTree()                                                   *
+ *                                                                           *
+ * Replays the widest-line tree above a range of buffer addresses whose      *
+ * line widths, or whose use, have changed.  Each level is replayed only     *
+ * over the nodes above the range, so this takes O(k + log n) for k          *
+ * addresses.  We can stop early once a level has been replayed without      *
+ * any node's winner changing, unless one of the winners is in the range     *
+ * (and so may have changed width), since the levels above depend on         *
+ * nothing else.  Where two lines are as wide as each other, the one at the  *
+ * lower address (i.e. the earlier line) wins.                               *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PLBOBUFFER pBuf     : Pointer to buffer object                          *
+ *   ULONG      ulAddress: First buffer address which has changed            *
+ *   ULONG      ulCount  : Number of addresses which have changed            *
+ *                                                                           *
+ * RETURNS: N/A                                                              *
+ * ------------------------------------------------------------------------- */
+void LineBuffer_UpdateTree( PLBOBUFFER pBuf, ULONG ulAddress, ULONG ulCount )
+{
+    ULONG ulFirst,      // First node to replay on the current level
+          ulLast,       // Last node to replay on the current level
+          ulLeft,       // Winner of the node's left branch
+          ulRight,      // Winner of the node's right branch
+          ulWinner,     // New winner of the node
+          n;
+    BOOL  fChanged;     // Has anything on the current level changed?
+
+    if ( !ulCount ) return;
+    ulFirst = ( pBuf->ulLeaves + ulAddress ) / 2;
+    ulLast  = ( pBuf->ulLeaves + ulAddress + ulCount - 1 ) / 2;
+    while ( ulFirst ) {
+        fChanged = FALSE;
+        for ( n = ulFirst; n <= ulLast; n++ ) {
+            ulLeft   = WINNER( *pBuf, 2*n );
+            ulRight  = WINNER( *pBuf, 2*n + 1 );
+            ulWinner = ( LINEEXTENT( *pBuf, ulRight ) > LINEEXTENT( *pBuf, ulLeft )) ?
+                           ulRight : ulLeft;
+            if (( ulWinner != pBuf->pulWinners[ n ] ) ||
+                (( ulWinner >= ulAddress ) && ( ulWinner - ulAddress < ulCount )))
+                fChanged = TRUE;
+            pBuf->pulWinners[ n ] = ulWinner;
+        }
+        if ( !fChanged ) break;
+        ulFirst /= 2;
+        ulLast  /= 2;
+    }
+}
+
+
+// ===========================================================================
+// PUBLIC FUNCTIONS
+// ===========================================================================
+
+
+/* ------------------------------------------------------------------------- *
+ * LineBuffer_ApplyEdits()                                                   *
+ *                                                                           *
+ * Adjusts the buffer contents to follow a batch of text edits.  The items   *
+ * and the edits are both sorted, so we simply walk through the two lists    *
+ * together; the items are gathered before the gap first so that they can    *
+ * be compacted in place.                                                    *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PLBOBUFFER pBuf   : Pointer to buffer object                            *
+ *   PTEXTEDIT  pEdits : Array of edits, sorted and with lShift filled in    *
+ *   ULONG      ulCount: Number of edits in the array                        *
+ *                                                                           *
+ * RETURNS: BOOL                                                             *
+ *   TRUE on success, FALSE on error                                         *
+ * ------------------------------------------------------------------------- */
+BOOL LineBuffer_ApplyEdits( PLBOBUFFER pBuf, PTEXTEDIT pEdits, ULONG ulCount )
+{
+    ULONG ulItems,      // Number of items before adjustment
+          ulValue,      // Current item value
+          ulIn,         // Index of the current item
+          ulOut,        // Index at which to write the current item
+          ulEdit;       // Index of the first edit not yet passed
+    LONG  lShift;       // Shift caused by all edits passed so far
+
+    if ( !ulCount ) return TRUE;
+    ulItems = ITEMCOUNT( *pBuf );
+    if ( ulItems != pBuf->ulSp1Len )
+        if ( ! LineBuffer_MoveGap( pBuf, ulItems )) return FALSE;
 
+    ulEdit = 0;
+    ulOut  = 0;
+    lShift = 0;
+    for ( ulIn = 0; ulIn < ulItems; ulIn++ ) {
+        ulValue = pBuf->pulItems[ ulIn ];
+
+        // Pass over any edits which end at or before this item
+        while (( ulEdit < ulCount ) &&
+               ( ulValue > pEdits[ ulEdit ].ulPosition ) &&
+               ( ulValue >= pEdits[ ulEdit ].ulPosition + pEdits[ ulEdit ].cbDelete ))
+        {
+            lShift = pEdits[ ulEdit ].lShift;
+            ulEdit++;
+        }
+
+        // Drop the item if it was deleted
+        if (( ulEdit < ulCount ) && ( ulValue > pEdits[ ulEdit ].ulPosition )) continue;
+
+        LineBuffer_MoveLines( pBuf, ulOut, ulIn, 1 );
+        pBuf->pulItems[ ulOut++ ] = ulValue + lShift;
+    }
+
+    memset( pBuf->pulItems + ulOut, 0, ( ulItems - ulOut ) * sizeof( ULONG ));
+    pBuf->ulGapLen += ulItems - ulOut;
+    pBuf->ulSp1Len  = ulOut;
+    LineBuffer_UpdateTree( pBuf, 0, ulItems );
+    return TRUE;
+}
 
 
 /* ------------------------------------------------------------------------- *
@@ -37,7 +330,7 @@
  *                                                                           *
  * Zeroizes the current buffer contents, starting from the indicated offset. *
  * The offset becomes the new gap starting position, although the gap size   *
- * is left unchanged.                                                        *
+ * is left unchanged.  The record of the last line is cleared as well.       *
  *                                                                           *
  * ARGUMENTS:                                                                *
  *   PLBOBUFFER pBuf      : Pointer to buffer object                         *
@@ -51,8 +344,11 @@ BOOL LineBuffer_Clear( PLBOBUFFER pBuf, ULONG ulPosition )
         if ( ! LineBuffer_MoveGap( pBuf, ulPosition )) return FALSE;
 
     memset( pBuf->pulItems + ulPosition, 0,
-            pBuf->ulSize - ( ulPosition * sizeof( ULONG )));
-    pBuf->ulSp2Len = 0;
+            ( pBuf->ulSize - ulPosition ) * sizeof( ULONG ));
+    pBuf->ulSp2Len  = 0;
+    pBuf->lSp2Shift = 0;
+    memset( &(pBuf->last), 0, sizeof( LBLINEINFO ));
+    LineBuffer_UpdateTree( pBuf, ulPosition, pBuf->ulSize - ulPosition );
     return TRUE;
 }
 
@@ -73,6 +369,34 @@ ULONG LineBuffer_Count( PLBOBUFFER pBuf )
 }
 
 
+/* ------------------------------------------------------------------------- *
+ * LineBuffer_Delete()                                                       *
+ *                                                                           *
+ * Removes the item at the given logical position, by moving the gap to it   *
+ * and then widening the gap over it.                                        *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PLBOBUFFER pBuf      : Pointer to buffer object                         *
+ *   ULONG      ulPosition: The logical position of the item to remove       *
+ *                                                                           *
+ * RETURNS: BOOL                                                             *
+ *   TRUE on success, FALSE on error                                         *
+ * ------------------------------------------------------------------------- */
+BOOL LineBuffer_Delete( PLBOBUFFER pBuf, ULONG ulPosition )
+{
+    if ( ulPosition >= ITEMCOUNT( *pBuf )) return FALSE;
+    if ( ulPosition != pBuf->ulSp1Len )
+        if ( ! LineBuffer_MoveGap( pBuf, ulPosition )) return FALSE;
+
+    pBuf->pulItems[ ulPosition + pBuf->ulGapLen ] = 0;
+    pBuf->ulGapLen++;
+    pBuf->ulSp2Len--;
+    if ( !pBuf->ulSp2Len ) pBuf->lSp2Shift = 0;
+    LineBuffer_UpdateTree( pBuf, ulPosition + pBuf->ulGapLen - 1, 1 );
+    return TRUE;
+}
+
+
 /* ------------------------------------------------------------------------- *
  * LineBuffer_Expand()                                                       *
  *                                                                           *
@@ -85,34 +409,36 @@ ULONG LineBuffer_Count( PLBOBUFFER pBuf )
  *   ULONG      ulRequested: Requested new buffer size (in ULONG items)      *
  *                                                                           *
  * RETURNS: ULONG                                                            *
- *   The new buffer size (in ULONGs).                                        *
+ *   The new buffer size (in ULONGs), or 0 if it could not be allocated.     *
  * ------------------------------------------------------------------------- */
 ULONG LineBuffer_Expand( PLBOBUFFER pBuf, ULONG ulRequested )
 {
     ULONG  ulCurrentSize,
            ulNewSize;
     PULONG pulNew;
-    APIRET rc;
+    LBOBUFFER old;      // Buffer state before expansion
+
+    if (( !pBuf->pulItems ) || ( !pBuf->ulSize ))
+        if ( ! LineBuffer_Init( pBuf, 0 )) return 0;
 
     ulCurrentSize = pBuf->ulSize;
     if ( ulRequested && ( ulRequested <= ulCurrentSize ))
         return ( ulCurrentSize );
 
-    if (( !pBuf->pulItems ) || ( !ulCurrentSize ))
-        if ( ! LineBuffer_Init( pBuf, 0 )) return 0;
-
     ulNewSize = ulRequested ? ulRequested : ( ulCurrentSize + LB_DEFAULT_INC );
-    rc = DosAllocMem( (PPVOID) &pulNew, ulNewSize * sizeof( ULONG ),
-                      PAG_READ | PAG_WRITE | PAG_COMMIT );
-    if ( rc == NO_ERROR ) {
-        memcpy( pulNew, pBuf->pulItems, pBuf->ulSize * sizeof( ULONG ));
-        DosFreeMem( pBuf->pulItems );
-        pBuf->pulItems = pulNew;
-    }
-//    pBuf->pulItems = (PULONG) realloc( pBuf->pulItems, ulNewSize * sizeof( ULONG ));
-//    if ( pBuf->pulItems == NULL ) return 0;
+    pulNew = (PULONG) TextAllocMemory( pBuf->pAllocator, LineBuffer_BlockSize( ulNewSize ));
+    if ( !pulNew ) return 0;
+    old = *pBuf;
+    LineBuffer_AttachArrays( pBuf, pulNew, ulNewSize );
+    memset( pBuf->pulItems, 0, ulNewSize * sizeof( ULONG ));
+    memcpy( pBuf->pulItems, old.pulItems, old.ulSize * sizeof( ULONG ));
+    memcpy( pBuf->plExtents, old.plExtents, old.ulSize * sizeof( LONG ));
+    memcpy( pBuf->pulRuns, old.pulRuns, old.ulSize * sizeof( ULONG ));
+    memcpy( pBuf->pfsFlags, old.pfsFlags, old.ulSize * sizeof( USHORT ));
+    TextFreeMemory( pBuf->pAllocator, old.pulItems );
 
     pBuf->ulSize = ulNewSize;
+    LineBuffer_BuildTree( pBuf );
 
 //printf("Expanded buffer to %u bytes\n", ulNewSize );
 
@@ -132,16 +458,80 @@ ULONG LineBuffer_Expand( PLBOBUFFER pBuf, ULONG ulRequested )
  * ------------------------------------------------------------------------- */
 void LineBuffer_Free( PLBOBUFFER pBuf )
 {
-    if ( pBuf->ulSize ) DosFreeMem( pBuf->pulItems );
+    if ( pBuf->ulSize ) TextFreeMemory( pBuf->pAllocator, pBuf->pulItems );
     memset( pBuf, 0, sizeof( LBOBUFFER ));
 }
 
 
+/* ------------------------------------------------------------------------- *
+ * LineBuffer_FindNear                                                       *
+ *                                                                           *
+ * Locates the sorted position for the specified value by searching outwards *
+ * from a hint (usually the result of a recent search) in steps of doubling  *
+ * size, until the value has been bracketed; the bracket is then searched    *
+ * with LineBuffer_FindPosition().  This takes O(log d) probes, where d is   *
+ * the distance between the hint and the result.                             *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PLBOBUFFER pBuf    : Pointer to buffer object                           *
+ *   ULONG      ulHint  : Position at which to start looking                 *
+ *   ULONG      ulValue : Value whose position is sought                     *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   The sorted position where the indicated value should be placed.         *
+ * ------------------------------------------------------------------------- */
+ULONG LineBuffer_FindNear( PLBOBUFFER pBuf, ULONG ulHint, ULONG ulValue )
+{
+    ULONG ulCount,      // Number of items in the buffer
+          ulLow,        // First position which may hold the result
+          ulHigh,       // Last position which may hold the result
+          ulStep;       // Distance of the current probe from the hint
+
+    ulCount = ITEMCOUNT( *pBuf );
+    if ( !ulCount ) return 0;
+    if ( ulHint >= ulCount ) ulHint = ulCount - 1;
+
+    if ( ITEMVALUE( *pBuf, ulHint ) < ulValue ) {
+        // Gallop forwards: the result lies after the hint
+        ulLow = ulHint + 1;
+        for ( ulStep = 1; ; ulStep *= 2 ) {
+            if ( ulStep >= ulCount - ulHint ) {
+                ulHigh = ulCount;
+                break;
+            }
+            ulHigh = ulHint + ulStep;
+            if ( ITEMVALUE( *pBuf, ulHigh ) >= ulValue ) break;
+            ulLow = ulHigh + 1;
+        }
+    }
+    else {
+        // Gallop backwards: the result is the hint or lies before it
+        ulHigh = ulHint;
+        for ( ulStep = 1; ; ulStep *= 2 ) {
+            if ( ulStep > ulHint ) {
+                ulLow = 0;
+                break;
+            }
+            if ( ITEMVALUE( *pBuf, ulHint - ulStep ) < ulValue ) {
+                ulLow = ulHint - ulStep + 1;
+                break;
+            }
+            ulHigh = ulHint - ulStep;
+        }
+    }
+
+    if ( ulLow >= ulHigh ) return ulLow;
+    return LineBuffer_FindPosition( pBuf, ulLow, ulHigh - 1, ulValue );
+}
+
+
 /* ------------------------------------------------------------------------- *
  * LineBuffer_FindPosition                                                   *
  *                                                                           *
  * Uses a binary search algorithm to locate the proper (sorted) position in  *
- * the line buffer for the specified value.                                  *
+ * the line buffer for the specified value.  The search narrows the range    *
+ * in a loop, reading the items directly rather than through                 *
+ * LineBuffer_ItemAt().                                                      *
  *                                                                           *
  * ARGUMENTS:                                                                *
  *   PLBOBUFFER pBuf    : Pointer to buffer object                           *
@@ -154,28 +544,61 @@ void LineBuffer_Free( PLBOBUFFER pBuf )
  * ------------------------------------------------------------------------- */
 ULONG LineBuffer_FindPosition( PLBOBUFFER pBuf, ULONG ulStart, ULONG ulEnd, ULONG ulValue )
 {
-    ULONG ulCurrent,
+    ULONG ulLimit,      // Position following the search range
           ulMid;
 
-    if ( ulStart > ulEnd )
-        return ulStart;
-
-    ulMid = ulStart + (( ulEnd - ulStart ) / 2 );
-    ulCurrent = LineBuffer_ItemAt( pBuf, ulMid );
-    if ( ulCurrent > ulValue )
-        return ( !ulMid ? ulMid :
-                 LineBuffer_FindPosition( pBuf, ulStart, ulMid-1, ulValue ));
-    else if ( ulCurrent < ulValue )
-        return LineBuffer_FindPosition( pBuf, ulMid+1, ulEnd, ulValue );
-    else
-        return ulMid;
+    // Positions beyond the last item count as greater than any value
+    if ( ulStart > ulEnd ) return ulStart;
+    ulLimit = ( ulEnd < ITEMCOUNT( *pBuf )) ? ulEnd + 1 : ITEMCOUNT( *pBuf );
+
+    while ( ulStart < ulLimit ) {
+        ulMid = ulStart + (( ulLimit - ulStart ) / 2 );
+        if ( ITEMVALUE( *pBuf, ulMid ) < ulValue )
+            ulStart = ulMid + 1;
+        else
+            ulLimit = ulMid;
+    }
+    return ulStart;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * LineBuffer_FindWidest()                                                   *
+ *                                                                           *
+ * Finds the widest line, according to the extents in the line records.      *
+ * The widest line with a break is the winner at the top of the widest-line  *
+ * tree; it only has to be compared with the last line, which is not in the  *
+ * tree, and converted from a buffer address to a line number.               *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PLBOBUFFER pBuf    : Pointer to buffer object                           *
+ *   PLONG      plExtent: Receives the width of that line (may be NULL)      *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   The number of the widest line.                                          *
+ * ------------------------------------------------------------------------- */
+ULONG LineBuffer_FindWidest( PLBOBUFFER pBuf, PLONG plExtent )
+{
+    ULONG ulAddress;    // Buffer address of the widest line with a break
+    LONG  lWidest;      // Its width
+
+    ulAddress = pBuf->pulWinners[ 1 ];
+    lWidest   = LINEEXTENT( *pBuf, ulAddress );
+    if (( lWidest == LB_NO_EXTENT ) || ( pBuf->last.lExtent > lWidest )) {
+        if ( plExtent ) *plExtent = pBuf->last.lExtent;
+        return ITEMCOUNT( *pBuf );
+    }
+
+    if ( plExtent ) *plExtent = lWidest;
+    return ( ulAddress < pBuf->ulSp1Len ) ? ulAddress : ulAddress - pBuf->ulGapLen;
 }
 
 
 /* ------------------------------------------------------------------------- *
  * LineBuffer_Init()                                                         *
  *                                                                           *
- * Allocates the line-break offset buffer.                                   *
+ * Allocates the line-break offset buffer from the default allocator (see    *
+ * TextSetDefaultAllocator).                                                 *
  *                                                                           *
  * ARGUMENTS:                                                                *
  *   PLBOBUFFER pBuf     : Pointer to buffer object                          *
@@ -186,17 +609,40 @@ ULONG LineBuffer_FindPosition( PLBOBUFFER pBuf, ULONG ulStart, ULONG ulEnd, ULON
  * ------------------------------------------------------------------------- */
 ULONG LineBuffer_Init( PLBOBUFFER pBuf, ULONG ulInitial )
 {
-    APIRET rc;
+    return LineBuffer_InitWithAllocator( pBuf, ulInitial, TextQueryDefaultAllocator() );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * LineBuffer_InitWithAllocator()                                            *
+ *                                                                           *
+ * Allocates the line-break offset buffer from the given allocator, which    *
+ * the buffer then keeps using until it is freed.                            *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PLBOBUFFER     pBuf     : Pointer to buffer object                      *
+ *   ULONG          ulInitial: Requested initial buffer size (in ULONGs)     *
+ *   PTEXTALLOCATOR pAlloc   : Allocator to use (NULL = the system)          *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   The size (in ULONGs) of the newly-created buffer.                       *
+ * ------------------------------------------------------------------------- */
+ULONG LineBuffer_InitWithAllocator( PLBOBUFFER pBuf, ULONG ulInitial, PTEXTALLOCATOR pAlloc )
+{
+    PULONG pulBlock;
+
     if ( !ulInitial ) ulInitial = LB_INITIAL_SIZE;
-    rc = DosAllocMem( (PPVOID) &(pBuf->pulItems), ulInitial * sizeof( ULONG ),
-                      PAG_READ | PAG_WRITE | PAG_COMMIT );
-    if ( rc != NO_ERROR) return 0;
-    //pBuf->pulItems = (PULONG) calloc( ulInitial, sizeof( ULONG ));
-    //if ( pBuf->pulItems == NULL ) return 0;
+    pulBlock = (PULONG) TextAllocMemory( pAlloc, LineBuffer_BlockSize( ulInitial ));
+    if ( !pulBlock ) return 0;
+    LineBuffer_AttachArrays( pBuf, pulBlock, ulInitial );
+    memset( &(pBuf->last), 0, sizeof( LBLINEINFO ));
     pBuf->ulSize   = ulInitial;
     pBuf->ulSp1Len = 0;
     pBuf->ulSp2Len = 0;
     pBuf->ulGapLen = ulInitial / 2;
+    pBuf->lSp2Shift  = 0;
+    pBuf->pAllocator = pAlloc;
+    LineBuffer_BuildTree( pBuf );
 
     return ulInitial;
 }
@@ -207,7 +653,8 @@ ULONG LineBuffer_Init( PLBOBUFFER pBuf, ULONG ulInitial )
  *                                                                           *
  * Insert a new line address into the line buffer at the proper place.  Note *
  * that an item may be either inserted into the middle of the buffer, or     *
- * placed IMMEDIATELY after the last item.                                   *
+ * placed IMMEDIATELY after the last item.  The new item's line record is    *
+ * left blank.                                                               *
  *                                                                           *
  * ARGUMENTS:                                                                *
  *   PLBOBUFFER pBuf      : Pointer to buffer object                         *
@@ -227,10 +674,12 @@ BOOL LineBuffer_Insert( PLBOBUFFER pBuf, ULONG cbValue, ULONG ulPosition )
         /* A cheap but useful optimization: if the insert position is at the
          * end of the array, and there's still room in the buffer, then don't
          * bother to move the gap there - just append the new value to the
-         * post-gap span.
+         * post-gap span (relative to its shift, like the rest of the span).
          */
-        pBuf->pulItems[ ITEMEND( *pBuf ) ] = cbValue;
+        pBuf->pulItems[ ITEMEND( *pBuf ) ] = cbValue - pBuf->lSp2Shift;
+        LineBuffer_PutLines( pBuf, ITEMEND( *pBuf ), NULL, 1 );
         pBuf->ulSp2Len++;
+        LineBuffer_UpdateTree( pBuf, ITEMEND( *pBuf ) - 1, 1 );
     }
     else {
         if ( ulPosition != pBuf->ulSp1Len )
@@ -241,13 +690,54 @@ BOOL LineBuffer_Insert( PLBOBUFFER pBuf, ULONG cbValue, ULONG ulPosition )
             if ( ! LineBuffer_OpenGap( pBuf, 0 )) return FALSE;
 
         pBuf->pulItems[ ulPosition ] = cbValue;
+        LineBuffer_PutLines( pBuf, ulPosition, NULL, 1 );
         pBuf->ulSp1Len++;
         pBuf->ulGapLen--;
+        LineBuffer_UpdateTree( pBuf, ulPosition, 1 );
     }
     return TRUE;
 }
 
 
+/* ------------------------------------------------------------------------- *
+ * LineBuffer_InsertRange()                                                  *
+ *                                                                           *
+ * Inserts a sorted array of values at the given logical position.  The gap  *
+ * is moved there once, opened wide enough for all of the values if need     *
+ * be, and the values copied into it in one go, along with their line        *
+ * records.                                                                  *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PLBOBUFFER  pBuf      : Pointer to buffer object                        *
+ *   ULONG       ulPosition: Logical position of the first new value         *
+ *   PULONG      pulValues : The values to add                               *
+ *   PLBLINEINFO pInfo     : Their line records (NULL = blank)               *
+ *   ULONG       ulCount   : Number of values                                *
+ *                                                                           *
+ * RETURNS: BOOL                                                             *
+ *   TRUE on success, FALSE on error                                         *
+ * ------------------------------------------------------------------------- */
+BOOL LineBuffer_InsertRange( PLBOBUFFER pBuf, ULONG ulPosition, PULONG pulValues, PLBLINEINFO pInfo, ULONG ulCount )
+{
+    if ( !pBuf->pulItems || !pBuf->ulSize )
+        if ( ! LineBuffer_Init( pBuf, 0 )) return FALSE;
+    if ( ulPosition > ITEMCOUNT( *pBuf )) return FALSE;
+    if ( !ulCount ) return TRUE;
+
+    if ( ulPosition != pBuf->ulSp1Len )
+        if ( ! LineBuffer_MoveGap( pBuf, ulPosition )) return FALSE;
+    if ( pBuf->ulGapLen <= ulCount )
+        if ( ! LineBuffer_OpenGap( pBuf, ulCount )) return FALSE;
+
+    memcpy( pBuf->pulItems + ulPosition, pulValues, ulCount * sizeof( ULONG ));
+    LineBuffer_PutLines( pBuf, ulPosition, pInfo, ulCount );
+    pBuf->ulSp1Len += ulCount;
+    pBuf->ulGapLen -= ulCount;
+    LineBuffer_UpdateTree( pBuf, ulPosition, ulCount );
+    return TRUE;
+}
+
+
 /* ------------------------------------------------------------------------- *
  * LineBuffer_ItemAt()                                                       *
  *                                                                           *
@@ -262,17 +752,18 @@ BOOL LineBuffer_Insert( PLBOBUFFER pBuf, ULONG cbValue, ULONG ulPosition )
  * ------------------------------------------------------------------------- */
 ULONG LineBuffer_ItemAt( PLBOBUFFER pBuf, ULONG ulPosition )
 {
-    ULONG ulAddr;
     if ( ulPosition >= ITEMCOUNT( *pBuf )) return LB_INVALID_POSITION;
-    ulAddr = INDEX2ACTUAL( *pBuf, ulPosition );
-    return ( pBuf->pulItems[ ulAddr ] );
+    if ( ulPosition < pBuf->ulSp1Len ) return ( pBuf->pulItems[ ulPosition ] );
+    return ( pBuf->pulItems[ pBuf->ulGapLen + ulPosition ] + pBuf->lSp2Shift );
 }
 
 
 /* ------------------------------------------------------------------------- *
  * LineBuffer_MoveGap()                                                      *
  *                                                                           *
- * Moves the current position of the gap within the line buffer.             *
+ * Moves the current position of the gap within the line buffer.  Items      *
+ * moved across the gap have the post-gap shift applied to them or taken     *
+ * away from them, as appropriate; their line records are moved with them.   *
  *                                                                           *
  * ARGUMENTS:                                                                *
  *   PLBOBUFFER pBuf      : Pointer to buffer object                         *
@@ -303,11 +794,15 @@ BOOL LineBuffer_MoveGap( PLBOBUFFER pBuf, ULONG ulPosition )
         ulSource = ulOldSp1Len + pBuf->ulGapLen;   // (old) start of post-gap text
         ulTarget = ulOldSp1Len;                    // (old) start of gap
         for ( i = 0; i < ulShift; i++ ) {
-            pBuf->pulItems[ ulTarget+i ] = pBuf->pulItems[ ulSource+i ];
+            pBuf->pulItems[ ulTarget+i ] = pBuf->pulItems[ ulSource+i ] + pBuf->lSp2Shift;
             pBuf->pulItems[ ulSource+i ] = 0;
         }
+        LineBuffer_MoveLines( pBuf, ulTarget, ulSource, ulShift );
         pBuf->ulSp1Len = ulGapStart;
         pBuf->ulSp2Len -= ulShift;
+        if ( !pBuf->ulSp2Len ) pBuf->lSp2Shift = 0;
+        LineBuffer_UpdateTree( pBuf, ulTarget, ulShift );
+        LineBuffer_UpdateTree( pBuf, ulSource, ulShift );
     }
     // shift gap to the left
     else if ( ulGapStart < ulOldSp1Len ) {
@@ -315,11 +810,14 @@ BOOL LineBuffer_MoveGap( PLBOBUFFER pBuf, ULONG ulPosition )
         ulSource = ulGapStart;                     // (new) start of gap
         ulTarget = ulGapStart + pBuf->ulGapLen;    // (new) start of post-gap text
         for ( i = ulShift-1; i >= 0; i-- ) {
-            pBuf->pulItems[ ulTarget+i ] = pBuf->pulItems[ ulSource+i ];
+            pBuf->pulItems[ ulTarget+i ] = pBuf->pulItems[ ulSource+i ] - pBuf->lSp2Shift;
             pBuf->pulItems[ ulSource+i ] = 0;
         }
+        LineBuffer_MoveLines( pBuf, ulTarget, ulSource, ulShift );
         pBuf->ulSp1Len = ulGapStart;
         pBuf->ulSp2Len += ulShift;
+        LineBuffer_UpdateTree( pBuf, ulSource, ulShift );
+        LineBuffer_UpdateTree( pBuf, ulTarget, ulShift );
     }
 
     return TRUE;
@@ -354,8 +852,7 @@ BOOL LineBuffer_OpenGap( PLBOBUFFER pBuf, ULONG ulRequired )
     if ( pBuf->ulGapLen >= ulNewGap ) return TRUE;    // nothing to do
 
     if (( ulNewGap + ITEMCOUNT( *pBuf )) > pBuf->ulSize ) {
-        if ( ! LineBuffer_Expand( pBuf, ulRequired )) return FALSE;
-        ulNewGap = pBuf->ulSize / 2;
+        if ( ! LineBuffer_Expand( pBuf, ulNewGap + ITEMCOUNT( *pBuf ))) return FALSE;
     }
 //printf("Expanding gap to %u bytes\n", ulNewGap );
 
@@ -365,12 +862,136 @@ BOOL LineBuffer_OpenGap( PLBOBUFFER pBuf, ULONG ulRequired )
         pBuf->pulItems[ ulTarget+i ] = pBuf->pulItems[ ulSource+i ];
         pBuf->pulItems[ ulSource+i ] = 0;
     }
+    LineBuffer_MoveLines( pBuf, ulTarget, ulSource, pBuf->ulSp2Len );
 
     pBuf->ulGapLen = ulNewGap;
+    LineBuffer_UpdateTree( pBuf, ulSource, ulTarget + pBuf->ulSp2Len - ulSource );
+    return TRUE;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * LineBuffer_QueryLine()                                                    *
+ *                                                                           *
+ * Returns the record of a line: that of the item ending it, or for the last *
+ * line, the one kept separately.                                            *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PLBOBUFFER  pBuf  : Pointer to buffer object                            *
+ *   ULONG       ulLine: Number of the line to query                         *
+ *   PLBLINEINFO pInfo : Receives the line's record                          *
+ *                                                                           *
+ * RETURNS: BOOL                                                             *
+ *   TRUE on success, FALSE if there is no such line                         *
+ * ------------------------------------------------------------------------- */
+BOOL LineBuffer_QueryLine( PLBOBUFFER pBuf, ULONG ulLine, PLBLINEINFO pInfo )
+{
+    ULONG ulAddress;
+
+    if ( ulLine > ITEMCOUNT( *pBuf )) return FALSE;
+    if ( ulLine == ITEMCOUNT( *pBuf )) {
+        *pInfo = pBuf->last;
+        return TRUE;
+    }
+    ulAddress = INDEX2ACTUAL( *pBuf, ulLine );
+    pInfo->lExtent = pBuf->plExtents[ ulAddress ];
+    pInfo->ulRun   = pBuf->pulRuns[ ulAddress ];
+    pInfo->fsFlags = pBuf->pfsFlags[ ulAddress ];
+    return TRUE;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * LineBuffer_SetLine()                                                      *
+ *                                                                           *
+ * Replaces the record of a line (see LineBuffer_QueryLine()), and replays   *
+ * the widest-line tree above it.                                            *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PLBOBUFFER  pBuf  : Pointer to buffer object                            *
+ *   ULONG       ulLine: Number of the line to update                        *
+ *   PLBLINEINFO pInfo : The line's new record                               *
+ *                                                                           *
+ * RETURNS: BOOL                                                             *
+ *   TRUE on success, FALSE if there is no such line                         *
+ * ------------------------------------------------------------------------- */
+BOOL LineBuffer_SetLine( PLBOBUFFER pBuf, ULONG ulLine, PLBLINEINFO pInfo )
+{
+    ULONG ulAddress;
+
+    if ( ulLine > ITEMCOUNT( *pBuf )) return FALSE;
+    if ( ulLine == ITEMCOUNT( *pBuf )) {
+        pBuf->last = *pInfo;
+        return TRUE;
+    }
+    ulAddress = INDEX2ACTUAL( *pBuf, ulLine );
+    LineBuffer_PutLines( pBuf, ulAddress, pInfo, 1 );
+    LineBuffer_UpdateTree( pBuf, ulAddress, 1 );
+    return TRUE;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * LineBuffer_Shift()                                                        *
+ *                                                                           *
+ * Adds lShift to the value of every item from the given logical position    *
+ * onwards.  Once the gap has been moved to that position, these are exactly *
+ * the items after the gap, so only the shift they share needs to change.    *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PLBOBUFFER pBuf      : Pointer to buffer object                         *
+ *   ULONG      ulPosition: Logical position of the first item to change     *
+ *   LONG       lShift    : Amount to add to each item                       *
+ *                                                                           *
+ * RETURNS: BOOL                                                             *
+ *   TRUE on success, FALSE on error                                         *
+ * ------------------------------------------------------------------------- */
+BOOL LineBuffer_Shift( PLBOBUFFER pBuf, ULONG ulPosition, LONG lShift )
+{
+    if ( ulPosition > ITEMCOUNT( *pBuf )) return FALSE;
+    if ( ulPosition != pBuf->ulSp1Len )
+        if ( ! LineBuffer_MoveGap( pBuf, ulPosition )) return FALSE;
+
+    if ( pBuf->ulSp2Len ) pBuf->lSp2Shift += lShift;
     return TRUE;
 }
 
 
+/* ------------------------------------------------------------------------- *
+ * LineBuffer_Splice()                                                       *
+ *                                                                           *
+ * Replaces the items from logical position ulStart up to (but excluding)    *
+ * ulEnd with a sorted array of values.  The gap is moved to ulEnd and then  *
+ * widened back over the old items, so that the new ones can be copied into  *
+ * it with LineBuffer_InsertRange() without moving the gap again.            *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PLBOBUFFER  pBuf     : Pointer to buffer object                         *
+ *   ULONG       ulStart  : Logical position of the first item to replace    *
+ *   ULONG       ulEnd    : Logical position following the last one          *
+ *   PULONG      pulValues: The values to put in their place                 *
+ *   PLBLINEINFO pInfo    : Their line records (NULL = blank)                *
+ *   ULONG       ulCount  : Number of values (may be 0)                      *
+ *                                                                           *
+ * RETURNS: BOOL                                                             *
+ *   TRUE on success, FALSE on error                                         *
+ * ------------------------------------------------------------------------- */
+BOOL LineBuffer_Splice( PLBOBUFFER pBuf, ULONG ulStart, ULONG ulEnd, PULONG pulValues, PLBLINEINFO pInfo, ULONG ulCount )
+{
+    if (( ulStart > ulEnd ) || ( ulEnd > ITEMCOUNT( *pBuf ))) return FALSE;
+
+    if ( ulStart < ulEnd ) {
+        if ( ulEnd != pBuf->ulSp1Len )
+            if ( ! LineBuffer_MoveGap( pBuf, ulEnd )) return FALSE;
+        memset( pBuf->pulItems + ulStart, 0, ( ulEnd - ulStart ) * sizeof( ULONG ));
+        pBuf->ulGapLen += ulEnd - ulStart;
+        pBuf->ulSp1Len  = ulStart;
+        LineBuffer_UpdateTree( pBuf, ulStart, ulEnd - ulStart );
+    }
+    return LineBuffer_InsertRange( pBuf, ulStart, pulValues, pInfo, ulCount );
+}
+
+
 /* ------------------------------------------------------------------------- *
  * LineBuffer_Dump()                                                         *
  *                                                                           *
@@ -398,7 +1019,7 @@ ULONG LineBuffer_Dump( FILE *f, LBOBUFFER buffer, BOOL all )
         for ( i = 0; i < count; i++ ) {
             fprintf( f, "|%u", buffer.pulItems[ i ] );
         }
-        fprintf( f, "|\n                     Gap position: %u, size: %u\n\n", buffer.ulSp1Len, buffer.ulGapLen );
+        fprintf( f, "|\n                     Gap position: %u, size: %u, shift: %d\n\n", buffer.ulSp1Len, buffer.ulGapLen, buffer.lSp2Shift );
     }
     else {
         count = ITEMCOUNT( buffer );
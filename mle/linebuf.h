@@ -8,15 +8,45 @@
  * intended that the items be kept sorted in ascending order; managing this  *
  * is the application's responsibility (since all items are inserted singly, *
  * it is easy enough to maintain sort order by inserting each item in the    *
- * correct position).  Still, the only function which actually depends on    *
- * the items being sorted is LineBuffer_FindPosition(), which is used to     *
- * find the sorted insert position for a given new value.                    *
+ * correct position).  Still, the only functions which actually depend on    *
+ * the items being sorted are LineBuffer_FindPosition() and                  *
+ * LineBuffer_FindNear(), which are used to find the sorted insert position  *
+ * for a given new value.                                                    *
  *                                                                           *
  * The gap buffer logic is largely copied from textseq.c, with the obvious   *
  * difference that the contents are ULONGs rather than bytes; but the        *
  * supported operations are very slightly different (e.g. there is no way to *
  * query a whole sequence of items at once, only individual ones).           *
  *                                                                           *
+ * Since the items are text offsets, every item after an insertion or        *
+ * deletion in the text has to change by the same amount.  The items after   *
+ * the gap are therefore stored relative to a common shift (lSp2Shift),      *
+ * which is applied as they are moved across the gap.  LineBuffer_Shift()    *
+ * moves the gap to the first item affected and adjusts the shift, so its    *
+ * cost depends on how far the gap moves rather than on how many items       *
+ * follow; when edits are made near each other, as in typing, it is small.   *
+ *                                                                           *
+ * Each item also has a record of the line which ends there: its display     *
+ * width, whether it ends with a hard line break, and the first attribute    *
+ * run on it (see LBLINEINFO).  The fields of these records are kept in      *
+ * arrays of their own, alongside the item array and in the same allocation, *
+ * and are moved with the items whenever the gap moves.  The last line in    *
+ * the text, which has no break, has its record kept separately.  The        *
+ * records are only stored here; it is up to the application to fill them    *
+ * in (with LineBuffer_SetLine()) as it measures the lines.                  *
+ *                                                                           *
+ * The widest line is tracked by a tournament tree over the buffer           *
+ * addresses (gap and all): each node holds the address of the widest line   *
+ * below it, and addresses which are not in use count as narrower than any   *
+ * line.  Since the tree is over addresses rather than line numbers, lines   *
+ * can be inserted and removed at the gap without renumbering it; only the   *
+ * addresses whose width or use has changed need their branches replaying,   *
+ * which takes O(log n) for each line set, inserted or deleted, and O(k) for *
+ * k lines moved across the gap.  The widest line can then be read from the  *
+ * top of the tree at any time.                                              *
+ *                                                                           *
+ * textseq.h must be included before this file.                              *
+ *                                                                           *
  *****************************************************************************/
 
 
@@ -26,24 +56,47 @@
 
 #define LB_INVALID_POSITION     0xFFFFFFFF
 
+// Flags for a line record (fsFlags in LBLINEINFO)
+#define LB_HARD_BREAK           0x0001      // line ends with a line break character
+
 
 // ---------------------------------------------------------------------------
 // TYPEDEFS
 //
 
+// Information about a single line, as stored alongside its line break.
+//
+typedef struct _line_info {
+    LONG   lExtent;             // Display width of the line (0 = not measured)
+    ULONG  ulRun;               // Index of the first attribute run on the line
+    USHORT fsFlags;             // Any combination of LB_* flags
+} LBLINEINFO, *PLBLINEINFO;
+
+
 // The implementation (gap buffer) of the data structure.
 //
 typedef struct _line_buffer {
     PULONG pulItems;            // The actual buffer containing values
+    PLONG  plExtents;           // Line widths, indexed like pulItems
+    PULONG pulRuns;             // First attribute runs, indexed like pulItems
+    PUSHORT pfsFlags;           // Line flags, indexed like pulItems
+    PULONG pulWinners;          // Tournament tree of the widest lines (see above)
+    ULONG  ulLeaves;            // Number of addresses covered by the tree
+    LBLINEINFO last;            // Record for the last line (which has no break)
     ULONG  ulSize,              // Total allocated buffer size
            ulSp1Len,            // Number of items before the gap
            ulSp2Len,            // Number of items after the gap
            ulGapLen;            // Size of the gap
+    LONG   lSp2Shift;           // Amount to add to every item after the gap
+    PTEXTALLOCATOR pAllocator;  // Allocator providing the buffer (NULL = system)
     /* ------------------------------------------------------------- *
      * NOTES: Total number of items         == ulSp1Len + ulSp2Len   *
      *        Start of the pre-gap section  == 0                     *
      *        Start of the gap              == ulSp1Len              *
      *        Start of the post-gap section == ulSp1Len + ulGapLen   *
+     *        Value of a post-gap item      == stored + lSp2Shift    *
+     *        Record of line i (i < count)  == arrays at index i     *
+     *        Record of line count          == last                  *
      * ------------------------------------------------------------- */
 } LBOBUFFER, *PLBOBUFFER;
 
@@ -52,6 +105,26 @@ typedef struct _line_buffer {
 // FUNCTION DECLARATIONS
 //
 
+/* ------------------------------------------------------------------------- *
+ * LineBuffer_ApplyEdits()                                                   *
+ *                                                                           *
+ * Adjusts the buffer contents to follow a batch of text edits, as returned  *
+ * by TextApplyEdits(), in a single pass.  Items which follow an edit are    *
+ * shifted by the amount indicated in the edit's lShift field; items which   *
+ * fell strictly inside a deleted range no longer correspond to anything in  *
+ * the text, and are removed.                                                *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PLBOBUFFER pBuf   : Pointer to buffer object                            *
+ *   PTEXTEDIT  pEdits : Array of edits, sorted and with lShift filled in    *
+ *   ULONG      ulCount: Number of edits in the array                        *
+ *                                                                           *
+ * RETURNS: BOOL                                                             *
+ *   TRUE on success, FALSE on error                                         *
+ * ------------------------------------------------------------------------- */
+BOOL  LineBuffer_ApplyEdits( PLBOBUFFER pBuf, PTEXTEDIT pEdits, ULONG ulCount );
+
+
 /* ------------------------------------------------------------------------- *
  * LineBuffer_Clear()                                                        *
  *                                                                           *
@@ -81,6 +154,21 @@ BOOL  LineBuffer_Clear( PLBOBUFFER pBuf, ULONG ulPosition );
 ULONG LineBuffer_Count( PLBOBUFFER pBuf );
 
 
+/* ------------------------------------------------------------------------- *
+ * LineBuffer_Delete()                                                       *
+ *                                                                           *
+ * Removes the item at the given logical position.                           *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PLBOBUFFER pBuf      : Pointer to buffer object                         *
+ *   ULONG      ulPosition: The logical position of the item to remove       *
+ *                                                                           *
+ * RETURNS: BOOL                                                             *
+ *   TRUE on success, FALSE on error                                         *
+ * ------------------------------------------------------------------------- */
+BOOL  LineBuffer_Delete( PLBOBUFFER pBuf, ULONG ulPosition );
+
+
 /* ------------------------------------------------------------------------- *
  * LineBuffer_Expand()                                                       *
  *                                                                           *
@@ -93,7 +181,7 @@ ULONG LineBuffer_Count( PLBOBUFFER pBuf );
  *   ULONG      ulRequested: Requested new buffer size (in ULONG items)      *
  *                                                                           *
  * RETURNS: ULONG                                                            *
- *   The new buffer size (in ULONGs).                                        *
+ *   The new buffer size (in ULONGs), or 0 if it could not be allocated.     *
  * ------------------------------------------------------------------------- */
 ULONG LineBuffer_Expand( PLBOBUFFER pBuffer, ULONG ulRequested );
 
@@ -111,6 +199,26 @@ ULONG LineBuffer_Expand( PLBOBUFFER pBuffer, ULONG ulRequested );
 void  LineBuffer_Free( PLBOBUFFER pBuf );
 
 
+/* ------------------------------------------------------------------------- *
+ * LineBuffer_FindNear                                                       *
+ *                                                                           *
+ * Locates the proper (sorted) position in the line buffer for the specified *
+ * value, searching outwards from a hint.  This is faster than               *
+ * LineBuffer_FindPosition() when the result is likely to be near the hint,  *
+ * e.g. when the hint is the result of the previous search.  Any hint gives  *
+ * the correct result.                                                       *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PLBOBUFFER pBuf    : Pointer to buffer object                           *
+ *   ULONG      ulHint  : Position at which to start looking                 *
+ *   ULONG      ulValue : Value whose position is sought                     *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   The sorted position where the indicated value should be placed.         *
+ * ------------------------------------------------------------------------- */
+ULONG LineBuffer_FindNear( PLBOBUFFER pBuf, ULONG ulHint, ULONG ulValue );
+
+
 /* ------------------------------------------------------------------------- *
  * LineBuffer_FindPosition                                                   *
  *                                                                           *
@@ -129,10 +237,29 @@ void  LineBuffer_Free( PLBOBUFFER pBuf );
 ULONG LineBuffer_FindPosition( PLBOBUFFER pBuf, ULONG ulStart, ULONG ulEnd, ULONG ulValue );
 
 
+/* ------------------------------------------------------------------------- *
+ * LineBuffer_FindWidest()                                                   *
+ *                                                                           *
+ * Finds the widest line, according to the extents in the line records.      *
+ * No text is measured, so the result is only as good as the records.  The   *
+ * line is read from the top of the widest-line tree, so this is quick       *
+ * enough to call after every change.                                        *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PLBOBUFFER pBuf    : Pointer to buffer object                           *
+ *   PLONG      plExtent: Receives the width of that line (may be NULL)      *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   The number of the widest line (the first, if several are as wide).      *
+ * ------------------------------------------------------------------------- */
+ULONG LineBuffer_FindWidest( PLBOBUFFER pBuf, PLONG plExtent );
+
+
 /* ------------------------------------------------------------------------- *
  * LineBuffer_Init()                                                         *
  *                                                                           *
- * Allocates the line-break offset buffer.                                   *
+ * Allocates the line-break offset buffer from the default allocator (see    *
+ * TextSetDefaultAllocator).                                                 *
  *                                                                           *
  * ARGUMENTS:                                                                *
  *   PLBOBUFFER pBuf     : Pointer to buffer object                          *
@@ -144,6 +271,23 @@ ULONG LineBuffer_FindPosition( PLBOBUFFER pBuf, ULONG ulStart, ULONG ulEnd, ULON
 ULONG LineBuffer_Init( PLBOBUFFER pBuf, ULONG ulInitial );
 
 
+/* ------------------------------------------------------------------------- *
+ * LineBuffer_InitWithAllocator()                                            *
+ *                                                                           *
+ * Allocates the line-break offset buffer from the given allocator, which    *
+ * the buffer then keeps using until it is freed.                            *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PLBOBUFFER     pBuf     : Pointer to buffer object                      *
+ *   ULONG          ulInitial: Requested initial buffer size (in ULONGs)     *
+ *   PTEXTALLOCATOR pAlloc   : Allocator to use (NULL = the system)          *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   The size (in ULONGs) of the newly-created buffer.                       *
+ * ------------------------------------------------------------------------- */
+ULONG LineBuffer_InitWithAllocator( PLBOBUFFER pBuf, ULONG ulInitial, PTEXTALLOCATOR pAlloc );
+
+
 /* ------------------------------------------------------------------------- *
  * LineBuffer_Insert()                                                       *
  *                                                                           *
@@ -161,6 +305,27 @@ ULONG LineBuffer_Init( PLBOBUFFER pBuf, ULONG ulInitial );
 BOOL  LineBuffer_Insert( PLBOBUFFER pBuf, ULONG cbValue, ULONG ulPosition );
 
 
+/* ------------------------------------------------------------------------- *
+ * LineBuffer_InsertRange()                                                  *
+ *                                                                           *
+ * Inserts a sorted array of values at the given logical position, as a      *
+ * single operation.  As with LineBuffer_Insert(), the caller must ensure    *
+ * that the values belong at that position.                                  *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PLBOBUFFER  pBuf      : Pointer to buffer object                        *
+ *   ULONG       ulPosition: Logical position of the first new value         *
+ *   PULONG      pulValues : The values to add                               *
+ *   PLBLINEINFO pInfo     : Records of the lines ending at each value, or   *
+ *                           NULL to leave them blank                        *
+ *   ULONG       ulCount   : Number of values                                *
+ *                                                                           *
+ * RETURNS: BOOL                                                             *
+ *   TRUE on success, FALSE on error                                         *
+ * ------------------------------------------------------------------------- */
+BOOL  LineBuffer_InsertRange( PLBOBUFFER pBuf, ULONG ulPosition, PULONG pulValues, PLBLINEINFO pInfo, ULONG ulCount );
+
+
 /* ------------------------------------------------------------------------- *
  * LineBuffer_ItemAt()                                                       *
  *                                                                           *
@@ -210,6 +375,82 @@ BOOL  LineBuffer_MoveGap( PLBOBUFFER pBuf, ULONG ulPosition );
 BOOL  LineBuffer_OpenGap( PLBOBUFFER pBuf, ULONG ulRequired );
 
 
+/* ------------------------------------------------------------------------- *
+ * LineBuffer_QueryLine()                                                    *
+ *                                                                           *
+ * Returns the record of a line.  Line n is the one ending at the item at    *
+ * logical position n; the line following the last item is number            *
+ * LineBuffer_Count().                                                       *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PLBOBUFFER  pBuf  : Pointer to buffer object                            *
+ *   ULONG       ulLine: Number of the line to query                         *
+ *   PLBLINEINFO pInfo : Receives the line's record                          *
+ *                                                                           *
+ * RETURNS: BOOL                                                             *
+ *   TRUE on success, FALSE if there is no such line                         *
+ * ------------------------------------------------------------------------- */
+BOOL  LineBuffer_QueryLine( PLBOBUFFER pBuf, ULONG ulLine, PLBLINEINFO pInfo );
+
+
+/* ------------------------------------------------------------------------- *
+ * LineBuffer_SetLine()                                                      *
+ *                                                                           *
+ * Replaces the record of a line (numbered as for LineBuffer_QueryLine()).   *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PLBOBUFFER  pBuf  : Pointer to buffer object                            *
+ *   ULONG       ulLine: Number of the line to update                        *
+ *   PLBLINEINFO pInfo : The line's new record                               *
+ *                                                                           *
+ * RETURNS: BOOL                                                             *
+ *   TRUE on success, FALSE if there is no such line                         *
+ * ------------------------------------------------------------------------- */
+BOOL  LineBuffer_SetLine( PLBOBUFFER pBuf, ULONG ulLine, PLBLINEINFO pInfo );
+
+
+/* ------------------------------------------------------------------------- *
+ * LineBuffer_Shift()                                                        *
+ *                                                                           *
+ * Adds lShift to the value of every item from the given logical position    *
+ * onwards, as when text has been inserted (or, if lShift is negative,       *
+ * deleted) before the offsets they hold.  The caller must ensure that the   *
+ * items stay in order.                                                      *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PLBOBUFFER pBuf      : Pointer to buffer object                         *
+ *   ULONG      ulPosition: Logical position of the first item to change     *
+ *   LONG       lShift    : Amount to add to each item                       *
+ *                                                                           *
+ * RETURNS: BOOL                                                             *
+ *   TRUE on success, FALSE on error                                         *
+ * ------------------------------------------------------------------------- */
+BOOL  LineBuffer_Shift( PLBOBUFFER pBuf, ULONG ulPosition, LONG lShift );
+
+
+/* ------------------------------------------------------------------------- *
+ * LineBuffer_Splice()                                                       *
+ *                                                                           *
+ * Replaces the items from logical position ulStart up to (but excluding)    *
+ * ulEnd with a sorted array of values, as a single operation; e.g. the      *
+ * wrap points of a paragraph which has been re-wrapped.  Either range may   *
+ * be empty.  The line records of the old items are discarded.               *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PLBOBUFFER  pBuf     : Pointer to buffer object                         *
+ *   ULONG       ulStart  : Logical position of the first item to replace    *
+ *   ULONG       ulEnd    : Logical position following the last one          *
+ *   PULONG      pulValues: The values to put in their place                 *
+ *   PLBLINEINFO pInfo    : Records of the lines ending at each value, or    *
+ *                          NULL to leave them blank                         *
+ *   ULONG       ulCount  : Number of values (may be 0)                      *
+ *                                                                           *
+ * RETURNS: BOOL                                                             *
+ *   TRUE on success, FALSE on error                                         *
+ * ------------------------------------------------------------------------- */
+BOOL  LineBuffer_Splice( PLBOBUFFER pBuf, ULONG ulStart, ULONG ulEnd, PULONG pulValues, PLBLINEINFO pInfo, ULONG ulCount );
+
+
 
 
 
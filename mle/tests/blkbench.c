@@ -0,0 +1,156 @@
+#include <os2.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "textseq.h"
+
+/* Block model benchmark.
+ *
+ * Builds a buffer of UCS-2 text of the given size (default 200 MB), made up
+ * of random words and lines, and loads it into a gap buffer and into the
+ * block model with the given hot set (default 4 MB).  The memory held by the
+ * compressed blocks is reported, along with the length of the text they
+ * hold.
+ *
+ * Each text object is then used as an editor would use it: the view jumps
+ * to a random place, scrolls through the text a screenful at a time and is
+ * typed into on each screen.  The time taken is reported for both, and the
+ * two texts should be identical at the end.
+ *
+ * Usage: blkbench [megabytes] [hot set kB] [jumps]
+ */
+
+#define SCREEN_CHARS    4000
+#define SCROLL_STEPS    50
+#define TYPE_CHARS      20
+
+typedef unsigned short UCS2;
+
+
+/* Simple linear congruential generator, so the text is the same on every
+ * platform.
+ */
+ULONG ulSeed = 1;
+
+ULONG Random( ULONG ulRange )
+{
+    ulSeed = ulSeed * 1103515245 + 12345;
+    return (( ulSeed >> 16 ) & 0x7FFF ) % ulRange;
+}
+
+
+void ReportStats( EDITORTEXT text )
+{
+    TEXTSTATS stats;
+
+    TextQueryStats( text, &stats );
+    printf("%u bytes of text compressed into %u (%.1f%%), %u bytes uncompressed\n",
+           stats.cbUncompressed, stats.cbCompressed,
+           stats.cbUncompressed ? 100.0 * stats.cbCompressed / stats.cbUncompressed : 0.0,
+           TextLength( text ) - stats.cbUncompressed );
+}
+
+
+void ModelTest( PSZ pszName, EDITORTEXT text, ULONG ulJumps )
+{
+    static UCS2 ausScreen[ SCREEN_CHARS ];
+    ULONG      ulChars,
+               ulPos,
+               ulScreens,
+               i, j, k;
+    clock_t    start;
+
+    ulSeed    = 2;
+    ulScreens = 0;
+    start     = clock();
+    for ( i = 0; i < ulJumps; i++ ) {
+        ulChars = TextLength( text ) / sizeof( UCS2 );
+        ulPos   = ( Random( 0x8000 ) * ( ulChars / 0x8000 + 1 )) % ulChars;
+        for ( j = 0; ( j < SCROLL_STEPS ) && ( ulPos < ulChars ); j++ ) {
+            TextSequence( text, (PBYTE) ausScreen, ulPos * sizeof( UCS2 ), sizeof( ausScreen ));
+            for ( k = 0; k < TYPE_CHARS; k++ ) {
+                UCS2 us = 'A' + Random( 26 );
+                TextInsert( text, (PBYTE) &us, ( ulPos + k ) * sizeof( UCS2 ), sizeof( UCS2 ));
+            }
+            ulChars += TYPE_CHARS;
+            ulPos   += SCREEN_CHARS;
+            ulScreens++;
+        }
+    }
+    printf("%-12s %6u screens in %6.3f s\n",
+           pszName, ulScreens, (double)( clock() - start ) / CLOCKS_PER_SEC );
+}
+
+
+int main( int argc, char *argv[] )
+{
+    EDITORTEXT gap,
+               block;
+    PBYTE      pbGap,
+               pbBlock;
+    UCS2       *pusText;
+    ULONG      cbText,
+               ulChars,
+               cbHot,
+               ulJumps,
+               i, j;
+    clock_t    start;
+    int        rc;
+
+    cbText  = (( argc > 1 ) ? atoi( argv[1] ) : 200 ) * 1048576;
+    cbHot   = (( argc > 2 ) ? atoi( argv[2] ) : 4096 ) * 1024;
+    ulJumps = ( argc > 3 ) ? atoi( argv[3] ) : 200;
+    ulChars = cbText / sizeof( UCS2 );
+
+    pusText = (UCS2 *) malloc( cbText );
+    if ( !pusText ) return 1;
+    for ( i = 0; i < ulChars; ) {
+        for ( j = 1 + Random( 10 ); j && ( i < ulChars ); j-- )
+            pusText[ i++ ] = 'a' + Random( 26 );
+        if ( i < ulChars ) pusText[ i++ ] = Random( 12 ) ? ' ' : '\n';
+    }
+
+    if ( !TextCreateModel( &gap, TEXT_MODEL_GAPBUFFER ) ||
+         !TextCreateModel( &block, TEXT_MODEL_BLOCK ))
+        return 1;
+    TextSetCacheLimit( block, cbHot );
+    if ( !TextInitContents( gap, (PBYTE) pusText, cbText )) return 1;
+    start = clock();
+    if ( !TextInitContents( block, (PBYTE) pusText, cbText )) return 1;
+    printf("Loaded into the block model in %6.3f s with a %u kB hot set\n",
+           (double)( clock() - start ) / CLOCKS_PER_SEC, cbHot / 1024 );
+    ReportStats( block );
+    free( pusText );
+
+    printf("\n");
+    ModelTest("Gap buffer", gap, ulJumps );
+    ModelTest("Block", block, ulJumps );
+    printf("\n");
+    ReportStats( block );
+
+    // Both should have been edited in exactly the same way
+    rc = 0;
+    cbText = TextLength( gap );
+    if ( TextLength( block ) != cbText ) {
+        printf("*** Block text is %u bytes, expected %u\n", TextLength( block ), cbText );
+        rc = 1;
+    }
+    else {
+        pbGap   = (PBYTE) malloc( cbText );
+        pbBlock = (PBYTE) malloc( cbText );
+        if ( !pbGap || !pbBlock ) return 1;
+        TextSequence( gap, pbGap, 0, cbText );
+        TextSequence( block, pbBlock, 0, cbText );
+        if ( memcmp( pbGap, pbBlock, cbText )) {
+            printf("*** Block text differs from the gap buffer\n");
+            rc = 1;
+        }
+        free( pbGap );
+        free( pbBlock );
+    }
+
+    TextFree( &gap );
+    TextFree( &block );
+    return rc;
+}
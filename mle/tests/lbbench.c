@@ -0,0 +1,219 @@
+#include <os2.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "textseq.h"
+#include "linebuf.h"
+
+/* Line buffer lookup benchmark.
+ *
+ * Fills a line buffer with the given number of line break offsets (default
+ * 10 million), for lines of random length, and then looks up offsets in it
+ * in three patterns:
+ *
+ *   random  - anywhere in the text
+ *   scroll  - each a line or two after the previous one, as when painting
+ *             or scrolling through the text
+ *   typing  - within a few lines of a fixed point, as when typing
+ *
+ * Each pattern is run with the old recursive search (reproduced below),
+ * with LineBuffer_FindPosition() over the whole buffer, and with
+ * LineBuffer_FindNear() using the previous result as its hint.  The results
+ * of the last two are compared with each other.
+ *
+ * Finally, the given number of random lines are given random widths, and
+ * the widest line is looked up after each; the last result is checked by
+ * scanning all of the line records.
+ *
+ * Usage: lbbench [lines] [lookups]
+ */
+
+#define MAX_LINE_CHARS  80
+
+#define PATTERN_RANDOM  0
+#define PATTERN_SCROLL  1
+#define PATTERN_TYPING  2
+
+#define SEARCH_RECURSIVE  0
+#define SEARCH_FULL       1
+#define SEARCH_NEAR       2
+
+
+/* Simple linear congruential generator, so the offsets are the same on
+ * every platform.
+ */
+ULONG ulSeed = 1;
+
+ULONG Random( ULONG ulRange )
+{
+    ulSeed = ulSeed * 1103515245 + 12345;
+    return ((( ulSeed >> 16 ) & 0x7FFF ) | (( ulSeed & 0xFFFF ) << 15 )) % ulRange;
+}
+
+
+/* LineBuffer_FindPosition() as it was originally written, for comparison.
+ */
+ULONG RecursiveFind( PLBOBUFFER pBuf, ULONG ulStart, ULONG ulEnd, ULONG ulValue )
+{
+    ULONG ulCurrent,
+          ulMid;
+
+    if ( ulStart > ulEnd )
+        return ulStart;
+
+    ulMid = ulStart + (( ulEnd - ulStart ) / 2 );
+    ulCurrent = LineBuffer_ItemAt( pBuf, ulMid );
+    if ( ulCurrent > ulValue )
+        return ( !ulMid ? ulMid :
+                 RecursiveFind( pBuf, ulStart, ulMid-1, ulValue ));
+    else if ( ulCurrent < ulValue )
+        return RecursiveFind( pBuf, ulMid+1, ulEnd, ulValue );
+    else
+        return ulMid;
+}
+
+
+/* Returns the next value to look up in the given pattern.
+ */
+ULONG NextValue( int iPattern, ULONG ulPrevious, ULONG cbTotal, ULONG cbCursor )
+{
+    switch ( iPattern ) {
+        case PATTERN_SCROLL:
+            ulPrevious += Random( 4 * MAX_LINE_CHARS );
+            return ( ulPrevious < cbTotal ) ? ulPrevious : 0;
+        case PATTERN_TYPING:
+            return cbCursor + Random( 8 * MAX_LINE_CHARS );
+        default:
+            return Random( cbTotal );
+    }
+}
+
+
+int Run( PLBOBUFFER pBuf, int iPattern, PSZ pszPattern, ULONG ulLookups, ULONG cbTotal, PULONG pulResults )
+{
+    static PSZ apszSearch[] = { "recursive", "full", "near" };
+    ULONG   ulCount,
+            ulValue,
+            ulIdx,
+            cbCursor,
+            i;
+    int     iSearch;
+    clock_t start;
+    double  dSecs;
+
+    ulCount  = LineBuffer_Count( pBuf );
+    cbCursor = cbTotal / 2;
+    for ( iSearch = SEARCH_RECURSIVE; iSearch <= SEARCH_NEAR; iSearch++ ) {
+        ulSeed  = 2;
+        ulValue = 0;
+        ulIdx   = 0;
+        start   = clock();
+        for ( i = 0; i < ulLookups; i++ ) {
+            ulValue = NextValue( iPattern, ulValue, cbTotal, cbCursor );
+            switch ( iSearch ) {
+                case SEARCH_RECURSIVE:
+                    ulIdx = RecursiveFind( pBuf, 0, ulCount - 1, ulValue );
+                    break;
+                case SEARCH_FULL:
+                    ulIdx = LineBuffer_FindPosition( pBuf, 0, ulCount - 1, ulValue );
+                    pulResults[ i ] = ulIdx;
+                    break;
+                default:
+                    ulIdx = LineBuffer_FindNear( pBuf, ulIdx, ulValue );
+                    if ( ulIdx != pulResults[ i ] ) {
+                        printf("*** %s: %u found at %u, expected %u\n",
+                               pszPattern, ulValue, ulIdx, pulResults[ i ]);
+                        return 1;
+                    }
+                    break;
+            }
+        }
+        dSecs = (double)( clock() - start ) / CLOCKS_PER_SEC;
+        printf("%-7s %-10s %8u lookups in %6.3f s = %7.1f ns each\n",
+               pszPattern, apszSearch[ iSearch ], ulLookups, dSecs,
+               dSecs * 1e9 / ulLookups );
+    }
+    return 0;
+}
+
+
+int Widest( PLBOBUFFER pBuf, ULONG ulUpdates )
+{
+    LBLINEINFO info;
+    ULONG      ulCount,
+               ulWidest,
+               ulExpected,
+               i;
+    LONG       lWidth,
+               lExpected;
+    clock_t    start;
+
+    ulCount  = LineBuffer_Count( pBuf );
+    ulSeed   = 3;
+    ulWidest = 0;
+    start    = clock();
+    for ( i = 0; i < ulUpdates; i++ ) {
+        info.lExtent = Random( 100000 );
+        info.ulRun   = 0;
+        info.fsFlags = LB_HARD_BREAK;
+        LineBuffer_SetLine( pBuf, Random( ulCount + 1 ), &info );
+        ulWidest = LineBuffer_FindWidest( pBuf, &lWidth );
+    }
+    printf("widest  %8u updates in %6.3f s\n", ulUpdates,
+           (double)( clock() - start ) / CLOCKS_PER_SEC );
+
+    ulExpected = 0;
+    lExpected  = -1;
+    for ( i = 0; i <= ulCount; i++ ) {
+        LineBuffer_QueryLine( pBuf, i, &info );
+        if ( info.lExtent > lExpected ) {
+            lExpected  = info.lExtent;
+            ulExpected = i;
+        }
+    }
+    if (( ulWidest != ulExpected ) || ( lWidth != lExpected )) {
+        printf("*** widest line is %u (%d), expected %u (%d)\n",
+               ulWidest, lWidth, ulExpected, lExpected );
+        return 1;
+    }
+    return 0;
+}
+
+
+int main( int argc, char *argv[] )
+{
+    LBOBUFFER buffer;
+    PULONG    pulResults;
+    ULONG     ulLines,
+              ulLookups,
+              cbTotal,
+              i;
+    clock_t   start;
+
+    ulLines   = ( argc > 1 ) ? atoi( argv[1] ) : 10000000;
+    ulLookups = ( argc > 2 ) ? atoi( argv[2] ) : 1000000;
+
+    pulResults = (PULONG) malloc( ulLookups * sizeof( ULONG ));
+    if ( !pulResults ) return 1;
+    if ( !LineBuffer_Init( &buffer, 0 )) return 1;
+
+    start   = clock();
+    cbTotal = 0;
+    for ( i = 0; i < ulLines; i++ ) {
+        cbTotal += 2 * ( 1 + Random( MAX_LINE_CHARS ));
+        if ( !LineBuffer_Insert( &buffer, cbTotal, i )) return 1;
+    }
+    printf("%u line breaks (%u bytes of text) added in %6.3f s\n\n",
+           LineBuffer_Count( &buffer ), cbTotal,
+           (double)( clock() - start ) / CLOCKS_PER_SEC );
+
+    if ( Run( &buffer, PATTERN_RANDOM, "random", ulLookups, cbTotal, pulResults ) ||
+         Run( &buffer, PATTERN_SCROLL, "scroll", ulLookups, cbTotal, pulResults ) ||
+         Run( &buffer, PATTERN_TYPING, "typing", ulLookups, cbTotal, pulResults ) ||
+         Widest( &buffer, ulLookups ))
+        return 1;
+
+    LineBuffer_Free( &buffer );
+    free( pulResults );
+    return 0;
+}
@@ -1,15 +1,23 @@
 #include <os2.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include "textseq.h"
 #include "linebuf.h"
 
 
 int main( int argc, char *argv[] )
 {
     LBOBUFFER buffer;
+    ULONG     range[]  = { 16, 17, 18 },
+              splice[] = { 12, 14 };
+    LBLINEINFO records[] = { { 30, 0, LB_HARD_BREAK },
+                             { 10, 0, LB_HARD_BREAK },
+                             { 10, 0, LB_HARD_BREAK } },
+               info;
     ULONG     count,
               val,
               pos;
+    LONG      width;
 
     if ( argc < 2 ) val = 100;
     else sscanf( argv[1], "%u", &val );
@@ -64,6 +72,41 @@ int main( int argc, char *argv[] )
     LineBuffer_Insert( &buffer, 35, pos );
     LineBuffer_Dump( stdout, buffer, FALSE );
 
+    printf("> %2u @%2u\t", 100, 3 );
+    LineBuffer_Shift( &buffer, 3, 100 );
+    LineBuffer_Dump( stdout, buffer, FALSE );
+    printf("> %2d @%2u\t", -3, 6 );
+    LineBuffer_Shift( &buffer, 6, -3 );
+    LineBuffer_Dump( stdout, buffer, FALSE );
+    printf("- %2u @%2u\t", LineBuffer_ItemAt( &buffer, 4 ), 4 );
+    LineBuffer_Delete( &buffer, 4 );
+    LineBuffer_Dump( stdout, buffer, FALSE );
+
+    count = LineBuffer_Count( &buffer );
+    pos = LineBuffer_FindPosition( &buffer, 0, count-1, 140 );
+    printf("+ %2u @%2u\t", 140, pos );
+    LineBuffer_Insert( &buffer, 140, pos );
+    LineBuffer_Dump( stdout, buffer, FALSE );
+
+    printf("+ %u..%u @%2u\t", range[ 0 ], range[ 2 ], 3 );
+    LineBuffer_InsertRange( &buffer, 3, range, records, 3 );
+    LineBuffer_Dump( stdout, buffer, FALSE );
+    printf("* %u..%u @%2u-%2u\t", splice[ 0 ], splice[ 1 ], 1, 5 );
+    LineBuffer_Splice( &buffer, 1, 5, splice, NULL, 2 );
+    LineBuffer_Dump( stdout, buffer, FALSE );
+    //LineBuffer_Dump( stdout, buffer, TRUE );
+
+    // The record of the line ending at 18 should have followed it
+    pos = LineBuffer_FindWidest( &buffer, &width );
+    printf("Widest line is %u (%d pels)\n", pos, width );
+    info.lExtent = 50;
+    info.ulRun   = 0;
+    info.fsFlags = 0;
+    LineBuffer_SetLine( &buffer, LineBuffer_Count( &buffer ), &info );
+    pos = LineBuffer_FindWidest( &buffer, &width );
+    LineBuffer_QueryLine( &buffer, pos, &info );
+    printf("Widest line is %u (%d pels, flags %X)\n", pos, info.lExtent, info.fsFlags );
+
     count = LineBuffer_Count( &buffer );
     pos = LineBuffer_FindPosition( &buffer, 0, count-1, val );
     printf("Position for value %u is: %u\n\n", val, pos );
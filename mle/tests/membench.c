@@ -0,0 +1,117 @@
+#include <os2.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "textseq.h"
+#include "textmem.h"
+#include "linebuf.h"
+
+/* Allocator benchmark.
+ *
+ * Creates and destroys the given number of editors (default 20000), as a
+ * program opening and closing dialogs might.  Each editor is a text object
+ * of the given model (default the gap buffer) holding a few kB of text and
+ * a line buffer with an entry for each line; some text is typed into it
+ * before it is destroyed.
+ *
+ * This is done with the system allocator, with a pool, and with an arena
+ * which is reset after each editor is destroyed.  The time taken is reported
+ * for each, along with the allocator's counters; the memory reserved by the
+ * pool and arena should stay the same however many editors are created.
+ *
+ * Usage: membench [editors] [model]
+ */
+
+#define TEXT_CHARS      2000
+#define LINE_CHARS      40
+#define TYPE_CHARS      200
+
+typedef unsigned short UCS2;
+
+
+int Editor( UCS2 *pusText, int iModel, PTEXTALLOCATOR pAlloc )
+{
+    EDITORTEXT text;
+    LBOBUFFER  lines;
+    UCS2       us;
+    ULONG      i;
+
+    if ( !TextCreateWithAllocator( &text, iModel, pAlloc )) return 0;
+    if ( !LineBuffer_InitWithAllocator( &lines, 0, pAlloc )) return 0;
+    if ( !TextInitContents( text, (PBYTE) pusText, TEXT_CHARS * sizeof( UCS2 ))) return 0;
+    for ( i = 0; i < TEXT_CHARS / LINE_CHARS; i++ )
+        if ( !LineBuffer_Insert( &lines, i * LINE_CHARS, i )) return 0;
+
+    for ( i = 0; i < TYPE_CHARS; i++ ) {
+        us = 'a' + ( i % 26 );
+        if ( !TextInsert( text, (PBYTE) &us, ( TEXT_CHARS / 2 + i ) * sizeof( UCS2 ), sizeof( UCS2 )))
+            return 0;
+    }
+
+    LineBuffer_Free( &lines );
+    TextFree( &text );
+    return 1;
+}
+
+
+void Report( PSZ pszName, PTEXTALLOCATOR pAlloc, clock_t ticks )
+{
+    printf("%-8s %6.3f s", pszName, (double) ticks / CLOCKS_PER_SEC );
+    if ( pAlloc )
+        printf("  %8u allocs %8u reallocs %8u frees %u failed, %u kB reserved",
+               pAlloc->ulAllocs, pAlloc->ulReallocs, pAlloc->ulFrees,
+               pAlloc->ulFailures, pAlloc->cbReserved / 1024 );
+    printf("\n");
+}
+
+
+int main( int argc, char *argv[] )
+{
+    PTEXTALLOCATOR pPool,
+                   pArena;
+    UCS2           ausText[ TEXT_CHARS ];
+    ULONG          ulEditors,
+                   i;
+    int            iModel;
+    clock_t        start;
+
+    ulEditors = ( argc > 1 ) ? atoi( argv[1] ) : 20000;
+    iModel    = ( argc > 2 ) ? atoi( argv[2] ) : TEXT_MODEL_GAPBUFFER;
+
+    for ( i = 0; i < TEXT_CHARS; i++ )
+        ausText[ i ] = (( i % LINE_CHARS ) == LINE_CHARS - 1 ) ? '\n' : 'a' + ( i % 26 );
+
+    if ( !Pool_Create( &pPool ) || !Arena_Create( &pArena, 0 )) return 1;
+
+    start = clock();
+    for ( i = 0; i < ulEditors; i++ )
+        if ( !Editor( ausText, iModel, NULL )) return 1;
+    Report("System", NULL, clock() - start );
+
+    start = clock();
+    for ( i = 0; i < ulEditors; i++ )
+        if ( !Editor( ausText, iModel, pPool )) return 1;
+    Report("Pool", pPool, clock() - start );
+
+    start = clock();
+    for ( i = 0; i < ulEditors; i++ ) {
+        if ( !Editor( ausText, iModel, pArena )) return 1;
+        Arena_Reset( pArena );
+    }
+    Report("Arena", pArena, clock() - start );
+
+    // Everything allocated should have been freed again
+    if ( pPool->ulAllocs != pPool->ulFrees ) {
+        printf("*** Pool: %u blocks not freed\n", pPool->ulAllocs - pPool->ulFrees );
+        return 1;
+    }
+    if ( pArena->ulAllocs != pArena->ulFrees ) {
+        printf("*** Arena: %u blocks not freed\n", pArena->ulAllocs - pArena->ulFrees );
+        return 1;
+    }
+
+    Pool_Free( &pPool );
+    Arena_Free( &pArena );
+    return 0;
+}
@@ -0,0 +1,3 @@
+icc /Ss /C /O+ /I.. ..\textseq.c ..\textgap.c ..\textpt.c ..\textrope.c ..\textpage.c ..\textutf8.c ..\textblock.c
+icc /Ss /C /O+ /I.. txbench.c
+ilink txbench.obj textseq.obj textgap.obj textpt.obj textrope.obj textpage.obj textutf8.obj textblock.obj
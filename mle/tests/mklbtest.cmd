@@ -1,3 +1,3 @@
-icc /Ss /C /Ti+ /Tm+ /I.. ..\linebuf.c
+icc /Ss /C /Ti+ /Tm+ /I.. ..\linebuf.c ..\textseq.c ..\textgap.c ..\textpt.c ..\textrope.c ..\textpage.c ..\textutf8.c ..\textblock.c
 icc /Ss /C /Ti+ /Tm+ /I.. lbtest.c
-ilink lbtest.obj linebuf.obj /DEBUG
+ilink lbtest.obj linebuf.obj textseq.obj textgap.obj textpt.obj textrope.obj textpage.obj textutf8.obj textblock.obj /DEBUG
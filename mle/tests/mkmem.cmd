@@ -0,0 +1,3 @@
+icc /Ss /C /O+ /I.. ..\linebuf.c ..\textseq.c ..\textgap.c ..\textpt.c ..\textrope.c ..\textpage.c ..\textutf8.c ..\textblock.c ..\textmem.c
+icc /Ss /C /O+ /I.. membench.c
+ilink membench.obj linebuf.obj textseq.obj textgap.obj textpt.obj textrope.obj textpage.obj textutf8.obj textblock.obj textmem.obj
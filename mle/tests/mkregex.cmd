@@ -0,0 +1,3 @@
+icc /Ss /C /O+ /I.. ..\textseq.c ..\textgap.c ..\textpt.c ..\textrope.c ..\textpage.c ..\textutf8.c ..\textblock.c ..\textre.c
+icc /Ss /C /O+ /I.. rebench.c
+ilink rebench.obj textseq.obj textgap.obj textpt.obj textrope.obj textpage.obj textutf8.obj textblock.obj textre.obj
@@ -1,3 +1,3 @@
-icc /Ss /C /Ti+ /Tm+ /I.. ..\textseq.c
+icc /Ss /C /Ti+ /Tm+ /I.. ..\textseq.c ..\textgap.c ..\textpt.c ..\textrope.c ..\textpage.c ..\textutf8.c ..\textblock.c
 icc /Ss /C /Ti+ /Tm+ /I.. txtest.c
-ilink txtest.obj textseq.obj /DEBUG
+ilink txtest.obj textseq.obj textgap.obj textpt.obj textrope.obj textpage.obj textutf8.obj textblock.obj /DEBUG
@@ -0,0 +1,137 @@
+#include <os2.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "textseq.h"
+#include "textre.h"
+
+/* Regular expression search benchmark.
+ *
+ * Builds a buffer of UCS-2 text of the given size (default 100 MB) which
+ * looks like a log file: each line has a sequence number, a severity and a
+ * message made up of random words.  The gap is left in the middle of the
+ * text.  Each pattern is then used to filter the log, by counting the lines
+ * it matches (searching again from the start of the next line after each
+ * match), and the throughput is reported.
+ *
+ * Usage: rebench [megabytes] [model]
+ */
+
+typedef unsigned short UCS2;
+
+PSZ apszSeverity[] = { "INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR" };
+PSZ apszWords[]    = { "connection", "request", "timeout", "user", "cache",
+                       "disk", "retry", "queue", "opened", "closed" };
+PSZ apszPatterns[] = { "ERROR",
+                       "ERROR .*timeout",
+                       "^\\d+ WARN",
+                       "(disk|cache) (opened|closed)$",
+                       "retr[a-z]+ \\w+ \\w+ timeout" };
+
+
+/* Simple linear congruential generator, so the text is the same on every
+ * platform.
+ */
+ULONG ulSeed = 1;
+
+ULONG Random( ULONG ulRange )
+{
+    ulSeed = ulSeed * 1103515245 + 12345;
+    return (( ulSeed >> 16 ) & 0x7FFF ) % ulRange;
+}
+
+
+/* Appends an ASCII string to the UCS-2 text, as far as there is room.
+ */
+ULONG AddString( UCS2 *pusText, ULONG ulPos, ULONG ulChars, PSZ psz )
+{
+    while ( *psz && ( ulPos < ulChars )) pusText[ ulPos++ ] = *psz++;
+    return ulPos;
+}
+
+
+int FilterTest( EDITORTEXT text, PSZ pszPattern )
+{
+    TEXTREGEX regex;
+    UCS2      ausPattern[ 64 ],
+              usLF = '\n';
+    ULONG     ulLength,
+              ulCount,
+              ulPos,
+              ulError,
+              cbMatch;
+    double    dSecs;
+    clock_t   start;
+
+    for ( ulLength = 0; pszPattern[ ulLength ]; ulLength++ )
+        ausPattern[ ulLength ] = pszPattern[ ulLength ];
+    if ( !Regex_Compile( &regex, ausPattern, ulLength, 0, &ulError )) {
+        printf("*** Pattern \"%s\" is invalid at offset %u\n", pszPattern, ulError );
+        return 0;
+    }
+
+    ulCount = 0;
+    start   = clock();
+    ulPos   = Regex_Search( regex, text, 0, &cbMatch );
+    while ( ulPos != TEXT_INVALID_POSITION ) {
+        ulCount++;
+        ulPos = TextSearch( text, (PBYTE) &usLF, sizeof( UCS2 ), ulPos + cbMatch, sizeof( UCS2 ));
+        if ( ulPos == TEXT_INVALID_POSITION ) break;
+        ulPos = Regex_Search( regex, text, ulPos + sizeof( UCS2 ), &cbMatch );
+    }
+    dSecs = (double)( clock() - start ) / CLOCKS_PER_SEC;
+    if ( dSecs <= 0 ) dSecs = 1.0 / CLOCKS_PER_SEC;
+
+    printf("%-32s %8u lines in %6.3f s = %8.1f MB/s\n", pszPattern, ulCount, dSecs,
+           ( TextLength( text ) / 1048576.0 ) / dSecs );
+    Regex_Free( &regex );
+    return 1;
+}
+
+
+int main( int argc, char *argv[] )
+{
+    EDITORTEXT text;
+    UCS2       *pusText;
+    CHAR       szNumber[ 16 ];
+    ULONG      cbText,
+               ulChars,
+               ulModel,
+               ulLine,
+               i, j;
+    int        rc;
+
+    cbText  = (( argc > 1 ) ? atoi( argv[1] ) : 100 ) * 1048576;
+    ulModel = ( argc > 2 ) ? atoi( argv[2] ) : TEXT_MODEL_GAPBUFFER;
+    ulChars = cbText / sizeof( UCS2 );
+
+    pusText = (UCS2 *) malloc( cbText );
+    if ( !pusText ) return 1;
+    for ( i = 0, ulLine = 1; i < ulChars; ulLine++ ) {
+        sprintf( szNumber, "%u ", ulLine );
+        i = AddString( pusText, i, ulChars, szNumber );
+        i = AddString( pusText, i, ulChars, apszSeverity[ Random( 6 ) ] );
+        for ( j = 3 + Random( 8 ); j; j-- ) {
+            i = AddString( pusText, i, ulChars, " " );
+            i = AddString( pusText, i, ulChars, apszWords[ Random( 10 ) ] );
+        }
+        i = AddString( pusText, i, ulChars, "\n" );
+    }
+
+    // Leave the gap (or a piece boundary) in the middle of the text
+    if ( !TextCreateModel( &text, ulModel )) return 1;
+    if ( !TextInitContents( text, (PBYTE) pusText, cbText )) return 1;
+    TextInsert( text, (PBYTE) pusText, ( ulChars / 2 ) * sizeof( UCS2 ), sizeof( UCS2 ));
+    TextDelete( text, ( ulChars / 2 ) * sizeof( UCS2 ), sizeof( UCS2 ));
+    free( pusText );
+
+    printf("Filtering %u bytes of UCS-2 text with text model %u\n\n", cbText, ulModel );
+    rc = 0;
+    for ( i = 0; i < sizeof( apszPatterns ) / sizeof( PSZ ); i++ )
+        if ( !FilterTest( text, apszPatterns[ i ] )) rc = 1;
+
+    TextFree( &text );
+    return rc;
+}
+
@@ -0,0 +1,249 @@
+#include <os2.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "textseq.h"
+
+/* Replace-all benchmark.
+ *
+ * Builds a buffer of UCS-2 text of the given size (default 50 MB), made up
+ * of random lower-case words and lines, with the given number of copies of
+ * a marker word (default 100,000) scattered through it.  Every copy is then
+ * replaced, first with a longer word and then with a line break, using
+ * TextReplaceAll().  The line breaks it reports are collected as they come
+ * (as they would be to rebuild a line index), and both the new text and the
+ * line breaks are checked against the expected results.
+ *
+ * For comparison, the first few thousand copies are also replaced one at a
+ * time with TextDelete() and TextInsert(), as a naive replace-all would do.
+ * In the editor, each such edit would also have to shift every line offset
+ * after it, which is what makes that approach quadratic.
+ *
+ * Usage: replbench [megabytes] [copies] [model]
+ */
+
+#define MARKER          "NEEDLE"
+#define NAIVE_COUNT     2000
+
+typedef unsigned short UCS2;
+
+
+/* Simple linear congruential generator, so the text is the same on every
+ * platform.
+ */
+ULONG ulSeed = 1;
+
+ULONG Random( ULONG ulRange )
+{
+    ulSeed = ulSeed * 1103515245 + 12345;
+    return (( ulSeed >> 16 ) & 0x7FFF ) % ulRange;
+}
+
+
+void Report( PSZ pszName, ULONG ulCount, clock_t ticks )
+{
+    double dSecs = (double) ticks / CLOCKS_PER_SEC;
+
+    if ( dSecs <= 0 ) dSecs = 1.0 / CLOCKS_PER_SEC;
+    printf("%-20s %7u replaced in %6.3f s = %9.0f per second\n",
+           pszName, ulCount, dSecs, ulCount / dSecs );
+}
+
+
+/* Line breaks reported by TextReplaceAll(), in the order received.
+ */
+typedef struct _break_list {
+    ULONG *pulBreaks;
+    ULONG ulCount,
+          ulMax;
+} BREAKLIST, *PBREAKLIST;
+
+int CollectBreaks( void *pUser, unsigned long *pulBreaks, unsigned long ulBreaks )
+{
+    PBREAKLIST pList = (PBREAKLIST) pUser;
+    ULONG      *pulMore;
+
+    if ( pList->ulCount + ulBreaks > pList->ulMax ) {
+        pList->ulMax = ( pList->ulCount + ulBreaks ) * 2;
+        pulMore = (ULONG *) realloc( pList->pulBreaks, pList->ulMax * sizeof( ULONG ));
+        if ( !pulMore ) return 0;
+        pList->pulBreaks = pulMore;
+    }
+    memcpy( pList->pulBreaks + pList->ulCount, pulBreaks, ulBreaks * sizeof( ULONG ));
+    pList->ulCount += ulBreaks;
+    return 1;
+}
+
+
+/* Builds the expected result of a replace-all in a plain array.
+ */
+UCS2 *ExpectedText( UCS2 *pusText, ULONG ulChars, UCS2 *pusFind, ULONG ulFind, UCS2 *pusReplace, ULONG ulReplace, PULONG pulNew )
+{
+    UCS2  *pusNew;
+    ULONG i, j;
+
+    pusNew = (UCS2 *) malloc(( ulChars / ulFind + 1 ) * ( ulReplace + ulFind ) * sizeof( UCS2 ));
+    if ( !pusNew ) return NULL;
+    for ( i = 0, j = 0; i < ulChars; ) {
+        if (( i + ulFind <= ulChars ) && !memcmp( pusText + i, pusFind, ulFind * sizeof( UCS2 ))) {
+            memcpy( pusNew + j, pusReplace, ulReplace * sizeof( UCS2 ));
+            i += ulFind;
+            j += ulReplace;
+        }
+        else pusNew[ j++ ] = pusText[ i++ ];
+    }
+    *pulNew = j;
+    return pusNew;
+}
+
+
+/* Checks the text object and the reported line breaks against the expected
+ * text.  A CR LF pair is one line break.
+ */
+int CheckResult( EDITORTEXT text, PBREAKLIST pList, UCS2 *pusExpect, ULONG ulExpect )
+{
+    UCS2  *pusText;
+    ULONG cbText,
+          ulBreak,
+          i;
+
+    cbText = TextLength( text );
+    if ( cbText != ulExpect * sizeof( UCS2 )) {
+        printf("*** Text is %u bytes, expected %u\n", cbText, ulExpect * sizeof( UCS2 ));
+        return 0;
+    }
+    pusText = (UCS2 *) malloc( cbText + 1 );
+    if ( !pusText ) return 0;
+    TextSequence( text, (PBYTE) pusText, 0, cbText );
+    if ( memcmp( pusText, pusExpect, cbText )) {
+        printf("*** Text differs from the expected result\n");
+        free( pusText );
+        return 0;
+    }
+    free( pusText );
+
+    ulBreak = 0;
+    for ( i = 0; i < ulExpect; i++ ) {
+        if ( pusExpect[ i ] == '\r' && ( i + 1 < ulExpect ) && pusExpect[ i + 1 ] == '\n' ) i++;
+        else if ( pusExpect[ i ] != '\r' && pusExpect[ i ] != '\n' ) continue;
+        if (( ulBreak >= pList->ulCount ) ||
+            ( pList->pulBreaks[ ulBreak ] != ( i + 1 ) * sizeof( UCS2 )))
+        {
+            printf("*** Line break %u is wrong or missing\n", ulBreak );
+            return 0;
+        }
+        ulBreak++;
+    }
+    if ( ulBreak != pList->ulCount ) {
+        printf("*** %u line breaks reported, expected %u\n", pList->ulCount, ulBreak );
+        return 0;
+    }
+    return 1;
+}
+
+
+int ReplaceTest( PSZ pszName, UCS2 *pusText, ULONG ulChars, ULONG ulModel, PSZ pszReplace )
+{
+    EDITORTEXT text;
+    BREAKLIST  breaks;
+    UCS2       ausFind[ 16 ],
+               ausReplace[ 16 ],
+               *pusExpect;
+    ULONG      ulFind,
+               ulReplace,
+               ulExpect,
+               ulCount,
+               ulPos,
+               i;
+    clock_t    start;
+    int        rc;
+
+    ulFind    = strlen( MARKER );
+    ulReplace = strlen( pszReplace );
+    for ( i = 0; i < ulFind; i++ )    ausFind[ i ]    = MARKER[ i ];
+    for ( i = 0; i < ulReplace; i++ ) ausReplace[ i ] = pszReplace[ i ];
+
+    printf("\nReplacing \"%s\" (%s)\n\n", MARKER, pszName );
+
+    pusExpect = ExpectedText( pusText, ulChars, ausFind, ulFind, ausReplace, ulReplace, &ulExpect );
+    if ( !pusExpect ) return 0;
+    if ( !TextCreateModel( &text, ulModel )) return 0;
+
+    // The naive way, for only the first few copies
+    TextInitContents( text, (PBYTE) pusText, ulChars * sizeof( UCS2 ));
+    start   = clock();
+    ulCount = 0;
+    ulPos   = TextSearch( text, (PBYTE) ausFind, ulFind * sizeof( UCS2 ), 0, sizeof( UCS2 ));
+    while (( ulPos != TEXT_INVALID_POSITION ) && ( ulCount < NAIVE_COUNT )) {
+        TextDelete( text, ulPos, ulFind * sizeof( UCS2 ));
+        TextInsert( text, (PBYTE) ausReplace, ulPos, ulReplace * sizeof( UCS2 ));
+        ulCount++;
+        ulPos = TextSearch( text, (PBYTE) ausFind, ulFind * sizeof( UCS2 ),
+                            ulPos + ulReplace * sizeof( UCS2 ), sizeof( UCS2 ));
+    }
+    Report("delete and insert", ulCount, clock() - start );
+
+    // And with TextReplaceAll()
+    TextInitContents( text, (PBYTE) pusText, ulChars * sizeof( UCS2 ));
+    memset( &breaks, 0, sizeof( breaks ));
+    start   = clock();
+    ulCount = TextReplaceAll( text, (PBYTE) ausFind, ulFind * sizeof( UCS2 ),
+                              (PBYTE) ausReplace, ulReplace * sizeof( UCS2 ),
+                              sizeof( UCS2 ), CollectBreaks, &breaks );
+    Report("TextReplaceAll", ulCount, clock() - start );
+    printf("%u line breaks reported\n", breaks.ulCount );
+
+    rc = ( ulCount != TEXT_INVALID_POSITION ) &&
+         CheckResult( text, &breaks, pusExpect, ulExpect );
+
+    free( breaks.pulBreaks );
+    free( pusExpect );
+    TextFree( &text );
+    return rc;
+}
+
+
+int main( int argc, char *argv[] )
+{
+    UCS2  *pusText;
+    ULONG cbText,
+          ulChars,
+          ulCopies,
+          ulModel,
+          ulMarker,
+          ulPos,
+          i, j;
+    int   rc;
+
+    cbText   = (( argc > 1 ) ? atoi( argv[1] ) : 50 ) * 1048576;
+    ulCopies = ( argc > 2 ) ? atoi( argv[2] ) : 100000;
+    ulModel  = ( argc > 3 ) ? atoi( argv[3] ) : TEXT_MODEL_GAPBUFFER;
+    ulChars  = cbText / sizeof( UCS2 );
+    ulMarker = strlen( MARKER );
+    if ( !ulCopies || ( ulChars / ulCopies <= ulMarker )) return 1;
+
+    pusText = (UCS2 *) malloc( cbText );
+    if ( !pusText ) return 1;
+    for ( i = 0; i < ulChars; ) {
+        for ( j = 1 + Random( 10 ); j && ( i < ulChars ); j-- )
+            pusText[ i++ ] = 'a' + Random( 26 );
+        if ( i < ulChars ) pusText[ i++ ] = Random( 12 ) ? ' ' : '\n';
+    }
+
+    // Scatter the copies of the marker, one somewhere within each interval
+    for ( i = 0; i < ulCopies; i++ ) {
+        ulSeed = ulSeed * 1103515245 + 12345;
+        ulPos  = i * ( ulChars / ulCopies ) +
+                 ( ulSeed >> 8 ) % ( ulChars / ulCopies - ulMarker );
+        for ( j = 0; j < ulMarker; j++ ) pusText[ ulPos + j ] = MARKER[ j ];
+    }
+
+    printf("Replacing in %u bytes of UCS-2 text with text model %u\n", cbText, ulModel );
+    rc = 0;
+    if ( !ReplaceTest("longer word", pusText, ulChars, ulModel, "SPINDLES")) rc = 1;
+    if ( !ReplaceTest("line break", pusText, ulChars, ulModel, "\r\n")) rc = 1;
+
+    free( pusText );
+    return rc;
+}
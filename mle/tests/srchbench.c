@@ -0,0 +1,170 @@
+#include <os2.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "textseq.h"
+
+/* Search benchmark.
+ *
+ * Builds a buffer of UCS-2 text of the given size (default 100 MB), made up
+ * of random lower-case words, and plants a marker phrase in upper case near
+ * the start, across the middle (where the gap, or a piece boundary, lies)
+ * and near the end.  Every occurrence of a few patterns is then counted,
+ * first with a byte-at-a-time loop over TextByteAt() and then by repeated
+ * TextSearch() calls (as find-next would make), and the throughput of each
+ * is reported.  The two methods should find the same number of matches.
+ *
+ * The patterns are the whole marker phrase (searched with the skip table),
+ * its first two characters (a rare first byte for memchr() to scan for) and
+ * a common two-character sequence.
+ *
+ * Usage: srchbench [megabytes] [model]
+ */
+
+#define MARKER      L"QUARTZ JUMPS FOX"
+#define MARKER_LEN  16
+
+typedef unsigned short UCS2;
+
+
+/* Simple linear congruential generator, so the text is the same on every
+ * platform.
+ */
+ULONG ulSeed = 1;
+
+ULONG Random( ULONG ulRange )
+{
+    ulSeed = ulSeed * 1103515245 + 12345;
+    return (( ulSeed >> 16 ) & 0x7FFF ) % ulRange;
+}
+
+
+void Report( PSZ pszName, ULONG ulCount, double dBytes, clock_t ticks )
+{
+    double dSecs = (double) ticks / CLOCKS_PER_SEC;
+
+    if ( dSecs <= 0 ) dSecs = 1.0 / CLOCKS_PER_SEC;
+    printf("%-10s %6u found in %6.3f s = %8.1f MB/s\n",
+           pszName, ulCount, dSecs, ( dBytes / 1048576.0 ) / dSecs );
+}
+
+
+/* Counts the occurrences of a pattern one byte at a time.
+ */
+ULONG ByteLoopCount( EDITORTEXT text, PBYTE pbPattern, ULONG cbPattern )
+{
+    ULONG cbText,
+          ulCount,
+          ulPos,
+          i;
+
+    cbText  = TextLength( text );
+    ulCount = 0;
+    for ( ulPos = 0; ulPos + cbPattern <= cbText; ulPos += sizeof( UCS2 )) {
+        for ( i = 0; i < cbPattern; i++ )
+            if ( TextByteAt( text, ulPos + i ) != pbPattern[ i ] ) break;
+        if ( i == cbPattern ) ulCount++;
+    }
+    return ulCount;
+}
+
+
+/* Counts the occurrences of a pattern with TextSearch().
+ */
+ULONG SearchCount( EDITORTEXT text, PBYTE pbPattern, ULONG cbPattern )
+{
+    ULONG ulCount,
+          ulPos;
+
+    ulCount = 0;
+    ulPos   = TextSearch( text, pbPattern, cbPattern, 0, sizeof( UCS2 ));
+    while ( ulPos != TEXT_INVALID_POSITION ) {
+        ulCount++;
+        ulPos = TextSearch( text, pbPattern, cbPattern, ulPos + sizeof( UCS2 ), sizeof( UCS2 ));
+    }
+    return ulCount;
+}
+
+
+int SearchTest( PSZ pszName, EDITORTEXT text, PSZ pszPattern )
+{
+    UCS2    ausPattern[ MARKER_LEN ];
+    ULONG   cbPattern,
+            ulLoop,
+            ulSearch,
+            i;
+    clock_t start;
+
+    cbPattern = strlen( pszPattern ) * sizeof( UCS2 );
+    for ( i = 0; pszPattern[ i ]; i++ ) ausPattern[ i ] = pszPattern[ i ];
+
+    printf("\nSearching for \"%s\" (%s)\n\n", pszPattern, pszName );
+
+    start  = clock();
+    ulLoop = ByteLoopCount( text, (PBYTE) ausPattern, cbPattern );
+    Report("byte loop", ulLoop, (double) TextLength( text ), clock() - start );
+
+    start    = clock();
+    ulSearch = SearchCount( text, (PBYTE) ausPattern, cbPattern );
+    Report("TextSearch", ulSearch, (double) TextLength( text ), clock() - start );
+
+    if ( ulSearch != ulLoop ) {
+        printf("*** TextSearch found %u matches, expected %u\n", ulSearch, ulLoop );
+        return 0;
+    }
+    return 1;
+}
+
+
+int main( int argc, char *argv[] )
+{
+    EDITORTEXT text;
+    UCS2       *pusText;
+    ULONG      cbText,
+               ulChars,
+               ulModel,
+               ulMiddle,
+               i, j;
+    int        rc;
+
+    cbText  = (( argc > 1 ) ? atoi( argv[1] ) : 100 ) * 1048576;
+    ulModel = ( argc > 2 ) ? atoi( argv[2] ) : TEXT_MODEL_GAPBUFFER;
+    ulChars = cbText / sizeof( UCS2 );
+
+    pusText = (UCS2 *) malloc( cbText );
+    if ( !pusText ) return 1;
+    for ( i = 0; i < ulChars; ) {
+        for ( j = 1 + Random( 10 ); j && ( i < ulChars ); j-- )
+            pusText[ i++ ] = 'a' + Random( 26 );
+        if ( i < ulChars ) pusText[ i++ ] = Random( 12 ) ? ' ' : '\n';
+    }
+
+    // Plant the marker near the start and the end, and across the middle
+    ulMiddle = ulChars / 2;
+    for ( i = 0; i < MARKER_LEN; i++ ) {
+        pusText[ 1000 + i ]                     = MARKER[ i ];
+        pusText[ ulMiddle - MARKER_LEN/2 + i ]  = MARKER[ i ];
+        pusText[ ulChars - 1000 + i ]           = MARKER[ i ];
+    }
+
+    /* Split the text in the middle by deleting one character there and
+     * putting it back, which leaves the gap (or a piece boundary) inside
+     * the middle marker.
+     */
+    if ( !TextCreateModel( &text, ulModel )) return 1;
+    if ( !TextInitContents( text, (PBYTE) pusText, cbText )) return 1;
+    TextDelete( text, ulMiddle * sizeof( UCS2 ), sizeof( UCS2 ));
+    TextInsert( text, (PBYTE)( pusText + ulMiddle ), ulMiddle * sizeof( UCS2 ), sizeof( UCS2 ));
+    free( pusText );
+
+    printf("Searching %u bytes of UCS-2 text with text model %u\n", cbText, ulModel );
+    rc = 0;
+    if ( !SearchTest("skip table", text, "QUARTZ JUMPS FOX")) rc = 1;
+    if ( !SearchTest("rare start", text, "QU")) rc = 1;
+    if ( !SearchTest("common", text, "e ")) rc = 1;
+
+    TextFree( &text );
+    return rc;
+}
+
@@ -0,0 +1,204 @@
+#include <os2.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "textseq.h"
+
+/* Gap movement benchmark.
+ *
+ * Builds a text buffer of the given size (default 20 MB) and repeatedly moves
+ * the gap between the top and bottom of the text, by inserting a single byte
+ * alternately near the start and near the end.  Each such insert moves almost
+ * the entire text across the gap.
+ *
+ * For comparison, the same gap movements are also performed on a plain buffer
+ * using the original byte-at-a-time loop (which also zeroed every byte that
+ * it vacated).
+ *
+ * Finally, the same amount of text is built up again by appending it in small
+ * chunks, first relying on the buffer growth policy and then with the buffer
+ * pre-sized by TextReserve().
+ *
+ * Last of all, scattered edits (such as multi-cursor typing) are simulated by
+ * replacing one byte in every EDIT_SPACING, first with individual TextDelete
+ * and TextInsert calls, made alternately near the start and the end of the
+ * text, and then with a single TextApplyEdits() batch.
+ *
+ * Usage: txbench [megabytes] [iterations]
+ */
+
+#define GAP_SIZE    8192
+#define CHUNK_SIZE  1024
+#define EDIT_SPACING 4096
+
+
+/* The original MoveGap() algorithm, operating on a bare buffer.  Moves the
+ * gap from ulOldStart to ulNewStart.
+ */
+void LegacyMoveGap( PBYTE pch, ULONG ulGapLen, ULONG ulOldStart, ULONG ulNewStart )
+{
+    ULONG ulShift,
+          ulSource,
+          ulTarget;
+    long  i;
+
+    if ( ulNewStart > ulOldStart ) {
+        ulShift  = ulNewStart - ulOldStart;
+        ulSource = ulOldStart + ulGapLen;
+        ulTarget = ulOldStart;
+        for ( i = 0; i < ulShift; i++ ) {
+            pch[ ulTarget+i ] = pch[ ulSource+i ];
+            pch[ ulSource+i ] = 0;
+        }
+    }
+    else if ( ulNewStart < ulOldStart ) {
+        ulShift  = ulOldStart - ulNewStart;
+        ulSource = ulNewStart;
+        ulTarget = ulNewStart + ulGapLen;
+        for ( i = ulShift-1; i >= 0; i-- ) {
+            pch[ ulTarget+i ] = pch[ ulSource+i ];
+            pch[ ulSource+i ] = 0;
+        }
+    }
+}
+
+
+void Report( PSZ pszName, double dBytes, clock_t ticks )
+{
+    double dSecs = (double) ticks / CLOCKS_PER_SEC;
+
+    if ( dSecs <= 0 ) dSecs = 1.0 / CLOCKS_PER_SEC;
+    printf("%-10s %8.0f MB moved in %6.3f s = %8.1f MB/s\n",
+           pszName, dBytes / 1048576.0, dSecs, ( dBytes / 1048576.0 ) / dSecs );
+}
+
+
+/* Appends cbText bytes to an empty buffer in CHUNK_SIZE pieces, optionally
+ * reserving the full size first.
+ */
+int AppendTest( PSZ pszName, ULONG cbText, BOOL fReserve )
+{
+    EDITORTEXT text;
+    BYTE       achChunk[ CHUNK_SIZE ];
+    ULONG      i;
+    clock_t    start;
+
+    for ( i = 0; i < CHUNK_SIZE; i++ ) achChunk[ i ] = 'a' + ( i % 26 );
+    if ( !TextCreateModel( &text, TEXT_MODEL_GAPBUFFER )) return 0;
+    if ( !TextInitContents( text, NULL, 0 )) return 0;
+
+    start = clock();
+    if ( fReserve && !TextReserve( text, cbText )) return 0;
+    for ( i = 0; i + CHUNK_SIZE <= cbText; i += CHUNK_SIZE )
+        if ( !TextInsert( text, achChunk, i, CHUNK_SIZE )) return 0;
+    Report( pszName, (double) i, clock() - start );
+
+    TextFree( &text );
+    return 1;
+}
+
+
+/* Replaces one byte in every EDIT_SPACING bytes of a cbText-byte text,
+ * either one edit at a time (working inwards from both ends) or as a single
+ * batch.
+ */
+int ReplaceTest( PSZ pszName, PBYTE pchText, ULONG cbText, BOOL fBatch )
+{
+    EDITORTEXT text;
+    PTEXTEDIT  pEdits;
+    ULONG      ulCount,
+               ulPos,
+               i;
+    clock_t    start;
+
+    ulCount = cbText / EDIT_SPACING;
+    pEdits  = (PTEXTEDIT) malloc( ulCount * sizeof( TEXTEDIT ));
+    if ( !pEdits ) return 0;
+    if ( !TextCreateModel( &text, TEXT_MODEL_GAPBUFFER )) return 0;
+    if ( !TextInitContents( text, pchText, cbText )) return 0;
+
+    start = clock();
+    if ( fBatch ) {
+        for ( i = 0; i < ulCount; i++ ) {
+            pEdits[ i ].ulPosition = i * EDIT_SPACING;
+            pEdits[ i ].cbDelete   = 1;
+            pEdits[ i ].pchInsert  = "x";
+            pEdits[ i ].cbInsert   = 1;
+        }
+        if ( !TextApplyEdits( text, pEdits, ulCount )) return 0;
+    }
+    else {
+        for ( i = 0; i < ulCount; i++ ) {
+            ulPos = ( i % 2 ) ? ( ulCount - 1 - ( i / 2 )) : ( i / 2 );
+            TextDelete( text, ulPos * EDIT_SPACING, 1 );
+            TextInsert( text, "x", ulPos * EDIT_SPACING, 1 );
+        }
+    }
+    Report( pszName, (double) cbText, clock() - start );
+
+    free( pEdits );
+    TextFree( &text );
+    return 1;
+}
+
+
+int main( int argc, char *argv[] )
+{
+    EDITORTEXT text;
+    PBYTE      pchText;
+    ULONG      cbText,
+               ulIters,
+               ulPos,
+               i;
+    double     dMoved;
+    clock_t    start;
+
+    cbText  = (( argc > 1 ) ? atoi( argv[1] ) : 20 ) * 1048576;
+    ulIters = ( argc > 2 ) ? atoi( argv[2] ) : 20;
+
+    pchText = (PBYTE) malloc( cbText + GAP_SIZE );
+    if ( !pchText ) return 1;
+    for ( i = 0; i < cbText; i++ ) pchText[ i ] = 'a' + ( i % 26 );
+
+    printf("Moving the gap %u times across %u bytes of text\n\n", ulIters * 2, cbText );
+
+    // Legacy byte loop
+    dMoved = 0;
+    ulPos  = cbText;
+    start  = clock();
+    for ( i = 0; i < ulIters; i++ ) {
+        LegacyMoveGap( pchText, GAP_SIZE, ulPos, 1 );
+        LegacyMoveGap( pchText, GAP_SIZE, 1, cbText - 1 );
+        ulPos   = cbText - 1;
+        dMoved += 2.0 * ( cbText - 2 );
+    }
+    Report("byte loop", dMoved, clock() - start );
+
+    // Current gap buffer implementation
+    if ( !TextCreateModel( &text, TEXT_MODEL_GAPBUFFER )) return 1;
+    if ( !TextInitContents( text, pchText, cbText )) return 1;
+
+    dMoved = 0;
+    start  = clock();
+    for ( i = 0; i < ulIters; i++ ) {
+        TextInsert( text, "x", 1, 1 );
+        TextInsert( text, "x", TextLength( text ) - 1, 1 );
+        dMoved += 2.0 * ( TextLength( text ) - 2 );
+    }
+    Report("TextInsert", dMoved, clock() - start );
+    TextFree( &text );
+
+    printf("\nAppending %u bytes of text in %u-byte chunks\n\n", cbText, CHUNK_SIZE );
+    if ( !AppendTest("append", cbText, FALSE )) return 1;
+    if ( !AppendTest("reserved", cbText, TRUE )) return 1;
+
+    printf("\nReplacing %u bytes in %u bytes of text\n\n", cbText / EDIT_SPACING, cbText );
+    if ( !ReplaceTest("singly", pchText, cbText, FALSE )) return 1;
+    if ( !ReplaceTest("batch", pchText, cbText, TRUE )) return 1;
+
+    free( pchText );
+
+    return 0;
+}
+
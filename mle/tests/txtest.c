@@ -6,17 +6,32 @@
 
 
 #define TEST_TEXT   "The fox jumps over the lazy dog.  Woven silk pyjamas exchanged for blue quartz?"
+#define LINE_TEXT   L"First line\r\nSecond line\nThird line\r\rFifth line"
 
 int main( int argc, char *argv[] )
 {
-    EDITORTEXT  text;
+    EDITORTEXT  text,
+                snapshot;
     ULONG     count,
               val,
               pos;
     CHAR      szText[ 256 ];
-
-    if ( !TextCreate( &text ))
+    TEXTSPAN  span1,
+              span2;
+    PUCHAR    pszView;
+    TEXTSTATS stats;
+    TEXTEDIT  edits[ 2 ];
+    TEXTITER  iter;
+    wchar_t   wc;
+    int       iModel;
+
+    // Usage: txtest [model] [file]
+    if ( argc < 2 ) iModel = TEXT_MODEL_GAPBUFFER;
+    else iModel = atoi( argv[1] );
+
+    if ( !TextCreateModel( &text, iModel ))
         return 1;
+    printf("Text model: %d\n\n", TextQueryModel( text ));
 
     TextInitContents( text, TEST_TEXT, strlen( TEST_TEXT ));
 
@@ -31,6 +46,12 @@ int main( int argc, char *argv[] )
     szText[ count ] = 0;
     printf("Text contents: %s\n\n", szText );
 
+    count = TextGetSpans( text, 0, TextLength( text ), &span1, &span2 );
+    printf("Text spans: %u (%u + %u bytes)\n", count, span1.cb, span2.cb );
+    pszView = TextGetView( text, 0, TextLength( text ));
+    if ( pszView ) printf("Contiguous view: %.20s...\n\n", pszView );
+    else           printf("Contiguous view: not available\n\n");
+
     TextInsert( text, "\r\n", 46, 2 );
     printf("Text length: %u bytes\n", TextLength( text ));
     count = TextSequence( text, szText, 0, 255 );
@@ -41,7 +62,93 @@ int main( int argc, char *argv[] )
     printf("Text length: %u bytes\n", TextLength( text ));
     count = TextSequence( text, szText, 0, 255 );
     szText[ count ] = 0;
-    printf("Text contents: %s\n", szText );
+    printf("Text contents: %s\n\n", szText );
+
+    TextDelete( text, 10, 6 );
+    printf("Text length: %u bytes\n", TextLength( text ));
+    count = TextSequence( text, szText, 0, 255 );
+    szText[ count ] = 0;
+    printf("Text contents: %s\n\n", szText );
+
+    // Apply several edits at once; positions refer to the text beforehand
+    edits[ 0 ].ulPosition = 30;
+    edits[ 0 ].cbDelete   = 4;
+    edits[ 0 ].pchInsert  = "cat";
+    edits[ 0 ].cbInsert   = 3;
+    edits[ 1 ].ulPosition = 0;
+    edits[ 1 ].cbDelete   = 3;
+    edits[ 1 ].pchInsert  = "A";
+    edits[ 1 ].cbInsert   = 1;
+    TextApplyEdits( text, edits, 2 );
+    printf("Text length: %u bytes (shifts %d, %d)\n", TextLength( text ), edits[ 0 ].lShift, edits[ 1 ].lShift );
+    count = TextSequence( text, szText, 0, 255 );
+    szText[ count ] = 0;
+    printf("Text contents: %s\n\n", szText );
+
+    // A snapshot keeps the text as it was, while the original is edited
+    if ( TextSnapshot( text, &snapshot )) {
+        TextDelete( text, 0, 12 );
+        count = TextSequence( snapshot, szText, 0, 255 );
+        szText[ count ] = 0;
+        printf("Snapshot contents: %s\n", szText );
+        count = TextSequence( text, szText, 0, 255 );
+        szText[ count ] = 0;
+        printf("Edited contents: %s\n\n", szText );
+        TextReleaseSnapshot( &snapshot );
+    }
+    else printf("Snapshots: not available\n\n");
+
+    // The line functions treat the text as wchar_t units
+    TextDestroyContents( text );
+    TextInitContents( text, (PCHAR) LINE_TEXT, sizeof( LINE_TEXT ) - sizeof( wchar_t ));
+    count = TextLineCount( text );
+    printf("Line count: %u\n", count );
+    for ( val = 0; val < count; val++ ) {
+        pos = TextLineOffset( text, val );
+        printf(" - line %u starts at byte %u (next break at %u, line of that offset is %u)\n",
+               val, pos, TextNextLineBreak( text, pos ), TextLineFromOffset( text, pos ));
+    }
+
+    // Walk the characters with an iterator, across an edit in the middle
+    TextDelete( text, 11 * sizeof( wchar_t ), sizeof( wchar_t ));
+    TextInsert( text, (PCHAR) L"\n", 11 * sizeof( wchar_t ), sizeof( wchar_t ));
+    if ( TextIterInit( &iter, text, 0 )) {
+        for ( count = 0, val = 0; TextIterNext( &iter, &wc ); count++ )
+            if ( wc == L'\n' ) val++;
+        printf("\nIterated forwards over %u characters (%u LFs), ending at byte %u\n",
+               count, val, TextIterPosition( &iter ));
+        for ( count = 0; TextIterPrev( &iter, &wc ); count++ );
+        printf("Iterated backwards over %u characters, ending at byte %u\n",
+               count, TextIterPosition( &iter ));
+    }
+
+    // With an element size set, edits which would split a character fail
+    if ( TextSetElementSize( text, sizeof( wchar_t ))) {
+        printf("\nElement %u is %04X; ", 12, TextElementAt( text, 12 ));
+        printf("odd insert %s, ", TextInsert( text, (PCHAR) L"?", 1, sizeof( wchar_t )) ? "allowed" : "refused");
+        printf("odd delete %s, ", TextDelete( text, 0, 1 ) ? "allowed" : "refused");
+        printf("whole insert %s\n", TextInsert( text, (PCHAR) L"?", sizeof( wchar_t ), sizeof( wchar_t )) ? "allowed" : "refused");
+        printf("Character 1 is now %c\n", (char) TextWCharAt( text, 1 ));
+        TextSetElementSize( text, 1 );
+    }
+
+    // Optionally, open a file (mapped in place under the piece table model,
+    // or read through the page cache under the paged model)
+    if ( argc > 2 ) {
+        if ( TextInitFromFile( text, argv[2] )) {
+            count = TextSequence( text, szText, 0, 40 );
+            szText[ count ] = 0;
+            printf("\nFile %s: %u bytes, starting with: %s\n", argv[2], TextLength( text ), szText );
+            TextInsert( text, "[edited]", 0, 8 );
+            count = TextSequence( text, szText, 0, 40 );
+            szText[ count ] = 0;
+            printf("After editing: %s\n", szText );
+            TextQueryStats( text, &stats );
+            printf("Page cache: %u hits, %u misses, %u of %u pages resident\n",
+                   stats.ulPageHits, stats.ulPageMisses, stats.ulPagesResident, stats.ulPagesMax );
+        }
+        else printf("\nFile %s could not be opened.\n", argv[2] );
+    }
 
 /*
     printf("+ %2u @%2u\t", 5, 0 );
@@ -0,0 +1,178 @@
+#include <os2.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "textseq.h"
+#include "textundo.h"
+
+/* Undo journal benchmark.
+ *
+ * Replays a synthetic trace of keystrokes (default 100,000) through the undo
+ * journal into a text buffer containing UCS-2 text, as the editor control
+ * would.  The trace consists of runs of typing (with word breaks and line
+ * breaks), runs of backspacing, forward deletions, and occasional jumps of
+ * the cursor to a random position, which seal the current undo step.
+ *
+ * Every recorded step is then undone, which should restore the original
+ * text, and redone, which should restore the final text.  This is done
+ * first with a journal large enough to hold the whole trace, and then with
+ * the default memory budget, where only the most recent steps survive.
+ *
+ * Usage: undobench [model] [keystrokes]
+ */
+
+#define INITIAL_SIZE    65536
+#define FULL_LIMIT      0x2000000   // enough to hold the whole trace
+
+
+/* Simple linear congruential generator, so the trace is the same on every
+ * platform.
+ */
+ULONG ulSeed = 1;
+
+ULONG Random( ULONG ulRange )
+{
+    ulSeed = ulSeed * 1103515245 + 12345;
+    return (( ulSeed >> 16 ) & 0x7FFF ) % ulRange;
+}
+
+
+PBYTE CopyText( EDITORTEXT text )
+{
+    PBYTE pch;
+
+    pch = (PBYTE) malloc( TextLength( text ) + 1 );
+    if ( pch ) TextSequence( text, pch, 0, TextLength( text ));
+    return pch;
+}
+
+
+void Report( PSZ pszName, ULONG ulCount, clock_t ticks )
+{
+    double dSecs = (double) ticks / CLOCKS_PER_SEC;
+
+    printf("%-10s %8u in %6.3f s", pszName, ulCount, dSecs );
+    if ( ulCount ) printf(" = %6.3f us each", ( dSecs * 1000000.0 ) / ulCount );
+    printf("\n");
+}
+
+
+/* Replays the trace into a fresh buffer, then undoes and redoes it all.
+ */
+int ReplayTest( ULONG ulModel, ULONG ulKeys, ULONG cbLimit, PBYTE pchInitial )
+{
+    EDITORTEXT  text;
+    TEXTJOURNAL journal;
+    PBYTE       pchFinal,
+                pchCheck;
+    ULONG       cbFinal,
+                ulPos,
+                ulRun,
+                ulSteps,
+                i, j;
+    USHORT      usChar;
+    clock_t     start;
+
+    if ( !TextCreateModel( &text, ulModel )) return 0;
+    if ( !TextInitContents( text, pchInitial, INITIAL_SIZE )) return 0;
+    if ( !Journal_Create( &journal, cbLimit )) return 0;
+
+    printf("\nJournal limit %u bytes\n\n", cbLimit );
+
+    ulSeed = 1;
+    ulPos  = INITIAL_SIZE / 2;
+    start  = clock();
+    for ( i = 0; i < ulKeys; i += ulRun ) {
+        ulRun = 1 + Random( 20 );
+        if ( ulRun > ulKeys - i ) ulRun = ulKeys - i;
+        switch ( Random( 10 )) {
+            case 0:                             // jump somewhere else
+                Journal_Seal( journal );
+                ulPos = Random( TextLength( text ) / 2 ) * 2;
+                ulRun = 1;
+                break;
+
+            case 1:                             // backspace
+            case 2:
+                for ( j = 0; ( j < ulRun ) && ( ulPos >= 2 ); j++ ) {
+                    ulPos -= 2;
+                    Journal_Delete( journal, text, ulPos, 2 );
+                }
+                break;
+
+            case 3:                             // forward delete
+                for ( j = 0; ( j < ulRun ) && ( ulPos < TextLength( text )); j++ )
+                    Journal_Delete( journal, text, ulPos, 2 );
+                break;
+
+            default:                            // type a word
+                for ( j = 0; j < ulRun; j++ ) {
+                    if ( j == ulRun - 1 )
+                        usChar = Random( 8 ) ? ' ' : '\n';
+                    else
+                        usChar = 'a' + Random( 26 );
+                    Journal_Insert( journal, text, (PBYTE) &usChar, ulPos, 2 );
+                    ulPos += 2;
+                }
+                break;
+        }
+    }
+    Report("record", ulKeys, clock() - start );
+
+    pchFinal = CopyText( text );
+    cbFinal  = TextLength( text );
+    if ( !pchFinal ) return 0;
+
+    ulSteps = 0;
+    start   = clock();
+    while ( Journal_Undo( journal, text, NULL, NULL )) ulSteps++;
+    Report("undo", ulSteps, clock() - start );
+    if ( cbLimit == FULL_LIMIT ) {
+        pchCheck = CopyText( text );
+        if ( !pchCheck || ( TextLength( text ) != INITIAL_SIZE ) ||
+             memcmp( pchCheck, pchInitial, INITIAL_SIZE ))
+            printf("*** Undo did not restore the original text\n");
+        free( pchCheck );
+    }
+
+    start = clock();
+    for ( i = 0; i < ulSteps; i++ ) Journal_Redo( journal, text, NULL, NULL );
+    Report("redo", ulSteps, clock() - start );
+    pchCheck = CopyText( text );
+    if ( !pchCheck || ( TextLength( text ) != cbFinal ) ||
+         memcmp( pchCheck, pchFinal, cbFinal ))
+        printf("*** Redo did not restore the final text\n");
+    free( pchCheck );
+
+    free( pchFinal );
+    Journal_Free( &journal );
+    TextFree( &text );
+    return 1;
+}
+
+
+int main( int argc, char *argv[] )
+{
+    PBYTE pchInitial;
+    ULONG ulModel,
+          ulKeys,
+          i;
+
+    ulModel = ( argc > 1 ) ? atoi( argv[1] ) : TEXT_MODEL_GAPBUFFER;
+    ulKeys  = ( argc > 2 ) ? atoi( argv[2] ) : 100000;
+
+    pchInitial = (PBYTE) malloc( INITIAL_SIZE );
+    if ( !pchInitial ) return 1;
+    for ( i = 0; i < INITIAL_SIZE; i += 2 ) {
+        pchInitial[ i ]     = ( i % 160 == 158 ) ? '\n' : 'a' + (( i / 2 ) % 26 );
+        pchInitial[ i + 1 ] = 0;
+    }
+
+    printf("Replaying %u keystrokes with text model %u\n", ulKeys, ulModel );
+    if ( !ReplayTest( ulModel, ulKeys, FULL_LIMIT, pchInitial )) return 1;
+    if ( !ReplayTest( ulModel, ulKeys, JOURNAL_DEFAULT_LIMIT, pchInitial )) return 1;
+
+    free( pchInitial );
+    return 0;
+}
@@ -0,0 +1,194 @@
+#include <os2.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "textseq.h"
+
+/* UTF-8 model benchmark.
+ *
+ * Builds a buffer of UCS-2 text of the given size (default 20 MB), made up
+ * of random words and lines which are mostly ASCII, with one word in twenty
+ * in Greek or CJK.  This is loaded into a gap buffer and into the UTF-8
+ * model, and the memory needed to hold it as UTF-8 is reported.
+ *
+ * Each text object is then put through the same operations: reading the
+ * whole text with an iterator, typing in bursts at random places (reading
+ * back the characters around the cursor after every keystroke, as redrawing
+ * the line would), and reading single characters at random positions.  The
+ * two texts should be identical at the end.
+ *
+ * Usage: utf8bench [megabytes] [bursts]
+ */
+
+#define BURST_LENGTH    50
+#define CONTEXT_CHARS   80
+#define RANDOM_READS    100000
+
+typedef unsigned short UCS2;
+
+
+/* Simple linear congruential generator, so the text is the same on every
+ * platform.
+ */
+ULONG ulSeed = 1;
+
+ULONG Random( ULONG ulRange )
+{
+    ulSeed = ulSeed * 1103515245 + 12345;
+    return (( ulSeed >> 16 ) & 0x7FFF ) % ulRange;
+}
+
+
+void Report( PSZ pszName, ULONG ulCount, clock_t ticks )
+{
+    double dSecs = (double) ticks / CLOCKS_PER_SEC;
+
+    if ( dSecs <= 0 ) dSecs = 1.0 / CLOCKS_PER_SEC;
+    printf("%-14s %8u in %6.3f s = %10.0f per second\n",
+           pszName, ulCount, dSecs, ulCount / dSecs );
+}
+
+
+/* Returns the number of bytes needed to hold the text as UTF-8.
+ */
+ULONG Utf8Size( UCS2 *pusText, ULONG ulChars )
+{
+    ULONG cb,
+          i;
+
+    for ( cb = 0, i = 0; i < ulChars; i++ )
+        cb += ( pusText[ i ] < 0x80 ) ? 1 : ( pusText[ i ] < 0x800 ) ? 2 : 3;
+    return cb;
+}
+
+
+int ModelTest( PSZ pszName, EDITORTEXT text, ULONG ulBursts )
+{
+    TEXTITER iter;
+    UCS2     ausContext[ CONTEXT_CHARS ];
+    wchar_t  wc;
+    ULONG    ulChars,
+             ulPos,
+             ulCount,
+             ulSum,
+             i, j;
+    clock_t  start;
+
+    printf("\n%s\n\n", pszName );
+
+    // Read the whole text in order
+    ulSum   = 0;
+    ulCount = 0;
+    start   = clock();
+    TextIterInit( &iter, text, 0 );
+    while ( TextIterNext( &iter, &wc )) {
+        ulSum += wc;
+        ulCount++;
+    }
+    Report("iterated", ulCount, clock() - start );
+
+    // Type in bursts, looking at the text around the cursor each time
+    ulSeed  = 2;
+    ulCount = 0;
+    start   = clock();
+    for ( i = 0; i < ulBursts; i++ ) {
+        ulChars = TextLength( text ) / sizeof( UCS2 );
+        ulPos   = ( Random( 0x8000 ) * ( ulChars / 0x8000 + 1 )) % ( ulChars + 1 );
+        for ( j = 0; j < BURST_LENGTH; j++ ) {
+            UCS2 us = ( j % 6 ) ? 'a' + Random( 26 ) : ' ';
+            TextInsert( text, (PBYTE) &us, ulPos * sizeof( UCS2 ), sizeof( UCS2 ));
+            ulPos++;
+            TextSequence( text, (PBYTE) ausContext,
+                          ( ulPos > CONTEXT_CHARS/2 ) ? ( ulPos - CONTEXT_CHARS/2 ) * sizeof( UCS2 ) : 0,
+                          sizeof( ausContext ));
+            ulCount++;
+        }
+    }
+    Report("keystrokes", ulCount, clock() - start );
+
+    // Read single characters at random
+    start   = clock();
+    ulChars = TextLength( text ) / sizeof( UCS2 );
+    for ( i = 0; i < RANDOM_READS; i++ ) {
+        ulPos  = ( Random( 0x8000 ) * ( ulChars / 0x8000 + 1 )) % ulChars;
+        ulSum += TextWCharAt( text, ulPos );
+    }
+    Report("random reads", RANDOM_READS, clock() - start );
+
+    return (int) ( ulSum & 1 );
+}
+
+
+int main( int argc, char *argv[] )
+{
+    static const UCS2 ausGreek[] = { 0x3B1, 0x3B2, 0x3B3, 0x3B4, 0x3B5, 0x3B6 };
+    static const UCS2 ausCJK[]   = { 0x4E00, 0x4E8C, 0x4E09, 0x56DB, 0x4E94, 0x516D };
+
+    EDITORTEXT gap,
+               utf8;
+    UCS2       *pusText,
+               *pusGap,
+               *pusUtf8;
+    ULONG      cbText,
+               ulChars,
+               ulBursts,
+               cbUtf8,
+               i, j, k;
+    int        rc;
+
+    cbText   = (( argc > 1 ) ? atoi( argv[1] ) : 20 ) * 1048576;
+    ulBursts = ( argc > 2 ) ? atoi( argv[2] ) : 2000;
+    ulChars  = cbText / sizeof( UCS2 );
+
+    pusText = (UCS2 *) malloc( cbText );
+    if ( !pusText ) return 1;
+    for ( i = 0; i < ulChars; ) {
+        k = Random( 20 );
+        for ( j = 1 + Random( 10 ); j && ( i < ulChars ); j-- )
+            pusText[ i++ ] = ( k == 0 ) ? ausGreek[ Random( 6 )] :
+                             ( k == 1 ) ? ausCJK[ Random( 6 )] :
+                                          'a' + Random( 26 );
+        if ( i < ulChars ) pusText[ i++ ] = Random( 12 ) ? ' ' : '\n';
+    }
+
+    if ( !TextCreateModel( &gap, TEXT_MODEL_GAPBUFFER ) ||
+         !TextCreateModel( &utf8, TEXT_MODEL_UTF8 ))
+        return 1;
+    if ( !TextInitContents( gap, (PBYTE) pusText, cbText ) ||
+         !TextInitContents( utf8, (PBYTE) pusText, cbText ))
+        return 1;
+
+    cbUtf8 = Utf8Size( pusText, ulChars );
+    printf("%u bytes of UCS-2 text take %u bytes as UTF-8 (%.1f%%)\n",
+           cbText, cbUtf8, 100.0 * cbUtf8 / cbText );
+    free( pusText );
+
+    ModelTest("Gap buffer", gap, ulBursts );
+    ModelTest("UTF-8", utf8, ulBursts );
+
+    // Both should have been edited in exactly the same way
+    rc = 0;
+    cbText = TextLength( gap );
+    if ( TextLength( utf8 ) != cbText ) {
+        printf("*** UTF-8 text is %u bytes, expected %u\n", TextLength( utf8 ), cbText );
+        rc = 1;
+    }
+    else {
+        pusGap  = (UCS2 *) malloc( cbText );
+        pusUtf8 = (UCS2 *) malloc( cbText );
+        if ( !pusGap || !pusUtf8 ) return 1;
+        TextSequence( gap, (PBYTE) pusGap, 0, cbText );
+        TextSequence( utf8, (PBYTE) pusUtf8, 0, cbText );
+        if ( memcmp( pusGap, pusUtf8, cbText )) {
+            printf("*** UTF-8 text differs from the gap buffer\n");
+            rc = 1;
+        }
+        free( pusGap );
+        free( pusUtf8 );
+    }
+
+    TextFree( &gap );
+    TextFree( &utf8 );
+    return rc;
+}
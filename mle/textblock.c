@@ -0,0 +1,908 @@
+/*****************************************************************************
+ * textblock.c                                                               *
+ *                                                                           *
+ * Implements the block text model, which is meant for very large documents  *
+ * of which only a small part is being looked at or edited at any one time.  *
+ * The text is divided into blocks of about BLOCK_SIZE bytes, and only the   *
+ * most recently used of them (the 'hot set') are kept as plain text; the    *
+ * rest are compressed, and only decompressed again when they are accessed.  *
+ * The blocks around the viewport and the insertion point thus stay hot,     *
+ * while the bulk of the document takes a fraction of its usual memory.      *
+ *                                                                           *
+ * The memory which the hot blocks may occupy is set by TextSetCacheLimit()  *
+ * (as for the paged model), and takes effect from the next access.  At      *
+ * least BLOCK_MINIMUM_HOT blocks are always kept hot, whatever the limit.   *
+ *                                                                           *
+ * Blocks are compressed with a simple LZ77 codec (in the style of LZ4),     *
+ * which favours speed over ratio: a block is compressed or decompressed in  *
+ * well under a millisecond, and UCS-2 text typically shrinks to between a   *
+ * quarter and a third of its size.  A block which does not compress is      *
+ * stored as it is.  TextQueryStats() reports the memory held by the cold    *
+ * blocks, and the length of the text they hold.                             *
+ *                                                                           *
+ * Text is read and edited in place in the hot blocks.  A block may grow up  *
+ * to BLOCK_MAX_SIZE by insertion before it is split; blocks emptied by      *
+ * deletion are removed.  Block boundaries only ever move by whole edits, so *
+ * (as with the other models) they fall on element boundaries as long as     *
+ * every edit does.                                                          *
+ *                                                                           *
+ * TextGetSpans() returns (part of) a single block at a time; since reading  *
+ * another block may compress this one, its pointers (like those of the      *
+ * paged model) only remain valid until the next call on the text object.    *
+ *                                                                           *
+ * The functions in this file are not called directly by applications; they  *
+ * are reached through the public Text*() functions in textseq.c.            *
+ *                                                                           *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <stddef.h>
+
+#include "debug.h"
+#include "textseq.h"
+#include "textimpl.h"
+
+
+// ---------------------------------------------------------------------------
+// CONSTANTS
+//
+#define BLOCK_SIZE          0x10000     // size of the blocks the text is divided into
+#define BLOCK_MAX_SIZE      0x20000     // largest a block may grow (size of a hot buffer)
+#define BLOCK_MINIMUM_HOT   2           // fewest blocks kept hot
+#define BLOCK_INITIAL_COUNT 16          // initial room for block descriptors
+
+#define LZ_HASH_BITS        12          // size of the match-finder's hash table
+#define LZ_HASH_SIZE        ( 1 << LZ_HASH_BITS )
+#define LZ_MIN_MATCH        4           // shortest match worth encoding
+#define LZ_MAX_OFFSET       0xFFFF      // furthest back a match may be
+#define LZ_NONE             0xFFFFFFFF  // empty hash table entry
+
+
+// ---------------------------------------------------------------------------
+// TYPEDEFS
+//
+
+// One block of the text.  Exactly one of pchText (when the block is hot) and
+// pchPacked (when it is cold) is set.
+//
+typedef struct _text_block {
+    unsigned long  ulStart;         // Position of the block within the text
+    unsigned long  cbText;          // Length of the text in the block
+    unsigned char *pchText;         // The text (BLOCK_MAX_SIZE buffer), if hot
+    unsigned char *pchPacked;       // The compressed text, if cold
+    unsigned long  cbPacked;        // Length of the compressed text (cbText = stored as is)
+    unsigned long  ulStamp;         // When the block was last used
+} TEXTBLOCK, *PTEXTBLOCK;
+
+
+// The internal implementation (block) of the text data structure.
+//
+typedef struct _block_text {
+    TEXTHDR        hdr;             // Common model header
+    PTEXTBLOCK     pBlocks;         // The blocks, in order
+    unsigned long  ulBlocks,        // Number of blocks
+                   ulMaxBlocks;     // Room in pBlocks
+    unsigned long  cbText;          // Total length of the text
+    unsigned long  ulHot;           // Number of hot blocks
+    unsigned long  cbPacked,        // Memory held by the cold blocks
+                   cbPackedText;    // Length of the text they hold
+    unsigned long  ulStamp;         // Block usage counter
+    unsigned long  ulLast;          // Block most recently located
+    unsigned char *pchScratch;      // Work area for compression
+    unsigned long *pulHash;         // Hash table for compression
+} BLOCKTEXT, *PBLOCKTEXT;
+
+
+
+// ---------------------------------------------------------------------------
+// MACROS
+//
+
+// Read four bytes as a number (for hashing), in any byte order
+#define LZ_READ32( pch )    ((unsigned long)( pch )[ 0 ] | ((unsigned long)( pch )[ 1 ] << 8 ) | \
+                             ((unsigned long)( pch )[ 2 ] << 16 ) | ((unsigned long)( pch )[ 3 ] << 24 ))
+
+// Hash four bytes (Knuth's multiplicative method)
+#define LZ_HASH( ul )       (((( ul ) * 2654435761UL ) & 0xFFFFFFFF ) >> ( 32 - LZ_HASH_BITS ))
+
+
+// ---------------------------------------------------------------------------
+// FUNCTION DECLARATIONS
+//
+
+// Internal
+unsigned long Block_Compress( PBLOCKTEXT pText, const unsigned char *pchIn, unsigned long cbIn, unsigned char *pchOut, unsigned long cbMax );
+unsigned long Block_Decompress( const unsigned char *pchIn, unsigned long cbIn, unsigned char *pchOut, unsigned long cbMax );
+int           Block_Expand( PBLOCKTEXT pText, PTEXTBLOCK pBlock );
+unsigned long Block_Locate( PBLOCKTEXT pText, unsigned long ulPosition );
+int           Block_MakeRoom( PBLOCKTEXT pText, unsigned long ulIndex, unsigned long ulCount );
+int           Block_Pack( PBLOCKTEXT pText, PTEXTBLOCK pBlock );
+unsigned long Block_PutLength( unsigned char *pch, unsigned long ulLength );
+void          Block_Remove( PBLOCKTEXT pText, unsigned long ulIndex, unsigned long ulCount );
+void          Block_Renumber( PBLOCKTEXT pText, unsigned long ulIndex );
+int           Block_Store( PBLOCKTEXT pText, PTEXTBLOCK pBlock, const unsigned char *pchText );
+void          Block_Trim( PBLOCKTEXT pText, unsigned long ulKeep );
+unsigned char *Block_Use( PBLOCKTEXT pText, unsigned long ulIndex );
+
+// Model implementation
+unsigned char Block_ByteAt( PBLOCKTEXT pText, unsigned long ulPosition );
+int           Block_Clear( PBLOCKTEXT pText );
+int           Block_Delete( PBLOCKTEXT pText, unsigned long ulPosition, unsigned long ulLength );
+int           Block_Destroy( PBLOCKTEXT pText );
+int           Block_Init( PBLOCKTEXT pText, unsigned char *pchText, unsigned long cbText );
+int           Block_Insert( PBLOCKTEXT pText, unsigned char *pch, unsigned long ulPosition, unsigned long ulLength );
+unsigned long Block_Length( PBLOCKTEXT pText );
+unsigned long Block_Sequence( PBLOCKTEXT pText, unsigned char *pchText, unsigned long ulPosition, unsigned long ulLength );
+int           Block_GetSpans( PBLOCKTEXT pText, unsigned long ulPosition, unsigned long ulLength, PTEXTSPAN pSpan1, PTEXTSPAN pSpan2 );
+int           Block_QueryStats( PBLOCKTEXT pText, PTEXTSTATS pStats );
+
+
+// ---------------------------------------------------------------------------
+// MODEL TABLE
+//
+
+const TEXTMODEL BlockModel = {
+    sizeof( BLOCKTEXT ),
+    (PFNTEXTBYTEAT)     Block_ByteAt,
+    (PFNTEXTCLEAR)      Block_Clear,
+    (PFNTEXTDELETE)     Block_Delete,
+    (PFNTEXTDESTROY)    Block_Destroy,
+    (PFNTEXTINIT)       Block_Init,
+    (PFNTEXTINSERT)     Block_Insert,
+    (PFNTEXTLENGTH)     Block_Length,
+    (PFNTEXTSEQUENCE)   Block_Sequence,
+    NULL,
+    NULL,
+    (PFNTEXTGETSPANS)   Block_GetSpans,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    (PFNTEXTQUERYSTATS) Block_QueryStats,
+    NULL,
+    NULL,
+    NULL
+};
+
+
+
+// ===========================================================================
+// INTERNAL FUNCTIONS
+// ===========================================================================
+
+
+/* ------------------------------------------------------------------------- *
+ * Block_Compress()                                                          *
+ *                                                                           *
+ * Compresses cbIn bytes into pchOut, as a series of sequences each made up  *
+ * of a run of literal bytes and a match (a copy of earlier output):         *
+ *                                                                           *
+ *   token         high 4 bits: literal count; low 4 bits: match length - 4  *
+ *                 (15 in either means the count continues in extra bytes,   *
+ *                 each of which is added to it, up to the first below 255)  *
+ *   literals      the literal bytes                                         *
+ *   offset        how far back the match starts (2 bytes, low byte first)   *
+ *   match length  any extra bytes for the match length                      *
+ *                                                                           *
+ * The last sequence has only literals (possibly none).  Matches are found   *
+ * through a hash table of four-byte sequences, with no chaining.  Returns   *
+ * the compressed length, or 0 if it would exceed cbMax.                     *
+ * ------------------------------------------------------------------------- */
+unsigned long Block_Compress( PBLOCKTEXT pText, const unsigned char *pchIn, unsigned long cbIn, unsigned char *pchOut, unsigned long cbMax )
+{
+    unsigned long *pulHash = pText->pulHash;
+    unsigned long ulIn,             // Current input position
+                  ulLiteral,        // Start of the pending literals
+                  ulOut,            // Current output position
+                  ulHash,
+                  ulMatch,          // Start of the match found
+                  cbLiteral,
+                  cbMatch;
+
+    for ( ulHash = 0; ulHash < LZ_HASH_SIZE; ulHash++ ) pulHash[ ulHash ] = LZ_NONE;
+
+    ulIn      = 0;
+    ulLiteral = 0;
+    ulOut     = 0;
+    while (( ulIn + LZ_MIN_MATCH ) <= cbIn ) {
+        ulHash  = LZ_HASH( LZ_READ32( pchIn + ulIn ));
+        ulMatch = pulHash[ ulHash ];
+        pulHash[ ulHash ] = ulIn;
+        if (( ulMatch == LZ_NONE ) || (( ulIn - ulMatch ) > LZ_MAX_OFFSET ) ||
+            memcmp( pchIn + ulMatch, pchIn + ulIn, LZ_MIN_MATCH ))
+        {
+            ulIn++;
+            continue;
+        }
+        cbMatch = LZ_MIN_MATCH;
+        while ((( ulIn + cbMatch ) < cbIn ) && ( pchIn[ ulMatch + cbMatch ] == pchIn[ ulIn + cbMatch ]))
+            cbMatch++;
+
+        // Write the sequence (checking for the longest it could possibly be)
+        cbLiteral = ulIn - ulLiteral;
+        if (( ulOut + cbLiteral + ( cbLiteral / 255 ) + ( cbMatch / 255 ) + 6 ) > cbMax )
+            return 0;
+        pchOut[ ulOut++ ] = (unsigned char)((( cbLiteral < 15 ? cbLiteral : 15 ) << 4 ) |
+                                            (( cbMatch - LZ_MIN_MATCH ) < 15 ? ( cbMatch - LZ_MIN_MATCH ) : 15 ));
+        if ( cbLiteral >= 15 ) ulOut += Block_PutLength( pchOut + ulOut, cbLiteral - 15 );
+        memcpy( pchOut + ulOut, pchIn + ulLiteral, cbLiteral );
+        ulOut += cbLiteral;
+        pchOut[ ulOut++ ] = (unsigned char)(( ulIn - ulMatch ) & 0xFF );
+        pchOut[ ulOut++ ] = (unsigned char)(( ulIn - ulMatch ) >> 8 );
+        if (( cbMatch - LZ_MIN_MATCH ) >= 15 )
+            ulOut += Block_PutLength( pchOut + ulOut, cbMatch - LZ_MIN_MATCH - 15 );
+
+        ulIn     += cbMatch;
+        ulLiteral = ulIn;
+    }
+
+    // Finish with the remaining literals
+    cbLiteral = cbIn - ulLiteral;
+    if (( ulOut + cbLiteral + ( cbLiteral / 255 ) + 2 ) > cbMax )
+        return 0;
+    pchOut[ ulOut++ ] = (unsigned char)(( cbLiteral < 15 ? cbLiteral : 15 ) << 4 );
+    if ( cbLiteral >= 15 ) ulOut += Block_PutLength( pchOut + ulOut, cbLiteral - 15 );
+    memcpy( pchOut + ulOut, pchIn + ulLiteral, cbLiteral );
+    return ulOut + cbLiteral;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Block_Decompress()                                                        *
+ *                                                                           *
+ * Decompresses the output of Block_Compress() into pchOut.  Returns the     *
+ * decompressed length, or 0 if the data is invalid or would exceed cbMax.   *
+ * ------------------------------------------------------------------------- */
+unsigned long Block_Decompress( const unsigned char *pchIn, unsigned long cbIn, unsigned char *pchOut, unsigned long cbMax )
+{
+    unsigned long ulIn,
+                  ulOut,
+                  ulOffset,
+                  cbLiteral,
+                  cbMatch,
+                  i;
+    unsigned char bToken,
+                  b;
+
+    ulIn  = 0;
+    ulOut = 0;
+    while ( ulIn < cbIn ) {
+        bToken    = pchIn[ ulIn++ ];
+        cbLiteral = bToken >> 4;
+        if ( cbLiteral == 15 ) {
+            do {
+                if ( ulIn >= cbIn ) return 0;
+                b = pchIn[ ulIn++ ];
+                cbLiteral += b;
+            } while ( b == 255 );
+        }
+        if (( cbLiteral > ( cbIn - ulIn )) || ( cbLiteral > ( cbMax - ulOut ))) return 0;
+        memcpy( pchOut + ulOut, pchIn + ulIn, cbLiteral );
+        ulIn  += cbLiteral;
+        ulOut += cbLiteral;
+        if ( ulIn >= cbIn ) break;
+
+        if (( ulIn + 2 ) > cbIn ) return 0;
+        ulOffset = pchIn[ ulIn ] | ( pchIn[ ulIn + 1 ] << 8 );
+        ulIn += 2;
+        cbMatch = ( bToken & 0xF ) + LZ_MIN_MATCH;
+        if (( bToken & 0xF ) == 15 ) {
+            do {
+                if ( ulIn >= cbIn ) return 0;
+                b = pchIn[ ulIn++ ];
+                cbMatch += b;
+            } while ( b == 255 );
+        }
+        if ( !ulOffset || ( ulOffset > ulOut ) || ( cbMatch > ( cbMax - ulOut ))) return 0;
+
+        // The match may overlap the bytes it produces, so copy it forwards
+        if ( ulOffset >= cbMatch )
+            memcpy( pchOut + ulOut, pchOut + ulOut - ulOffset, cbMatch );
+        else for ( i = 0; i < cbMatch; i++ )
+            pchOut[ ulOut + i ] = pchOut[ ulOut - ulOffset + i ];
+        ulOut += cbMatch;
+    }
+    return ulOut;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Block_Expand()                                                            *
+ *                                                                           *
+ * Makes a cold block hot, by decompressing it into a new buffer.            *
+ * ------------------------------------------------------------------------- */
+int Block_Expand( PBLOCKTEXT pText, PTEXTBLOCK pBlock )
+{
+    unsigned char *pch;
+
+    pch = (unsigned char *) allocate_memory( pText->hdr.pAllocator, BLOCK_MAX_SIZE );
+    if ( !pch ) return 0;
+    if ( pBlock->cbPacked == pBlock->cbText )
+        memcpy( pch, pBlock->pchPacked, pBlock->cbText );
+    else if ( Block_Decompress( pBlock->pchPacked, pBlock->cbPacked,
+                                pch, BLOCK_MAX_SIZE ) != pBlock->cbText )
+    {
+        free_memory( pText->hdr.pAllocator, pch );
+        return 0;
+    }
+
+    pText->cbPacked     -= pBlock->cbPacked;
+    pText->cbPackedText -= pBlock->cbText;
+    free_small( pText->hdr.pAllocator, pBlock->pchPacked );
+    pBlock->pchPacked = NULL;
+    pBlock->cbPacked  = 0;
+    pBlock->pchText   = pch;
+    pText->ulHot++;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Block_Locate()                                                            *
+ *                                                                           *
+ * Returns the index of the block holding the given position (or the last    *
+ * block, if the position is the end of the text).  The block last located   *
+ * and the one after it are tried first, since most accesses are near the    *
+ * previous one; otherwise the blocks are searched by position.              *
+ * ------------------------------------------------------------------------- */
+unsigned long Block_Locate( PBLOCKTEXT pText, unsigned long ulPosition )
+{
+    PTEXTBLOCK    pBlocks = pText->pBlocks;
+    unsigned long ulLow,
+                  ulHigh,
+                  ulMid,
+                  i;
+
+    if ( ulPosition >= pText->cbText ) return pText->ulBlocks ? pText->ulBlocks - 1 : 0;
+
+    for ( i = pText->ulLast; ( i < pText->ulBlocks ) && ( i <= pText->ulLast + 1 ); i++ ) {
+        if (( ulPosition >= pBlocks[ i ].ulStart ) &&
+            (( ulPosition - pBlocks[ i ].ulStart ) < pBlocks[ i ].cbText ))
+            return ( pText->ulLast = i );
+    }
+
+    ulLow  = 0;
+    ulHigh = pText->ulBlocks;
+    while (( ulHigh - ulLow ) > 1 ) {
+        ulMid = ( ulLow + ulHigh ) / 2;
+        if ( pBlocks[ ulMid ].ulStart <= ulPosition ) ulLow = ulMid;
+        else ulHigh = ulMid;
+    }
+    return ( pText->ulLast = ulLow );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Block_MakeRoom()                                                          *
+ *                                                                           *
+ * Inserts ulCount empty block descriptors at the given index.               *
+ * ------------------------------------------------------------------------- */
+int Block_MakeRoom( PBLOCKTEXT pText, unsigned long ulIndex, unsigned long ulCount )
+{
+    PTEXTBLOCK    pBlocks;
+    unsigned long ulMax;
+
+    if (( pText->ulBlocks + ulCount ) > pText->ulMaxBlocks ) {
+        ulMax = ( pText->ulBlocks + ulCount ) * 2;
+        if ( ulMax < BLOCK_INITIAL_COUNT ) ulMax = BLOCK_INITIAL_COUNT;
+        pBlocks = (PTEXTBLOCK) reallocate_memory( pText->hdr.pAllocator, pText->pBlocks,
+                                                  pText->ulMaxBlocks * sizeof( TEXTBLOCK ),
+                                                  ulMax * sizeof( TEXTBLOCK ));
+        if ( !pBlocks ) return 0;
+        pText->pBlocks     = pBlocks;
+        pText->ulMaxBlocks = ulMax;
+    }
+    memmove( pText->pBlocks + ulIndex + ulCount, pText->pBlocks + ulIndex,
+             ( pText->ulBlocks - ulIndex ) * sizeof( TEXTBLOCK ));
+    memset( pText->pBlocks + ulIndex, 0, ulCount * sizeof( TEXTBLOCK ));
+    pText->ulBlocks += ulCount;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Block_Pack()                                                              *
+ *                                                                           *
+ * Makes a hot block cold, by compressing it and freeing its buffer.         *
+ * ------------------------------------------------------------------------- */
+int Block_Pack( PBLOCKTEXT pText, PTEXTBLOCK pBlock )
+{
+    if ( ! Block_Store( pText, pBlock, pBlock->pchText )) return 0;
+    free_memory( pText->hdr.pAllocator, pBlock->pchText );
+    pBlock->pchText = NULL;
+    pText->ulHot--;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Block_PutLength()                                                         *
+ *                                                                           *
+ * Writes the extra bytes of a literal count or match length (the amount by  *
+ * which it exceeds 15), and returns the number written.                     *
+ * ------------------------------------------------------------------------- */
+unsigned long Block_PutLength( unsigned char *pch, unsigned long ulLength )
+{
+    unsigned long cb;
+
+    for ( cb = 0; ulLength >= 255; ulLength -= 255 ) pch[ cb++ ] = 255;
+    pch[ cb++ ] = (unsigned char) ulLength;
+    return cb;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Block_Remove()                                                            *
+ *                                                                           *
+ * Frees ulCount blocks, starting at the given index, and closes up the      *
+ * descriptors after them.  The positions of the later blocks are left for   *
+ * the caller to correct.                                                    *
+ * ------------------------------------------------------------------------- */
+void Block_Remove( PBLOCKTEXT pText, unsigned long ulIndex, unsigned long ulCount )
+{
+    PTEXTBLOCK    pBlock;
+    unsigned long i;
+
+    for ( i = ulIndex; i < ( ulIndex + ulCount ); i++ ) {
+        pBlock = pText->pBlocks + i;
+        if ( pBlock->pchText ) {
+            free_memory( pText->hdr.pAllocator, pBlock->pchText );
+            pText->ulHot--;
+        }
+        if ( pBlock->pchPacked ) {
+            free_small( pText->hdr.pAllocator, pBlock->pchPacked );
+            pText->cbPacked     -= pBlock->cbPacked;
+            pText->cbPackedText -= pBlock->cbText;
+        }
+    }
+    memmove( pText->pBlocks + ulIndex, pText->pBlocks + ulIndex + ulCount,
+             ( pText->ulBlocks - ulIndex - ulCount ) * sizeof( TEXTBLOCK ));
+    pText->ulBlocks -= ulCount;
+    if ( pText->ulLast >= pText->ulBlocks ) pText->ulLast = 0;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Block_Renumber()                                                          *
+ *                                                                           *
+ * Recalculates the positions of the blocks from the given index onwards.    *
+ * ------------------------------------------------------------------------- */
+void Block_Renumber( PBLOCKTEXT pText, unsigned long ulIndex )
+{
+    PTEXTBLOCK    pBlocks = pText->pBlocks;
+    unsigned long ulStart;
+
+    ulStart = ulIndex ? pBlocks[ ulIndex-1 ].ulStart + pBlocks[ ulIndex-1 ].cbText : 0;
+    for ( ; ulIndex < pText->ulBlocks; ulIndex++ ) {
+        pBlocks[ ulIndex ].ulStart = ulStart;
+        ulStart += pBlocks[ ulIndex ].cbText;
+    }
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Block_Store()                                                             *
+ *                                                                           *
+ * Compresses the given text (pBlock->cbText bytes) into a new allocation,   *
+ * as the block's cold contents; the block's hot buffer, if any, is left     *
+ * alone.  Compressed blocks are numerous and of all sizes, so they come     *
+ * from allocate_small() rather than from allocate_memory().                 *
+ * ------------------------------------------------------------------------- */
+int Block_Store( PBLOCKTEXT pText, PTEXTBLOCK pBlock, const unsigned char *pchText )
+{
+    unsigned char *pchPacked;
+    const unsigned char *pchFrom;
+    unsigned long cbPacked;
+
+    cbPacked = pBlock->cbText ?
+                 Block_Compress( pText, pchText, pBlock->cbText, pText->pchScratch, pBlock->cbText - 1 ) : 0;
+    if ( cbPacked ) pchFrom = pText->pchScratch;
+    else {
+        // Not worth compressing; store it as it is
+        pchFrom  = pchText;
+        cbPacked = pBlock->cbText;
+    }
+
+    pchPacked = (unsigned char *) allocate_small( pText->hdr.pAllocator, cbPacked ? cbPacked : 1 );
+    if ( !pchPacked ) return 0;
+    memcpy( pchPacked, pchFrom, cbPacked );
+
+    pBlock->pchPacked    = pchPacked;
+    pBlock->cbPacked     = cbPacked;
+    pText->cbPacked     += cbPacked;
+    pText->cbPackedText += pBlock->cbText;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Block_Trim()                                                              *
+ *                                                                           *
+ * Compresses the least recently used hot blocks (other than the one given)  *
+ * until the hot set fits within the memory limit.                           *
+ * ------------------------------------------------------------------------- */
+void Block_Trim( PBLOCKTEXT pText, unsigned long ulKeep )
+{
+    unsigned long ulOldest,
+                  i;
+
+    while (( pText->ulHot > BLOCK_MINIMUM_HOT ) &&
+           (( pText->ulHot * BLOCK_MAX_SIZE ) > pText->hdr.cbCacheLimit ))
+    {
+        ulOldest = pText->ulBlocks;
+        for ( i = 0; i < pText->ulBlocks; i++ ) {
+            if ( !pText->pBlocks[ i ].pchText || ( i == ulKeep )) continue;
+            if (( ulOldest == pText->ulBlocks ) ||
+                ( pText->pBlocks[ i ].ulStamp < pText->pBlocks[ ulOldest ].ulStamp ))
+                ulOldest = i;
+        }
+        if (( ulOldest == pText->ulBlocks ) ||
+            ! Block_Pack( pText, pText->pBlocks + ulOldest ))
+            break;
+    }
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Block_Use()                                                               *
+ *                                                                           *
+ * Makes the given block hot (compressing others if that exceeds the limit)  *
+ * and marks it as the most recently used.  Returns its text, or NULL if it  *
+ * could not be decompressed.                                                *
+ * ------------------------------------------------------------------------- */
+unsigned char *Block_Use( PBLOCKTEXT pText, unsigned long ulIndex )
+{
+    PTEXTBLOCK pBlock = pText->pBlocks + ulIndex;
+
+    pBlock->ulStamp = ++(pText->ulStamp);
+    if ( !pBlock->pchText ) {
+        if ( ! Block_Expand( pText, pBlock )) return NULL;
+        Block_Trim( pText, ulIndex );
+    }
+    return pBlock->pchText;
+}
+
+
+
+// ===========================================================================
+// MODEL IMPLEMENTATION
+// ===========================================================================
+
+
+/* ------------------------------------------------------------------------- *
+ * Block_ByteAt()                                                            *
+ * ------------------------------------------------------------------------- */
+unsigned char Block_ByteAt( PBLOCKTEXT pText, unsigned long ulPosition )
+{
+    unsigned long ulIndex;
+    unsigned char *pch;
+
+    if ( ulPosition >= pText->cbText ) return 0;
+    ulIndex = Block_Locate( pText, ulPosition );
+    pch = Block_Use( pText, ulIndex );
+    return pch ? pch[ ulPosition - pText->pBlocks[ ulIndex ].ulStart ] : 0;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Block_Clear()                                                             *
+ * ------------------------------------------------------------------------- */
+int Block_Clear( PBLOCKTEXT pText )
+{
+    if ( pText->ulBlocks ) Block_Remove( pText, 0, pText->ulBlocks );
+    pText->cbText = 0;
+    pText->ulLast = 0;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Block_Delete()                                                            *
+ *                                                                           *
+ * Deletes the text from each block in turn.  Blocks which are deleted in    *
+ * their entirety are simply freed, without being decompressed.              *
+ * ------------------------------------------------------------------------- */
+int Block_Delete( PBLOCKTEXT pText, unsigned long ulPosition, unsigned long ulLength )
+{
+    PTEXTBLOCK    pBlock;
+    unsigned char *pch;
+    unsigned long ulFirst,          // First block affected
+                  ulIndex,
+                  ulOffset,         // Position of the deletion within the block
+                  cbDone,
+                  cb;
+    int           rc;
+
+    if ( ulPosition > pText->cbText ) return 0;
+    if ( ulLength > ( pText->cbText - ulPosition )) ulLength = pText->cbText - ulPosition;
+    if ( !ulLength ) return 1;
+
+    ulFirst  = Block_Locate( pText, ulPosition );
+    ulIndex  = ulFirst;
+    ulOffset = ulPosition - pText->pBlocks[ ulIndex ].ulStart;
+    cbDone   = 0;
+    rc       = 1;
+    while (( cbDone < ulLength ) && ( ulIndex < pText->ulBlocks )) {
+        pBlock = pText->pBlocks + ulIndex;
+        cb = pBlock->cbText - ulOffset;
+        if ( cb > ( ulLength - cbDone )) cb = ulLength - cbDone;
+        if ( cb == pBlock->cbText )
+            Block_Remove( pText, ulIndex, 1 );
+        else {
+            if (( pch = Block_Use( pText, ulIndex )) == NULL ) {
+                rc = 0;
+                break;
+            }
+            memmove( pch + ulOffset, pch + ulOffset + cb, pBlock->cbText - ulOffset - cb );
+            pBlock->cbText -= cb;
+            ulIndex++;
+        }
+        cbDone  += cb;
+        ulOffset = 0;
+    }
+
+    pText->cbText -= cbDone;
+    Block_Renumber( pText, ulFirst );
+    return rc;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Block_Destroy()                                                           *
+ * ------------------------------------------------------------------------- */
+int Block_Destroy( PBLOCKTEXT pText )
+{
+    Block_Clear( pText );
+    if ( pText->pBlocks ) free_memory( pText->hdr.pAllocator, pText->pBlocks );
+    if ( pText->pchScratch ) free_memory( pText->hdr.pAllocator, pText->pchScratch );
+    if ( pText->pulHash ) free_memory( pText->hdr.pAllocator, pText->pulHash );
+    pText->pBlocks     = NULL;
+    pText->pchScratch  = NULL;
+    pText->pulHash     = NULL;
+    pText->ulMaxBlocks = 0;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Block_Init()                                                              *
+ *                                                                           *
+ * Divides the initial text into blocks.  The first of them are kept hot,    *
+ * as far as the memory limit allows, since the start of the document is     *
+ * what will be shown first; the rest are compressed straight from the       *
+ * given text.                                                               *
+ * ------------------------------------------------------------------------- */
+int Block_Init( PBLOCKTEXT pText, unsigned char *pchText, unsigned long cbText )
+{
+    PTEXTBLOCK    pBlock;
+    unsigned long ulCount,
+                  cb,
+                  i;
+
+    if ( !pText->pchScratch ) {
+        pText->pchScratch = (unsigned char *) allocate_memory( pText->hdr.pAllocator, BLOCK_MAX_SIZE );
+        pText->pulHash    = (unsigned long *) allocate_memory( pText->hdr.pAllocator, LZ_HASH_SIZE * sizeof( unsigned long ));
+        if ( !pText->pchScratch || !pText->pulHash ) {
+            Block_Destroy( pText );
+            return 0;
+        }
+    }
+    Block_Clear( pText );
+    if ( !pchText || !cbText ) return 1;
+
+    ulCount = ( cbText + BLOCK_SIZE - 1 ) / BLOCK_SIZE;
+    if ( ! Block_MakeRoom( pText, 0, ulCount )) return 0;
+    for ( i = 0; i < ulCount; i++ ) {
+        pBlock = pText->pBlocks + i;
+        cb = cbText - ( i * BLOCK_SIZE );
+        if ( cb > BLOCK_SIZE ) cb = BLOCK_SIZE;
+        pBlock->ulStart = i * BLOCK_SIZE;
+        pBlock->cbText  = cb;
+        pBlock->ulStamp = ++(pText->ulStamp);
+        if (( pText->ulHot < BLOCK_MINIMUM_HOT ) ||
+            ((( pText->ulHot + 1 ) * BLOCK_MAX_SIZE ) <= pText->hdr.cbCacheLimit ))
+        {
+            pBlock->pchText = (unsigned char *) allocate_memory( pText->hdr.pAllocator, BLOCK_MAX_SIZE );
+            if ( pBlock->pchText ) {
+                memcpy( pBlock->pchText, pchText + pBlock->ulStart, cb );
+                pText->ulHot++;
+            }
+        }
+        if ( !pBlock->pchText && ! Block_Store( pText, pBlock, pchText + pBlock->ulStart )) {
+            // Drop this block and those not yet filled in
+            pText->ulBlocks = i;
+            Block_Clear( pText );
+            return 0;
+        }
+    }
+    pText->cbText = cbText;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Block_Insert()                                                            *
+ *                                                                           *
+ * Inserts the text into the block which holds the position (or the one      *
+ * which ends there, so that typing at the end of a block extends it).  If   *
+ * the block would grow beyond BLOCK_MAX_SIZE, its text from the insertion   *
+ * point onwards is set aside, and the new text followed by that is poured   *
+ * into the block and into as many new blocks as it takes, filling each to   *
+ * BLOCK_SIZE.  The new blocks are all allocated first, so that the text is  *
+ * left unchanged if memory runs out.                                        *
+ * ------------------------------------------------------------------------- */
+int Block_Insert( PBLOCKTEXT pText, unsigned char *pch, unsigned long ulPosition, unsigned long ulLength )
+{
+    PTEXTBLOCK    pBlock;
+    unsigned char *pchBlock,
+                  *pchTail,
+                  *pchFrom;
+    unsigned long ulIndex,
+                  ulOffset,         // Position of the insertion within the block
+                  cbTail,           // Length of the block's text after that
+                  cbFirst,          // Length of the text kept in the block
+                  ulNew,            // Number of blocks to add
+                  cbFrom,
+                  cb,
+                  i;
+
+    if ( !pText->pchScratch || ( ulPosition > pText->cbText )) return 0;
+    if ( !ulLength ) return 1;
+
+    if ( !pText->ulBlocks ) {
+        if ( ! Block_MakeRoom( pText, 0, 1 )) return 0;
+        pText->pBlocks[ 0 ].pchText = (unsigned char *) allocate_memory( pText->hdr.pAllocator, BLOCK_MAX_SIZE );
+        if ( !pText->pBlocks[ 0 ].pchText ) {
+            pText->ulBlocks = 0;
+            return 0;
+        }
+        pText->ulHot++;
+    }
+    ulIndex = Block_Locate( pText, ulPosition );
+    if ( ulIndex && ( ulPosition == pText->pBlocks[ ulIndex ].ulStart ) &&
+         (( pText->pBlocks[ ulIndex-1 ].cbText + ulLength ) <= BLOCK_MAX_SIZE ))
+        ulIndex--;
+    if (( pchBlock = Block_Use( pText, ulIndex )) == NULL ) return 0;
+    pBlock   = pText->pBlocks + ulIndex;
+    ulOffset = ulPosition - pBlock->ulStart;
+    cbTail   = pBlock->cbText - ulOffset;
+
+    // The simple case: the text fits in the block
+    if (( pBlock->cbText + ulLength ) <= BLOCK_MAX_SIZE ) {
+        memmove( pchBlock + ulOffset + ulLength, pchBlock + ulOffset, cbTail );
+        memcpy( pchBlock + ulOffset, pch, ulLength );
+        pBlock->cbText += ulLength;
+        pText->cbText  += ulLength;
+        Block_Renumber( pText, ulIndex + 1 );
+        return 1;
+    }
+
+    // Otherwise, allocate the new blocks and set the tail aside
+    cbFirst = ( ulOffset > BLOCK_SIZE ) ? ulOffset : BLOCK_SIZE;
+    ulNew   = ( pBlock->cbText + ulLength - cbFirst + BLOCK_SIZE - 1 ) / BLOCK_SIZE;
+    pchTail = (unsigned char *) allocate_memory( pText->hdr.pAllocator, cbTail ? cbTail : 1 );
+    if ( !pchTail || ! Block_MakeRoom( pText, ulIndex + 1, ulNew )) {
+        if ( pchTail ) free_memory( pText->hdr.pAllocator, pchTail );
+        return 0;
+    }
+    for ( i = 1; i <= ulNew; i++ ) {
+        pText->pBlocks[ ulIndex + i ].pchText = (unsigned char *) allocate_memory( pText->hdr.pAllocator, BLOCK_MAX_SIZE );
+        if ( !pText->pBlocks[ ulIndex + i ].pchText ) {
+            while ( --i ) {
+                free_memory( pText->hdr.pAllocator, pText->pBlocks[ ulIndex + i ].pchText );
+                pText->ulHot--;
+            }
+            memmove( pText->pBlocks + ulIndex + 1, pText->pBlocks + ulIndex + 1 + ulNew,
+                     ( pText->ulBlocks - ulIndex - 1 - ulNew ) * sizeof( TEXTBLOCK ));
+            pText->ulBlocks -= ulNew;
+            free_memory( pText->hdr.pAllocator, pchTail );
+            return 0;
+        }
+        pText->pBlocks[ ulIndex + i ].ulStamp = ++(pText->ulStamp);
+        pText->ulHot++;
+    }
+    pBlock = pText->pBlocks + ulIndex;
+    memcpy( pchTail, pchBlock + ulOffset, cbTail );
+    pBlock->cbText = ulOffset;
+
+    // Pour the new text, then the tail, into the blocks
+    for ( i = 0; i < 2; i++ ) {
+        pchFrom = i ? pchTail : pch;
+        cbFrom  = i ? cbTail : ulLength;
+        while ( cbFrom ) {
+            if ( pBlock->cbText >= BLOCK_SIZE ) pBlock++;
+            cb = BLOCK_SIZE - pBlock->cbText;
+            if ( cb > cbFrom ) cb = cbFrom;
+            memcpy( pBlock->pchText + pBlock->cbText, pchFrom, cb );
+            pBlock->cbText += cb;
+            pchFrom += cb;
+            cbFrom  -= cb;
+        }
+    }
+    free_memory( pText->hdr.pAllocator, pchTail );
+
+    pText->cbText += ulLength;
+    Block_Renumber( pText, ulIndex + 1 );
+    Block_Trim( pText, pBlock - pText->pBlocks );
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Block_Length()                                                            *
+ * ------------------------------------------------------------------------- */
+unsigned long Block_Length( PBLOCKTEXT pText )
+{
+    return pText->cbText;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Block_Sequence()                                                          *
+ * ------------------------------------------------------------------------- */
+unsigned long Block_Sequence( PBLOCKTEXT pText, unsigned char *pchText, unsigned long ulPosition, unsigned long ulLength )
+{
+    PTEXTBLOCK    pBlock;
+    unsigned char *pch;
+    unsigned long ulIndex,
+                  ulOffset,
+                  cbDone,
+                  cb;
+
+    if ( ulPosition >= pText->cbText ) return 0;
+    if ( ulLength > ( pText->cbText - ulPosition )) ulLength = pText->cbText - ulPosition;
+
+    ulIndex  = Block_Locate( pText, ulPosition );
+    ulOffset = ulPosition - pText->pBlocks[ ulIndex ].ulStart;
+    for ( cbDone = 0; ( cbDone < ulLength ) && ( ulIndex < pText->ulBlocks ); ulIndex++ ) {
+        if (( pch = Block_Use( pText, ulIndex )) == NULL ) break;
+        pBlock = pText->pBlocks + ulIndex;
+        cb = pBlock->cbText - ulOffset;
+        if ( cb > ( ulLength - cbDone )) cb = ulLength - cbDone;
+        memcpy( pchText + cbDone, pch + ulOffset, cb );
+        cbDone  += cb;
+        ulOffset = 0;
+    }
+    return cbDone;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Block_GetSpans()                                                          *
+ *                                                                           *
+ * Returns a single span, within the block holding the position, which may   *
+ * be shorter than the range requested.                                      *
+ * ------------------------------------------------------------------------- */
+int Block_GetSpans( PBLOCKTEXT pText, unsigned long ulPosition, unsigned long ulLength, PTEXTSPAN pSpan1, PTEXTSPAN pSpan2 )
+{
+    unsigned long ulIndex,
+                  ulOffset;
+    unsigned char *pch;
+
+    if ( ulPosition >= pText->cbText ) return 0;
+    ulIndex = Block_Locate( pText, ulPosition );
+    if (( pch = Block_Use( pText, ulIndex )) == NULL ) return 0;
+
+    ulOffset    = ulPosition - pText->pBlocks[ ulIndex ].ulStart;
+    pSpan1->pch = pch + ulOffset;
+    pSpan1->cb  = pText->pBlocks[ ulIndex ].cbText - ulOffset;
+    if ( pSpan1->cb > ulLength ) pSpan1->cb = ulLength;
+
+    // The next block may only be used once this one is released
+    pSpan2->pch = NULL;
+    pSpan2->cb  = 0;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Block_QueryStats()                                                        *
+ * ------------------------------------------------------------------------- */
+int Block_QueryStats( PBLOCKTEXT pText, PTEXTSTATS pStats )
+{
+    pStats->cbCompressed   = pText->cbPacked;
+    pStats->cbUncompressed = pText->cbPackedText;
+    return 1;
+}
+
@@ -1,4 +1,5 @@
 #define INCL_DOSERRORS
+#define INCL_DOSFILEMGR
 #define INCL_DOSMISC
 #define INCL_DOSNLS
 #define INCL_GPI
@@ -12,9 +13,10 @@
 #include "byteparse.h"
 #include "gpitext.h"
 #include "gpiutil.h"
+#include "textseq.h"
+#include "textundo.h"
 #include "linebuf.h"
 #include "textctl.h"
-#include "textseq.h"
 
 #include "debug.h"
 
@@ -32,9 +34,29 @@
 #define CPSPEC_MAXZ             32      // ...of a ULS codepage specifier
 #define CPDESC_MAXZ             128     // ...of a codepage description in the GUI
 
+#define EXPORT_BUFFER_SIZE      0x10000 // convert exported text into pieces of at most this many bytes
+#define EXPORT_UNLIMITED        0xFFFFFFFF  // export size limit meaning 'no limit'
+
+#define IMPORT_CHUNK_LENGTH     0x8000  // convert imported text in pieces of this many bytes
+#define IMPORT_NULL_TERMINATED  0xFFFFFFFF  // import length meaning 'up to the null'
+
 #define LB_INITIAL_SIZE         128     // initial size of the line-offset buffer
 
 #define REFLOW_SEGMENT_LENGTH   1024    // split reflow into strings of this length
+#define REFLOW_BATCH_LENGTH     128     // add reflowed line breaks to the buffer this many at a time
+
+// Text model used for the editor contents (see textseq.h); may be overridden
+// at build time, e.g. /DUMLE_TEXT_MODEL=2 for very large documents, or
+// /DUMLE_TEXT_MODEL=4 to hold mostly-ASCII documents in half the memory, or
+// /DUMLE_TEXT_MODEL=5 to keep huge documents compressed except where in use.
+#ifndef UMLE_TEXT_MODEL
+#define UMLE_TEXT_MODEL         TEXT_MODEL_GAPBUFFER
+#endif
+
+// Memory budget for the undo/redo journal (see textundo.h)
+#ifndef UMLE_UNDO_LIMIT
+#define UMLE_UNDO_LIMIT         JOURNAL_DEFAULT_LIMIT
+#endif
 
 
 // ----------------------------------------------------------------------------
@@ -45,6 +67,12 @@
 #define RECTL_WIDTH( r )    ((ULONG)max(r.xRight - r.xLeft, 0))
 #define RECTL_HEIGHT( r )   ((ULONG)max(r.yTop - r.yBottom, 0))
 
+// Allocator from which the control gets its text and working storage
+#define UMLE_ALLOCATOR( p ) ((PTEXTALLOCATOR)( (p)->ctldata.pAllocator ))
+
+// Codepage of the text in the import/export buffer, according to the format
+#define IE_CODEPAGE( p )    ((USHORT)(( (p)->ctldata.afIEFormat == MLFIE_UCS ) ? 1200 : (p)->usConvCP ))
+
 
 // ----------------------------------------------------------------------------
 // TYPEDEFS
@@ -86,25 +114,51 @@ typedef struct _UMLE_Private_Data {
                 usDispCP;           // default display codepage (in codepage mode this may be overridden by text attributes)
     BYTE        dbcs[ 12 ];         // default DBCS information vector (byte-ranges)
     ULONG       ulTabSize,          // current horizontal tab width
-                ulLongest;          // line-buffer offset of the longest line in the text
+                ulLongest,          // line-buffer offset of the longest line in the text
+                ulBreakHint;        // line-buffer offset found by the last lookup (see LineBuffer_FindNear)
     LBOBUFFER   breaks;             // buffer of line-break byte offsets
     EDITORTEXT  text;               // text buffer
+    TEXTJOURNAL journal;            // undo/redo journal for the text buffer
+    PCH         pchIEBuffer;        // import/export transfer buffer (MLM_SETIMPORTEXPORT)
+    ULONG       cbIEBuffer;         // size of the import/export transfer buffer
 } UMLEPDATA, *PUMLEPDATA;
 
 
+// State of an export in progress (see ExportText)
+typedef struct _UMLE_Export_State {
+    UconvObject uconv;              // converter from UCS-2 to the target codepage
+    PCH         pchOut;             // conversion buffer (EXPORT_BUFFER_SIZE bytes)
+    ULONG       cbMax,              // maximum number of bytes to produce
+                cbOut,              // number of bytes produced so far
+                cbIn;               // number of bytes of UCS-2 text consumed so far
+    PFNTEXTSINK pfnSink;            // destination of the converted text
+    PVOID       pUser;              // data passed to pfnSink
+} UMEXPORT, *PUMEXPORT;
+
+
 // ----------------------------------------------------------------------------
 // PRIVATE FUNCTION PROTOTYPES
 
 ULONG            DrawEditorText( HWND hwnd, HPS hps, PPOINTL pptl, PUMLEPDATA pCtl );
 ULONG            DrawUnicodeTextSequence( HWND hwnd, HPS hps, PPOINTL pptl, PUMLEPDATA pCtl, ULONG ulStart, ULONG ulLength );
 ULONG            DrawCodepageTextSequence( HWND hwnd, HPS hps, PPOINTL pptl, PUMLEPDATA pCtl, ULONG ulStart, ULONG ulLength, ULONG ulCP );
+ULONG            EnumerateInsertedLines( HPS hps, PUMLEPDATA pPrivate, ULONG cbStart, ULONG cbLength, ULONG cbRemoved );
 ULONG            EnumerateLines( HPS hps, PUMLEPDATA pPrivate, ULONG cbStart );
+int              ExportSpans( PVOID pUser, PTEXTSPAN pSpans, ULONG ulSpans );
+ULONG            ExportText( HWND hwnd, PIPT pipt, PULONG pulChars, ULONG cbMax, USHORT usCP, PFNTEXTSINK pfnSink, PVOID pUser );
+int              ExportToBuffer( PVOID pUser, PTEXTSPAN pSpans, ULONG ulSpans );
+int              ExportToFile( PVOID pUser, PTEXTSPAN pSpans, ULONG ulSpans );
+ULONG            FindNextLine( PTEXTITER pIter );
 LONG             GetLineExtent( HPS hps, PUMLEPDATA pPrivate, ULONG cbStart, ULONG cbLength );
+ULONG            ImportText( HWND hwnd, PCH pchText, PULONG pcbText, PIPT pipt, USHORT usCP, USHORT fsAttr );
 ULONG            InsertText( HWND hwnd, PSZ pszText, USHORT usCP, USHORT fsAttr );
 ULONG            ReflowEditorText( HPS hps, PUMLEPDATA pPrivate, POINTL ptl, ULONG cbStart  );
-ULONG            ReflowUnicodeTextSequence( HPS hps, PPOINTL pptl, PUMLEPDATA pCtl, UniChar *psuText, ULONG cbOffset );
+ULONG            ReflowUnicodeTextSequence( HPS hps, PPOINTL pptl, PUMLEPDATA pCtl, UniChar *psuText, ULONG ulChars, ULONG cbOffset );
+BOOL             SaveText( HWND hwnd, PSZ pszFile, PULONG pcbWritten );
 MRESULT EXPENTRY UMLEWndProc( HWND hwnd, ULONG msg, MPARAM mp1, MPARAM mp2 );
+BOOL             UndoText( HWND hwnd, BOOL fRedo );
 void             UpdateFont( HWND hwnd, PUMLEPDATA pPrivate );
+void             UpdateLayout( HWND hwnd, PUMLEPDATA pCtl, ULONG cbOffset, ULONG cbLength, ULONG cbRemoved );
 
 
 
@@ -157,12 +211,59 @@ MRESULT EXPENTRY UMLEWndProc( HWND hwnd, ULONG msg, MPARAM mp1, MPARAM mp2 )
                 lScrlHw, lScrlHh, // horizontal (bottom) scrollbar size
                 lInc;             // scrollbar change size
     SHORT       sMaxH, sMaxV;     // scrollbar maximum ranges
+    PCH         pch;              // export buffer position
     ULONG       ulRC;
 
 
     switch( msg ) {
 
 
+        /* MLM_EXPORT: Exports text into the buffer set by MLM_SETIMPORTEXPORT,
+         * in UCS-2 if the format is MLFIE_UCS, or otherwise in the conversion
+         * codepage.  The text is converted straight from the text buffer.
+         *   PIPT   pipt: Starting point; updated to the point following the
+         *                exported text
+         *   PULONG pcch: Number of characters to export; updated to the
+         *                number of characters actually exported
+         * Returns the number of bytes written to the buffer.
+         */
+        case MLM_EXPORT:
+            pPrivate = WinQueryWindowPtr( hwnd, 0 );
+            if ( !pPrivate || !pPrivate->pchIEBuffer || !mp1 || !mp2 )
+                return (MRESULT) 0;
+            pch = pPrivate->pchIEBuffer;
+            return (MRESULT) ExportText( hwnd, (PIPT) mp1, (PULONG) mp2,
+                                         pPrivate->cbIEBuffer, IE_CODEPAGE( pPrivate ),
+                                         ExportToBuffer, &pch );
+
+
+        case MLM_FORMAT:
+            pPrivate = WinQueryWindowPtr( hwnd, 0 );
+            if ( !pPrivate ) return (MRESULT) FALSE;
+            pPrivate->ctldata.afIEFormat = SHORT1FROMMP( mp1 );
+            return (MRESULT) TRUE;
+
+
+        /* MLM_IMPORT: Imports text from the buffer set by MLM_SETIMPORTEXPORT,
+         * which is in UCS-2 if the format is MLFIE_UCS, or otherwise in the
+         * conversion codepage.
+         *   PIPT   pipt: Insertion point (-1 for the cursor position); updated
+         *                to the point following the imported text
+         *   PULONG pcb : Number of bytes to import; updated to the number of
+         *                bytes actually imported
+         * Returns the number of bytes imported.
+         */
+        case MLM_IMPORT:
+            pPrivate = WinQueryWindowPtr( hwnd, 0 );
+            if ( !pPrivate || !mp1 || !mp2 ) return (MRESULT) 0;
+            if ( *((PULONG) mp2 ) > pPrivate->cbIEBuffer )
+                *((PULONG) mp2 ) = pPrivate->cbIEBuffer;
+            ImportText( hwnd, pPrivate->pchIEBuffer, (PULONG) mp2, (PIPT) mp1,
+                        IE_CODEPAGE( pPrivate ), 0 );
+            WinInvalidateRect( hwnd, NULL, FALSE );
+            return (MRESULT) *((PULONG) mp2 );
+
+
         /* MLM_INSERT: Differs from the standard MLE version in that mp2 may
          * contain the following:
          *   USHORT usCodepage: Source codepage of inserted text (default: current)
@@ -174,6 +275,43 @@ MRESULT EXPENTRY UMLEWndProc( HWND hwnd, ULONG msg, MPARAM mp1, MPARAM mp2 )
             return (MRESULT) ulRC;
 
 
+        /* MLM_UNDO: Unlike the standard MLE, this does not toggle between
+         * undo and redo; it undoes successively older changes each time it
+         * is sent.  MLM_REDO reapplies them.
+         */
+        case MLM_UNDO:
+            return (MRESULT) UndoText( hwnd, FALSE );
+
+
+        case MLM_REDO:
+            return (MRESULT) UndoText( hwnd, TRUE );
+
+
+        case MLM_RESETUNDO:
+            pPrivate = WinQueryWindowPtr( hwnd, 0 );
+            if ( pPrivate ) Journal_Clear( pPrivate->journal );
+            return (MRESULT) 0;
+
+
+        /* MLM_SAVEFILE: Writes all of the text to a file, in the same format
+         * as MLM_EXPORT.
+         *   PSZ    pszFile   : Name of the file to create (or replace)
+         *   PULONG pcbWritten: Returns the number of bytes written (or NULL)
+         * Returns TRUE if the text was saved in full, or FALSE if it was not
+         * (in which case the file is deleted).
+         */
+        case MLM_SAVEFILE:
+            return (MRESULT) SaveText( hwnd, (PSZ) mp1, (PULONG) mp2 );
+
+
+        case MLM_SETIMPORTEXPORT:
+            pPrivate = WinQueryWindowPtr( hwnd, 0 );
+            if ( !pPrivate ) return (MRESULT) FALSE;
+            pPrivate->pchIEBuffer = (PCH) mp1;
+            pPrivate->cbIEBuffer  = LONGFROMMP( mp2 );
+            return (MRESULT) TRUE;
+
+
         case WM_CHAR:
             break;
 
@@ -202,10 +340,17 @@ MRESULT EXPENTRY UMLEWndProc( HWND hwnd, ULONG msg, MPARAM mp1, MPARAM mp2 )
             DEBUG_START();
             DEBUG_PRINTF("[UMLEWndProc] WM_CREATE\n");
 
-            // Create the text object and line buffer
-            TextCreate( &(pPrivate->text) );
+            // Create the text object and line buffer, using the allocator
+            // from the control data if one was given
+            if ( !pPrivate->ctldata.pAllocator )
+                pPrivate->ctldata.pAllocator = TextQueryDefaultAllocator();
+            TextCreateWithAllocator( &(pPrivate->text), UMLE_TEXT_MODEL,
+                                     UMLE_ALLOCATOR( pPrivate ));
             TextInitContents( pPrivate->text, NULL, 0 );
-            LineBuffer_Init( &(pPrivate->breaks), LB_INITIAL_SIZE );
+            TextSetElementSize( pPrivate->text, sizeof( UniChar ));
+            LineBuffer_InitWithAllocator( &(pPrivate->breaks), LB_INITIAL_SIZE,
+                                          UMLE_ALLOCATOR( pPrivate ));
+            Journal_Create( &(pPrivate->journal), UMLE_UNDO_LIMIT );
 
             // Set the initial font
             UpdateFont( hwnd, pPrivate );
@@ -240,6 +385,8 @@ MRESULT EXPENTRY UMLEWndProc( HWND hwnd, ULONG msg, MPARAM mp1, MPARAM mp2 )
             if (( pPrivate = WinQueryWindowPtr( hwnd, 0 )) != NULL ) {
                 // free any allocated fields of pPrivate
                 LineBuffer_Free( &(pPrivate->breaks) );
+                if ( pPrivate->journal )
+                    Journal_Free( &(pPrivate->journal) );
                 if ( pPrivate->text )
                     TextFree( &(pPrivate->text) );
                 if ( pPrivate->hwndSBH != NULLHANDLE )
@@ -580,7 +727,10 @@ ULONG DrawEditorText( HWND hwnd, HPS hps, PPOINTL pptl, PUMLEPDATA pCtl )
  * ------------------------------------------------------------------------- */
 ULONG DrawUnicodeTextSequence( HWND hwnd, HPS hps, PPOINTL pptl, PUMLEPDATA pCtl, ULONG ulStart, ULONG ulLength )
 {
-    UniChar    suText[ UCS_MAX_RENDER+1 ];  // Text of current segment
+    UniChar    suText[ UCS_MAX_RENDER+1 ];  // Copy of current segment (if needed)
+    UniChar    *psuText;     // Text of current segment
+    TEXTSPAN   span1,        // Direct pointers to the segment in the buffer
+               span2;
     LONG       lRC;          // GPI return code
     LONG       lFG;          // Current foreground (text) colour
     ULONG      ulBreakIdx;   // Buffer index of the next line-break offset
@@ -601,8 +751,11 @@ ULONG DrawUnicodeTextSequence( HWND hwnd, HPS hps, PPOINTL pptl, PUMLEPDATA pCtl
     GpiSetTextAlignment( hps, TA_LEFT, TA_BOTTOM );
     GpiSetCp( hps, 1200 );
 
-    ulBreakIdx = 0;
+    // Start from the first line break after the starting position
     pLB = &(pCtl->breaks);
+    ulBreakIdx = LineBuffer_FindNear( pLB, pCtl->ulBreakHint, UPOS_TO_BYTEOFF( ulStart ));
+    if ( LineBuffer_ItemAt( pLB, ulBreakIdx ) == UPOS_TO_BYTEOFF( ulStart )) ulBreakIdx++;
+    pCtl->ulBreakHint = ulBreakIdx;
     while (( ulStart < ulLength )) {
         fLineBreak = TRUE;          // assume this by default
 
@@ -626,18 +779,32 @@ ULONG DrawUnicodeTextSequence( HWND hwnd, HPS hps, PPOINTL pptl, PUMLEPDATA pCtl
             else ulDraw = ulChars;
             ulStrip = 0;
 
-            // Retrieve the calculated character range from the text buffer
-            cbChars = TextSequence( pCtl->text, (PCH) suText,
-                                    UPOS_TO_BYTEOFF( ulStart ),
-                                    UPOS_TO_BYTEOFF( ulDraw ));
+            /* Retrieve the calculated character range from the text buffer.
+             * We can draw it directly from the buffer unless it happens to
+             * straddle the gap (or the text model only returned part of it),
+             * in which case it has to be copied.
+             */
+            if (( TextGetSpans( pCtl->text, UPOS_TO_BYTEOFF( ulStart ),
+                                UPOS_TO_BYTEOFF( ulDraw ), &span1, &span2 ) == 1 ) &&
+                ( span1.cb == UPOS_TO_BYTEOFF( ulDraw )))
+            {
+                psuText = (UniChar *) span1.pch;
+                cbChars = span1.cb;
+            }
+            else {
+                psuText = suText;
+                cbChars = TextSequence( pCtl->text, (PCH) suText,
+                                        UPOS_TO_BYTEOFF( ulStart ),
+                                        UPOS_TO_BYTEOFF( ulDraw ));
+                suText[ BYTEOFF_TO_UPOS( cbChars ) ] = 0;
+            }
             if ( !cbChars ) return ulStart;
             ulDraw = BYTEOFF_TO_UPOS( cbChars );
-            suText[ ulDraw ] = 0;
 
             // Don't display any trailing newlines or spaces following the break
             if ( fLineBreak ) {
                 ULONG c = ulDraw;
-                while ( c && SKIP_WRAPPED_CHAR( suText[ c-1 ] ))
+                while ( c && SKIP_WRAPPED_CHAR( psuText[ c-1 ] ))
                     c--;
                 ulStrip = ulDraw - c;
             }
@@ -656,7 +823,7 @@ ULONG DrawUnicodeTextSequence( HWND hwnd, HPS hps, PPOINTL pptl, PUMLEPDATA pCtl
 //                                              (PCH) suText, NULL );
 //                    lRC = GpiTabbedCharStringAt( hps, pptl, &pCtl->rclView, CHS_CLIP, UPOS_TO_BYTEOFF( ulDraw - ulStrip ), (PCH) suText, 1, &(pCtl->ulTabSize), 0 );
 #endif
-                    lRC = DrawTabbedUnicodeText( hps, pptl, pCtl->rclView, pCtl->fm, pCtl->ulTabSize, suText, ulDraw - ulStrip );
+                    lRC = DrawTabbedUnicodeText( hps, pptl, pCtl->rclView, pCtl->fm, pCtl->ulTabSize, psuText, ulDraw - ulStrip );
                 if ( lRC != GPI_OK ) return ulStart;
             }
             ulStart += ulDraw;
@@ -725,8 +892,11 @@ ULONG DrawCodepageTextSequence( HWND hwnd, HPS hps, PPOINTL pptl, PUMLEPDATA pCt
     GpiSetTextAlignment( hps, TA_LEFT, TA_BOTTOM );
     GpiSetCp( hps, ulCP );
 
-    ulBreakIdx = 0;
+    // Start from the first line break after the starting position
     pLB = &(pCtl->breaks);
+    ulBreakIdx = LineBuffer_FindNear( pLB, pCtl->ulBreakHint, ulStart );
+    if ( LineBuffer_ItemAt( pLB, ulBreakIdx ) == ulStart ) ulBreakIdx++;
+    pCtl->ulBreakHint = ulBreakIdx;
     while (( ulStart < ulLength )) {
         fLineBreak = TRUE;          // assume this by default
 
@@ -788,12 +958,105 @@ ULONG DrawCodepageTextSequence( HWND hwnd, HPS hps, PPOINTL pptl, PUMLEPDATA pCt
 }
 
 
+/* ------------------------------------------------------------------------- *
+ * EnumerateInsertedLines                                                    *
+ *                                                                           *
+ * Updates the line offset buffer after text has been inserted (possibly in  *
+ * place of text which was removed), without rescanning the rest of the      *
+ * text.  The line breaks within the removed text are dropped, those which   *
+ * follow it are shifted by the change in length, and then only the lines    *
+ * which contain the new text are parsed for hard line breaks, and measured. *
+ * The longest line is then read from the line buffer, which keeps track of  *
+ * it as the lines' widths are recorded, so no other lines need to be        *
+ * measured again.                                                           *
+ *                                                                           *
+ * Like EnumerateLines(), this is not useful if MLS_WORDWRAP is set.         *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   HPS        hps      : Handle of the current presentation space     (I)  *
+ *   PUMLEPDATA pPrivate : Private control data                         (I)  *
+ *   ULONG      cbStart  : Byte offset at which the text was inserted   (I)  *
+ *   ULONG      cbLength : Number of bytes inserted                     (I)  *
+ *   ULONG      cbRemoved: Number of bytes removed there beforehand     (I)  *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   Number of lines in the text (i.e. one plus the number of line breaks).  *
+ * ------------------------------------------------------------------------- */
+ULONG EnumerateInsertedLines( HPS hps, PUMLEPDATA pPrivate, ULONG cbStart, ULONG cbLength, ULONG cbRemoved )
+{
+    PLBOBUFFER pLB;          // Pointer to line-break offsets buffer
+    TEXTITER   iter;         // Reads the text as we go
+    ULONG      cbEnd,        // Byte offset following the inserted text
+               cbLine,       // Byte offset of the current line
+               cbNext,       // Byte offset of the following line
+               ulBreakIdx,   // Current index in the line buffer
+               ulBreakEnd;   // Index of the first break after the old text
+    LONG       lLongest;     // Display width of the longest line
+    BOOL       fLast;        // Is this the last line containing new text?
+    LBLINEINFO info;         // Record of the current line
+
+
+    /* Drop the line breaks which ended within the removed text, and shift
+     * the ones which follow it.  The line buffer only has to move its gap
+     * here to do this, so the cost does not depend on how much text follows.
+     * A break right at the insertion point is dropped too (as though the
+     * characters on either side had been replaced as well), since the new
+     * text may join it to the previous line, e.g. by completing a CR-LF
+     * pair.  It is found again below if it still applies.
+     */
+    pLB        = &(pPrivate->breaks);
+    ulBreakIdx = LineBuffer_FindNear( pLB, pPrivate->ulBreakHint, cbStart );
+    ulBreakEnd = LineBuffer_FindNear( pLB, ulBreakIdx, cbStart + cbRemoved + 1 );
+    pPrivate->ulBreakHint = ulBreakIdx;
+    if ( ! LineBuffer_Splice( pLB, ulBreakIdx, ulBreakEnd, NULL, NULL, 0 ))
+        return EnumerateLines( hps, pPrivate, cbStart );
+    if ( ! LineBuffer_Shift( pLB, ulBreakIdx, (LONG) cbLength - (LONG) cbRemoved ))
+        return EnumerateLines( hps, pPrivate, cbStart );
+
+    // Now parse each line from the one containing the insertion point, up
+    // to the one containing the end of the new text
+    cbLine     = ulBreakIdx ? LineBuffer_ItemAt( pLB, ulBreakIdx-1 ) : 0;
+    cbEnd      = cbStart + cbLength;
+    fLast      = FALSE;
+    while ( !fLast ) {
+        TextIterInit( &iter, pPrivate->text, cbLine );
+        cbNext = FindNextLine( &iter );
+        if (( cbNext == TEXT_INVALID_POSITION ) || ( cbNext > cbEnd )) {
+            // The line ends with a break we already know of (or the text)
+            cbNext = ( ulBreakIdx < LineBuffer_Count( pLB )) ?
+                        LineBuffer_ItemAt( pLB, ulBreakIdx ) :
+                        TextLength( pPrivate->text );
+            fLast  = TRUE;
+        }
+        else
+            LineBuffer_Insert( pLB, cbNext, ulBreakIdx );
+
+        info.lExtent = GetLineExtent( hps, pPrivate, cbLine, cbNext );
+        info.ulRun   = 0;
+        info.fsFlags = ( ulBreakIdx < LineBuffer_Count( pLB )) ? LB_HARD_BREAK : 0;
+        LineBuffer_SetLine( pLB, ulBreakIdx, &info );
+        if ( !fLast ) ulBreakIdx++;
+        cbLine = cbNext;
+    }
+
+    /* This also covers the longest line having been split up by the new
+     * text, in which case it may no longer be the longest.
+     */
+    pPrivate->ulLongest   = LineBuffer_FindWidest( pLB, &lLongest );
+    pPrivate->ulColsTotal = pPrivate->ulUnitWidth ?
+                                (ULONG) ( lLongest / pPrivate->ulUnitWidth ) : 0;
+
+    return ( LineBuffer_Count( pLB ) + 1 );
+}
+
+
 /* ------------------------------------------------------------------------- *
  * EnumerateLines                                                            *
  *                                                                           *
  * Parses the editor text from the specified offset to the end, looking for  *
- * hard line breaks and saving their positions in the line offset buffer.    *
- * Also makes a note of the longest line (display-wise).                     *
+ * hard line breaks and saving their positions in the line offset buffer,    *
+ * along with the display width of each line.  Also makes a note of the      *
+ * longest line (display-wise) in the whole text.                            *
  *                                                                           *
  * This function does not take word wrapping (a.k.a. soft line breaks) into  *
  * account, and therefore is not useful if MLS_WORDWRAP is set.  Use the     *
@@ -810,55 +1073,58 @@ ULONG DrawCodepageTextSequence( HWND hwnd, HPS hps, PPOINTL pptl, PUMLEPDATA pCt
 ULONG EnumerateLines( HPS hps, PUMLEPDATA pPrivate, ULONG cbStart )
 {
     PLBOBUFFER pLB;          // Pointer to line-break offsets buffer
-    ULONG      ulTotal,      // Total length of the text (in UniChars)
-               ulStart,      // Starting UniChar offset
-               ulBreakIdx,   // Current index in the line buffer
-               ulLongestIdx, // Index of the longest line
-               i;
-    LONG       lWidth,       // Display width of current line
-               lLongest;     // Display width of longest line
-    UniChar    uc;
+    TEXTITER   iter;         // Reads the text as we go
+    ULONG      cbTotal,      // Total length of the text (in bytes)
+               cbLine,       // Byte offset of the current line
+               cbNext,       // Byte offset of the following line
+               ulBreakIdx;   // Current index in the line buffer
+    LONG       lLongest;     // Display width of longest line
+    BOOL       fLast;        // Is this the last line?
+    LBLINEINFO info;         // Record of the current line
 
 
     // Clear all stored line-breaks after the current starting offset
     pLB     = &(pPrivate->breaks);
-    ulBreakIdx = LineBuffer_FindPosition( pLB, 0, pLB->ulSize-1, cbStart );
+    ulBreakIdx = LineBuffer_FindNear( pLB, pPrivate->ulBreakHint, cbStart );
+    pPrivate->ulBreakHint = ulBreakIdx;
     LineBuffer_Clear( pLB, ulBreakIdx );
 
-    // The text in the buffer is always UCS-2
-    ulTotal  = BYTEOFF_TO_UPOS( TextLength( pPrivate->text ));
-    if ( !ulTotal ) return 0;
-
-    ulStart  = BYTEOFF_TO_UPOS( cbStart );
-    lLongest = 0;
-    for ( i = ulStart; i < ulTotal; i++ ) {
-        uc = TextWCharAt( pPrivate->text, i );
-        if ( NEWLINE_CHAR( uc )) {
+    cbTotal = TextLength( pPrivate->text );
+    if ( !cbTotal ) return 0;
 
-            // End-of-line found, save the position in the line buffer
-            if (( uc == 0xD ) &&
-                ((i+1) < ulTotal ) && ( TextWCharAt( pPrivate->text, i+1 ) == 0xA ))
-                i++;
-            LineBuffer_Insert( pLB, UPOS_TO_BYTEOFF( i+1 ), ulBreakIdx );
-
-            // Now calculate the line's display-width
-            lWidth = GetLineExtent( hps, pPrivate,
-                                    ulBreakIdx ?
-                                        LineBuffer_ItemAt( pLB, ulBreakIdx-1 ) :
-                                        cbStart,
-                                    UPOS_TO_BYTEOFF( i - ulStart ));
-            if ( lWidth > lLongest ) {
-                lLongest = lWidth;
-                ulLongestIdx = ulBreakIdx ? ( ulBreakIdx - 1 ) : 0;
-            }
-            ulBreakIdx++;
+    /* Start from the beginning of the line containing the starting offset,
+     * and read on through the text from there with an iterator, which only
+     * has to go back to the text model when it crosses the gap (and once
+     * per line, to set it up again after measuring the line).
+     */
+    cbLine = ulBreakIdx ? LineBuffer_ItemAt( pLB, ulBreakIdx-1 ) : 0;
+    fLast  = FALSE;
+    while ( !fLast ) {
+        TextIterInit( &iter, pPrivate->text, cbLine );
+        cbNext = FindNextLine( &iter );
+        if ( cbNext == TEXT_INVALID_POSITION ) {
+            cbNext = cbTotal;
+            fLast  = TRUE;
         }
+        else
+            // End-of-line found, save the position in the line buffer
+            LineBuffer_Insert( pLB, cbNext, ulBreakIdx );
+
+        // Now calculate the line's display-width, and record it
+        info.lExtent = GetLineExtent( hps, pPrivate, cbLine, cbNext );
+        info.ulRun   = 0;
+        info.fsFlags = fLast ? 0 : LB_HARD_BREAK;
+        LineBuffer_SetLine( pLB, ulBreakIdx, &info );
+        if ( !fLast ) ulBreakIdx++;
+        cbLine = cbNext;
     }
 
-    DEBUG_PRINTF("Enumerated %u lines (%u characters total)\n", ulBreakIdx, ulTotal );
-    DEBUG_PRINTF(" - (longest is line %u (%u pels)\n", ulLongestIdx, lLongest );
+    // The lines before the starting offset still have their widths recorded
+    pPrivate->ulLongest = LineBuffer_FindWidest( pLB, &lLongest );
+
+    DEBUG_PRINTF("Enumerated %u lines (%u bytes total)\n", ulBreakIdx, cbTotal );
+    DEBUG_PRINTF(" - (longest is line %u (%u pels)\n", pPrivate->ulLongest, lLongest );
 
-    pPrivate->ulLongest = ulLongestIdx;
     pPrivate->ulColsTotal = pPrivate->ulUnitWidth ?
                                 (ULONG) ( lLongest / pPrivate->ulUnitWidth ) : 0;
 
@@ -866,107 +1132,379 @@ ULONG EnumerateLines( HPS hps, PUMLEPDATA pPrivate, ULONG cbStart )
 }
 
 
+/* ------------------------------------------------------------------------- *
+ * ExportSpans                                                               *
+ *                                                                           *
+ * Text sink (see TextExport) which converts UCS-2 text from the buffer into *
+ * the target codepage of an export, and passes it on to the export's own    *
+ * sink.  The text is converted into a fixed buffer, one buffer-full at a    *
+ * time, so no copy of the whole text is ever made.                          *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PVOID     pUser  : Export state (PUMEXPORT)                       (I/O) *
+ *   PTEXTSPAN pSpans : Array of spans of UCS-2 text                   (I)   *
+ *   ULONG     ulSpans: Number of spans in the array                   (I)   *
+ *                                                                           *
+ * RETURNS: int                                                              *
+ *   1 to continue the export, 0 to stop it (because of an error, or because *
+ *   the export's size limit has been reached).                              *
+ * ------------------------------------------------------------------------- */
+int ExportSpans( PVOID pUser, PTEXTSPAN pSpans, ULONG ulSpans )
+{
+    PUMEXPORT pExport = (PUMEXPORT) pUser;
+    TEXTSPAN  span;                     // Converted text
+    UniChar   *pin,
+              *psuStart;
+    PCH       pout;
+    size_t    stIn, stOut, stSub;
+    ULONG     i,
+              ulRC;
+
+
+    for ( i = 0; i < ulSpans; i++ ) {
+        pin  = (UniChar *) pSpans[ i ].pch;
+        stIn = BYTEOFF_TO_UPOS( pSpans[ i ].cb );
+        while ( stIn ) {
+            if ( pExport->cbOut >= pExport->cbMax ) return 0;
+
+            // Convert as much as fits in the buffer (and within the limit)
+            psuStart = pin;
+            pout     = pExport->pchOut;
+            stOut    = min( EXPORT_BUFFER_SIZE, pExport->cbMax - pExport->cbOut );
+            stSub    = 0;
+            ulRC = UniUconvFromUcs( pExport->uconv, &pin, &stIn,
+                                    (PPVOID) &pout, &stOut, &stSub );
+            if (( ulRC != ULS_SUCCESS ) && ( ulRC != ULS_BUFFERFULL )) return 0;
+
+            // Nothing converted means the next character doesn't fit
+            if ( pin == psuStart ) return 0;
+
+            span.pch = (PUCHAR) pExport->pchOut;
+            span.cb  = (ULONG)( pout - pExport->pchOut );
+            if ( span.cb && !pExport->pfnSink( pExport->pUser, &span, 1 ))
+                return 0;
+            pExport->cbOut += span.cb;
+            pExport->cbIn  += UPOS_TO_BYTEOFF( pin - psuStart );
+        }
+    }
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * ExportText                                                                *
+ *                                                                           *
+ * Exports text from the edit window, converted into the specified codepage, *
+ * to a text sink.  Called by the MLM_EXPORT and MLM_SAVEFILE handlers.      *
+ *                                                                           *
+ * The text is read directly from the text buffer (see TextExport), and is   *
+ * converted in pieces of up to EXPORT_BUFFER_SIZE bytes, so the memory      *
+ * needed does not depend on the size of the text.  The sink receives each   *
+ * piece as soon as it is converted.                                         *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   HWND        hwnd    : Control's window handle                     (I)   *
+ *   PIPT        pipt    : Starting point; returns the point following (I/O) *
+ *                         the exported text                                 *
+ *   PULONG      pulChars: Number of characters to export; returns the (I/O) *
+ *                         number which were actually exported               *
+ *   ULONG       cbMax   : Maximum number of bytes to produce, or      (I)   *
+ *                         EXPORT_UNLIMITED                                  *
+ *   USHORT      usCP    : Codepage to convert the text into           (I)   *
+ *   PFNTEXTSINK pfnSink : Sink to which the converted text is passed  (I)   *
+ *   PVOID       pUser   : Data passed to pfnSink                      (I)   *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   Number of bytes passed to the sink.                                     *
+ * ------------------------------------------------------------------------- */
+ULONG ExportText( HWND hwnd, PIPT pipt, PULONG pulChars, ULONG cbMax, USHORT usCP, PFNTEXTSINK pfnSink, PVOID pUser )
+{
+    UMEXPORT   state;
+    PUMLEPDATA pCtl;
+    UniChar    uniCP[ CPSPEC_MAXZ ] = {0};
+    ULONG      cbText,          // Length of the editor text
+               cbOffset,        // Byte offset at which the export starts
+               cbLength,        // Number of bytes of text to export
+               ulRC;
+
+
+    pCtl = WinQueryWindowPtr( hwnd, 0 );
+    if ( !pCtl || !pipt || !pulChars || !pfnSink ) return 0;
+
+    cbText   = TextLength( pCtl->text );
+    cbOffset = ( *pipt > BYTEOFF_TO_UPOS( cbText )) ? cbText : UPOS_TO_BYTEOFF( *pipt );
+    cbLength = cbText - cbOffset;
+    if ( *pulChars < BYTEOFF_TO_UPOS( cbLength ))
+        cbLength = UPOS_TO_BYTEOFF( *pulChars );
+    *pulChars = 0;
+    if ( !cbLength || !cbMax ) return 0;
+
+    // Set up the conversion from UCS-2
+    if ( usCP )
+        ulRC = UniMapCpToUcsCp( (ULONG) usCP, uniCP, CPNAME_MAXZ );
+    UniStrncat( uniCP, L"@map=crlf,path=no", CPSPEC_MAXZ-1 );
+    ulRC = UniCreateUconvObject( uniCP, &(state.uconv) );
+    if ( ulRC != ULS_SUCCESS ) return 0;
+
+    state.pchOut = (PCH) TextAllocMemory( UMLE_ALLOCATOR( pCtl ), EXPORT_BUFFER_SIZE );
+    if ( !state.pchOut ) {
+        UniFreeUconvObject( state.uconv );
+        return 0;
+    }
+    state.cbMax   = cbMax;
+    state.cbOut   = 0;
+    state.cbIn    = 0;
+    state.pfnSink = pfnSink;
+    state.pUser   = pUser;
+
+    TextExport( pCtl->text, cbOffset, cbLength, ExportSpans, &state );
+
+    TextFreeMemory( UMLE_ALLOCATOR( pCtl ), state.pchOut );
+    UniFreeUconvObject( state.uconv );
+
+    *pulChars = BYTEOFF_TO_UPOS( state.cbIn );
+    *pipt     = BYTEOFF_TO_UPOS( cbOffset + state.cbIn );
+    return state.cbOut;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * ExportToBuffer                                                            *
+ *                                                                           *
+ * Text sink which copies exported text into a memory buffer (MLM_EXPORT).   *
+ * The buffer size is enforced by the caller of ExportText.                  *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PVOID     pUser  : Current buffer position (PCH *); updated       (I/O) *
+ *   PTEXTSPAN pSpans : Array of spans of text                         (I)   *
+ *   ULONG     ulSpans: Number of spans in the array                   (I)   *
+ *                                                                           *
+ * RETURNS: int                                                              *
+ *   Always 1.                                                               *
+ * ------------------------------------------------------------------------- */
+int ExportToBuffer( PVOID pUser, PTEXTSPAN pSpans, ULONG ulSpans )
+{
+    PCH   *ppch = (PCH *) pUser;
+    ULONG i;
+
+    for ( i = 0; i < ulSpans; i++ ) {
+        memcpy( *ppch, pSpans[ i ].pch, pSpans[ i ].cb );
+        *ppch += pSpans[ i ].cb;
+    }
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * ExportToFile                                                              *
+ *                                                                           *
+ * Text sink which writes exported text to an open file (MLM_SAVEFILE).      *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PVOID     pUser  : File handle (PHFILE)                           (I)   *
+ *   PTEXTSPAN pSpans : Array of spans of text                         (I)   *
+ *   ULONG     ulSpans: Number of spans in the array                   (I)   *
+ *                                                                           *
+ * RETURNS: int                                                              *
+ *   1 if all of the text was written, 0 otherwise.                          *
+ * ------------------------------------------------------------------------- */
+int ExportToFile( PVOID pUser, PTEXTSPAN pSpans, ULONG ulSpans )
+{
+    HFILE  hf = *((PHFILE) pUser );
+    ULONG  cbActual,
+           i;
+    APIRET rc;
+
+    for ( i = 0; i < ulSpans; i++ ) {
+        rc = DosWrite( hf, pSpans[ i ].pch, pSpans[ i ].cb, &cbActual );
+        if (( rc != NO_ERROR ) || ( cbActual != pSpans[ i ].cb )) return 0;
+    }
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * FindNextLine                                                              *
+ *                                                                           *
+ * Reads forward through the text from the iterator's position to the next   *
+ * hard line break, and leaves the iterator at the start of the following    *
+ * line.  A CR followed by an LF counts as a single line break.  The text is *
+ * examined in place, one span at a time; only a character which straddles   *
+ * two spans is read separately.                                             *
+ *                                                                           *
+ * Under some text models (paged and UTF-8) the iterator only remains valid  *
+ * until the next call on the text object, so the caller sets it up again    *
+ * for each line, after any GetLineExtent() call made in between.            *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   PTEXTITER pIter: Iterator positioned within the editor text       (I/O) *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   Byte offset of the start of the next line, or TEXT_INVALID_POSITION if  *
+ *   there are no more line breaks.                                          *
+ * ------------------------------------------------------------------------- */
+ULONG FindNextLine( PTEXTITER pIter )
+{
+    UniChar *psu;            // Text remaining in the current span
+    ULONG   ulChars,         // Number of characters in it
+            i;
+    wchar_t wc;              // Character read by the iterator
+
+
+    for (;;) {
+        // Skip over ordinary characters in place
+        ulChars = BYTEOFF_TO_UPOS( TextIterSpan( pIter, (PBYTE *) &psu ));
+        for ( i = 0; ( i < ulChars ) && !NEWLINE_CHAR( psu[ i ] ); i++ );
+        TextIterSeek( pIter, TextIterPosition( pIter ) + UPOS_TO_BYTEOFF( i ));
+
+        // Then read the line break (or a character straddling the gap)
+        if ( !TextIterNext( pIter, &wc )) return TEXT_INVALID_POSITION;
+        if ( !NEWLINE_CHAR( wc )) continue;
+        if (( wc == 0xD ) && TextIterNext( pIter, &wc ) && ( wc != 0xA ))
+            TextIterPrev( pIter, &wc );
+        return TextIterPosition( pIter );
+    }
+}
+
+
 /* ------------------------------------------------------------------------- *
  * GetLineExtent                                                             *
  *                                                                           *
- * Determine the display-width of the specified text range, up to the given  *
- * length.  The text is assumed to contain no line-breaks.                   *
+ * Determine the display-width of the specified text range.  Measurement     *
+ * stops at the first line-break, if the range contains one.                 *
  *                                                                           *
  * ARGUMENTS:                                                                *
  *   HPS        hps     : Handle of the current presentation space      (I)  *
  *   PUMLEPDATA pPrivate: Private control data                          (I)  *
  *   ULONG      cbStart : Starting byte offset in the editor text       (I)  *
- *   ULONG      cbLength: Number of bytes to measure                    (I)  *
+ *   ULONG      cbLength: Byte offset at which to stop measuring        (I)  *
  *                                                                           *
  * RETURNS: LONG                                                             *
  *   The number of horizontal pels required to display the given string.     *
  * ------------------------------------------------------------------------- */
 LONG GetLineExtent( HPS hps, PUMLEPDATA pPrivate, ULONG cbStart, ULONG cbLength )
 {
-    CHAR  szText[ CB_MAX_RENDER + 2 ];  // Buffer for holding text being checked
-    ULONG cbRemaining,                  // Number of bytes not yet processed
-          cbChars;                      // Number of bytes to process
-    LONG  lExtent;                      // Calculated display width
+    TEXTSPAN aSpans[ 2 ];               // Direct pointers to the text in the buffer
+    ULONG    ulSpans,                   // Number of spans returned
+             cbChars,                   // Number of bytes to measure
+             i, j;
+    LONG     lExtent;                   // Calculated display width
+    BOOL     fBreak;                    // Has a line-break been found?
 
 
+    /* Measure the text straight from the buffer.  This normally takes a single
+     * span; the only time it takes two is if the line straddles the gap.
+     */
+    // TODO get attribute codepage if not in UCS-2 mode
+    GpiSetCp( hps, (ULONG) pPrivate->usDispCP );
     lExtent = 0;
-    do {
-        cbRemaining = cbLength - cbStart;
-        cbChars = ( cbRemaining > CB_MAX_RENDER )? CB_MAX_RENDER: cbRemaining;
-        cbChars = TextSequence( pPrivate->text, szText, cbStart, cbChars );
-        if ( !cbChars ) break;
-        szText[ cbChars ] = 0;
-        szText[ cbChars+1 ] = 0;    // In case string is UCS-encoded
-
-        // Truncate the checked characters at the first line-break
-        if ( pPrivate->usDispCP == 1200 ) {
-            UniChar auLineBreaks[] = { 0xA, 0xB, 0xC, 0xD, 0x2028, 0x2029 };
-            ULONG ulStop = UniStrcspn( (UniChar *) szText, auLineBreaks );
-            cbChars = UPOS_TO_BYTEOFF( ulStop );
-        }
-        else {
-            CHAR acLineBreaks[] = { 0xA, 0xB, 0xC, 0xD };
-            cbChars = strcspn( szText, acLineBreaks );
-        }
-
-        // Check the width of this segment
-        // TODO get attribute codepage if not in UCS-2 mode
-        GpiSetCp( hps, (ULONG) pPrivate->usDispCP );
-        lExtent += QueryTextWidth( hps, szText, cbChars, pPrivate->fm, pPrivate->ulTabSize, pPrivate->usDispCP );
-        cbStart += cbChars;
+    fBreak  = FALSE;
+    while ( !fBreak && ( cbStart < cbLength )) {
+        ulSpans = TextGetSpans( pPrivate->text, cbStart, cbLength - cbStart,
+                                aSpans, aSpans + 1 );
+        if ( !ulSpans ) break;
+
+        for ( i = 0; !fBreak && ( i < ulSpans ); i++ ) {
+            // Truncate the checked characters at the first line-break
+            if ( pPrivate->usDispCP == 1200 ) {
+                UniChar *psu = (UniChar *) aSpans[ i ].pch;
+                ULONG   ulChars = BYTEOFF_TO_UPOS( aSpans[ i ].cb );
+                for ( j = 0; ( j < ulChars ) && !NEWLINE_CHAR( psu[ j ] ); j++ );
+                cbChars = UPOS_TO_BYTEOFF( j );
+            }
+            else {
+                PCH pch = (PCH) aSpans[ i ].pch;
+                for ( j = 0; ( j < aSpans[ i ].cb ) && !NEWLINE_CHAR( pch[ j ] ); j++ );
+                cbChars = j;
+            }
+            fBreak = ( cbChars < aSpans[ i ].cb );
 
-    } while ( cbStart < cbLength );
+            // Check the width of this segment
+            lExtent += QueryTextWidth( hps, (PCHAR) aSpans[ i ].pch, cbChars, pPrivate->fm, pPrivate->ulTabSize, pPrivate->usDispCP );
+            cbStart += aSpans[ i ].cb;
+        }
+    }
 
     return lExtent;
 }
 
 
 /* ------------------------------------------------------------------------- *
- * InsertText                                                                *
+ * ImportText                                                                *
  *                                                                           *
- * Inserts codepage-formatted text into the edit window at the current       *
- * insertion point.  Called by the MLM_INSERT message handler.               *
+ * Imports codepage-formatted text into the edit window at the specified     *
+ * insertion point.  Called by the MLM_IMPORT message handler, and (through  *
+ * InsertText) by the MLM_INSERT message handler.                            *
  *                                                                           *
  * All text, no matter what its source codepage, and no matter what the      *
  * current display codepage, is stored in the text buffer as UCS-2.  It may  *
  * or may not be converted to back to the original codepage, or to another   *
  * codepage entirely, at display time.                                       *
  *                                                                           *
+ * The text is converted and inserted in pieces of up to IMPORT_CHUNK_LENGTH *
+ * bytes, so the memory needed does not depend on the size of the text.  If  *
+ * a piece ends partway through a multi-byte character, the remainder is     *
+ * converted along with the next piece.  The line buffer is updated as each  *
+ * piece is inserted, and the window is repainted after the first one, so    *
+ * that the beginning of a large import is visible while the rest is still   *
+ * being processed.  (When MLS_WORDWRAP is set, the text is only reflowed    *
+ * after the first and last pieces, since reflowing is not incremental.)     *
+ *                                                                           *
+ * The whole import is recorded as a single undo step.                       *
+ *                                                                           *
  * ARGUMENTS:                                                                *
- *   HWND   hwnd   : Control's window handle                                 *
- *   PSZ    pszText: Multi-byte text to insert                               *
- *   USHORT usCP   : Codepage in which pszText is encoded                    *
- *   USHORT fsAttr : Additional text attributes (style, direction)           *
+ *   HWND   hwnd   : Control's window handle                          (I)    *
+ *   PCH    pchText: Multi-byte text to insert                        (I)    *
+ *   PULONG pcbText: Length of the text in bytes, or                  (I/O)  *
+ *                   IMPORT_NULL_TERMINATED; returns the number of           *
+ *                   bytes which were actually imported                      *
+ *   PIPT   pipt   : Insertion point, or -1 for the cursor position;  (I/O)  *
+ *                   returns the point following the imported text           *
+ *   USHORT usCP   : Codepage in which pchText is encoded             (I)    *
+ *   USHORT fsAttr : Additional text attributes (style, direction)    (I)    *
  *                                                                           *
  * RETURNS: ULONG                                                            *
  *   Number of characters inserted.                                          *
  * ------------------------------------------------------------------------- */
-ULONG InsertText( HWND hwnd, PSZ pszText, USHORT usCP, USHORT fsAttr )
+ULONG ImportText( HWND hwnd, PCH pchText, PULONG pcbText, PIPT pipt, USHORT usCP, USHORT fsAttr )
 {
     UconvObject uconv;
     PUMLEPDATA  pCtl;
-    HPS         hps;
     IPT         ipt;
     UniChar     uniCP[ CPSPEC_MAXZ ] = {0},
                 *pout,
                 *psuText;
-    PSZ         pin;
+    PCH         pin,
+                pchPiece,       // Start of the current piece of input
+                pchEnd;         // End of the input
     size_t      stIn, stOut, stSub;
-    ULONG       cbOffset,
-                aulCP[ 3 ] = {0},
-                pcbCP,
+    ULONG       cbText,         // Length of the input
+                cbOffset,       // Byte offset at which the import starts
+                cbPos,          // Byte offset at which the next piece goes
+                cbPiece,        // Size of the current piece, after conversion
                 ulRC;
-    APIRET      rc;
+    BOOL        fFinal,         // Is this the last piece of the input?
+                fWrap,          // Is word-wrap on?
+                fReflow;        // Does the text need reflowing at the end?
 
 
     pCtl = WinQueryWindowPtr( hwnd, 0 );
-    if ( !pCtl || !pszText ) return 0;
+    if ( !pCtl || !pcbText || !pipt ) return 0;
+    cbText   = *pcbText;
+    *pcbText = 0;
+    if ( !pchText || !cbText ) return 0;
 
-    // Query the current process codepage
-    rc = DosQueryCp( sizeof( aulCP ), aulCP, &pcbCP );
+    /* Null-terminated input may end anywhere, and nothing past the terminator
+     * can be assumed readable, so find it before dividing the text up.
+     */
+    if ( cbText == IMPORT_NULL_TERMINATED )
+        cbText = strlen( pchText );
+    pchEnd = pchText + cbText;
 
-    ipt = pCtl->ctldata.iptCursor;
-    if ( ipt > TextLength( pCtl->text )) ipt = 0;
+    ipt = *pipt;
+    if (( ipt == (IPT) -1 ) || ( ipt > BYTEOFF_TO_UPOS( TextLength( pCtl->text ))))
+        ipt = pCtl->ctldata.iptCursor;
+    if ( ipt > BYTEOFF_TO_UPOS( TextLength( pCtl->text ))) ipt = 0;
 
     /* Given the IPT, determine the byte offset within the text buffer.
      *
@@ -978,7 +1516,7 @@ ULONG InsertText( HWND hwnd, PSZ pszText, USHORT usCP, USHORT fsAttr )
      */
     cbOffset = UPOS_TO_BYTEOFF( ipt );
 
-    // Convert the source text into UCS-2
+    // Set up the conversion into UCS-2
     if ( usCP )
         ulRC = UniMapCpToUcsCp( (ULONG) usCP, uniCP, CPNAME_MAXZ );
     // TODO should eventually implement a cache of previously-used UconvObjects
@@ -986,58 +1524,109 @@ ULONG InsertText( HWND hwnd, PSZ pszText, USHORT usCP, USHORT fsAttr )
     ulRC = UniCreateUconvObject( uniCP, &uconv );
     if ( ulRC != ULS_SUCCESS ) return 0;
 
-    stIn  = strlen( pszText );
-    stOut = stIn * 4;
-    stSub = 0;
-    rc = DosAllocMem( (PPVOID) &psuText,
-                      ( stOut + 1 ) * sizeof( UniChar ),
-                      PAG_READ | PAG_WRITE | PAG_COMMIT );
-    if ( rc != NO_ERROR ) {
+    // Each input byte produces at most one UniChar
+    psuText = (UniChar *) TextAllocMemory( UMLE_ALLOCATOR( pCtl ),
+                                           IMPORT_CHUNK_LENGTH * sizeof( UniChar ));
+    if ( !psuText ) {
         UniFreeUconvObject( uconv );
         return 0;
     }
 
-    pin  = pszText;
-    pout = psuText;
-    ulRC = UniUconvToUcs( uconv, (PPVOID) &pin, &stIn, &pout, &stOut, &stSub );
-    if ( ulRC == ULS_SUCCESS ) {
-
-        // Text converted successfully, now insert it into the global buffer
-        ulRC = TextInsert( pCtl->text, (PCH) psuText, UPOS_TO_BYTEOFF( ipt ),
-                           UPOS_TO_BYTEOFF( UniStrlen( psuText )));
-        if ( ulRC ) {
-            // Update the line buffer
-            hps = WinGetPS( hwnd );
-            SetFontFromAttrs( hps, pCtl->lDPI, &(pCtl->fattrs), pCtl->fm );
-            //SetFontFromPP( hps, hwnd, pCtl->lDPI, &(pCtl->fattrs) );
-            if (( pCtl->flStyle & MLS_WORDWRAP ) && RECTL_WIDTH( pCtl->rclView )) {
-                POINTL ptl;
-                // TODO Only reflow the buffer contents from cbOffset (this will
-                //      require deriving ptl from ipt... somehow)
-                ptl.x = pCtl->rclView.xLeft;
-                ptl.y = pCtl->rclView.yTop - pCtl->ulUnitHeight;
-                pCtl->ulLinesTotal = ReflowEditorText( hps, pCtl, ptl, 0 );
-            }
-            else if ( RECTL_WIDTH( pCtl->rclView )) {
-                // TODO A possible optimization here: if psuText contains no linebreaks,
-                //      add some parameter telling EnumerateLines to only re-check the
-                //      longest line by comparing the current line with the old longest.
-                pCtl->ulLinesTotal = EnumerateLines( hps, pCtl, cbOffset );
-            }
-            WinReleasePS( hps );
-
-            /* If the previous or following text attribues don't match the
-             * current ones, create a new text-attribute object for the
-             * inserted text.  TODO
-             */
+    Journal_Group( pCtl->journal, TRUE );
+    fWrap   = ( pCtl->flStyle & MLS_WORDWRAP ) ? TRUE : FALSE;
+    fReflow = FALSE;
+    cbPos   = cbOffset;
+    pin     = pchText;
+    fFinal  = FALSE;
+    while ( !fFinal ) {
+
+        // Find the extent of the next piece of input
+        stIn   = min( (ULONG)( pchEnd - pin ), IMPORT_CHUNK_LENGTH );
+        fFinal = ( pin + stIn == pchEnd );
+        if ( !stIn ) break;
+
+        /* Convert it, leaving pin at the first byte not converted.  If the
+         * output fills up, or the piece ends with an incomplete character,
+         * the rest is converted along with the next piece; any other error
+         * ends the import.
+         */
+        pchPiece = pin;
+        pout     = psuText;
+        stOut    = IMPORT_CHUNK_LENGTH;
+        stSub    = 0;
+        ulRC = UniUconvToUcs( uconv, (PPVOID) &pin, &stIn, &pout, &stOut, &stSub );
+        if ( ulRC == ULS_BUFFERFULL )
+            fFinal = FALSE;
+        else if (( ulRC != ULS_SUCCESS ) &&
+                 (( ulRC != ULS_ILLEGALSEQUENCE ) || fFinal || ( stIn >= CHARSTRING_MAXZ )))
+            fFinal = TRUE;
+        if ( pin == pchPiece ) break;
+
+        // Insert the converted text and update the line buffer
+        cbPiece = UPOS_TO_BYTEOFF( pout - psuText );
+        if ( !cbPiece ) continue;
+        if ( ! Journal_Insert( pCtl->journal, pCtl->text, (PCH) psuText,
+                               cbPos, cbPiece ))
+            break;
+        if ( !fWrap )
+            UpdateLayout( hwnd, pCtl, cbPos, cbPiece, 0 );
+        else if ( cbPos == cbOffset )
+            UpdateLayout( hwnd, pCtl, cbOffset, 0, 0 );
+        else
+            fReflow = TRUE;
+        if ( cbPos == cbOffset ) {
+            WinInvalidateRect( hwnd, NULL, FALSE );
+            WinUpdateWindow( hwnd );
         }
+        cbPos += cbPiece;
+
+        /* If the previous or following text attribues don't match the
+         * current ones, create a new text-attribute object for the
+         * inserted text.  TODO
+         */
     }
-    else ulRC = 0;
+    Journal_Group( pCtl->journal, FALSE );
+
+    if ( fReflow )
+        UpdateLayout( hwnd, pCtl, cbOffset, 0, 0 );
 
     UniFreeUconvObject( uconv );
-    DosFreeMem( psuText );
+    TextFreeMemory( UMLE_ALLOCATOR( pCtl ), psuText );
 
-    return ( ulRC );
+    *pcbText = (ULONG)( pin - pchText );
+    *pipt    = BYTEOFF_TO_UPOS( cbPos );
+    return BYTEOFF_TO_UPOS( cbPos - cbOffset );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * InsertText                                                                *
+ *                                                                           *
+ * Inserts null-terminated, codepage-formatted text into the edit window at  *
+ * the current insertion point.  Called by the MLM_INSERT message handler.   *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   HWND   hwnd   : Control's window handle                                 *
+ *   PSZ    pszText: Multi-byte text to insert                               *
+ *   USHORT usCP   : Codepage in which pszText is encoded                    *
+ *   USHORT fsAttr : Additional text attributes (style, direction)           *
+ *                                                                           *
+ * RETURNS: ULONG                                                            *
+ *   Number of characters inserted.                                          *
+ * ------------------------------------------------------------------------- */
+ULONG InsertText( HWND hwnd, PSZ pszText, USHORT usCP, USHORT fsAttr )
+{
+    PUMLEPDATA pCtl;
+    IPT        ipt;
+    ULONG      cbText;
+
+
+    pCtl = WinQueryWindowPtr( hwnd, 0 );
+    if ( !pCtl ) return 0;
+
+    ipt    = pCtl->ctldata.iptCursor;
+    cbText = IMPORT_NULL_TERMINATED;
+    return ImportText( hwnd, (PCH) pszText, &cbText, &ipt, usCP, fsAttr );
 }
 
 
@@ -1054,12 +1643,11 @@ ULONG InsertText( HWND hwnd, PSZ pszText, USHORT usCP, USHORT fsAttr )
  * This function should not be used when the MLS_WORDWRAP style is not set.  *
  * In that case, EnumerateLines() should be used instead.                    *
  *                                                                           *
- * Note that the text has to be read into a contiguous (UCS-2) string from   *
- * the buffer's own (non-contiguous) internal format, before we can process  *
- * it.  To avoid having to duplicate the entire buffer contents in memory    *
- * (which could be very expensive for large buffers), the text is processed  *
- * in consecutive segments of REFLOW_SEGMENT_LENGTH UniChars until the end   *
- * of the text is reached.                                                   *
+ * The text is processed in consecutive segments of REFLOW_SEGMENT_LENGTH    *
+ * UniChars until the end of the text is reached.  An iterator walks through *
+ * the text, and each segment is read directly from the buffer where it      *
+ * lies (see TextIterSpan); it is only copied into a local string if it      *
+ * straddles the gap.                                                        *
  *                                                                           *
  * ARGUMENTS:                                                                *
  *   HPS        hps     : Handle of the current presentation space      (I)  *
@@ -1074,17 +1662,21 @@ ULONG ReflowEditorText( HPS hps, PUMLEPDATA pPrivate, POINTL ptl, ULONG cbStart
 {
     PLBOBUFFER pLB;          // Pointer to line-break offsets buffer
     UniChar    suText[ REFLOW_SEGMENT_LENGTH+1 ];
+    UniChar    *psuText;     // Text of the current segment
+    TEXTITER   iter;         // Current position in the text
+    wchar_t    wc;           // Character read by the iterator
     ULONG      ulTotal,      // Total length of the text (in UniChars)
                ulStart,      // Starting offset of the current segment
                ulRemaining,  // Number of characters left to process
-               cbChars,      // Number of bytes returned by TextSequence()
-               ulChars;      // Number of characters in the current segment
+               cbSpan,       // Number of bytes readable in place
+               ulChars,      // Number of characters in the current segment
+               i;
 
 
     // Clear all stored line-breaks after the current starting offset
     pLB = &(pPrivate->breaks);
-    LineBuffer_Clear( pLB,
-                      LineBuffer_FindPosition( pLB, 0, pLB->ulSize-1, cbStart ));
+    pPrivate->ulBreakHint = LineBuffer_FindNear( pLB, pPrivate->ulBreakHint, cbStart );
+    LineBuffer_Clear( pLB, pPrivate->ulBreakHint );
 
     // The text in the buffer is always UCS-2, i.e. two bytes per character
     ulTotal = BYTEOFF_TO_UPOS( TextLength( pPrivate->text ));
@@ -1095,21 +1687,31 @@ ULONG ReflowEditorText( HPS hps, PUMLEPDATA pPrivate, POINTL ptl, ULONG cbStart
 //#endif
 
     ulStart = BYTEOFF_TO_UPOS( cbStart );
+    if ( !TextIterInit( &iter, pPrivate->text, UPOS_TO_BYTEOFF( ulStart )))
+        return LineBuffer_Count( &(pPrivate->breaks) );
     do {
         ulRemaining = ulTotal - ulStart;
         ulChars = ( ulRemaining > REFLOW_SEGMENT_LENGTH ) ?
                     REFLOW_SEGMENT_LENGTH : ulRemaining;
 
-        // Retrieve the current character range from the text buffer
-        cbChars = TextSequence( pPrivate->text, (PCH) suText,
-                                UPOS_TO_BYTEOFF( ulStart ),
-                                UPOS_TO_BYTEOFF( ulChars ));
-        ulChars = BYTEOFF_TO_UPOS( cbChars );
+        /* Take the current character range from the text buffer.  We can
+         * use it in place unless it straddles the gap, in which case the
+         * iterator copies it out one character at a time.
+         */
+        cbSpan = TextIterSpan( &iter, (PBYTE *) &psuText );
+        if ( cbSpan >= UPOS_TO_BYTEOFF( ulChars ))
+            TextIterSeek( &iter, UPOS_TO_BYTEOFF( ulStart + ulChars ));
+        else {
+            psuText = suText;
+            for ( i = 0; ( i < ulChars ) && TextIterNext( &iter, &wc ); i++ )
+                suText[ i ] = (UniChar) wc;
+            ulChars = i;
+        }
         if ( !ulChars ) break;
 
         // Now reflow this segment
-        suText[ ulChars ] = 0;
-        ReflowUnicodeTextSequence( hps, &ptl, pPrivate, suText, 0 );
+        ReflowUnicodeTextSequence( hps, &ptl, pPrivate, psuText, ulChars,
+                                   UPOS_TO_BYTEOFF( ulStart ));
         ulStart += ulChars;
 
     } while ( ulStart < ulTotal );
@@ -1130,13 +1732,20 @@ ULONG ReflowEditorText( HPS hps, PUMLEPDATA pPrivate, POINTL ptl, ULONG cbStart
  * to the point after the last drawn character where the theoretical next    *
  * character should be drawn, if it existed.                                 *
  *                                                                           *
- * The text must be UCS-2 encoded, and terminated by a null UniChar.         *
+ * The text must be UCS-2 encoded, and is length-delimited (it need not be   *
+ * null-terminated, and may point directly into the text buffer).            *
+ *                                                                           *
+ * The line breaks found are collected and added to the line offset buffer   *
+ * in batches with LineBuffer_InsertRange(), rather than one at a time.      *
+ * Each line is recorded as ending with a hard break or not; its width is    *
+ * not recorded, since the break may be moved back after it has been fitted. *
  *                                                                           *
  * ARGUMENTS:                                                                *
  *   HPS        hps     : Handle of the current presentation space      (I)  *
  *   PPOINTL    pptl    : Position of the next character to be drawn  (I/O)  *
  *   PUMLEPDATA pCtl    : Private control data                          (I)  *
  *   UniChar    *psuText: The Unicode text sequence to reflow           (I)  *
+ *   ULONG      ulChars : Length of the text sequence, in UniChars      (I)  *
  *   ULONG      cbOffset: Corresponding offset within the editor text   (I)  *
  *                                                                           *
  * RETURNS: ULONG                                                            *
@@ -1147,27 +1756,36 @@ ULONG ReflowEditorText( HPS hps, PUMLEPDATA pPrivate, POINTL ptl, ULONG cbStart
 //    need only be incremented by the size of the added text)
 
 
-ULONG ReflowUnicodeTextSequence( HPS hps, PPOINTL pptl, PUMLEPDATA pCtl, UniChar *psuText, ULONG cbOffset )
+ULONG ReflowUnicodeTextSequence( HPS hps, PPOINTL pptl, PUMLEPDATA pCtl, UniChar *psuText, ULONG ulChars, ULONG cbOffset )
 {
     PLBOBUFFER pLB;         // Pointer to line-break offsets buffer
+    ULONG      aulBreaks[ REFLOW_BATCH_LENGTH ];
+    LBLINEINFO aInfo[ REFLOW_BATCH_LENGTH ];
     ULONG      ulStart,     // Starting character index within our text sequence
                ulTotal,     // Total length of the text sequence, in UniChars
                cbDraw,      // Byte-count returned by FitTextWidth
                ulDraw,      // Number of UniChars to draw before wrapping
                cbAbs,       // Absolute byte address of the wrap position
+               cbLast,      // Absolute byte address of the previous wrap position
 //               ulTabOffset, // Current tabstop position
-               ulLBIdx;     // Position of current line-break in the buffer
+               ulFound,     // Number of line-breaks collected in aulBreaks
+               ulLBIdx,     // Position in the buffer for the collected line-breaks
+               i;
+    USHORT     fsFlags;     // Line record flags for the current line
 
 
     // Need to set the codepage for the GPI functions called in FitTextWidth
     GpiSetCp( hps, 1200 );
     // TODO need to set the font for the current attributes as well
 
+    // The new line-breaks go after any which are already known up to here
     pLB         =  &(pCtl->breaks);
-    ulLBIdx     = 0;
+    ulLBIdx     = LineBuffer_FindNear( pLB, pCtl->ulBreakHint, cbOffset + 1 );
+    cbLast      = ulLBIdx ? LineBuffer_ItemAt( pLB, ulLBIdx-1 ) : 0;
+    ulFound     = 0;
 //    ulTabOffset = 0;
     ulStart     = 0;
-    ulTotal     = UniStrlen( psuText );
+    ulTotal     = ulChars;
 
     while (( ulStart < ulTotal )) {
         ulDraw = ulTotal - ulStart;
@@ -1182,7 +1800,7 @@ ULONG ReflowUnicodeTextSequence( HPS hps, PPOINTL pptl, PUMLEPDATA pCtl, UniChar
 
         // If no characters fit and we're at the start of the line, give up
         if ( !ulDraw && ( pptl->x == pCtl->rclView.xLeft ))
-            return ulStart;
+            break;
 
         /* Extend the length to include any trailing whitespace
          * (which won't be displayed at the end of a line anyway)
@@ -1200,18 +1818,31 @@ ULONG ReflowUnicodeTextSequence( HPS hps, PPOINTL pptl, PUMLEPDATA pCtl, UniChar
             ulDraw = FindBreakPosition( (PCH) (psuText + ulStart),
                                          ulDraw - 1, 1200 ) + 1;
         }
+
+        // The line ends with a hard break if one was skipped over above
+        fsFlags = 0;
+        for ( i = ulStart + ulDraw;
+              ( i > ulStart ) && SKIP_WRAPPED_CHAR( psuText[ i-1 ] ); i-- )
+            if ( NEWLINE_CHAR( psuText[ i-1 ] )) fsFlags = LB_HARD_BREAK;
         ulStart += ulDraw;
         cbAbs = cbOffset + UPOS_TO_BYTEOFF( ulStart );
 
-        /* Add the calculated break point to the line-break index (checking
-         * first to make sure the current value is not a duplicate).
+        /* Collect the calculated break point for the line-break index
+         * (unless it duplicates the previous one), adding the collected
+         * points to the index whenever the batch is full.
          */
-        if ( !ulLBIdx )
-            ulLBIdx = LineBuffer_FindPosition( pLB, 0,
-                                               LineBuffer_Count( pLB ) - 1,
-                                               cbAbs );
-        if ( !ulLBIdx || ( LineBuffer_ItemAt( pLB, ulLBIdx-1 ) != cbAbs ))
-            LineBuffer_Insert( pLB, cbAbs, ulLBIdx++ );
+        if ( cbAbs != cbLast ) {
+            aInfo[ ulFound ].lExtent = 0;
+            aInfo[ ulFound ].ulRun   = 0;
+            aInfo[ ulFound ].fsFlags = fsFlags;
+            aulBreaks[ ulFound++ ] = cbAbs;
+            cbLast = cbAbs;
+        }
+        if ( ulFound == REFLOW_BATCH_LENGTH ) {
+            LineBuffer_InsertRange( pLB, ulLBIdx, aulBreaks, aInfo, ulFound );
+            ulLBIdx += ulFound;
+            ulFound  = 0;
+        }
 
         // If we're not finished, move to the next line and continue
         if ( ulStart < ulTotal ) {
@@ -1221,10 +1852,117 @@ ULONG ReflowUnicodeTextSequence( HPS hps, PPOINTL pptl, PUMLEPDATA pCtl, UniChar
 
     }
 
+    LineBuffer_InsertRange( pLB, ulLBIdx, aulBreaks, aInfo, ulFound );
+    pCtl->ulBreakHint = ulLBIdx + ulFound;
     return ulStart;
 }
 
 
+/* ------------------------------------------------------------------------- *
+ * SaveText                                                                  *
+ *                                                                           *
+ * Writes all of the editor text to a file, in UCS-2 if the import/export    *
+ * format is MLFIE_UCS, or otherwise in the conversion codepage.  The text   *
+ * is converted and written in pieces (see ExportText), so saving even a     *
+ * very large document needs only a small, fixed amount of extra memory.     *
+ *                                                                           *
+ * If the text cannot be saved in full, the partly-written file is           *
+ * deleted, rather than being left behind in place of whatever was there     *
+ * before.                                                                   *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   HWND   hwnd      : Control's window handle                        (I)   *
+ *   PSZ    pszFile   : Name of the file to create (or replace)        (I)   *
+ *   PULONG pcbWritten: Number of bytes written (may be NULL)          (O)   *
+ *                                                                           *
+ * RETURNS: BOOL                                                             *
+ *   TRUE if all of the text was saved (even if there was none), FALSE if    *
+ *   it was not.                                                             *
+ * ------------------------------------------------------------------------- */
+BOOL SaveText( HWND hwnd, PSZ pszFile, PULONG pcbWritten )
+{
+    PUMLEPDATA pCtl;
+    HFILE      hf;
+    IPT        ipt;
+    ULONG      ulChars,         // Number of characters to save
+               ulAction,
+               cbWritten;
+    APIRET     rc;
+    BOOL       fSaved;
+
+
+    if ( pcbWritten ) *pcbWritten = 0;
+    pCtl = WinQueryWindowPtr( hwnd, 0 );
+    if ( !pCtl || !pszFile ) return FALSE;
+
+    rc = DosOpen( pszFile, &hf, &ulAction, 0L, FILE_NORMAL,
+                  OPEN_ACTION_CREATE_IF_NEW | OPEN_ACTION_REPLACE_IF_EXISTS,
+                  OPEN_FLAGS_SEQUENTIAL | OPEN_SHARE_DENYREADWRITE | OPEN_ACCESS_WRITEONLY,
+                  NULL );
+    if ( rc != NO_ERROR ) return FALSE;
+
+    ipt       = 0;
+    ulChars   = BYTEOFF_TO_UPOS( TextLength( pCtl->text ));
+    cbWritten = ExportText( hwnd, &ipt, &ulChars, EXPORT_UNLIMITED,
+                            IE_CODEPAGE( pCtl ), ExportToFile, &hf );
+    fSaved    = ( ulChars >= BYTEOFF_TO_UPOS( TextLength( pCtl->text )));
+
+    // Closing the file may still fail to write out the last of the data
+    if ( DosClose( hf ) != NO_ERROR ) fSaved = FALSE;
+    if ( !fSaved ) {
+        DosDelete( pszFile );
+        return FALSE;
+    }
+
+    if ( pcbWritten ) *pcbWritten = cbWritten;
+    return TRUE;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * UndoText                                                                  *
+ *                                                                           *
+ * Undoes the most recent change to the text, or redoes the most recently    *
+ * undone change, using the undo journal.  The insertion point is moved to   *
+ * the location of the change.  Called by the MLM_UNDO and MLM_REDO message  *
+ * handlers.                                                                 *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   HWND hwnd : Control's window handle                                     *
+ *   BOOL fRedo: TRUE to redo, FALSE to undo                                 *
+ *                                                                           *
+ * RETURNS: BOOL                                                             *
+ *   TRUE if a change was undone or redone, FALSE if there was none.         *
+ * ------------------------------------------------------------------------- */
+BOOL UndoText( HWND hwnd, BOOL fRedo )
+{
+    PUMLEPDATA    pCtl;
+    JOURNALCHANGE change;       // Range of text changed by the step
+    ULONG         cbOffset,
+                  ulRC;
+
+
+    pCtl = WinQueryWindowPtr( hwnd, 0 );
+    if ( !pCtl ) return FALSE;
+
+    cbOffset = 0;
+    if ( fRedo )
+        ulRC = Journal_Redo( pCtl->journal, pCtl->text, &cbOffset, &change );
+    else
+        ulRC = Journal_Undo( pCtl->journal, pCtl->text, &cbOffset, &change );
+    if ( !ulRC ) return FALSE;
+
+    pCtl->ctldata.iptCursor = BYTEOFF_TO_UPOS( cbOffset );
+    pCtl->ctldata.iptAnchor = pCtl->ctldata.iptCursor;
+
+    // Only the lines containing the changed text need to be parsed again
+    UpdateLayout( hwnd, pCtl, change.ulPosition, change.cbInserted, change.cbRemoved );
+    WinInvalidateRect( hwnd, NULL, FALSE );
+
+    return TRUE;
+}
+
+
 /* ------------------------------------------------------------------------- *
  * UpdateFont                                                                *
  *                                                                           *
@@ -1280,24 +2018,10 @@ void UpdateFont( HWND hwnd, PUMLEPDATA pPrivate )
         pPrivate->ulLinesTotal = ReflowEditorText( hps, pPrivate, ptl, 0 );
     }
     else {
-        // Recalculate the display width of the longest line
-        // TODO It's probably better to recalculate all the line lengths
-        LONG lWidth;
-        ULONG ulLines,
-              cbStart,
-              cbLength;
-        ulLines  = LineBuffer_Count( &(pPrivate->breaks) );
-        cbStart  = ( pPrivate->ulLongest )?
-                       LineBuffer_ItemAt( &(pPrivate->breaks),
-                                          pPrivate->ulLongest - 1 ): 0;
-        cbLength = ( pPrivate->ulLongest < ulLines )?
-                       LineBuffer_ItemAt( &(pPrivate->breaks),
-                                          pPrivate->ulLongest ):
-                       TextLength( pPrivate->text );
-        lWidth = GetLineExtent( hps, pPrivate, cbStart, cbLength );
-
-        pPrivate->ulColsTotal = pPrivate->ulUnitWidth ?
-                                (ULONG) ( lWidth / pPrivate->ulUnitWidth ) : 0;
+        /* Every line's recorded display width has changed with the font, and
+         * so may the longest line; so measure all the lines again.
+         */
+        pPrivate->ulLinesTotal = EnumerateLines( hps, pPrivate, 0 );
     }
 
     // Recalculate the scrollbar bounds
@@ -1341,4 +2065,48 @@ void UpdateFont( HWND hwnd, PUMLEPDATA pPrivate )
 }
 
 
+/* ------------------------------------------------------------------------- *
+ * UpdateLayout                                                              *
+ *                                                                           *
+ * Updates the line buffer after the text has been changed, either by        *
+ * reflowing it (when word-wrap is on) or by enumerating the hard line       *
+ * breaks from the given offset.  If the lengths of the text inserted and    *
+ * removed there are given, only the new text is enumerated.                 *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   HWND       hwnd     : Control's window handle                           *
+ *   PUMLEPDATA pCtl     : Pointer to control data                           *
+ *   ULONG      cbOffset : Byte offset of the earliest changed text          *
+ *   ULONG      cbLength : Number of bytes inserted at cbOffset              *
+ *   ULONG      cbRemoved: Number of bytes they replaced (if both lengths    *
+ *                         are 0, everything from cbOffset is enumerated)    *
+ *                                                                           *
+ * RETURNS: N/A                                                              *
+ * ------------------------------------------------------------------------- */
+void UpdateLayout( HWND hwnd, PUMLEPDATA pCtl, ULONG cbOffset, ULONG cbLength, ULONG cbRemoved )
+{
+    HPS hps;
+
+
+    hps = WinGetPS( hwnd );
+    SetFontFromAttrs( hps, pCtl->lDPI, &(pCtl->fattrs), pCtl->fm );
+    //SetFontFromPP( hps, hwnd, pCtl->lDPI, &(pCtl->fattrs) );
+    if (( pCtl->flStyle & MLS_WORDWRAP ) && RECTL_WIDTH( pCtl->rclView )) {
+        POINTL ptl;
+        // TODO Only reflow the buffer contents from cbOffset (this will
+        //      require deriving ptl from ipt... somehow)
+        ptl.x = pCtl->rclView.xLeft;
+        ptl.y = pCtl->rclView.yTop - pCtl->ulUnitHeight;
+        pCtl->ulLinesTotal = ReflowEditorText( hps, pCtl, ptl, 0 );
+    }
+    else if ( RECTL_WIDTH( pCtl->rclView )) {
+        if ( cbLength || cbRemoved )
+            pCtl->ulLinesTotal = EnumerateInsertedLines( hps, pCtl, cbOffset, cbLength, cbRemoved );
+        else
+            pCtl->ulLinesTotal = EnumerateLines( hps, pCtl, cbOffset );
+    }
+    WinReleasePS( hps );
+}
+
+
 
@@ -12,6 +12,10 @@
 
 #define MLFIE_UCS               4           // Import/export format is UCS-2
 
+// Additional messages (not supported by the standard MLE)
+#define MLM_REDO                ( WM_USER + 0x100 )     // Redo last undone change
+#define MLM_SAVEFILE            ( WM_USER + 0x101 )     // Save the text to a file
+
 // ----------------------------------------------------------------------------
 // TYPEDEFS
 
@@ -25,6 +29,7 @@ typedef struct _UMLE_Data {
     LONG    cxFormat;       // formatting-rectangle width in pels
     LONG    cyFormat;       // formatting-rectangle height in pels
     ULONG   afFormatFlags;  // format flags
+    PVOID   pAllocator;     // memory allocator for the text (PTEXTALLOCATOR, or NULL)
 } UMLECTLDATA, *PUMLECTLDATA;
 
 
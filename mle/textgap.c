@@ -0,0 +1,623 @@
+/*****************************************************************************
+ * textgap.c                                                                 *
+ *                                                                           *
+ * Implements the 'gap' (or split) buffer text model, based on the theory    *
+ * described by Charles Crowley in his paper "Data Structures for Text       *
+ * Sequences" (1998, University of New Mexico).  This is the default model   *
+ * used by TextCreate().                                                     *
+ *                                                                           *
+ * Note that we make no assumptions about how the buffer contents will be    *
+ * interpreted.  Matters of character width (whether fixed-width or MBCS),   *
+ * codepage, string terminators (NULLs or anything else) etc. are entirely   *
+ * outside our scope here.  From our point of view, the buffer simply        *
+ * contains a sequence of bytes with a specified length.  It will be up to   *
+ * whatever program uses this model to decide what the bytes represent, and  *
+ * how to deal with them accordingly.                                        *
+ *                                                                           *
+ * All references to 'characters' in this file refer to single bytes (char). *
+ *                                                                           *
+ * The functions in this file are not called directly by applications; they  *
+ * are reached through the public Text*() functions in textseq.c.            *
+ *                                                                           *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <stddef.h>
+
+#include "debug.h"
+#include "textseq.h"
+#include "textimpl.h"
+
+
+// ---------------------------------------------------------------------------
+// CONSTANTS
+//
+#define INITIAL_BUF_SIZE 8192   // default initial buffer size (including gap)
+
+
+// ---------------------------------------------------------------------------
+// TYPEDEFS
+//
+
+// The internal implementation (gap buffer) of the text data structure.
+//
+typedef struct _text_sequence {
+    TEXTHDR       hdr;              // Common model header
+    unsigned char *pchContents;     // The actual text buffer
+    unsigned long ulSize,           // Total allocated buffer size
+                  ulSp1Len,         // Length of text before the gap (span 1)
+                  ulSp2Len,         // Length of text after the gap (span 2)
+                  ulGapLen;         // Length of the gap
+    /* ------------------------------------------------------------- *
+     * NOTES: Total text length             == ulSp1Len + ulSp2Len   *
+     *        Position of the pre-gap text  == 0                     *
+     *        Position of the gap           == ulSp1Len              *
+     *        Position of the post-gap text == ulSp1Len + ulGapLen   *
+     * ------------------------------------------------------------- */
+} TEXT, *PTEXT;
+
+
+
+// ---------------------------------------------------------------------------
+// MACROS
+//
+
+// Return the absolute buffer position of the requested character position
+#define TEXTPOS2ABS( text, pos ) \
+  (( (pos) < (text).ulSp1Len ) ? (pos) : ((text).ulGapLen + (pos) ))
+
+// Return the length of the text
+#define TEXTLEN( text )     ( (text).ulSp1Len + (text).ulSp2Len )
+
+// Return the buffer position following the last character
+#define TEXTEND( text ) \
+  ( (text).ulSp1Len + (text).ulGapLen + (text).ulSp2Len )
+
+/* The contents of the gap are never read, so text moved across (or deleted
+ * into) the gap is not normally cleared.  For debugging, define GAP_POISON
+ * as a byte value (e.g. /DGAP_POISON=0xDD) to have the entire gap filled
+ * with that value whenever it changes, so that stray reads stand out.
+ */
+#ifdef GAP_POISON
+#define POISON_GAP( ptext ) \
+  memset( (ptext)->pchContents + (ptext)->ulSp1Len, GAP_POISON, (ptext)->ulGapLen )
+#else
+#define POISON_GAP( ptext )
+#endif
+
+
+// ---------------------------------------------------------------------------
+// FUNCTION DECLARATIONS
+//
+
+// Internal
+int ExpandBuffer( PTEXT pText, unsigned long cbNewSize );
+int MoveGap( PTEXT pText, unsigned long ulPosition );
+int ResetGap( PTEXT pText, unsigned long cbRequired );
+
+// Model implementation
+unsigned char GapBuffer_ByteAt( PTEXT pText, unsigned long ulPosition );
+int           GapBuffer_Clear( PTEXT pText );
+int           GapBuffer_Delete( PTEXT pText, unsigned long ulPosition, unsigned long ulLength );
+int           GapBuffer_Destroy( PTEXT pText );
+int           GapBuffer_Init( PTEXT pText, unsigned char *pchText, unsigned long cbText );
+int           GapBuffer_Insert( PTEXT pText, unsigned char *pch, unsigned long ulPosition, unsigned long ulLength );
+unsigned long GapBuffer_Length( PTEXT pText );
+unsigned long GapBuffer_Sequence( PTEXT pText, unsigned char *pchText, unsigned long ulPosition, unsigned long ulLength );
+int           GapBuffer_GetSpans( PTEXT pText, unsigned long ulPosition, unsigned long ulLength, PTEXTSPAN pSpan1, PTEXTSPAN pSpan2 );
+unsigned char *GapBuffer_GetView( PTEXT pText, unsigned long ulPosition, unsigned long ulLength );
+int           GapBuffer_Reserve( PTEXT pText, unsigned long cbText );
+int           GapBuffer_ApplyEdits( PTEXT pText, PTEXTEDIT pEdits, unsigned long ulCount, unsigned long cbNewText );
+int           GapBuffer_Adopt( PTEXT pText, unsigned char *pchBuffer, unsigned long cbText, unsigned long cbBuffer );
+
+
+// ---------------------------------------------------------------------------
+// MODEL TABLE
+//
+
+const TEXTMODEL GapBufferModel = {
+    sizeof( TEXT ),
+    (PFNTEXTBYTEAT)   GapBuffer_ByteAt,
+    (PFNTEXTCLEAR)    GapBuffer_Clear,
+    (PFNTEXTDELETE)   GapBuffer_Delete,
+    (PFNTEXTDESTROY)  GapBuffer_Destroy,
+    (PFNTEXTINIT)     GapBuffer_Init,
+    (PFNTEXTINSERT)   GapBuffer_Insert,
+    (PFNTEXTLENGTH)   GapBuffer_Length,
+    (PFNTEXTSEQUENCE) GapBuffer_Sequence,
+    NULL,
+    NULL,
+    (PFNTEXTGETSPANS) GapBuffer_GetSpans,
+    (PFNTEXTGETVIEW)  GapBuffer_GetView,
+    (PFNTEXTRESERVE)  GapBuffer_Reserve,
+    NULL,
+    NULL,
+    NULL,
+    (PFNTEXTAPPLYEDITS) GapBuffer_ApplyEdits,
+    NULL,
+    (PFNTEXTADOPT)    GapBuffer_Adopt
+};
+
+
+
+// ===========================================================================
+// INTERNAL FUNCTIONS
+// ===========================================================================
+
+
+/* ------------------------------------------------------------------------- *
+ * ExpandBuffer()                                                            *
+ *                                                                           *
+ * Increases the size of the text buffer to the requested size, which the    *
+ * caller will normally have calculated with next_buffer_size().  The text   *
+ * is preserved, but the post-gap text is moved to the end of the new        *
+ * buffer so that the gap takes up all of the free space.                    *
+ *                                                                           *
+ * Where the platform allows it, the buffer is resized in place (realloc);   *
+ * otherwise it is copied to a new allocation.                               *
+ * ------------------------------------------------------------------------- */
+int ExpandBuffer( PTEXT pText, unsigned long cbNewSize )
+{
+    unsigned char *pchNew;
+    unsigned long ulSource,     // Old start of post-gap text
+                  ulTarget;     // New start of post-gap text
+
+
+    if (( ! pText->pchContents ) || ( ! pText->ulSize ))
+        if ( ! GapBuffer_Init( pText, NULL, 0 )) return 0;
+
+    if ( cbNewSize <= pText->ulSize ) return 1;
+
+#ifdef DEBUG_LOG
+fprintf(dbg, "Increasing buffer to %u bytes\n", cbNewSize );
+#endif
+
+    pchNew = (unsigned char *) reallocate_memory( pText->hdr.pAllocator, pText->pchContents, pText->ulSize, cbNewSize );
+    if ( pchNew == NULL ) return 0;
+
+    ulSource = pText->ulSp1Len + pText->ulGapLen;
+    ulTarget = cbNewSize - pText->ulSp2Len;
+    memmove( pchNew + ulTarget, pchNew + ulSource, pText->ulSp2Len );
+
+    pText->pchContents = pchNew;
+    pText->ulSize      = cbNewSize;
+    pText->ulGapLen    = cbNewSize - TEXTLEN( *pText );
+    POISON_GAP( pText );
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * MoveGap()                                                                 *
+ *                                                                           *
+ * Moves the current position of the gap within the text buffer.  The text   *
+ * between the old and new gap positions is block-copied across the gap; the *
+ * bytes left behind are not cleared (see POISON_GAP).                       *
+ * ------------------------------------------------------------------------- */
+int MoveGap( PTEXT pText, unsigned long ulPosition )
+{
+    unsigned long ulGapStart,   // New starting position of the gap
+                  ulShift,      // Number of bytes to shift
+                  ulOldSp1Len,  // Old length of the pre-gap text
+                  ulSource,     // Starting source index of bytes to move
+                  ulTarget;     // Starting destination index of bytes to move
+
+    if ( ulPosition > TEXTLEN( *pText )) return 0;
+
+    ulGapStart  = ulPosition;
+    ulOldSp1Len = pText->ulSp1Len;
+
+    // shift gap to the right
+    if ( ulGapStart > ulOldSp1Len ) {
+        ulShift  = ulGapStart - ulOldSp1Len;
+        ulSource = ulOldSp1Len + pText->ulGapLen;   // (old) start of post-gap text
+        ulTarget = ulOldSp1Len;                     // (old) start of gap
+        memmove( pText->pchContents + ulTarget, pText->pchContents + ulSource, ulShift );
+        pText->ulSp1Len = ulGapStart;
+        pText->ulSp2Len -= ulShift;
+        POISON_GAP( pText );
+    }
+    // shift gap to the left
+    else if ( ulGapStart < ulOldSp1Len ) {
+        ulShift  = ulOldSp1Len - ulGapStart;
+        ulSource = ulGapStart;                      // (new) start of gap
+        ulTarget = ulGapStart + pText->ulGapLen;    // (new) start of post-gap text
+        memmove( pText->pchContents + ulTarget, pText->pchContents + ulSource, ulShift );
+        pText->ulSp1Len = ulGapStart;
+        pText->ulSp2Len += ulShift;
+        POISON_GAP( pText );
+    }
+
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * ResetGap()                                                                *
+ *                                                                           *
+ * Widens the gap so that it can hold at least cbRequired bytes.  To be      *
+ * called whenever the gap is about to fill up.  The new gap is sized in     *
+ * proportion to the text, following the same growth policy as the buffer    *
+ * itself (see next_buffer_size).  If there is insufficient free space in    *
+ * the buffer, the buffer itself is expanded (and the gap grows to fill all  *
+ * of the free space in the new buffer).                                     *
+ * ------------------------------------------------------------------------- */
+int ResetGap( PTEXT pText, unsigned long cbRequired )
+{
+    unsigned long cbText,       // Current text length
+                  cbNewGap,     // New gap length
+                  ulSource,     // Starting source index of bytes to move
+                  ulTarget;     // Starting destination index of bytes to move
+
+    cbText   = TEXTLEN( *pText );
+    cbNewGap = next_buffer_size( &(pText->hdr), cbText, cbText + cbRequired ) - cbText;
+    if ( pText->ulGapLen >= cbNewGap ) return 1;    // nothing to do
+
+    if (( cbNewGap + cbText ) > pText->ulSize )
+        return ExpandBuffer( pText, next_buffer_size( &(pText->hdr), pText->ulSize,
+                                                      cbNewGap + cbText ));
+
+#ifdef DEBUG_LOG
+fprintf(dbg, "Expanding gap to %u bytes (%u requested)\n", cbNewGap, cbRequired );
+#endif
+
+    ulSource = pText->ulSp1Len + pText->ulGapLen;   // old start of post-gap text
+    ulTarget = pText->ulSp1Len + cbNewGap;          // new start of post-gap text
+    memmove( pText->pchContents + ulTarget, pText->pchContents + ulSource, pText->ulSp2Len );
+
+    pText->ulGapLen = cbNewGap;
+    POISON_GAP( pText );
+    return 1;
+}
+
+
+// ===========================================================================
+// MODEL IMPLEMENTATION
+// ===========================================================================
+
+
+/* ------------------------------------------------------------------------- *
+ * GapBuffer_ByteAt                                                          *
+ *                                                                           *
+ * Returns the byte at the given text position.  If the position is invalid, *
+ * 0 (a null-byte) is returned.                                              *
+ * ------------------------------------------------------------------------- */
+unsigned char GapBuffer_ByteAt( PTEXT pText, unsigned long ulPosition )
+{
+    if ( ulPosition >= TEXTLEN( *pText )) return 0;
+    return ( pText->pchContents[ TEXTPOS2ABS(*pText, ulPosition) ] );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * GapBuffer_Clear()                                                         *
+ *                                                                           *
+ * Erases the current text contents (but keeps the buffer allocated).        *
+ * ------------------------------------------------------------------------- */
+int GapBuffer_Clear( PTEXT pText )
+{
+    memset( pText->pchContents, 0, pText->ulSize );
+    pText->ulSp1Len = 0;
+    pText->ulSp2Len = 0;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * GapBuffer_Delete                                                          *
+ *                                                                           *
+ * Deletes one or more bytes from the sequence, starting at the specified    *
+ * position.                                                                 *
+ * ------------------------------------------------------------------------- */
+int GapBuffer_Delete( PTEXT pText, unsigned long ulPosition, unsigned long ulLength )
+{
+    // Ensure that the deleted bytes are always immediately following the gap
+    if ( ulPosition != pText->ulSp1Len )
+        if ( ! MoveGap( pText, ulPosition )) return 0;
+
+    // Now simply absorb the bytes into the gap
+    pText->ulGapLen += ulLength;
+    pText->ulSp2Len -= ulLength;
+    POISON_GAP( pText );
+
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * GapBuffer_Destroy()                                                       *
+ *                                                                           *
+ * Destroys the text buffer and zeroes the rest of the data structure.       *
+ * ------------------------------------------------------------------------- */
+int GapBuffer_Destroy( PTEXT pText )
+{
+    if ( pText->pchContents != NULL ) free_memory( pText->hdr.pAllocator, pText->pchContents );
+    pText->pchContents = NULL;
+    pText->ulSize      = 0;
+    pText->ulSp1Len    = 0;
+    pText->ulSp2Len    = 0;
+    pText->ulGapLen    = 0;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * GapBuffer_Init()                                                          *
+ *                                                                           *
+ * Initializes the text data structure.  Populates it with the specified     *
+ * text, if any; otherwise allocates an empty buffer.                        *
+ * ------------------------------------------------------------------------- */
+int GapBuffer_Init( PTEXT pText, unsigned char *pchText, unsigned long cbText )
+{
+    if ( pText->pchContents ) GapBuffer_Destroy( pText );
+
+    if ( cbText && pchText ) {
+        unsigned long ulInitial = next_buffer_size( &(pText->hdr), cbText, cbText );
+        pText->pchContents = (unsigned char *) allocate_memory( pText->hdr.pAllocator, ulInitial );
+        if ( pText->pchContents == NULL ) return 0;
+        memcpy( pText->pchContents, pchText, cbText );
+        pText->ulSize   = ulInitial;
+        pText->ulSp1Len = cbText;
+        pText->ulSp2Len = 0;
+        pText->ulGapLen = ulInitial - cbText;
+    }
+    else {
+        pText->pchContents = (unsigned char *) allocate_memory( pText->hdr.pAllocator, INITIAL_BUF_SIZE );
+        if ( pText->pchContents == NULL ) return 0;
+        pText->ulSize   = INITIAL_BUF_SIZE;
+        pText->ulSp1Len = 0;
+        pText->ulSp2Len = 0;
+        pText->ulGapLen = INITIAL_BUF_SIZE / 2;
+    }
+
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * GapBuffer_Insert                                                          *
+ *                                                                           *
+ * Inserts one or more bytes into the sequence at the specified position.    *
+ * ------------------------------------------------------------------------- */
+int GapBuffer_Insert( PTEXT pText, unsigned char *pch, unsigned long ulPosition, unsigned long ulLength )
+{
+    // Make sure the buffer exists
+    if ( !pText || !pText->pchContents || !pText->ulSize )
+        return 0;
+
+    // Don't allow adding items more than one position past the end of the array
+    if ( ulPosition > TEXTLEN( *pText )) return 0;
+
+/*
+#ifdef DEBUG_LOG
+fprintf(dbg, "Inserting %u bytes at position %u\n", ulLength, ulPosition );
+fprintf(dbg, " Buffer size:   %u\n", pText->ulSize );
+fprintf(dbg, " Span 1 length: %u\n", pText->ulSp1Len );
+fprintf(dbg, " Gap length:    %u\n", pText->ulGapLen );
+fprintf(dbg, " Span 2 length: %u\n", pText->ulSp2Len );
+fprintf(dbg, " Text size:     %u\n", TEXTLEN( *pText ));
+fprintf(dbg, " First free:    %u\n", TEXTEND( *pText ));
+#endif
+*/
+
+    if (( TEXTPOS2ABS( *pText, ulPosition ) == TEXTEND( *pText )) &&
+          (( TEXTEND( *pText ) + ulLength ) < pText->ulSize ) && pText->ulSp2Len )
+    {
+        /* A cheap but useful optimization: if the insert position is just
+         * after the last value, and there's enough space left at the end of
+         * the buffer, then don't bother moving the gap - just append the new
+         * data to the post-gap text.
+         */
+        unsigned long cbAddr = TEXTPOS2ABS( *pText, ulPosition );
+
+        if ( ulLength == 1 )
+            pText->pchContents[ cbAddr ] = *pch;
+        else
+            memcpy( pText->pchContents + cbAddr, pch, ulLength );
+        pText->ulSp2Len += ulLength;
+    }
+
+    else {
+        // TODO Optimize somehow by combining MoveGap and ResetGap when appropriate
+        if ( ulPosition != pText->ulSp1Len )
+            if ( ! MoveGap( pText, ulPosition )) return 0;
+        if ( pText->ulGapLen < ulLength )
+            if ( ! ResetGap( pText, ulLength )) return 0;
+
+        if ( ulLength == 1 )
+            pText->pchContents[ ulPosition ] = *pch;
+        else
+            memcpy( pText->pchContents + ulPosition, pch, ulLength );
+        pText->ulSp1Len += ulLength;
+        pText->ulGapLen -= ulLength;
+    }
+
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * GapBuffer_Length()                                                        *
+ *                                                                           *
+ * Returns the length of the text within the buffer.                         *
+ * ------------------------------------------------------------------------- */
+unsigned long GapBuffer_Length( PTEXT pText )
+{
+    if ( !pText ) return 0;
+    return ( TEXTLEN(*pText) );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * GapBuffer_Sequence                                                        *
+ *                                                                           *
+ * Writes a character sequence (string) of the requested length, starting at *
+ * at the specified position.  Returns the number of bytes written (which    *
+ * may be less than the requested length if the end of the text is reached.) *
+ * ------------------------------------------------------------------------- */
+unsigned long GapBuffer_Sequence( PTEXT pText, unsigned char *pchText, unsigned long ulPosition, unsigned long ulLength )
+{
+    unsigned long cbFirst;      // Number of bytes copied from before the gap
+
+    if ( !pchText ) return 0;
+    if ( ulPosition >= TEXTLEN( *pText )) return 0;
+    if ( ulLength > ( TEXTLEN( *pText ) - ulPosition ))
+        ulLength = TEXTLEN( *pText ) - ulPosition;
+
+    cbFirst = 0;
+    if ( ulPosition < pText->ulSp1Len ) {
+        cbFirst = pText->ulSp1Len - ulPosition;
+        if ( cbFirst > ulLength ) cbFirst = ulLength;
+        memcpy( pchText, pText->pchContents + ulPosition, cbFirst );
+    }
+    if ( ulLength > cbFirst )
+        memcpy( pchText + cbFirst,
+                pText->pchContents + TEXTPOS2ABS( *pText, ulPosition + cbFirst ),
+                ulLength - cbFirst );
+    return ulLength;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * GapBuffer_GetSpans                                                        *
+ *                                                                           *
+ * Returns the requested range as (at most) two spans: the part before the   *
+ * gap, and the part after it.                                               *
+ * ------------------------------------------------------------------------- */
+int GapBuffer_GetSpans( PTEXT pText, unsigned long ulPosition, unsigned long ulLength, PTEXTSPAN pSpan1, PTEXTSPAN pSpan2 )
+{
+    unsigned long ulChunk;
+
+    if ( !pText->pchContents || ( ulPosition >= TEXTLEN( *pText ))) return 0;
+    if ( ulLength > ( TEXTLEN( *pText ) - ulPosition ))
+        ulLength = TEXTLEN( *pText ) - ulPosition;
+
+    if ( ulPosition >= pText->ulSp1Len ) {
+        pSpan1->pch = pText->pchContents + TEXTPOS2ABS( *pText, ulPosition );
+        pSpan1->cb  = ulLength;
+        return 1;
+    }
+
+    ulChunk = pText->ulSp1Len - ulPosition;
+    if ( ulChunk >= ulLength ) {
+        pSpan1->pch = pText->pchContents + ulPosition;
+        pSpan1->cb  = ulLength;
+        return 1;
+    }
+    pSpan1->pch = pText->pchContents + ulPosition;
+    pSpan1->cb  = ulChunk;
+    pSpan2->pch = pText->pchContents + pText->ulSp1Len + pText->ulGapLen;
+    pSpan2->cb  = ulLength - ulChunk;
+    return 2;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * GapBuffer_GetView                                                         *
+ *                                                                           *
+ * Returns a pointer to the requested range as a single contiguous string.   *
+ * If the gap currently falls within the range, it is moved to whichever end *
+ * of the range requires the fewest bytes to be shifted.                     *
+ * ------------------------------------------------------------------------- */
+unsigned char *GapBuffer_GetView( PTEXT pText, unsigned long ulPosition, unsigned long ulLength )
+{
+    unsigned long ulEnd;
+
+    if ( !pText->pchContents || ( ulPosition >= TEXTLEN( *pText ))) return NULL;
+    if ( ulLength > ( TEXTLEN( *pText ) - ulPosition ))
+        ulLength = TEXTLEN( *pText ) - ulPosition;
+    ulEnd = ulPosition + ulLength;
+
+    if (( ulPosition < pText->ulSp1Len ) && ( ulEnd > pText->ulSp1Len )) {
+        if (( pText->ulSp1Len - ulPosition ) <= ( ulEnd - pText->ulSp1Len )) {
+            if ( ! MoveGap( pText, ulPosition )) return NULL;
+        }
+        else if ( ! MoveGap( pText, ulEnd )) return NULL;
+    }
+    return ( pText->pchContents + TEXTPOS2ABS( *pText, ulPosition ));
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * GapBuffer_Reserve                                                         *
+ *                                                                           *
+ * Enlarges the buffer to exactly the size required to hold the given total  *
+ * amount of text, if it is not already that large.                          *
+ * ------------------------------------------------------------------------- */
+int GapBuffer_Reserve( PTEXT pText, unsigned long cbText )
+{
+    if ( cbText <= pText->ulSize ) return 1;
+    return ExpandBuffer( pText, cbText );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * GapBuffer_ApplyEdits                                                      *
+ *                                                                           *
+ * Applies a sorted batch of edits by building the new text in a fresh       *
+ * buffer, in a single left-to-right pass: each unchanged run of the old     *
+ * text is copied across once, followed by the text inserted by the next     *
+ * edit.  The gap is left at the end of the last edit, on the assumption     *
+ * that editing will probably continue from there.  The old buffer is only   *
+ * freed once the new one is complete, so a failure leaves the text intact.  *
+ * ------------------------------------------------------------------------- */
+int GapBuffer_ApplyEdits( PTEXT pText, PTEXTEDIT pEdits, unsigned long ulCount, unsigned long cbNewText )
+{
+    unsigned char *pchNew;
+    unsigned long ulNewSize,
+                  ulOld,        // Current position in the old text
+                  ulNew,        // Current position in the new text
+                  cbTail,       // Length of the old text after the last edit
+                  i;
+
+    if ( !pText->pchContents ) return 0;
+
+    ulNewSize = next_buffer_size( &(pText->hdr), cbNewText, cbNewText );
+    pchNew = (unsigned char *) allocate_memory( pText->hdr.pAllocator, ulNewSize );
+    if ( !pchNew ) return 0;
+
+    ulOld = 0;
+    ulNew = 0;
+    for ( i = 0; i < ulCount; i++ ) {
+        ulNew += GapBuffer_Sequence( pText, pchNew + ulNew, ulOld, pEdits[ i ].ulPosition - ulOld );
+        if ( pEdits[ i ].cbInsert ) {
+            memcpy( pchNew + ulNew, pEdits[ i ].pchInsert, pEdits[ i ].cbInsert );
+            ulNew += pEdits[ i ].cbInsert;
+        }
+        ulOld = pEdits[ i ].ulPosition + pEdits[ i ].cbDelete;
+    }
+    cbTail = TEXTLEN( *pText ) - ulOld;
+    if ( cbTail ) GapBuffer_Sequence( pText, pchNew + ulNewSize - cbTail, ulOld, cbTail );
+
+    free_memory( pText->hdr.pAllocator, pText->pchContents );
+    pText->pchContents = pchNew;
+    pText->ulSize      = ulNewSize;
+    pText->ulSp1Len    = ulNew;
+    pText->ulSp2Len    = cbTail;
+    pText->ulGapLen    = ulNewSize - cbNewText;
+    POISON_GAP( pText );
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * GapBuffer_Adopt                                                           *
+ *                                                                           *
+ * Takes over a freshly built buffer as the new contents.  The text already  *
+ * occupies the start of the buffer, so the gap is simply the rest of it.    *
+ * ------------------------------------------------------------------------- */
+int GapBuffer_Adopt( PTEXT pText, unsigned char *pchBuffer, unsigned long cbText, unsigned long cbBuffer )
+{
+    if ( !pchBuffer || ( cbText > cbBuffer )) return 0;
+
+    if ( pText->pchContents ) free_memory( pText->hdr.pAllocator, pText->pchContents );
+    pText->pchContents = pchBuffer;
+    pText->ulSize      = cbBuffer;
+    pText->ulSp1Len    = cbText;
+    pText->ulSp2Len    = 0;
+    pText->ulGapLen    = cbBuffer - cbText;
+    POISON_GAP( pText );
+    return 1;
+}
+
@@ -0,0 +1,212 @@
+/*****************************************************************************
+ * textimpl.h                                                                *
+ *                                                                           *
+ * Internal interface shared between the public text sequence functions (in  *
+ * textseq.c) and the various text model implementations.  This file should  *
+ * not be included by application code, which should only ever use the       *
+ * opaque EDITORTEXT type and the functions declared in textseq.h.           *
+ *                                                                           *
+ * Every model implementation defines its own data structure, but the first  *
+ * member of that structure must always be a TEXTHDR.  The header identifies *
+ * the model and points to the table of functions which implement it; the    *
+ * public functions simply look up the appropriate entry and pass the call   *
+ * through.                                                                  *
+ *                                                                           *
+ * textseq.h must be included before this file.                              *
+ *                                                                           *
+ *****************************************************************************/
+
+
+// ---------------------------------------------------------------------------
+// TYPEDEFS
+//
+
+// Function types implementing a particular text model.  The arguments and
+// return values correspond exactly to the like-named public functions.
+//
+typedef unsigned char (*PFNTEXTBYTEAT)( void *pText, unsigned long ulPosition );
+typedef int           (*PFNTEXTCLEAR)( void *pText );
+typedef int           (*PFNTEXTDELETE)( void *pText, unsigned long ulPosition, unsigned long ulLength );
+typedef int           (*PFNTEXTDESTROY)( void *pText );
+typedef int           (*PFNTEXTINIT)( void *pText, unsigned char *pchText, unsigned long cbText );
+typedef int           (*PFNTEXTINSERT)( void *pText, unsigned char *pch, unsigned long ulPosition, unsigned long ulLength );
+typedef unsigned long (*PFNTEXTLENGTH)( void *pText );
+typedef unsigned long (*PFNTEXTSEQUENCE)( void *pText, unsigned char *pchText, unsigned long ulPosition, unsigned long ulLength );
+typedef unsigned long (*PFNTEXTLINEFROMOFFSET)( void *pText, unsigned long ulPosition );
+typedef unsigned long (*PFNTEXTLINEOFFSET)( void *pText, unsigned long ulLine );
+typedef int           (*PFNTEXTGETSPANS)( void *pText, unsigned long ulPosition, unsigned long ulLength, PTEXTSPAN pSpan1, PTEXTSPAN pSpan2 );
+typedef unsigned char *(*PFNTEXTGETVIEW)( void *pText, unsigned long ulPosition, unsigned long ulLength );
+typedef int           (*PFNTEXTRESERVE)( void *pText, unsigned long cbText );
+typedef int           (*PFNTEXTINITSHARED)( void *pText, unsigned char *pchText, unsigned long cbText );
+typedef int           (*PFNTEXTINITFILE)( void *pText, const char *pszFile );
+typedef int           (*PFNTEXTQUERYSTATS)( void *pText, PTEXTSTATS pStats );
+typedef int           (*PFNTEXTAPPLYEDITS)( void *pText, PTEXTEDIT pEdits, unsigned long ulCount, unsigned long cbNewText );
+typedef int           (*PFNTEXTSNAPSHOT)( void *pText, void *pSnapshot );
+typedef int           (*PFNTEXTADOPT)( void *pText, unsigned char *pchBuffer, unsigned long cbText, unsigned long cbBuffer );
+
+
+// Table of functions implementing a particular text model.  The line lookup
+// functions are optional; a model which does not index its line breaks may
+// leave them NULL, in which case textseq.c falls back to scanning the text.
+// Likewise, a model which can only provide a contiguous view of text that is
+// already stored contiguously may leave pfnGetView NULL, and a model which
+// has no use for a size hint may leave pfnReserve NULL.
+//
+// pfnInitShared is like pfnInit, except that the model should use the given
+// text in place as its (read-only) initial contents rather than copying it.
+// The text belongs to textseq.c, which keeps it valid until the model has
+// been cleared, destroyed or re-initialized; the model must never write to
+// or free it.  Models which cannot do this leave the entry NULL, and are
+// initialized with a private copy instead.
+//
+// pfnInitFile is for models which read their files themselves, rather than
+// having textseq.c map them into memory.  If present, TextInitFromFile()
+// calls it in preference to pfnInitShared.  pfnQueryStats is also optional.
+//
+// pfnApplyEdits receives a batch of edits which textseq.c has already sorted
+// and validated (and whose lShift fields are filled in), along with the
+// resulting length of the text.  Models which leave it NULL have the edits
+// applied one at a time, from last to first.
+//
+// pfnSnapshot makes pSnapshot (a newly created, empty object of the same
+// model) share the current contents of pText, without copying them.  From
+// then on, neither object may change any storage that the other can see,
+// and the storage must only be freed by whichever of them lets go of it
+// last (see atomic_decrement).  textseq.c prevents the snapshot itself from
+// being modified.  Models which cannot share their storage leave it NULL.
+//
+// pfnAdopt replaces the contents with a buffer of cbBuffer bytes, obtained
+// from allocate_memory() with the text's allocator, whose first cbText
+// bytes are the new text.  If it succeeds the model owns the buffer (and may
+// use the rest of it as free space); if it fails the buffer still belongs to
+// the caller and the text must be unchanged.  Models which leave it NULL
+// are re-initialized with a copy of the text instead.
+//
+typedef struct _text_model {
+    unsigned long         cbText;       // Size of the model's data structure
+    PFNTEXTBYTEAT         pfnByteAt;
+    PFNTEXTCLEAR          pfnClear;
+    PFNTEXTDELETE         pfnDelete;
+    PFNTEXTDESTROY        pfnDestroy;
+    PFNTEXTINIT           pfnInit;
+    PFNTEXTINSERT         pfnInsert;
+    PFNTEXTLENGTH         pfnLength;
+    PFNTEXTSEQUENCE       pfnSequence;
+    PFNTEXTLINEFROMOFFSET pfnLineFromOffset;    // optional
+    PFNTEXTLINEOFFSET     pfnLineOffset;        // optional
+    PFNTEXTGETSPANS       pfnGetSpans;
+    PFNTEXTGETVIEW        pfnGetView;           // optional
+    PFNTEXTRESERVE        pfnReserve;           // optional
+    PFNTEXTINITSHARED     pfnInitShared;        // optional
+    PFNTEXTINITFILE       pfnInitFile;          // optional
+    PFNTEXTQUERYSTATS     pfnQueryStats;        // optional
+    PFNTEXTAPPLYEDITS     pfnApplyEdits;        // optional
+    PFNTEXTSNAPSHOT       pfnSnapshot;          // optional
+    PFNTEXTADOPT          pfnAdopt;             // optional
+} TEXTMODEL, *PTEXTMODEL;
+
+
+// Common header which begins every model's data structure.
+//
+typedef struct _text_header {
+    const TEXTMODEL *pModel;            // Functions implementing this model
+    int              iModel;            // Model identifier (TEXT_MODEL_*)
+    unsigned short   usGrowPercent;     // Buffer growth factor (percent)
+    unsigned long    cbGrowLimit;       // Maximum growth increment (0 = none)
+    void            *pMapped;           // File view shared with the model
+    unsigned long    cbMapped;          // Length of the file view
+    unsigned long    cbCacheLimit;      // Page cache budget (paged model) or hot set (block)
+    int              fSnapshot;         // Object is a read-only snapshot
+    unsigned long    cbElement;         // Size of one element (see TextSetElementSize)
+    PTEXTALLOCATOR   pAllocator;        // Source of all the object's memory (NULL = system)
+} TEXTHDR, *PTEXTHDR;
+
+
+// Page cache used by the paged model (opaque; see textpage.c).
+//
+typedef struct _page_cache *PPAGECACHE;
+
+
+// ---------------------------------------------------------------------------
+// CONSTANTS
+//
+
+// Default buffer growth policy (see TextSetGrowth)
+#define GROWTH_DEFAULT_PERCENT  200         // double the size each time...
+#define GROWTH_DEFAULT_LIMIT    0x2000000   // ...but by no more than 32 MB
+#define GROWTH_MINIMUM          8192        // smallest growth increment
+#define GROWTH_MAX_PERCENT      1000        // largest permitted growth factor
+
+// Page cache parameters (see TextSetCacheLimit)
+#define PAGE_SIZE               0x10000     // size of one file page
+#define PAGE_MINIMUM_COUNT      2           // fewest pages kept resident
+#define PAGE_DEFAULT_LIMIT      0x400000    // default budget (64 pages)
+
+
+// ---------------------------------------------------------------------------
+// MACROS
+//
+
+// Determine if a character unit (wchar_t) is a hard line break.  This must
+// agree with NEWLINE_CHAR in byteparse.h; note that a CR immediately followed
+// by an LF is treated as a single line break.
+#define IS_LINEBREAK( c )   ((( c ) >= 0xA && ( c ) <= 0xD ) || ( c ) == 0x2028 || ( c ) == 0x2029 )
+
+// Determine if a byte count or position is a whole number of the text's
+// elements.  As long as every edit is, each span of the text (and hence the
+// gap, and every piece or leaf boundary) also falls on an element boundary.
+#define IS_ELEMENTS( pHdr, ul )     ((( ul ) % ( pHdr )->cbElement ) == 0 )
+
+
+// ---------------------------------------------------------------------------
+// FUNCTION DECLARATIONS
+//
+
+// Memory allocation (textseq.c).  Models pass their hdr.pAllocator, or NULL
+// for memory taken straight from the system.  The _small functions are for
+// objects created and freed in large numbers (such as tree nodes), which the
+// system allocator takes from the C runtime heap instead of giving each of
+// them pages of its own.
+void *allocate_memory( PTEXTALLOCATOR pAlloc, size_t size );
+void  free_memory( PTEXTALLOCATOR pAlloc, void *pObj );
+void *reallocate_memory( PTEXTALLOCATOR pAlloc, void *pObj, size_t cbOld, size_t cbNew );
+void *allocate_small( PTEXTALLOCATOR pAlloc, size_t size );
+void  free_small( PTEXTALLOCATOR pAlloc, void *pObj );
+
+// Read-only file views (textseq.c)
+int   map_file( const char *pszFile, void **ppView, unsigned long *pcbView );
+void  unmap_file( void *pView, unsigned long cbView );
+
+// File access (textseq.c)
+int           open_file( const char *pszFile, unsigned long *phFile, unsigned long *pcbFile );
+int           create_file( const char *pszFile, unsigned long *phFile );
+unsigned long read_file( unsigned long hFile, unsigned long ulOffset, void *pBuffer, unsigned long cb );
+int           write_file( unsigned long hFile, PTEXTSPAN pSpans, unsigned long ulSpans );
+void          close_file( unsigned long hFile );
+
+// Page cache (textpage.c)
+PPAGECACHE     PageCache_Open( const char *pszFile, unsigned long cbLimit, PTEXTALLOCATOR pAlloc, unsigned long *pcbFile );
+void           PageCache_Close( PPAGECACHE pCache );
+unsigned char *PageCache_Get( PPAGECACHE pCache, unsigned long ulOffset, unsigned long *pcbAvail );
+void           PageCache_QueryStats( PPAGECACHE pCache, PTEXTSTATS pStats );
+
+// Reference counts shared between threads (textseq.c)
+unsigned long atomic_increment( volatile unsigned long *pulValue );
+unsigned long atomic_decrement( volatile unsigned long *pulValue );
+unsigned long atomic_read( volatile unsigned long *pulValue );
+
+// Buffer growth policy (textseq.c)
+unsigned long next_buffer_size( PTEXTHDR pHdr, unsigned long cbCurrent, unsigned long cbRequired );
+
+
+// ---------------------------------------------------------------------------
+// MODEL TABLES
+//
+
+extern const TEXTMODEL GapBufferModel;      // textgap.c
+extern const TEXTMODEL PieceTableModel;     // textpt.c
+extern const TEXTMODEL PagedModel;          // textpt.c
+extern const TEXTMODEL RopeModel;           // textrope.c
+extern const TEXTMODEL Utf8Model;           // textutf8.c
+extern const TEXTMODEL BlockModel;          // textblock.c
+
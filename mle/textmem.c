@@ -0,0 +1,514 @@
+/*****************************************************************************
+ * textmem.c                                                                 *
+ *                                                                           *
+ * Implements the arena and pool allocators (see textmem.h).                 *
+ *                                                                           *
+ * Each allocator structure begins with its TEXTALLOCATOR, and passes itself *
+ * as the allocator's pUser, so the functions below can find it from either. *
+ * Chunks and slabs are obtained from the system with allocate_memory().     *
+ *                                                                           *
+ * Every pool block is preceded by a header giving the index of its size, so *
+ * that it can be returned to the right list when it is freed.  Blocks which *
+ * are free hold the link to the next free block of the same size.           *
+ *                                                                           *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <stddef.h>
+
+#include "debug.h"
+#include "textseq.h"
+#include "textimpl.h"
+#include "textmem.h"
+
+
+// ---------------------------------------------------------------------------
+// CONSTANTS
+//
+
+#define POOL_SMALLEST_SHIFT 4               // smallest pool block is 16 bytes
+#define POOL_SIZES          11              // number of block sizes (16 bytes to 16 kB)
+#define POOL_LARGE          0xFFFFFFFFUL    // size index of a block from the system
+
+
+// ---------------------------------------------------------------------------
+// TYPEDEFS
+//
+
+// A chunk of memory from which an arena allocates.
+//
+typedef struct _arena_chunk {
+    struct _arena_chunk *pNext;     // Next chunk in the list
+    unsigned long       cbSize,     // Bytes of data the chunk holds
+                        cbUsed;     // Bytes allocated from it
+} ARENACHUNK, *PARENACHUNK;
+
+
+// An arena.
+//
+typedef struct _arena {
+    TEXTALLOCATOR alloc;            // Allocator passed to the text functions (must be first)
+    PARENACHUNK   pChunks,          // Ordinary chunks, the one in use first
+                  pLarge;           // Chunks holding a single large block
+    unsigned long cbChunk;          // Size of an ordinary chunk
+    unsigned char *pbLast;          // Block allocated most recently (or NULL)
+    unsigned long cbLast;           // Its size, rounded up
+} ARENA, *PARENA;
+
+
+// The header in front of each pool block.
+//
+typedef union _pool_header {
+    struct {
+        unsigned long ulSize,       // Index of the block's size (or POOL_LARGE)
+                      cb;           // Bytes obtained from the system (large blocks)
+    } info;
+    double dAlign;                  // (keeps the block which follows aligned)
+} POOLHEADER, *PPOOLHEADER;
+
+
+// A pool block which is not in use.
+//
+typedef struct _pool_free {
+    struct _pool_free *pNext;       // Next free block of the same size
+} POOLFREE, *PPOOLFREE;
+
+
+// A slab of memory carved into pool blocks.
+//
+typedef struct _pool_slab {
+    struct _pool_slab *pNext;       // Next slab in the list
+} POOLSLAB, *PPOOLSLAB;
+
+
+// A pool.
+//
+typedef struct _pool {
+    TEXTALLOCATOR alloc;                // Allocator passed to the text functions (must be first)
+    PPOOLSLAB     pSlabs;               // All slabs obtained
+    PPOOLFREE     apFree[ POOL_SIZES ]; // Free blocks of each size
+} POOL, *PPOOL;
+
+
+// ---------------------------------------------------------------------------
+// MACROS
+//
+
+// Round a size up to a multiple of 8 bytes
+#define ALIGN8( cb )        ((( cb ) + 7 ) & ~7UL )
+
+// Size of a chunk or slab header, and the first byte after it
+#define CHUNK_HEADER        ALIGN8( sizeof( ARENACHUNK ))
+#define CHUNK_DATA( c )     ((unsigned char *)( c ) + CHUNK_HEADER )
+#define SLAB_HEADER         ALIGN8( sizeof( POOLSLAB ))
+
+// Size of the pool blocks with the given index (including the header)
+#define POOL_BLOCK_SIZE( i )    ( 1UL << (( i ) + POOL_SMALLEST_SHIFT ))
+
+
+// ---------------------------------------------------------------------------
+// FUNCTION DECLARATIONS
+//
+
+void        *Arena_Allocate( void *pUser, unsigned long cb );
+PARENACHUNK Arena_NewChunk( PARENA pArena, unsigned long cb );
+void        Arena_Release( void *pUser, void *pObj );
+void        Arena_ReleaseChunks( PARENA pArena, PARENACHUNK pChunk );
+void        *Arena_Resize( void *pUser, void *pObj, unsigned long cbOld, unsigned long cbNew );
+void        *Pool_Allocate( void *pUser, unsigned long cb );
+int         Pool_Refill( PPOOL pPool, unsigned long ulSize );
+void        Pool_Release( void *pUser, void *pObj );
+void        *Pool_Resize( void *pUser, void *pObj, unsigned long cbOld, unsigned long cbNew );
+unsigned long Pool_SizeIndex( unsigned long cb );
+
+
+// ===========================================================================
+// INTERNAL FUNCTIONS
+// ===========================================================================
+
+
+/* ------------------------------------------------------------------------- *
+ * Arena_Allocate()                                                          *
+ *                                                                           *
+ * Allocates a block from the arena (the pfnAlloc function of an arena).     *
+ * ------------------------------------------------------------------------- */
+void *Arena_Allocate( void *pUser, unsigned long cb )
+{
+    PARENA        pArena = (PARENA) pUser;
+    PARENACHUNK   pChunk;
+    unsigned char *pb;
+
+    cb = cb ? ALIGN8( cb ) : 8;
+
+    // A large block gets a chunk to itself, so it can be released on its own
+    if ( cb > pArena->cbChunk / 4 ) {
+        pChunk = Arena_NewChunk( pArena, cb );
+        if ( !pChunk ) return NULL;
+        pChunk->cbUsed = cb;
+        pChunk->pNext  = pArena->pLarge;
+        pArena->pLarge = pChunk;
+        return CHUNK_DATA( pChunk );
+    }
+
+    // Anything else comes from the current chunk, or a new one if it is full
+    pChunk = pArena->pChunks;
+    if ( !pChunk || ( pChunk->cbSize - pChunk->cbUsed < cb )) {
+        pChunk = Arena_NewChunk( pArena, pArena->cbChunk );
+        if ( !pChunk ) return NULL;
+        pChunk->pNext   = pArena->pChunks;
+        pArena->pChunks = pChunk;
+    }
+    pb = CHUNK_DATA( pChunk ) + pChunk->cbUsed;
+    pChunk->cbUsed += cb;
+    pArena->pbLast  = pb;
+    pArena->cbLast  = cb;
+    return pb;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Arena_NewChunk()                                                          *
+ *                                                                           *
+ * Obtains a chunk holding cb bytes from the system.                         *
+ * ------------------------------------------------------------------------- */
+PARENACHUNK Arena_NewChunk( PARENA pArena, unsigned long cb )
+{
+    PARENACHUNK pChunk;
+
+    pChunk = (PARENACHUNK) allocate_memory( NULL, CHUNK_HEADER + cb );
+    if ( !pChunk ) return NULL;
+    pChunk->cbSize = cb;
+    pChunk->cbUsed = 0;
+    pArena->alloc.cbReserved += CHUNK_HEADER + cb;
+    return pChunk;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Arena_Release()                                                           *
+ *                                                                           *
+ * Frees a block (the pfnFree function of an arena).  Only the most recent   *
+ * block, or one with a chunk of its own, is actually given back.            *
+ * ------------------------------------------------------------------------- */
+void Arena_Release( void *pUser, void *pObj )
+{
+    PARENA      pArena = (PARENA) pUser;
+    PARENACHUNK *ppChunk,
+                pChunk;
+
+    if ( !pObj ) return;
+    if ( pObj == pArena->pbLast ) {
+        pArena->pChunks->cbUsed -= pArena->cbLast;
+        pArena->pbLast = NULL;
+        return;
+    }
+    for ( ppChunk = &pArena->pLarge; *ppChunk; ppChunk = &( (*ppChunk)->pNext )) {
+        if ( CHUNK_DATA( *ppChunk ) == pObj ) {
+            pChunk   = *ppChunk;
+            *ppChunk = pChunk->pNext;
+            pArena->alloc.cbReserved -= CHUNK_HEADER + pChunk->cbSize;
+            free_memory( NULL, pChunk );
+            return;
+        }
+    }
+    // Anything else stays allocated until the arena is reset
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Arena_ReleaseChunks()                                                     *
+ *                                                                           *
+ * Gives a list of chunks back to the system.                                *
+ * ------------------------------------------------------------------------- */
+void Arena_ReleaseChunks( PARENA pArena, PARENACHUNK pChunk )
+{
+    PARENACHUNK pNext;
+
+    for ( ; pChunk; pChunk = pNext ) {
+        pNext = pChunk->pNext;
+        pArena->alloc.cbReserved -= CHUNK_HEADER + pChunk->cbSize;
+        free_memory( NULL, pChunk );
+    }
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Arena_Resize()                                                            *
+ *                                                                           *
+ * Resizes a block (the pfnRealloc function of an arena).  The most recent   *
+ * block can grow in place while there is room for it in the current chunk,  *
+ * and any block can shrink in place; otherwise the contents are copied to a *
+ * new block.                                                                *
+ * ------------------------------------------------------------------------- */
+void *Arena_Resize( void *pUser, void *pObj, unsigned long cbOld, unsigned long cbNew )
+{
+    PARENA        pArena = (PARENA) pUser;
+    PARENACHUNK   pChunk;
+    unsigned long cbAligned;
+    void          *pNew;
+
+    cbAligned = cbNew ? ALIGN8( cbNew ) : 8;
+    if (( pObj == pArena->pbLast ) && ( cbAligned <= pArena->cbChunk / 4 )) {
+        pChunk = pArena->pChunks;
+        if ( cbAligned <= pArena->cbLast + pChunk->cbSize - pChunk->cbUsed ) {
+            pChunk->cbUsed = pChunk->cbUsed - pArena->cbLast + cbAligned;
+            pArena->cbLast = cbAligned;
+            return pObj;
+        }
+    }
+    else if ( cbNew <= cbOld )
+        return pObj;
+
+    pNew = Arena_Allocate( pUser, cbNew );
+    if ( !pNew ) return NULL;
+    memcpy( pNew, pObj, ( cbOld < cbNew ) ? cbOld : cbNew );
+    Arena_Release( pUser, pObj );
+    return pNew;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Pool_Allocate()                                                           *
+ *                                                                           *
+ * Allocates a block from the pool (the pfnAlloc function of a pool).        *
+ * ------------------------------------------------------------------------- */
+void *Pool_Allocate( void *pUser, unsigned long cb )
+{
+    PPOOL         pPool = (PPOOL) pUser;
+    PPOOLHEADER   pHeader;
+    unsigned long ulSize;
+
+    ulSize = Pool_SizeIndex( cb );
+    if ( ulSize == POOL_LARGE ) {
+        pHeader = (PPOOLHEADER) allocate_memory( NULL, sizeof( POOLHEADER ) + cb );
+        if ( !pHeader ) return NULL;
+        pHeader->info.cb = sizeof( POOLHEADER ) + cb;
+        pPool->alloc.cbReserved += pHeader->info.cb;
+    }
+    else {
+        if ( !pPool->apFree[ ulSize ] && !Pool_Refill( pPool, ulSize ))
+            return NULL;
+        pHeader = (PPOOLHEADER) pPool->apFree[ ulSize ];
+        pPool->apFree[ ulSize ] = pPool->apFree[ ulSize ]->pNext;
+        pHeader->info.cb = 0;
+    }
+    pHeader->info.ulSize = ulSize;
+    return pHeader + 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Pool_Refill()                                                             *
+ *                                                                           *
+ * Obtains a new slab and divides it into free blocks of the given size.     *
+ * ------------------------------------------------------------------------- */
+int Pool_Refill( PPOOL pPool, unsigned long ulSize )
+{
+    PPOOLSLAB     pSlab;
+    PPOOLFREE     pFree;
+    unsigned long cbBlock,
+                  ulOffset;
+
+    pSlab = (PPOOLSLAB) allocate_memory( NULL, POOL_SLAB_SIZE );
+    if ( !pSlab ) return 0;
+    pSlab->pNext  = pPool->pSlabs;
+    pPool->pSlabs = pSlab;
+    pPool->alloc.cbReserved += POOL_SLAB_SIZE;
+
+    cbBlock = POOL_BLOCK_SIZE( ulSize );
+    for ( ulOffset = SLAB_HEADER; ulOffset + cbBlock <= POOL_SLAB_SIZE; ulOffset += cbBlock ) {
+        pFree = (PPOOLFREE)( (unsigned char *) pSlab + ulOffset );
+        pFree->pNext = pPool->apFree[ ulSize ];
+        pPool->apFree[ ulSize ] = pFree;
+    }
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Pool_Release()                                                            *
+ *                                                                           *
+ * Frees a block (the pfnFree function of a pool), putting it back on the    *
+ * list for its size, or giving it back to the system if it came from there. *
+ * ------------------------------------------------------------------------- */
+void Pool_Release( void *pUser, void *pObj )
+{
+    PPOOL         pPool = (PPOOL) pUser;
+    PPOOLHEADER   pHeader;
+    PPOOLFREE     pFree;
+    unsigned long ulSize;
+
+    if ( !pObj ) return;
+    pHeader = (PPOOLHEADER) pObj - 1;
+    ulSize  = pHeader->info.ulSize;
+    if ( ulSize == POOL_LARGE ) {
+        pPool->alloc.cbReserved -= pHeader->info.cb;
+        free_memory( NULL, pHeader );
+        return;
+    }
+    pFree = (PPOOLFREE) pHeader;
+    pFree->pNext = pPool->apFree[ ulSize ];
+    pPool->apFree[ ulSize ] = pFree;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Pool_Resize()                                                             *
+ *                                                                           *
+ * Resizes a block (the pfnRealloc function of a pool).  The block is kept   *
+ * if the new size rounds up to the same one; otherwise the contents are     *
+ * copied to a new block.                                                    *
+ * ------------------------------------------------------------------------- */
+void *Pool_Resize( void *pUser, void *pObj, unsigned long cbOld, unsigned long cbNew )
+{
+    PPOOLHEADER pHeader;
+    void        *pNew;
+
+    pHeader = (PPOOLHEADER) pObj - 1;
+    if (( pHeader->info.ulSize != POOL_LARGE ) &&
+        ( pHeader->info.ulSize == Pool_SizeIndex( cbNew )))
+        return pObj;
+
+    pNew = Pool_Allocate( pUser, cbNew );
+    if ( !pNew ) return NULL;
+    memcpy( pNew, pObj, ( cbOld < cbNew ) ? cbOld : cbNew );
+    Pool_Release( pUser, pObj );
+    return pNew;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Pool_SizeIndex()                                                          *
+ *                                                                           *
+ * Returns the index of the smallest pool block which will hold cb bytes     *
+ * along with its header, or POOL_LARGE if none will.                        *
+ * ------------------------------------------------------------------------- */
+unsigned long Pool_SizeIndex( unsigned long cb )
+{
+    unsigned long ulSize;
+
+    if ( cb > POOL_LARGEST_BLOCK - sizeof( POOLHEADER )) return POOL_LARGE;
+    cb += sizeof( POOLHEADER );
+    for ( ulSize = 0; POOL_BLOCK_SIZE( ulSize ) < cb; ulSize++ );
+    return ulSize;
+}
+
+
+// ===========================================================================
+// PUBLIC FUNCTIONS
+// ===========================================================================
+
+
+/* ------------------------------------------------------------------------- *
+ * Arena_Create()                                                            *
+ *                                                                           *
+ * See textmem.h                                                             *
+ * ------------------------------------------------------------------------- */
+int Arena_Create( PTEXTALLOCATOR *ppAlloc, unsigned long cbChunk )
+{
+    PARENA pArena;
+
+    if ( !ppAlloc ) return 0;
+    if ( !cbChunk ) cbChunk = ARENA_DEFAULT_CHUNK;
+    if ( cbChunk < ARENA_MINIMUM_CHUNK ) cbChunk = ARENA_MINIMUM_CHUNK;
+
+    pArena = (PARENA) allocate_small( NULL, sizeof( ARENA ));
+    if ( !pArena ) return 0;
+    pArena->cbChunk          = ALIGN8( cbChunk );
+    pArena->alloc.pfnAlloc   = Arena_Allocate;
+    pArena->alloc.pfnFree    = Arena_Release;
+    pArena->alloc.pfnRealloc = Arena_Resize;
+    pArena->alloc.pUser      = pArena;
+
+    *ppAlloc = &( pArena->alloc );
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Arena_Free()                                                              *
+ *                                                                           *
+ * See textmem.h                                                             *
+ * ------------------------------------------------------------------------- */
+int Arena_Free( PTEXTALLOCATOR *ppAlloc )
+{
+    PARENA pArena;
+
+    if ( !ppAlloc || !*ppAlloc ) return 0;
+    pArena = (PARENA) (*ppAlloc)->pUser;
+    Arena_ReleaseChunks( pArena, pArena->pLarge );
+    Arena_ReleaseChunks( pArena, pArena->pChunks );
+    free_small( NULL, pArena );
+    *ppAlloc = NULL;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Arena_Reset()                                                             *
+ *                                                                           *
+ * See textmem.h                                                             *
+ * ------------------------------------------------------------------------- */
+int Arena_Reset( PTEXTALLOCATOR pAlloc )
+{
+    PARENA pArena;
+
+    if ( !pAlloc ) return 0;
+    pArena = (PARENA) pAlloc->pUser;
+    Arena_ReleaseChunks( pArena, pArena->pLarge );
+    pArena->pLarge = NULL;
+    if ( pArena->pChunks ) {
+        Arena_ReleaseChunks( pArena, pArena->pChunks->pNext );
+        pArena->pChunks->pNext  = NULL;
+        pArena->pChunks->cbUsed = 0;
+    }
+    pArena->pbLast = NULL;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Pool_Create()                                                             *
+ *                                                                           *
+ * See textmem.h                                                             *
+ * ------------------------------------------------------------------------- */
+int Pool_Create( PTEXTALLOCATOR *ppAlloc )
+{
+    PPOOL pPool;
+
+    if ( !ppAlloc ) return 0;
+    pPool = (PPOOL) allocate_small( NULL, sizeof( POOL ));
+    if ( !pPool ) return 0;
+    pPool->alloc.pfnAlloc   = Pool_Allocate;
+    pPool->alloc.pfnFree    = Pool_Release;
+    pPool->alloc.pfnRealloc = Pool_Resize;
+    pPool->alloc.pUser      = pPool;
+
+    *ppAlloc = &( pPool->alloc );
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Pool_Free()                                                               *
+ *                                                                           *
+ * See textmem.h                                                             *
+ * ------------------------------------------------------------------------- */
+int Pool_Free( PTEXTALLOCATOR *ppAlloc )
+{
+    PPOOL     pPool;
+    PPOOLSLAB pSlab,
+              pNext;
+
+    if ( !ppAlloc || !*ppAlloc ) return 0;
+    pPool = (PPOOL) (*ppAlloc)->pUser;
+    for ( pSlab = pPool->pSlabs; pSlab; pSlab = pNext ) {
+        pNext = pSlab->pNext;
+        free_memory( NULL, pSlab );
+    }
+    free_small( NULL, pPool );
+    *ppAlloc = NULL;
+    return 1;
+}
+
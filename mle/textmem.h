@@ -0,0 +1,87 @@
+/*****************************************************************************
+ * textmem.h                                                                 *
+ *                                                                           *
+ * Allocators for text objects and line buffers (see TEXTALLOCATOR in        *
+ * textseq.h).                                                               *
+ *                                                                           *
+ * An arena hands out memory from large chunks, one after another, and only  *
+ * gives it back when the whole arena is reset or freed.  Freeing a block    *
+ * returns nothing to the arena, except for the block allocated most         *
+ * recently, or one large enough to have been given a chunk of its own.      *
+ * This suits objects which all die together, such as the text and line      *
+ * buffer of an editor in a dialog: once the editor has been destroyed, the  *
+ * arena can be reset and used for the next one.                             *
+ *                                                                           *
+ * A pool rounds each request up to a power of two and keeps a list of free  *
+ * blocks of each size, which are carved from 64 kB slabs.  Freed blocks go  *
+ * back on their list for reuse, so a pool can serve text objects which are  *
+ * created and destroyed at different times without fragmenting the heap.    *
+ * Requests too large for any size are passed to the system.                 *
+ *                                                                           *
+ * Both keep cbReserved in their TEXTALLOCATOR up to date.  Neither          *
+ * serializes access, so an allocator must only be used by one thread at a   *
+ * time.  Every object using an allocator must be freed before the           *
+ * allocator itself is.                                                      *
+ *                                                                           *
+ * textseq.h must be included before this file.                              *
+ *                                                                           *
+ *****************************************************************************/
+
+
+// ---------------------------------------------------------------------------
+// CONSTANTS
+//
+
+#define ARENA_DEFAULT_CHUNK     0x40000     // default arena chunk size (256 kB)
+#define ARENA_MINIMUM_CHUNK     0x1000      // smallest permitted chunk size
+
+#define POOL_SLAB_SIZE          0x10000     // memory obtained for a size at once
+#define POOL_LARGEST_BLOCK      0x4000      // largest block kept in a pool
+
+
+// ---------------------------------------------------------------------------
+// FUNCTION DECLARATIONS
+//
+
+/* ------------------------------------------------------------------------- *
+ * Arena_Create()                                                            *
+ *                                                                           *
+ * Creates an arena which obtains memory in chunks of cbChunk bytes (or      *
+ * ARENA_DEFAULT_CHUNK, if cbChunk is 0).  Requests larger than a quarter of *
+ * a chunk get a chunk of their own, which is released when they are freed.  *
+ * ------------------------------------------------------------------------- */
+int Arena_Create( PTEXTALLOCATOR *ppAlloc, unsigned long cbChunk );
+
+
+/* ------------------------------------------------------------------------- *
+ * Arena_Free()                                                              *
+ *                                                                           *
+ * Releases all memory held by the arena, along with the arena itself.       *
+ * ------------------------------------------------------------------------- */
+int Arena_Free( PTEXTALLOCATOR *ppAlloc );
+
+
+/* ------------------------------------------------------------------------- *
+ * Arena_Reset()                                                             *
+ *                                                                           *
+ * Discards everything allocated from the arena, keeping one chunk for the   *
+ * next allocations.  Nothing allocated from it may be used afterwards.      *
+ * ------------------------------------------------------------------------- */
+int Arena_Reset( PTEXTALLOCATOR pAlloc );
+
+
+/* ------------------------------------------------------------------------- *
+ * Pool_Create()                                                             *
+ *                                                                           *
+ * Creates an empty pool.                                                    *
+ * ------------------------------------------------------------------------- */
+int Pool_Create( PTEXTALLOCATOR *ppAlloc );
+
+
+/* ------------------------------------------------------------------------- *
+ * Pool_Free()                                                               *
+ *                                                                           *
+ * Releases the pool's slabs, along with the pool itself.                    *
+ * ------------------------------------------------------------------------- */
+int Pool_Free( PTEXTALLOCATOR *ppAlloc );
+
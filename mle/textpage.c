@@ -0,0 +1,282 @@
+/*****************************************************************************
+ * textpage.c                                                                *
+ *                                                                           *
+ * Implements a read-only page cache over a file, used by the paged text     *
+ * model (TEXT_MODEL_PAGED) to hold the original text of documents which are *
+ * too large to be read or mapped into memory in their entirety.             *
+ *                                                                           *
+ * The file is divided into fixed-size pages (PAGE_SIZE bytes), which are    *
+ * read on demand into a bounded number of page buffers.  When all buffers   *
+ * are in use, the least recently used page is discarded to make room for    *
+ * the next one.  The memory footprint is therefore fixed, regardless of the *
+ * size of the file.                                                         *
+ *                                                                           *
+ * Resident pages are found through a table indexed by page number, and the  *
+ * buffers are kept in a doubly-linked list in order of use, so that both    *
+ * finding and recycling a page take constant time.                          *
+ *                                                                           *
+ * The functions in this file are not called directly by applications; they  *
+ * are used by the piece table implementation in textpt.c.                   *
+ *                                                                           *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <stddef.h>
+
+#include "debug.h"
+#include "textseq.h"
+#include "textimpl.h"
+
+
+// ---------------------------------------------------------------------------
+// CONSTANTS
+//
+
+#define PAGE_NONE           0xFFFFFFFF  // end of list, or no such page
+
+
+// ---------------------------------------------------------------------------
+// TYPEDEFS
+//
+
+// A single page buffer.
+//
+typedef struct _cache_page {
+    unsigned long ulPage,           // Number of the file page held here
+                  cb,               // Number of valid bytes in the page
+                  ulPrev,           // Next more recently used buffer
+                  ulNext;           // Next less recently used buffer
+    unsigned char *pch;             // The page contents
+} CACHEPAGE, *PCACHEPAGE;
+
+
+// The page cache itself.
+//
+typedef struct _page_cache {
+    unsigned long hFile,            // Handle of the open file
+                  cbFile,           // Length of the file
+                  ulFilePages,      // Number of pages in the file
+                  ulMax,            // Maximum number of resident pages
+                  ulUsed,           // Number of page buffers allocated
+                  ulHead,           // Most recently used buffer
+                  ulTail,           // Least recently used buffer
+                  ulHits,           // Number of requests for resident pages
+                  ulMisses;         // Number of requests which read the file
+    unsigned long *pulSlot;         // Buffer holding each file page (or PAGE_NONE)
+    PCACHEPAGE    pPages;           // The page buffers
+    PTEXTALLOCATOR pAlloc;          // Allocator providing the cache's memory
+} PAGECACHE;
+
+
+// ---------------------------------------------------------------------------
+// FUNCTION DECLARATIONS
+//
+
+void PageCache_Unlink( PPAGECACHE pCache, unsigned long ulSlot );
+void PageCache_Link( PPAGECACHE pCache, unsigned long ulSlot );
+
+
+// ===========================================================================
+// INTERNAL FUNCTIONS
+// ===========================================================================
+
+
+/* ------------------------------------------------------------------------- *
+ * PageCache_Unlink()                                                        *
+ *                                                                           *
+ * Removes the given buffer from the usage list.                             *
+ * ------------------------------------------------------------------------- */
+void PageCache_Unlink( PPAGECACHE pCache, unsigned long ulSlot )
+{
+    PCACHEPAGE pPage = pCache->pPages + ulSlot;
+
+    if ( pPage->ulPrev != PAGE_NONE ) pCache->pPages[ pPage->ulPrev ].ulNext = pPage->ulNext;
+    else                              pCache->ulHead = pPage->ulNext;
+    if ( pPage->ulNext != PAGE_NONE ) pCache->pPages[ pPage->ulNext ].ulPrev = pPage->ulPrev;
+    else                              pCache->ulTail = pPage->ulPrev;
+    pPage->ulPrev = PAGE_NONE;
+    pPage->ulNext = PAGE_NONE;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * PageCache_Link()                                                          *
+ *                                                                           *
+ * Adds the given buffer to the front (most recently used end) of the usage  *
+ * list.                                                                     *
+ * ------------------------------------------------------------------------- */
+void PageCache_Link( PPAGECACHE pCache, unsigned long ulSlot )
+{
+    PCACHEPAGE pPage = pCache->pPages + ulSlot;
+
+    pPage->ulPrev = PAGE_NONE;
+    pPage->ulNext = pCache->ulHead;
+    if ( pCache->ulHead != PAGE_NONE ) pCache->pPages[ pCache->ulHead ].ulPrev = ulSlot;
+    else                               pCache->ulTail = ulSlot;
+    pCache->ulHead = ulSlot;
+}
+
+
+// ===========================================================================
+// PAGE CACHE FUNCTIONS
+// ===========================================================================
+
+
+/* ------------------------------------------------------------------------- *
+ * PageCache_Open()                                                          *
+ *                                                                           *
+ * Opens the named file for paged reading, with at most cbLimit bytes worth  *
+ * of pages (but never fewer than PAGE_MINIMUM_COUNT) resident at once, all  *
+ * allocated from pAlloc.  No pages are read until they are requested.  The  *
+ * length of the file is returned in pcbFile.  Returns NULL if the file      *
+ * could not be opened, or is too large.                                     *
+ * ------------------------------------------------------------------------- */
+PPAGECACHE PageCache_Open( const char *pszFile, unsigned long cbLimit, PTEXTALLOCATOR pAlloc, unsigned long *pcbFile )
+{
+    PPAGECACHE    pCache;
+    unsigned long i;
+
+    pCache = (PPAGECACHE) allocate_memory( pAlloc, sizeof( PAGECACHE ));
+    if ( !pCache ) return NULL;
+    if ( ! open_file( pszFile, &(pCache->hFile), &(pCache->cbFile) )) {
+        free_memory( pAlloc, pCache );
+        return NULL;
+    }
+    pCache->pAlloc = pAlloc;
+
+    pCache->ulFilePages = ( pCache->cbFile / PAGE_SIZE ) + 1;
+    pCache->ulMax = cbLimit / PAGE_SIZE;
+    if ( pCache->ulMax < PAGE_MINIMUM_COUNT ) pCache->ulMax = PAGE_MINIMUM_COUNT;
+    if ( pCache->ulMax > pCache->ulFilePages ) pCache->ulMax = pCache->ulFilePages;
+    pCache->ulUsed   = 0;
+    pCache->ulHead   = PAGE_NONE;
+    pCache->ulTail   = PAGE_NONE;
+    pCache->ulHits   = 0;
+    pCache->ulMisses = 0;
+
+    pCache->pulSlot = (unsigned long *) allocate_memory( pCache->pAlloc, pCache->ulFilePages * sizeof( unsigned long ));
+    pCache->pPages  = (PCACHEPAGE) allocate_memory( pCache->pAlloc, pCache->ulMax * sizeof( CACHEPAGE ));
+    if ( !pCache->pulSlot || !pCache->pPages ) {
+        PageCache_Close( pCache );
+        return NULL;
+    }
+    for ( i = 0; i < pCache->ulFilePages; i++ ) pCache->pulSlot[ i ] = PAGE_NONE;
+
+#ifdef DEBUG_LOG
+fprintf(dbg, "Opened page cache on %s (%u bytes, %u of %u pages resident)\n", pszFile, pCache->cbFile, pCache->ulMax, pCache->ulFilePages );
+#endif
+
+    *pcbFile = pCache->cbFile;
+    return pCache;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * PageCache_Close()                                                         *
+ *                                                                           *
+ * Closes the file and frees the cache along with all of its pages.          *
+ * ------------------------------------------------------------------------- */
+void PageCache_Close( PPAGECACHE pCache )
+{
+    unsigned long i;
+
+    if ( !pCache ) return;
+    if ( pCache->pPages ) {
+        for ( i = 0; i < pCache->ulUsed; i++ )
+            free_memory( pCache->pAlloc, pCache->pPages[ i ].pch );
+        free_memory( pCache->pAlloc, pCache->pPages );
+    }
+    if ( pCache->pulSlot ) free_memory( pCache->pAlloc, pCache->pulSlot );
+    close_file( pCache->hFile );
+    free_memory( pCache->pAlloc, pCache );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * PageCache_Get()                                                           *
+ *                                                                           *
+ * Returns a pointer to the byte at the given offset within the file, after  *
+ * reading its page into the cache if necessary.  The number of bytes which  *
+ * may be read from the pointer (i.e. up to the end of the page) is returned *
+ * in pcbAvail.  Returns NULL if the offset is invalid or the page could not *
+ * be read.                                                                  *
+ *                                                                           *
+ * The pointer remains valid until the page is discarded, which cannot       *
+ * happen before PAGE_MINIMUM_COUNT-1 other pages have been requested.       *
+ * ------------------------------------------------------------------------- */
+unsigned char *PageCache_Get( PPAGECACHE pCache, unsigned long ulOffset, unsigned long *pcbAvail )
+{
+    unsigned long ulPage,
+                  ulSlot,
+                  ulWithin;
+    PCACHEPAGE    pPage;
+
+    *pcbAvail = 0;
+    if ( ulOffset >= pCache->cbFile ) return NULL;
+    ulPage   = ulOffset / PAGE_SIZE;
+    ulWithin = ulOffset % PAGE_SIZE;
+    ulSlot   = pCache->pulSlot[ ulPage ];
+
+    if ( ulSlot != PAGE_NONE ) {
+        pCache->ulHits++;
+        if ( ulSlot != pCache->ulHead ) {
+            PageCache_Unlink( pCache, ulSlot );
+            PageCache_Link( pCache, ulSlot );
+        }
+        pPage = pCache->pPages + ulSlot;
+        *pcbAvail = pPage->cb - ulWithin;
+        return pPage->pch + ulWithin;
+    }
+
+    // Not resident: use a new buffer if we're allowed one, otherwise recycle
+    // the least recently used
+    pCache->ulMisses++;
+    if ( pCache->ulUsed < pCache->ulMax ) {
+        ulSlot = pCache->ulUsed;
+        pPage  = pCache->pPages + ulSlot;
+        pPage->pch = (unsigned char *) allocate_memory( pCache->pAlloc, PAGE_SIZE );
+        if ( !pPage->pch ) return NULL;
+        pPage->ulPrev = PAGE_NONE;
+        pPage->ulNext = PAGE_NONE;
+        pCache->ulUsed++;
+    }
+    else {
+        ulSlot = pCache->ulTail;
+        pPage  = pCache->pPages + ulSlot;
+        PageCache_Unlink( pCache, ulSlot );
+        if ( pCache->pulSlot[ pPage->ulPage ] == ulSlot )
+            pCache->pulSlot[ pPage->ulPage ] = PAGE_NONE;
+    }
+
+    pPage->ulPage = ulPage;
+    pPage->cb     = read_file( pCache->hFile, ulPage * PAGE_SIZE, pPage->pch,
+                               ( ulPage == pCache->ulFilePages - 1 ) ?
+                                 pCache->cbFile % PAGE_SIZE : PAGE_SIZE );
+    PageCache_Link( pCache, ulSlot );
+    if ( pPage->cb <= ulWithin ) {
+        // Short read (the file must have changed); leave the buffer unassigned
+        pPage->cb = 0;
+        return NULL;
+    }
+    pCache->pulSlot[ ulPage ] = ulSlot;
+
+    *pcbAvail = pPage->cb - ulWithin;
+    return pPage->pch + ulWithin;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * PageCache_QueryStats()                                                    *
+ *                                                                           *
+ * Fills in the page-related fields of a TEXTSTATS structure.                *
+ * ------------------------------------------------------------------------- */
+void PageCache_QueryStats( PPAGECACHE pCache, PTEXTSTATS pStats )
+{
+    pStats->ulPageHits      = pCache->ulHits;
+    pStats->ulPageMisses    = pCache->ulMisses;
+    pStats->ulPagesResident = pCache->ulUsed;
+    pStats->ulPagesMax      = pCache->ulMax;
+    pStats->cbPage          = PAGE_SIZE;
+}
+
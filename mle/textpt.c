@@ -0,0 +1,761 @@
+/*****************************************************************************
+ * textpt.c                                                                  *
+ *                                                                           *
+ * Implements the 'piece table' text model, also described by Charles        *
+ * Crowley in "Data Structures for Text Sequences" (1998, University of New  *
+ * Mexico).                                                                  *
+ *                                                                           *
+ * The text is never moved once it has been stored.  The initial contents    *
+ * are kept in the 'original' buffer, which is never modified afterwards.    *
+ * (This may also be a read-only file mapping; see PieceTable_InitShared.)   *
+ *                                                                           *
+ * The same implementation also provides the paged model.  In that case the  *
+ * original text is not held in memory at all; it stays in the file, and is  *
+ * read through a page cache (see textpage.c) whenever it is accessed.       *
+ * All subsequently inserted text is appended to the end of the 'added'      *
+ * buffer, which only ever grows.  The logical text sequence is described by *
+ * an ordered array of pieces, each of which refers to a span of one of the  *
+ * two buffers.                                                              *
+ *                                                                           *
+ * Inserting or deleting text therefore only requires splitting, trimming or *
+ * removing piece descriptors; the cost is proportional to the number of     *
+ * pieces rather than to the size of the text.  The most recently located    *
+ * piece is cached, so that runs of nearby accesses (such as sequential      *
+ * TextByteAt() calls, or typing at the same position) do not have to walk   *
+ * the piece array from the beginning each time.                             *
+ *                                                                           *
+ * As with the gap buffer, we make no assumptions about how the contents are *
+ * to be interpreted; the text is simply a sequence of bytes.                *
+ *                                                                           *
+ * The functions in this file are not called directly by applications; they  *
+ * are reached through the public Text*() functions in textseq.c.            *
+ *                                                                           *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <stddef.h>
+
+#include "debug.h"
+#include "textseq.h"
+#include "textimpl.h"
+
+
+// ---------------------------------------------------------------------------
+// CONSTANTS
+//
+#define PT_INITIAL_PIECES   256     // initial size of the piece array
+#define PT_INITIAL_ADDED    8192    // initial size of the 'added' buffer
+
+#define PT_ORIGINAL         0       // piece refers to the original buffer
+#define PT_ADDED            1       // piece refers to the 'added' buffer
+
+
+// ---------------------------------------------------------------------------
+// TYPEDEFS
+//
+
+// A single piece: a span of text within one of the two buffers.
+//
+typedef struct _text_piece {
+    unsigned long ulSource,         // Which buffer (PT_ORIGINAL or PT_ADDED)
+                  ulStart,          // Starting offset within that buffer
+                  ulLength;         // Length of the span
+} PIECE, *PPIECE;
+
+
+// The internal implementation (piece table) of the text data structure.
+//
+typedef struct _piece_table {
+    TEXTHDR       hdr;              // Common model header
+    unsigned char *pchOriginal,     // The original (read-only) text
+                  *pchAdded;        // The append-only buffer of added text
+    unsigned long cbOriginal,       // Length of the original text
+                  cbAdded,          // Number of bytes used in the added buffer
+                  cbAddedSize;      // Allocated size of the added buffer
+    PPIECE        pPieces;          // The ordered array of pieces
+    unsigned long ulPieces,         // Number of pieces in use
+                  ulPiecesSize,     // Allocated size of the piece array
+                  cbText,           // Total length of the text
+                  ulCacheIdx,       // Index of the most recently located piece
+                  ulCachePos;       // Text position at which that piece starts
+    int           fShared;          // Original text is not ours to free
+    PPAGECACHE    pCache;           // Page cache holding the original text
+} PIECETABLE, *PPIECETABLE;
+
+
+
+// ---------------------------------------------------------------------------
+// FUNCTION DECLARATIONS
+//
+
+// Internal
+int           PieceTable_AddText( PPIECETABLE pTable, unsigned char *pch, unsigned long ulLength, unsigned long *pulStart );
+unsigned long PieceTable_FindPiece( PPIECETABLE pTable, unsigned long ulPosition, unsigned long *pulOffset );
+int           PieceTable_OpenPieces( PPIECETABLE pTable, unsigned long ulIndex, unsigned long ulCount );
+int           PieceTable_ResizeAdded( PPIECETABLE pTable, unsigned long cbNewSize );
+unsigned char *PieceTable_PieceText( PPIECETABLE pTable, PPIECE pPiece, unsigned long ulOffset, unsigned long *pcbAvail );
+
+// Model implementation
+unsigned char PieceTable_ByteAt( PPIECETABLE pTable, unsigned long ulPosition );
+int           PieceTable_Clear( PPIECETABLE pTable );
+int           PieceTable_Delete( PPIECETABLE pTable, unsigned long ulPosition, unsigned long ulLength );
+int           PieceTable_Destroy( PPIECETABLE pTable );
+int           PieceTable_Init( PPIECETABLE pTable, unsigned char *pchText, unsigned long cbText );
+int           PieceTable_Insert( PPIECETABLE pTable, unsigned char *pch, unsigned long ulPosition, unsigned long ulLength );
+unsigned long PieceTable_Length( PPIECETABLE pTable );
+unsigned long PieceTable_Sequence( PPIECETABLE pTable, unsigned char *pchText, unsigned long ulPosition, unsigned long ulLength );
+int           PieceTable_GetSpans( PPIECETABLE pTable, unsigned long ulPosition, unsigned long ulLength, PTEXTSPAN pSpan1, PTEXTSPAN pSpan2 );
+int           PieceTable_Reserve( PPIECETABLE pTable, unsigned long cbText );
+int           PieceTable_InitShared( PPIECETABLE pTable, unsigned char *pchText, unsigned long cbText );
+int           PieceTable_InitFile( PPIECETABLE pTable, const char *pszFile );
+int           PieceTable_QueryStats( PPIECETABLE pTable, PTEXTSTATS pStats );
+
+
+// ---------------------------------------------------------------------------
+// MODEL TABLE
+//
+
+const TEXTMODEL PieceTableModel = {
+    sizeof( PIECETABLE ),
+    (PFNTEXTBYTEAT)   PieceTable_ByteAt,
+    (PFNTEXTCLEAR)    PieceTable_Clear,
+    (PFNTEXTDELETE)   PieceTable_Delete,
+    (PFNTEXTDESTROY)  PieceTable_Destroy,
+    (PFNTEXTINIT)     PieceTable_Init,
+    (PFNTEXTINSERT)   PieceTable_Insert,
+    (PFNTEXTLENGTH)   PieceTable_Length,
+    (PFNTEXTSEQUENCE) PieceTable_Sequence,
+    NULL,
+    NULL,
+    (PFNTEXTGETSPANS) PieceTable_GetSpans,
+    NULL,
+    (PFNTEXTRESERVE)  PieceTable_Reserve,
+    (PFNTEXTINITSHARED) PieceTable_InitShared,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL
+};
+
+// The paged model differs only in reading files through the page cache.
+const TEXTMODEL PagedModel = {
+    sizeof( PIECETABLE ),
+    (PFNTEXTBYTEAT)   PieceTable_ByteAt,
+    (PFNTEXTCLEAR)    PieceTable_Clear,
+    (PFNTEXTDELETE)   PieceTable_Delete,
+    (PFNTEXTDESTROY)  PieceTable_Destroy,
+    (PFNTEXTINIT)     PieceTable_Init,
+    (PFNTEXTINSERT)   PieceTable_Insert,
+    (PFNTEXTLENGTH)   PieceTable_Length,
+    (PFNTEXTSEQUENCE) PieceTable_Sequence,
+    NULL,
+    NULL,
+    (PFNTEXTGETSPANS) PieceTable_GetSpans,
+    NULL,
+    (PFNTEXTRESERVE)  PieceTable_Reserve,
+    NULL,
+    (PFNTEXTINITFILE) PieceTable_InitFile,
+    (PFNTEXTQUERYSTATS) PieceTable_QueryStats,
+    NULL,
+    NULL,
+    NULL
+};
+
+
+
+// ===========================================================================
+// INTERNAL FUNCTIONS
+// ===========================================================================
+
+
+/* ------------------------------------------------------------------------- *
+ * PieceTable_AddText()                                                      *
+ *                                                                           *
+ * Appends the given bytes to the end of the 'added' buffer, expanding the   *
+ * buffer (to double its current size) if necessary.  The offset at which    *
+ * the text was stored is returned in pulStart.                              *
+ * ------------------------------------------------------------------------- */
+int PieceTable_AddText( PPIECETABLE pTable, unsigned char *pch, unsigned long ulLength, unsigned long *pulStart )
+{
+    if (( pTable->cbAdded + ulLength ) > pTable->cbAddedSize )
+        if ( ! PieceTable_ResizeAdded( pTable,
+                                       next_buffer_size( &(pTable->hdr), pTable->cbAddedSize,
+                                                         pTable->cbAdded + ulLength )))
+            return 0;
+
+    memcpy( pTable->pchAdded + pTable->cbAdded, pch, ulLength );
+    *pulStart = pTable->cbAdded;
+    pTable->cbAdded += ulLength;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * PieceTable_FindPiece()                                                    *
+ *                                                                           *
+ * Returns the index of the piece containing the given text position, and    *
+ * the offset of that position within the piece.  If the position is at (or  *
+ * past) the end of the text, the number of pieces is returned (i.e. the     *
+ * index one past the last piece), with an offset of 0.                      *
+ *                                                                           *
+ * The search starts from the most recently located piece and proceeds       *
+ * forwards or backwards from there as appropriate.                          *
+ * ------------------------------------------------------------------------- */
+unsigned long PieceTable_FindPiece( PPIECETABLE pTable, unsigned long ulPosition, unsigned long *pulOffset )
+{
+    unsigned long ulIndex,
+                  ulStart;
+
+    if ( ulPosition >= pTable->cbText ) {
+        *pulOffset = 0;
+        return pTable->ulPieces;
+    }
+
+    ulIndex = pTable->ulCacheIdx;
+    ulStart = pTable->ulCachePos;
+    if ( ulIndex > pTable->ulPieces ) {
+        ulIndex = 0;
+        ulStart = 0;
+    }
+
+    // Walk backwards until we reach a piece starting at or before the position
+    while ( ulStart > ulPosition ) {
+        ulIndex--;
+        ulStart -= pTable->pPieces[ ulIndex ].ulLength;
+    }
+    // Walk forwards until we reach the piece containing the position
+    while ( ulPosition >= ( ulStart + pTable->pPieces[ ulIndex ].ulLength )) {
+        ulStart += pTable->pPieces[ ulIndex ].ulLength;
+        ulIndex++;
+    }
+
+    pTable->ulCacheIdx = ulIndex;
+    pTable->ulCachePos = ulStart;
+    *pulOffset = ulPosition - ulStart;
+    return ulIndex;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * PieceTable_OpenPieces()                                                   *
+ *                                                                           *
+ * Makes room for the requested number of new pieces at the given index, by  *
+ * shifting all subsequent pieces up.  The piece array is expanded (to twice *
+ * its current size) if necessary.  The new entries are left uninitialized.  *
+ * ------------------------------------------------------------------------- */
+int PieceTable_OpenPieces( PPIECETABLE pTable, unsigned long ulIndex, unsigned long ulCount )
+{
+    unsigned long ulNewSize;
+    PPIECE        pNew;
+
+    if (( pTable->ulPieces + ulCount ) > pTable->ulPiecesSize ) {
+        ulNewSize = pTable->ulPiecesSize ? pTable->ulPiecesSize : PT_INITIAL_PIECES;
+        while ( ulNewSize < ( pTable->ulPieces + ulCount )) ulNewSize *= 2;
+        pNew = (PPIECE) allocate_memory( pTable->hdr.pAllocator, ulNewSize * sizeof( PIECE ));
+        if ( pNew == NULL ) return 0;
+        if ( pTable->pPieces ) {
+            memcpy( pNew, pTable->pPieces, pTable->ulPieces * sizeof( PIECE ));
+            free_memory( pTable->hdr.pAllocator, pTable->pPieces );
+        }
+        pTable->pPieces      = pNew;
+        pTable->ulPiecesSize = ulNewSize;
+    }
+
+    if ( ulIndex < pTable->ulPieces )
+        memmove( pTable->pPieces + ulIndex + ulCount, pTable->pPieces + ulIndex,
+                 ( pTable->ulPieces - ulIndex ) * sizeof( PIECE ));
+    pTable->ulPieces += ulCount;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * PieceTable_ResizeAdded()                                                  *
+ *                                                                           *
+ * Enlarges the 'added' buffer to the given size, preserving its contents.   *
+ * ------------------------------------------------------------------------- */
+int PieceTable_ResizeAdded( PPIECETABLE pTable, unsigned long cbNewSize )
+{
+    unsigned char *pchNew;
+
+    if ( cbNewSize <= pTable->cbAddedSize ) return 1;
+
+#ifdef DEBUG_LOG
+fprintf(dbg, "Increasing added-text buffer to %u bytes\n", cbNewSize );
+#endif
+
+    pchNew = (unsigned char *) reallocate_memory( pTable->hdr.pAllocator, pTable->pchAdded, pTable->cbAddedSize, cbNewSize );
+    if ( pchNew == NULL ) return 0;
+    pTable->pchAdded    = pchNew;
+    pTable->cbAddedSize = cbNewSize;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * PieceTable_PieceText()                                                    *
+ *                                                                           *
+ * Returns a pointer to the text at the given offset within a piece, and the *
+ * number of contiguous bytes available from that pointer (which, for text   *
+ * read through the page cache, may end before the piece does).  Returns     *
+ * NULL if a page of the original text could not be read.                    *
+ * ------------------------------------------------------------------------- */
+unsigned char *PieceTable_PieceText( PPIECETABLE pTable, PPIECE pPiece, unsigned long ulOffset, unsigned long *pcbAvail )
+{
+    unsigned char *pch;
+
+    *pcbAvail = pPiece->ulLength - ulOffset;
+    if ( pPiece->ulSource == PT_ADDED )
+        return pTable->pchAdded + pPiece->ulStart + ulOffset;
+    if ( !pTable->pCache )
+        return pTable->pchOriginal + pPiece->ulStart + ulOffset;
+
+    pch = PageCache_Get( pTable->pCache, pPiece->ulStart + ulOffset, pcbAvail );
+    if ( *pcbAvail > ( pPiece->ulLength - ulOffset ))
+        *pcbAvail = pPiece->ulLength - ulOffset;
+    return pch;
+}
+
+
+// ===========================================================================
+// MODEL IMPLEMENTATION
+// ===========================================================================
+
+
+/* ------------------------------------------------------------------------- *
+ * PieceTable_ByteAt                                                         *
+ *                                                                           *
+ * Returns the byte at the given text position.  If the position is invalid, *
+ * 0 (a null-byte) is returned.                                              *
+ * ------------------------------------------------------------------------- */
+unsigned char PieceTable_ByteAt( PPIECETABLE pTable, unsigned long ulPosition )
+{
+    unsigned long ulIndex,
+                  ulOffset,
+                  cbAvail;
+    unsigned char *pch;
+
+    if ( ulPosition >= pTable->cbText ) return 0;
+    ulIndex = PieceTable_FindPiece( pTable, ulPosition, &ulOffset );
+    pch = PieceTable_PieceText( pTable, pTable->pPieces + ulIndex, ulOffset, &cbAvail );
+    return ( pch ? *pch : 0 );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * PieceTable_Clear()                                                        *
+ *                                                                           *
+ * Erases the current text contents.  The piece array and 'added' buffer     *
+ * remain allocated, but the original text is no longer needed and is freed  *
+ * immediately.                                                              *
+ * ------------------------------------------------------------------------- */
+int PieceTable_Clear( PPIECETABLE pTable )
+{
+    if (( pTable->pchOriginal != NULL ) && !pTable->fShared )
+        free_memory( pTable->hdr.pAllocator, pTable->pchOriginal );
+    if ( pTable->pCache ) PageCache_Close( pTable->pCache );
+    pTable->pchOriginal = NULL;
+    pTable->pCache      = NULL;
+    pTable->fShared     = 0;
+    pTable->cbOriginal  = 0;
+    pTable->cbAdded     = 0;
+    pTable->ulPieces    = 0;
+    pTable->cbText      = 0;
+    pTable->ulCacheIdx  = 0;
+    pTable->ulCachePos  = 0;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * PieceTable_Delete                                                         *
+ *                                                                           *
+ * Deletes one or more bytes from the sequence, starting at the specified    *
+ * position.  No text is actually moved or freed; the pieces describing the  *
+ * deleted range are simply trimmed, split, or removed.                      *
+ * ------------------------------------------------------------------------- */
+int PieceTable_Delete( PPIECETABLE pTable, unsigned long ulPosition, unsigned long ulLength )
+{
+    unsigned long ulFirst,      // Index of the piece containing ulPosition
+                  ulOffset,     // Offset of ulPosition within that piece
+                  ulIndex,      // Current piece index
+                  ulLast,       // Index after the last wholly-deleted piece
+                  ulRemaining;  // Number of bytes still to be deleted
+    PPIECE        pPiece;
+
+    if ( ulPosition >= pTable->cbText ) return 0;
+    if ( ulLength > ( pTable->cbText - ulPosition ))
+        ulLength = pTable->cbText - ulPosition;
+    if ( !ulLength ) return 1;
+
+    ulFirst = PieceTable_FindPiece( pTable, ulPosition, &ulOffset );
+    ulIndex = ulFirst;
+    ulRemaining = ulLength;
+
+    if ( ulOffset ) {
+        pPiece = pTable->pPieces + ulIndex;
+
+        // The deleted range lies entirely inside one piece: split it in two
+        if (( ulOffset + ulRemaining ) < pPiece->ulLength ) {
+            if ( ! PieceTable_OpenPieces( pTable, ulIndex + 1, 1 )) return 0;
+            pPiece = pTable->pPieces + ulIndex;
+            pPiece[ 1 ].ulSource = pPiece->ulSource;
+            pPiece[ 1 ].ulStart  = pPiece->ulStart + ulOffset + ulRemaining;
+            pPiece[ 1 ].ulLength = pPiece->ulLength - ulOffset - ulRemaining;
+            pPiece->ulLength = ulOffset;
+            ulRemaining = 0;
+        }
+        // Otherwise trim the tail off the first piece
+        else {
+            ulRemaining -= pPiece->ulLength - ulOffset;
+            pPiece->ulLength = ulOffset;
+        }
+        ulIndex++;
+    }
+
+    // Skip over all pieces which are deleted completely...
+    ulLast = ulIndex;
+    while ( ulRemaining && ( pTable->pPieces[ ulLast ].ulLength <= ulRemaining )) {
+        ulRemaining -= pTable->pPieces[ ulLast ].ulLength;
+        ulLast++;
+    }
+    // ...trim the head off the next one...
+    if ( ulRemaining ) {
+        pTable->pPieces[ ulLast ].ulStart  += ulRemaining;
+        pTable->pPieces[ ulLast ].ulLength -= ulRemaining;
+    }
+    // ...and then remove the deleted ones from the array
+    if ( ulLast > ulIndex ) {
+        memmove( pTable->pPieces + ulIndex, pTable->pPieces + ulLast,
+                 ( pTable->ulPieces - ulLast ) * sizeof( PIECE ));
+        pTable->ulPieces -= ulLast - ulIndex;
+    }
+
+    pTable->cbText -= ulLength;
+
+    // The first affected piece (or whatever now occupies its index) still
+    // starts at the same position, so it remains a valid cache entry.
+    pTable->ulCacheIdx = ulFirst;
+    pTable->ulCachePos = ulPosition - ulOffset;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * PieceTable_Destroy()                                                      *
+ *                                                                           *
+ * Frees all buffers and zeroes the rest of the data structure.              *
+ * ------------------------------------------------------------------------- */
+int PieceTable_Destroy( PPIECETABLE pTable )
+{
+    if (( pTable->pchOriginal != NULL ) && !pTable->fShared )
+        free_memory( pTable->hdr.pAllocator, pTable->pchOriginal );
+    if ( pTable->pchAdded != NULL )    free_memory( pTable->hdr.pAllocator, pTable->pchAdded );
+    if ( pTable->pPieces != NULL )     free_memory( pTable->hdr.pAllocator, pTable->pPieces );
+    if ( pTable->pCache != NULL )      PageCache_Close( pTable->pCache );
+    pTable->pchOriginal  = NULL;
+    pTable->pCache       = NULL;
+    pTable->fShared      = 0;
+    pTable->pchAdded     = NULL;
+    pTable->pPieces      = NULL;
+    pTable->cbOriginal   = 0;
+    pTable->cbAdded      = 0;
+    pTable->cbAddedSize  = 0;
+    pTable->ulPieces     = 0;
+    pTable->ulPiecesSize = 0;
+    pTable->cbText       = 0;
+    pTable->ulCacheIdx   = 0;
+    pTable->ulCachePos   = 0;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * PieceTable_Init()                                                         *
+ *                                                                           *
+ * Initializes the text data structure.  If any text is specified, it is     *
+ * copied into the original buffer and described by a single piece.  The     *
+ * piece array and the 'added' buffer are allocated in any case.             *
+ * ------------------------------------------------------------------------- */
+int PieceTable_Init( PPIECETABLE pTable, unsigned char *pchText, unsigned long cbText )
+{
+    PieceTable_Destroy( pTable );
+
+    pTable->pPieces = (PPIECE) allocate_memory( pTable->hdr.pAllocator, PT_INITIAL_PIECES * sizeof( PIECE ));
+    if ( pTable->pPieces == NULL ) return 0;
+    pTable->ulPiecesSize = PT_INITIAL_PIECES;
+
+    pTable->pchAdded = (unsigned char *) allocate_memory( pTable->hdr.pAllocator, PT_INITIAL_ADDED );
+    if ( pTable->pchAdded == NULL ) return 0;
+    pTable->cbAddedSize = PT_INITIAL_ADDED;
+
+    if ( cbText && pchText ) {
+        pTable->pchOriginal = (unsigned char *) allocate_memory( pTable->hdr.pAllocator, cbText );
+        if ( pTable->pchOriginal == NULL ) return 0;
+        memcpy( pTable->pchOriginal, pchText, cbText );
+        pTable->cbOriginal = cbText;
+
+        pTable->pPieces[ 0 ].ulSource = PT_ORIGINAL;
+        pTable->pPieces[ 0 ].ulStart  = 0;
+        pTable->pPieces[ 0 ].ulLength = cbText;
+        pTable->ulPieces = 1;
+        pTable->cbText   = cbText;
+    }
+
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * PieceTable_Insert                                                         *
+ *                                                                           *
+ * Inserts one or more bytes into the sequence at the specified position.    *
+ * The new text is appended to the 'added' buffer, and a piece describing it *
+ * is inserted into the piece array (splitting an existing piece if the      *
+ * position falls in the middle of one).                                     *
+ * ------------------------------------------------------------------------- */
+int PieceTable_Insert( PPIECETABLE pTable, unsigned char *pch, unsigned long ulPosition, unsigned long ulLength )
+{
+    unsigned long ulIndex,      // Index of the piece containing ulPosition
+                  ulOffset,     // Offset of ulPosition within that piece
+                  ulStart;      // Offset of the new text in the added buffer
+    PPIECE        pPiece;
+
+    // Make sure the buffer exists
+    if ( !pTable || !pTable->pPieces ) return 0;
+
+    // Don't allow adding items more than one position past the end of the array
+    if ( ulPosition > pTable->cbText ) return 0;
+    if ( !ulLength ) return 1;
+
+    ulIndex = PieceTable_FindPiece( pTable, ulPosition, &ulOffset );
+    if ( ! PieceTable_AddText( pTable, pch, ulLength, &ulStart )) return 0;
+
+    if ( !ulOffset && ulIndex ) {
+        pPiece = pTable->pPieces + ulIndex - 1;
+        if (( pPiece->ulSource == PT_ADDED ) &&
+            (( pPiece->ulStart + pPiece->ulLength ) == ulStart ))
+        {
+            /* The common case when typing: the new text directly follows the
+             * previously-inserted text, both in the sequence and in the added
+             * buffer.  Just extend the preceding piece.
+             */
+            pPiece->ulLength += ulLength;
+            pTable->cbText   += ulLength;
+            pTable->ulCacheIdx = ulIndex - 1;
+            pTable->ulCachePos = ulPosition + ulLength - pPiece->ulLength;
+            return 1;
+        }
+    }
+
+    if ( !ulOffset ) {
+        // Insert a new piece in front of the current one
+        if ( ! PieceTable_OpenPieces( pTable, ulIndex, 1 )) return 0;
+        pPiece = pTable->pPieces + ulIndex;
+    }
+    else {
+        // Split the current piece and insert the new one between the halves
+        if ( ! PieceTable_OpenPieces( pTable, ulIndex + 1, 2 )) return 0;
+        pPiece = pTable->pPieces + ulIndex;
+        pPiece[ 2 ].ulSource = pPiece->ulSource;
+        pPiece[ 2 ].ulStart  = pPiece->ulStart + ulOffset;
+        pPiece[ 2 ].ulLength = pPiece->ulLength - ulOffset;
+        pPiece->ulLength = ulOffset;
+        pPiece++;
+    }
+    pPiece->ulSource = PT_ADDED;
+    pPiece->ulStart  = ulStart;
+    pPiece->ulLength = ulLength;
+
+    pTable->cbText += ulLength;
+    pTable->ulCacheIdx = ulIndex;
+    pTable->ulCachePos = ulPosition - ulOffset;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * PieceTable_Length()                                                       *
+ *                                                                           *
+ * Returns the length of the text.                                           *
+ * ------------------------------------------------------------------------- */
+unsigned long PieceTable_Length( PPIECETABLE pTable )
+{
+    if ( !pTable ) return 0;
+    return ( pTable->cbText );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * PieceTable_Sequence                                                       *
+ *                                                                           *
+ * Writes a character sequence (string) of the requested length, starting at *
+ * at the specified position.  Returns the number of bytes written (which    *
+ * may be less than the requested length if the end of the text is reached.) *
+ * ------------------------------------------------------------------------- */
+unsigned long PieceTable_Sequence( PPIECETABLE pTable, unsigned char *pchText, unsigned long ulPosition, unsigned long ulLength )
+{
+    unsigned long ulIndex,
+                  ulOffset,
+                  ulCopied,
+                  ulChunk;
+    unsigned char *pch;
+    PPIECE        pPiece;
+
+    if ( !pchText ) return 0;
+    if ( ulPosition >= pTable->cbText ) return 0;
+    if ( ulLength > ( pTable->cbText - ulPosition ))
+        ulLength = pTable->cbText - ulPosition;
+
+    ulIndex  = PieceTable_FindPiece( pTable, ulPosition, &ulOffset );
+    ulCopied = 0;
+    while ( ulCopied < ulLength ) {
+        pPiece = pTable->pPieces + ulIndex;
+        pch    = PieceTable_PieceText( pTable, pPiece, ulOffset, &ulChunk );
+        if ( !pch ) break;
+        if ( ulChunk > ( ulLength - ulCopied )) ulChunk = ulLength - ulCopied;
+        memcpy( pchText + ulCopied, pch, ulChunk );
+        ulCopied += ulChunk;
+        ulOffset += ulChunk;
+        if ( ulOffset >= pPiece->ulLength ) {
+            ulOffset = 0;
+            ulIndex++;
+        }
+    }
+    return ulCopied;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * PieceTable_GetSpans                                                       *
+ *                                                                           *
+ * Returns the text of the piece containing the given position (from that    *
+ * position onwards) and of the piece following it, up to the requested      *
+ * length.  Under the paged model, a span also ends at the end of a page.    *
+ * ------------------------------------------------------------------------- */
+int PieceTable_GetSpans( PPIECETABLE pTable, unsigned long ulPosition, unsigned long ulLength, PTEXTSPAN pSpan1, PTEXTSPAN pSpan2 )
+{
+    unsigned long ulIndex,
+                  ulOffset;
+    PPIECE        pPiece;
+
+    if ( ulPosition >= pTable->cbText ) return 0;
+    if ( ulLength > ( pTable->cbText - ulPosition ))
+        ulLength = pTable->cbText - ulPosition;
+
+    ulIndex = PieceTable_FindPiece( pTable, ulPosition, &ulOffset );
+    pPiece  = pTable->pPieces + ulIndex;
+    pSpan1->pch = PieceTable_PieceText( pTable, pPiece, ulOffset, &(pSpan1->cb) );
+    if ( !pSpan1->pch ) {
+        pSpan1->cb = 0;
+        return 0;
+    }
+    if ( pSpan1->cb >= ulLength ) {
+        pSpan1->cb = ulLength;
+        return 1;
+    }
+
+    // If the first span ended at a page boundary, the second span continues
+    // within the same piece
+    if ( pSpan1->cb < ( pPiece->ulLength - ulOffset ))
+        ulOffset += pSpan1->cb;
+    else {
+        pPiece++;
+        ulOffset = 0;
+    }
+    pSpan2->pch = PieceTable_PieceText( pTable, pPiece, ulOffset, &(pSpan2->cb) );
+    if ( !pSpan2->pch ) {
+        pSpan2->cb = 0;
+        return 1;
+    }
+    if ( pSpan2->cb > ( ulLength - pSpan1->cb ))
+        pSpan2->cb = ulLength - pSpan1->cb;
+    return 2;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * PieceTable_Reserve                                                        *
+ *                                                                           *
+ * Enlarges the 'added' buffer to exactly the size needed to grow the text   *
+ * to the given total length, if it is not already that large.               *
+ * ------------------------------------------------------------------------- */
+int PieceTable_Reserve( PPIECETABLE pTable, unsigned long cbText )
+{
+    if ( cbText <= pTable->cbText ) return 1;
+    return PieceTable_ResizeAdded( pTable, pTable->cbAdded + ( cbText - pTable->cbText ));
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * PieceTable_InitShared                                                     *
+ *                                                                           *
+ * Initializes the text data structure using the specified text in place as  *
+ * the original buffer, without copying it.  Since the original buffer is    *
+ * never written to, this is safe even with a read-only file mapping; it is  *
+ * only touched when its text is actually read.                              *
+ * ------------------------------------------------------------------------- */
+int PieceTable_InitShared( PPIECETABLE pTable, unsigned char *pchText, unsigned long cbText )
+{
+    if ( ! PieceTable_Init( pTable, NULL, 0 )) return 0;
+    if ( !cbText || !pchText ) return 1;
+
+    pTable->pchOriginal = pchText;
+    pTable->cbOriginal  = cbText;
+    pTable->fShared     = 1;
+
+    pTable->pPieces[ 0 ].ulSource = PT_ORIGINAL;
+    pTable->pPieces[ 0 ].ulStart  = 0;
+    pTable->pPieces[ 0 ].ulLength = cbText;
+    pTable->ulPieces = 1;
+    pTable->cbText   = cbText;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * PieceTable_InitFile                                                       *
+ *                                                                           *
+ * Initializes the text data structure with the contents of the named file,  *
+ * which is opened through a page cache rather than read into memory.  The   *
+ * whole file is described by a single 'original' piece, whose offsets are   *
+ * simply file offsets.                                                      *
+ * ------------------------------------------------------------------------- */
+int PieceTable_InitFile( PPIECETABLE pTable, const char *pszFile )
+{
+    PPAGECACHE    pCache;
+    unsigned long cbFile;
+
+    pCache = PageCache_Open( pszFile, pTable->hdr.cbCacheLimit, pTable->hdr.pAllocator, &cbFile );
+    if ( !pCache ) return 0;
+    if ( ! PieceTable_Init( pTable, NULL, 0 )) {
+        PageCache_Close( pCache );
+        return 0;
+    }
+
+    pTable->pCache     = pCache;
+    pTable->cbOriginal = cbFile;
+    if ( cbFile ) {
+        pTable->pPieces[ 0 ].ulSource = PT_ORIGINAL;
+        pTable->pPieces[ 0 ].ulStart  = 0;
+        pTable->pPieces[ 0 ].ulLength = cbFile;
+        pTable->ulPieces = 1;
+        pTable->cbText   = cbFile;
+    }
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * PieceTable_QueryStats                                                     *
+ *                                                                           *
+ * Returns the page cache statistics, if the text was opened from a file.    *
+ * ------------------------------------------------------------------------- */
+int PieceTable_QueryStats( PPIECETABLE pTable, PTEXTSTATS pStats )
+{
+    if ( pTable->pCache ) PageCache_QueryStats( pTable->pCache, pStats );
+    return 1;
+}
+
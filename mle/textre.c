@@ -0,0 +1,1427 @@
+/*****************************************************************************
+ * textre.c                                                                  *
+ *                                                                           *
+ * Implements regular expression search (see textre.h).                      *
+ *                                                                           *
+ * A pattern is parsed into a tree, which is then compiled twice into a      *
+ * simple NFA program: once as written, and once with every sequence         *
+ * reversed.  Neither program is ever run directly; instead each one is      *
+ * used to build a DFA lazily, one state at a time, as the text calls for    *
+ * it.  A DFA state is the list of NFA instructions which are active at a    *
+ * point in the text, kept in order of preference, along with the kind of    *
+ * character before it (which ^ and $ depend on).                            *
+ *                                                                           *
+ * To keep the DFA's transition tables small, the 65536 UCS-2 code units     *
+ * are divided into classes of characters which the pattern cannot tell      *
+ * apart, and the transitions are indexed by class.                          *
+ *                                                                           *
+ * A search is made in two passes.  The forward DFA starts a new attempt at  *
+ * every position (at lowest priority) until some attempt matches, and then  *
+ * drops everything less preferred than the match, so when it runs out of    *
+ * states the last match it saw is where the preferred match ends.  The      *
+ * reverse DFA then runs backwards from that point, taking the longest       *
+ * match it can, to find where the match starts.                             *
+ *                                                                           *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <stddef.h>
+
+#include "debug.h"
+#include "textseq.h"
+#include "textre.h"
+
+
+// ---------------------------------------------------------------------------
+// CONSTANTS
+//
+
+// Parse tree node types
+#define NODE_EMPTY          0       // matches the empty string
+#define NODE_SET            1       // a character in a set (ulLeft = set index)
+#define NODE_BOL            2       // start of a line
+#define NODE_EOL            3       // end of a line
+#define NODE_CAT            4       // ulLeft followed by ulRight
+#define NODE_ALT            5       // ulLeft or ulRight
+#define NODE_REPEAT         6       // ulLeft, between ulMin and ulMax times
+
+// NFA instructions
+#define OP_SET              1       // consume a character in set x
+#define OP_SPLIT            2       // continue at both x (preferred) and y
+#define OP_JUMP             3       // continue at x
+#define OP_BOL              4       // continue if at the start of a line
+#define OP_EOL              5       // continue if at the end of a line
+#define OP_MATCH            6       // the pattern has matched
+
+// Kinds of character, as far as ^ and $ are concerned
+#define CTX_EDGE            0       // no character (edge of the text)
+#define CTX_LF              1       // line feed
+#define CTX_CR              2       // carriage return
+#define CTX_OTHER           3       // anything else
+
+#define REPEAT_INFINITE     0xFFFFFFFF  // no upper limit on repetitions
+#define REPEAT_MAX          1000        // largest count permitted in {m,n}
+#define REGEX_INSTS_MAX     0x10000     // largest permitted program
+
+#define DFA_HASH_SIZE       1024    // buckets in the DFA state table
+#define DFA_MATCHED         0x1     // a match ended before the character leading here
+#define DFA_DEAD            0x2     // nothing more can match from this state
+#define REVERSE_CHUNK       4096    // bytes read at a time when scanning backwards
+
+#define CHAR_LF             0x000A
+#define CHAR_CR             0x000D
+
+
+// ---------------------------------------------------------------------------
+// TYPEDEFS
+//
+
+// A range of characters in a set.
+//
+typedef struct _regex_range {
+    unsigned short usLow,           // First character in the range
+                   usHigh;          // Last character in the range
+} REGEXRANGE, *PREGEXRANGE;
+
+
+// A character set: a run of entries in the range array.
+//
+typedef struct _regex_set {
+    unsigned long ulFirst,          // Index of the first range
+                  ulCount;          // Number of ranges
+} REGEXSET, *PREGEXSET;
+
+
+// A node of the parse tree.
+//
+typedef struct _regex_node {
+    unsigned short usType;          // NODE_* constant
+    unsigned short fLazy;           // NODE_REPEAT prefers fewer repetitions
+    unsigned long  ulLeft,          // First (or only) child, or set index
+                   ulRight,         // Second child
+                   ulMin,           // Minimum repetitions
+                   ulMax;           // Maximum repetitions, or REPEAT_INFINITE
+} REGEXNODE, *PREGEXNODE;
+
+
+// An NFA instruction.
+//
+typedef struct _regex_inst {
+    unsigned long ulOp,             // OP_* constant
+                  x,                // Set index, or target
+                  y;                // Second target (OP_SPLIT)
+} REGEXINST, *PREGEXINST;
+
+
+// A cached DFA state.  The transition table and the list of threads are
+// allocated along with the structure.  Whether a match ended just before
+// the character which led to the state is part of the state, so that the
+// scanning loop only has to look at the state it moves to.
+//
+typedef struct _dfa_state {
+    unsigned long     flState;      // DFA_* flags
+    struct _dfa_state **apNext;     // Successor for each class (NULL until known)
+    struct _dfa_state *pHashNext;   // Next state in the same hash bucket
+    unsigned long     *pulThreads;  // Active instructions, most preferred first
+    unsigned long     ulThreads,    // Number of active instructions
+                      ulHash,       // Hash of the key below
+                      ulContext;    // Kind of character before the state
+    int               fInject;      // Still starting a new attempt at each position
+} DFASTATE, *PDFASTATE;
+
+
+// One compiled direction of a pattern, with its DFA cache.
+//
+typedef struct _regex_dfa {
+    PREGEXINST    pInsts;           // NFA program
+    unsigned long ulInsts,          // Number of instructions
+                  ulStart;          // Entry point
+    int           fReverse;         // Runs backwards, taking the longest match
+    PDFASTATE     apHash[ DFA_HASH_SIZE ];  // Cached states
+    unsigned long cbCache;          // Memory used by the cached states
+    unsigned long *pulList,         // Work list of threads
+                  *pulNew,          // List of threads for the next state
+                  *pulStack,        // Stack for following the program
+                  *pulMark,         // Generation at which each instruction was added
+                  ulGeneration;     // Current generation
+} REGEXDFA, *PREGEXDFA;
+
+
+// A compiled pattern.
+//
+typedef struct _text_regex {
+    unsigned short ausClass[ 65536 ];   // Class of each code unit
+    unsigned short *pusRep;             // A representative character of each class
+    unsigned long  ulClasses;           // Number of classes
+    PREGEXRANGE    pRanges;             // Ranges of all character sets
+    PREGEXSET      pSets;               // Character sets
+    unsigned long  ulSets;              // Number of sets
+    REGEXDFA       forward,             // Pattern as written
+                   reverse;             // Pattern reversed
+} REGEX, *PREGEX;
+
+
+// State of the parser.
+//
+typedef struct _regex_parse {
+    const unsigned short *pus;          // Pattern
+    unsigned long  ulLength,            // Length of the pattern
+                   ulPos,               // Current position in the pattern
+                   flOptions;           // REGEX_* options
+    int            fError;              // A syntax error was found
+    PREGEXNODE     pNodes;              // Parse tree nodes
+    unsigned long  ulNodes,
+                   ulNodesMax;
+    PREGEXRANGE    pRanges;             // Ranges of all character sets
+    unsigned long  ulRanges,
+                   ulRangesMax;
+    PREGEXSET      pSets;               // Character sets
+    unsigned long  ulSets,
+                   ulSetsMax;
+} REGEXPARSE, *PREGEXPARSE;
+
+
+// ---------------------------------------------------------------------------
+// MACROS
+//
+
+// Is the parser at the end of the pattern?
+#define PARSE_END( p )      ( (p)->ulPos >= (p)->ulLength )
+
+// The next pattern character (only valid if not at the end)
+#define PARSE_PEEK( p )     ( (p)->pus[ (p)->ulPos ] )
+
+// ---------------------------------------------------------------------------
+// FUNCTION DECLARATIONS
+//
+
+int           Regex_AddRange( PREGEXPARSE pParse, unsigned short usLow, unsigned short usHigh );
+int           Regex_AssertHolds( unsigned long ulOp, unsigned long ulBefore, unsigned long ulAfter );
+int           Regex_BuildClasses( PREGEX pRegex );
+unsigned long Regex_CharContext( unsigned short usChar );
+int           Regex_Emit( PREGEXDFA pDfa, unsigned long *pulMax, PREGEXNODE pNodes, unsigned long ulNode );
+unsigned long Regex_EmitInst( PREGEXDFA pDfa, unsigned long *pulMax, unsigned long ulOp, unsigned long x, unsigned long y );
+int           Regex_Escape( PREGEXPARSE pParse, unsigned short *pusChar );
+void          Regex_Follow( PREGEXDFA pDfa, unsigned long *pulList, unsigned long *pulCount, unsigned long ulPC, int fEval, unsigned long ulBefore, unsigned long ulAfter );
+int           Regex_Grow( void **ppItems, unsigned long *pulMax, unsigned long ulCount, size_t cbItem );
+int           Regex_InSet( PREGEX pRegex, unsigned long ulSet, unsigned short usChar );
+unsigned long Regex_NewNode( PREGEXPARSE pParse, unsigned short usType, unsigned long ulLeft, unsigned long ulRight );
+unsigned long Regex_NewSet( PREGEXPARSE pParse, unsigned long ulFirst, int fNegate );
+int           Regex_Normalize( PREGEXPARSE pParse, unsigned long ulFirst, int fNegate );
+unsigned long Regex_ParseAlt( PREGEXPARSE pParse );
+unsigned long Regex_ParseAtom( PREGEXPARSE pParse );
+unsigned long Regex_ParseClass( PREGEXPARSE pParse );
+unsigned long Regex_ParseRepeat( PREGEXPARSE pParse );
+int           Regex_Program( PREGEXDFA pDfa, PREGEXNODE pNodes, unsigned long ulRoot, int fReverse );
+unsigned long Regex_ScanForward( PREGEX pRegex, EDITORTEXT text, unsigned long ulPosition, unsigned long cbText );
+unsigned long Regex_ScanReverse( PREGEX pRegex, EDITORTEXT text, unsigned long ulPosition, unsigned long ulEnd, unsigned long cbText );
+unsigned long Regex_UnitContext( EDITORTEXT text, unsigned long ulPosition, unsigned long cbText );
+
+void          Dfa_Flush( PREGEXDFA pDfa );
+int           Dfa_Final( PREGEXDFA pDfa, PDFASTATE pState, unsigned long ulContext );
+PDFASTATE     Dfa_State( PREGEX pRegex, PREGEXDFA pDfa, unsigned long *pulThreads, unsigned long ulThreads, unsigned long ulContext, int fInject, unsigned long flMatch, int *pfFlushed );
+PDFASTATE     Dfa_Start( PREGEX pRegex, PREGEXDFA pDfa, unsigned long ulContext );
+PDFASTATE     Dfa_Step( PREGEX pRegex, PREGEXDFA pDfa, PDFASTATE pState, unsigned long ulClass );
+
+
+// ===========================================================================
+// INTERNAL FUNCTIONS
+// ===========================================================================
+
+
+/* ------------------------------------------------------------------------- *
+ * Regex_Grow()                                                              *
+ *                                                                           *
+ * Makes sure that a growable array has room for one more item, doubling     *
+ * its capacity if necessary.                                                *
+ * ------------------------------------------------------------------------- */
+int Regex_Grow( void **ppItems, unsigned long *pulMax, unsigned long ulCount, size_t cbItem )
+{
+    void          *pNew;
+    unsigned long ulNewMax;
+
+    if ( ulCount < *pulMax ) return 1;
+    ulNewMax = *pulMax ? *pulMax * 2 : 16;
+    pNew = realloc( *ppItems, ulNewMax * cbItem );
+    if ( !pNew ) return 0;
+    *ppItems = pNew;
+    *pulMax  = ulNewMax;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Regex_NewNode()                                                           *
+ *                                                                           *
+ * Adds a node to the parse tree and returns its index.                      *
+ * ------------------------------------------------------------------------- */
+unsigned long Regex_NewNode( PREGEXPARSE pParse, unsigned short usType, unsigned long ulLeft, unsigned long ulRight )
+{
+    PREGEXNODE pNode;
+
+    if ( !Regex_Grow( (void **) &(pParse->pNodes), &(pParse->ulNodesMax),
+                      pParse->ulNodes, sizeof( REGEXNODE )))
+    {
+        pParse->fError = 1;
+        return 0;
+    }
+    pNode = pParse->pNodes + pParse->ulNodes;
+    pNode->usType  = usType;
+    pNode->fLazy   = 0;
+    pNode->ulLeft  = ulLeft;
+    pNode->ulRight = ulRight;
+    pNode->ulMin   = 0;
+    pNode->ulMax   = 0;
+    return pParse->ulNodes++;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Regex_AddRange()                                                          *
+ *                                                                           *
+ * Adds a range of characters to the set being built (the last ranges in     *
+ * the range array), along with the other case of any letters in it if the   *
+ * pattern ignores case.                                                     *
+ * ------------------------------------------------------------------------- */
+int Regex_AddRange( PREGEXPARSE pParse, unsigned short usLow, unsigned short usHigh )
+{
+    unsigned short usFrom,
+                   usTo;
+    int            i;
+
+    for ( i = 0; i < 3; i++ ) {
+        if ( i == 0 ) {
+            usFrom = usLow;
+            usTo   = usHigh;
+        }
+        else {
+            if ( !( pParse->flOptions & REGEX_IGNORECASE )) break;
+            usFrom = ( i == 1 ) ? 'A' : 'a';
+            usTo   = ( i == 1 ) ? 'Z' : 'z';
+            if ( usFrom < usLow ) usFrom = usLow;
+            if ( usTo > usHigh )  usTo   = usHigh;
+            if ( usFrom > usTo ) continue;
+            usFrom ^= 0x20;
+            usTo   ^= 0x20;
+        }
+        if ( !Regex_Grow( (void **) &(pParse->pRanges), &(pParse->ulRangesMax),
+                          pParse->ulRanges, sizeof( REGEXRANGE )))
+            return 0;
+        pParse->pRanges[ pParse->ulRanges ].usLow  = usFrom;
+        pParse->pRanges[ pParse->ulRanges ].usHigh = usTo;
+        pParse->ulRanges++;
+    }
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Regex_Normalize()                                                         *
+ *                                                                           *
+ * Sorts and merges the ranges added since ulFirst, and if fNegate is set,   *
+ * replaces them by the ranges they leave out.                               *
+ * ------------------------------------------------------------------------- */
+int Regex_Normalize( PREGEXPARSE pParse, unsigned long ulFirst, int fNegate )
+{
+    PREGEXRANGE   pRanges;
+    REGEXRANGE    range;
+    unsigned long ulCount,
+                  ulOut,
+                  ulNext,
+                  i, j;
+
+    pRanges = pParse->pRanges + ulFirst;
+    ulCount = pParse->ulRanges - ulFirst;
+
+    // Sort by starting character (sets are small, so insertion sort will do)
+    for ( i = 1; i < ulCount; i++ ) {
+        range = pRanges[ i ];
+        for ( j = i; j && ( pRanges[ j-1 ].usLow > range.usLow ); j-- )
+            pRanges[ j ] = pRanges[ j-1 ];
+        pRanges[ j ] = range;
+    }
+
+    // Merge overlapping or adjoining ranges
+    ulOut = 0;
+    for ( i = 0; i < ulCount; i++ ) {
+        if ( ulOut && ( (unsigned long) pRanges[ i ].usLow <= (unsigned long) pRanges[ ulOut-1 ].usHigh + 1 )) {
+            if ( pRanges[ i ].usHigh > pRanges[ ulOut-1 ].usHigh )
+                pRanges[ ulOut-1 ].usHigh = pRanges[ i ].usHigh;
+        }
+        else pRanges[ ulOut++ ] = pRanges[ i ];
+    }
+    pParse->ulRanges = ulFirst + ulOut;
+    if ( !fNegate ) return 1;
+
+    // Add the gaps between the ranges after them, then drop the ranges
+    ulNext = 0;
+    for ( i = 0; i <= ulOut; i++ ) {
+        if ( i < ulOut ) {
+            if ( pParse->pRanges[ ulFirst + i ].usLow <= ulNext ) {
+                ulNext = (unsigned long) pParse->pRanges[ ulFirst + i ].usHigh + 1;
+                continue;
+            }
+        }
+        else if ( ulNext > 0xFFFF ) break;
+
+        if ( !Regex_Grow( (void **) &(pParse->pRanges), &(pParse->ulRangesMax),
+                          pParse->ulRanges, sizeof( REGEXRANGE )))
+            return 0;
+        pParse->pRanges[ pParse->ulRanges ].usLow  = (unsigned short) ulNext;
+        pParse->pRanges[ pParse->ulRanges ].usHigh = ( i < ulOut ) ?
+                                                     pParse->pRanges[ ulFirst + i ].usLow - 1 : 0xFFFF;
+        pParse->ulRanges++;
+        if ( i < ulOut ) ulNext = (unsigned long) pParse->pRanges[ ulFirst + i ].usHigh + 1;
+    }
+    memmove( pParse->pRanges + ulFirst, pParse->pRanges + ulFirst + ulOut,
+             ( pParse->ulRanges - ulFirst - ulOut ) * sizeof( REGEXRANGE ));
+    pParse->ulRanges -= ulOut;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Regex_NewSet()                                                            *
+ *                                                                           *
+ * Turns the ranges added since ulFirst into a set (negated if fNegate is    *
+ * set), and returns a new NODE_SET for it.                                  *
+ * ------------------------------------------------------------------------- */
+unsigned long Regex_NewSet( PREGEXPARSE pParse, unsigned long ulFirst, int fNegate )
+{
+    if ( !Regex_Normalize( pParse, ulFirst, fNegate ) ||
+         !Regex_Grow( (void **) &(pParse->pSets), &(pParse->ulSetsMax),
+                      pParse->ulSets, sizeof( REGEXSET )))
+    {
+        pParse->fError = 1;
+        return 0;
+    }
+    pParse->pSets[ pParse->ulSets ].ulFirst = ulFirst;
+    pParse->pSets[ pParse->ulSets ].ulCount = pParse->ulRanges - ulFirst;
+    return Regex_NewNode( pParse, NODE_SET, pParse->ulSets++, 0 );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Regex_Escape()                                                            *
+ *                                                                           *
+ * Parses the escape sequence following a backslash.  If it stands for a     *
+ * single character, that is returned in pusChar and the return value is 1;  *
+ * if it stands for a class (\d, \w, \s and their negations), the class's    *
+ * ranges are added to the set being built and the return value is 2 (or 3   *
+ * for a negated class, whose ranges are the ones it excludes).  Returns 0   *
+ * on a syntax error.                                                        *
+ * ------------------------------------------------------------------------- */
+int Regex_Escape( PREGEXPARSE pParse, unsigned short *pusChar )
+{
+    unsigned short usChar,
+                   usDigit;
+    int            i;
+
+    if ( PARSE_END( pParse )) return 0;
+    usChar = pParse->pus[ pParse->ulPos++ ];
+    switch ( usChar ) {
+        case 'n': *pusChar = CHAR_LF; return 1;
+        case 'r': *pusChar = CHAR_CR; return 1;
+        case 't': *pusChar = 0x0009;  return 1;
+        case 'f': *pusChar = 0x000C;  return 1;
+        case 'v': *pusChar = 0x000B;  return 1;
+
+        case 'u':
+            *pusChar = 0;
+            for ( i = 0; i < 4; i++ ) {
+                if ( PARSE_END( pParse )) return 0;
+                usDigit = pParse->pus[ pParse->ulPos++ ];
+                if (( usDigit >= '0' ) && ( usDigit <= '9' ))      usDigit -= '0';
+                else if (( usDigit >= 'a' ) && ( usDigit <= 'f' )) usDigit -= 'a' - 10;
+                else if (( usDigit >= 'A' ) && ( usDigit <= 'F' )) usDigit -= 'A' - 10;
+                else return 0;
+                *pusChar = ( *pusChar << 4 ) | usDigit;
+            }
+            return 1;
+
+        case 'd':
+        case 'D':
+            if ( !Regex_AddRange( pParse, '0', '9' )) return 0;
+            return ( usChar == 'd' ) ? 2 : 3;
+
+        case 'w':
+        case 'W':
+            if ( !Regex_AddRange( pParse, '0', '9' ) || !Regex_AddRange( pParse, 'A', 'Z' ) ||
+                 !Regex_AddRange( pParse, '_', '_' ) || !Regex_AddRange( pParse, 'a', 'z' ))
+                return 0;
+            return ( usChar == 'w' ) ? 2 : 3;
+
+        case 's':
+        case 'S':
+            if ( !Regex_AddRange( pParse, 0x0009, 0x000D ) || !Regex_AddRange( pParse, ' ', ' ' ))
+                return 0;
+            return ( usChar == 's' ) ? 2 : 3;
+
+        default:
+            // Any other letter or digit is reserved
+            if ((( usChar >= 'a' ) && ( usChar <= 'z' )) ||
+                (( usChar >= 'A' ) && ( usChar <= 'Z' )) ||
+                (( usChar >= '0' ) && ( usChar <= '9' )))
+                return 0;
+            *pusChar = usChar;
+            return 1;
+    }
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Regex_ParseClass()                                                        *
+ *                                                                           *
+ * Parses a bracketed character set, following the opening '['.              *
+ * ------------------------------------------------------------------------- */
+unsigned long Regex_ParseClass( PREGEXPARSE pParse )
+{
+    unsigned long  ulFirst,
+                   ulEscape;
+    unsigned short usLow,
+                   usHigh;
+    int            fNegate,
+                   fFirst,
+                   iKind;
+
+    ulFirst = pParse->ulRanges;
+    fNegate = 0;
+    if ( !PARSE_END( pParse ) && ( PARSE_PEEK( pParse ) == '^' )) {
+        fNegate = 1;
+        pParse->ulPos++;
+    }
+
+    fFirst = 1;
+    while ( !PARSE_END( pParse ) && (( PARSE_PEEK( pParse ) != ']' ) || fFirst )) {
+        fFirst = 0;
+        usLow  = pParse->pus[ pParse->ulPos++ ];
+        if ( usLow == '\\' ) {
+            ulEscape = pParse->ulRanges;
+            iKind    = Regex_Escape( pParse, &usLow );
+            if ( !iKind ) goto fail;
+            if (( iKind == 3 ) && !Regex_Normalize( pParse, ulEscape, 1 )) goto fail;
+            if ( iKind > 1 ) continue;
+        }
+
+        usHigh = usLow;
+        if (( pParse->ulPos + 1 < pParse->ulLength ) && ( PARSE_PEEK( pParse ) == '-' ) &&
+            ( pParse->pus[ pParse->ulPos + 1 ] != ']' ))
+        {
+            pParse->ulPos++;
+            usHigh = pParse->pus[ pParse->ulPos++ ];
+            if (( usHigh == '\\' ) && ( Regex_Escape( pParse, &usHigh ) != 1 )) goto fail;
+            if ( usHigh < usLow ) goto fail;
+        }
+        if ( !Regex_AddRange( pParse, usLow, usHigh )) goto fail;
+    }
+    if ( PARSE_END( pParse )) goto fail;
+    pParse->ulPos++;                    // skip the ']'
+    return Regex_NewSet( pParse, ulFirst, fNegate );
+
+fail:
+    pParse->fError = 1;
+    return 0;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Regex_ParseAtom()                                                         *
+ *                                                                           *
+ * Parses a single item: a character, set, anchor or parenthesized group.    *
+ * ------------------------------------------------------------------------- */
+unsigned long Regex_ParseAtom( PREGEXPARSE pParse )
+{
+    unsigned long  ulNode,
+                   ulFirst;
+    unsigned short usChar;
+    int            iKind;
+
+    usChar = pParse->pus[ pParse->ulPos++ ];
+    switch ( usChar ) {
+        case '(':
+            if (( pParse->ulPos + 1 < pParse->ulLength ) && ( PARSE_PEEK( pParse ) == '?' ) &&
+                ( pParse->pus[ pParse->ulPos + 1 ] == ':' ))
+                pParse->ulPos += 2;
+            ulNode = Regex_ParseAlt( pParse );
+            if ( pParse->fError ) return 0;
+            if ( PARSE_END( pParse ) || ( PARSE_PEEK( pParse ) != ')' )) break;
+            pParse->ulPos++;
+            return ulNode;
+
+        case '[':
+            return Regex_ParseClass( pParse );
+
+        case '.':
+            ulFirst = pParse->ulRanges;
+            if ( !Regex_AddRange( pParse, CHAR_LF, CHAR_LF ) ||
+                 !Regex_AddRange( pParse, CHAR_CR, CHAR_CR ))
+                break;
+            return Regex_NewSet( pParse, ulFirst, 1 );
+
+        case '^':
+            return Regex_NewNode( pParse, NODE_BOL, 0, 0 );
+
+        case '$':
+            return Regex_NewNode( pParse, NODE_EOL, 0, 0 );
+
+        case ')':
+        case '*':
+        case '+':
+        case '?':
+        case '{':
+            pParse->ulPos--;
+            break;
+
+        case '\\':
+            ulFirst = pParse->ulRanges;
+            iKind   = Regex_Escape( pParse, &usChar );
+            if ( !iKind ) break;
+            if ( iKind > 1 ) return Regex_NewSet( pParse, ulFirst, ( iKind == 3 ));
+            // fall through
+
+        default:
+            ulFirst = pParse->ulRanges;
+            if ( !Regex_AddRange( pParse, usChar, usChar )) break;
+            return Regex_NewSet( pParse, ulFirst, 0 );
+    }
+    pParse->fError = 1;
+    return 0;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Regex_ParseRepeat()                                                       *
+ *                                                                           *
+ * Parses an item followed by any number of repetition operators.            *
+ * ------------------------------------------------------------------------- */
+unsigned long Regex_ParseRepeat( PREGEXPARSE pParse )
+{
+    PREGEXNODE     pNode;
+    unsigned long  ulNode,
+                   ulMin,
+                   ulMax;
+    unsigned short usChar;
+
+    ulNode = Regex_ParseAtom( pParse );
+    while ( !pParse->fError && !PARSE_END( pParse )) {
+        usChar = PARSE_PEEK( pParse );
+        if ( usChar == '*' )      { ulMin = 0; ulMax = REPEAT_INFINITE; }
+        else if ( usChar == '+' ) { ulMin = 1; ulMax = REPEAT_INFINITE; }
+        else if ( usChar == '?' ) { ulMin = 0; ulMax = 1; }
+        else if ( usChar == '{' ) {
+            pParse->ulPos++;
+            for ( ulMin = 0; !PARSE_END( pParse ) && ( PARSE_PEEK( pParse ) >= '0' ) &&
+                             ( PARSE_PEEK( pParse ) <= '9' ) && ( ulMin <= REPEAT_MAX ); pParse->ulPos++ )
+                ulMin = ulMin * 10 + PARSE_PEEK( pParse ) - '0';
+            ulMax = ulMin;
+            if ( !PARSE_END( pParse ) && ( PARSE_PEEK( pParse ) == ',' )) {
+                pParse->ulPos++;
+                if ( !PARSE_END( pParse ) && ( PARSE_PEEK( pParse ) == '}' ))
+                    ulMax = REPEAT_INFINITE;
+                else for ( ulMax = 0; !PARSE_END( pParse ) && ( PARSE_PEEK( pParse ) >= '0' ) &&
+                                      ( PARSE_PEEK( pParse ) <= '9' ) && ( ulMax <= REPEAT_MAX ); pParse->ulPos++ )
+                    ulMax = ulMax * 10 + PARSE_PEEK( pParse ) - '0';
+            }
+            if ( PARSE_END( pParse ) || ( PARSE_PEEK( pParse ) != '}' ) ||
+                 ( ulMin > REPEAT_MAX ) || ( ulMax < ulMin ) ||
+                 (( ulMax != REPEAT_INFINITE ) && ( ulMax > REPEAT_MAX )))
+            {
+                pParse->fError = 1;
+                return 0;
+            }
+        }
+        else break;
+        pParse->ulPos++;
+
+        ulNode = Regex_NewNode( pParse, NODE_REPEAT, ulNode, 0 );
+        if ( pParse->fError ) return 0;
+        pNode = pParse->pNodes + ulNode;
+        pNode->ulMin = ulMin;
+        pNode->ulMax = ulMax;
+        if ( !PARSE_END( pParse ) && ( PARSE_PEEK( pParse ) == '?' )) {
+            pNode->fLazy = 1;
+            pParse->ulPos++;
+        }
+    }
+    return ulNode;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Regex_ParseAlt()                                                          *
+ *                                                                           *
+ * Parses a list of alternatives, each a sequence of items, up to the end of *
+ * the pattern or an unmatched ')'.                                          *
+ * ------------------------------------------------------------------------- */
+unsigned long Regex_ParseAlt( PREGEXPARSE pParse )
+{
+    unsigned long ulAlt,
+                  ulSeq;
+
+    ulAlt = (unsigned long) -1;
+    for (;;) {
+        ulSeq = Regex_NewNode( pParse, NODE_EMPTY, 0, 0 );
+        while ( !pParse->fError && !PARSE_END( pParse ) &&
+                ( PARSE_PEEK( pParse ) != '|' ) && ( PARSE_PEEK( pParse ) != ')' ))
+            ulSeq = Regex_NewNode( pParse, NODE_CAT, ulSeq, Regex_ParseRepeat( pParse ));
+        if ( pParse->fError ) return 0;
+
+        ulAlt = ( ulAlt == (unsigned long) -1 ) ? ulSeq :
+                                                  Regex_NewNode( pParse, NODE_ALT, ulAlt, ulSeq );
+        if ( PARSE_END( pParse ) || ( PARSE_PEEK( pParse ) != '|' )) break;
+        pParse->ulPos++;
+    }
+    return ulAlt;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Regex_EmitInst()                                                          *
+ *                                                                           *
+ * Appends an instruction to a program and returns its index, or             *
+ * REGEX_INSTS_MAX if the program is full.                                   *
+ * ------------------------------------------------------------------------- */
+unsigned long Regex_EmitInst( PREGEXDFA pDfa, unsigned long *pulMax, unsigned long ulOp, unsigned long x, unsigned long y )
+{
+    if (( pDfa->ulInsts >= REGEX_INSTS_MAX ) ||
+        !Regex_Grow( (void **) &(pDfa->pInsts), pulMax, pDfa->ulInsts, sizeof( REGEXINST )))
+        return REGEX_INSTS_MAX;
+    pDfa->pInsts[ pDfa->ulInsts ].ulOp = ulOp;
+    pDfa->pInsts[ pDfa->ulInsts ].x    = x;
+    pDfa->pInsts[ pDfa->ulInsts ].y    = y;
+    return pDfa->ulInsts++;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Regex_Emit()                                                              *
+ *                                                                           *
+ * Compiles a parse tree node (and its children) into instructions.  In the  *
+ * reverse program, sequences are emitted back to front.  Repetition counts  *
+ * are expanded by emitting the item several times.                          *
+ * ------------------------------------------------------------------------- */
+int Regex_Emit( PREGEXDFA pDfa, unsigned long *pulMax, PREGEXNODE pNodes, unsigned long ulNode )
+{
+    PREGEXNODE    pNode = pNodes + ulNode;
+    unsigned long ulSplit,
+                  ulJump,
+                  ulLoop,
+                  ulEnd,
+                  i;
+
+    switch ( pNode->usType ) {
+        case NODE_EMPTY:
+            return 1;
+
+        case NODE_SET:
+            return ( Regex_EmitInst( pDfa, pulMax, OP_SET, pNode->ulLeft, 0 ) != REGEX_INSTS_MAX );
+
+        case NODE_BOL:
+            return ( Regex_EmitInst( pDfa, pulMax, OP_BOL, 0, 0 ) != REGEX_INSTS_MAX );
+
+        case NODE_EOL:
+            return ( Regex_EmitInst( pDfa, pulMax, OP_EOL, 0, 0 ) != REGEX_INSTS_MAX );
+
+        case NODE_CAT:
+            if ( pDfa->fReverse )
+                return ( Regex_Emit( pDfa, pulMax, pNodes, pNode->ulRight ) &&
+                         Regex_Emit( pDfa, pulMax, pNodes, pNode->ulLeft ));
+            return ( Regex_Emit( pDfa, pulMax, pNodes, pNode->ulLeft ) &&
+                     Regex_Emit( pDfa, pulMax, pNodes, pNode->ulRight ));
+
+        case NODE_ALT:
+            ulSplit = Regex_EmitInst( pDfa, pulMax, OP_SPLIT, 0, 0 );
+            if ( ulSplit == REGEX_INSTS_MAX ) return 0;
+            pDfa->pInsts[ ulSplit ].x = pDfa->ulInsts;
+            if ( !Regex_Emit( pDfa, pulMax, pNodes, pNode->ulLeft )) return 0;
+            ulJump = Regex_EmitInst( pDfa, pulMax, OP_JUMP, 0, 0 );
+            if ( ulJump == REGEX_INSTS_MAX ) return 0;
+            pDfa->pInsts[ ulSplit ].y = pDfa->ulInsts;
+            if ( !Regex_Emit( pDfa, pulMax, pNodes, pNode->ulRight )) return 0;
+            pDfa->pInsts[ ulJump ].x = pDfa->ulInsts;
+            return 1;
+
+        case NODE_REPEAT:
+            // The required repetitions
+            for ( i = 0; i < pNode->ulMin; i++ )
+                if ( !Regex_Emit( pDfa, pulMax, pNodes, pNode->ulLeft )) return 0;
+
+            // Any number more: loop back to a split before the item
+            if ( pNode->ulMax == REPEAT_INFINITE ) {
+                ulLoop = Regex_EmitInst( pDfa, pulMax, OP_SPLIT, 0, 0 );
+                if ( ulLoop == REGEX_INSTS_MAX ) return 0;
+                if ( !Regex_Emit( pDfa, pulMax, pNodes, pNode->ulLeft )) return 0;
+                if ( Regex_EmitInst( pDfa, pulMax, OP_JUMP, ulLoop, 0 ) == REGEX_INSTS_MAX ) return 0;
+                ulEnd = pDfa->ulInsts;
+                pDfa->pInsts[ ulLoop ].x = pNode->fLazy ? ulEnd : ulLoop + 1;
+                pDfa->pInsts[ ulLoop ].y = pNode->fLazy ? ulLoop + 1 : ulEnd;
+                return 1;
+            }
+
+            /* Up to ulMax-ulMin more: each optional repetition is preceded by
+             * a split which may skip to the end.  The targets are filled in
+             * afterwards, once the end is known (the y field temporarily
+             * holds the index of the previous split).
+             */
+            ulSplit = REGEX_INSTS_MAX;
+            for ( i = pNode->ulMin; i < pNode->ulMax; i++ ) {
+                ulLoop = Regex_EmitInst( pDfa, pulMax, OP_SPLIT, ulSplit, 0 );
+                if ( ulLoop == REGEX_INSTS_MAX ) return 0;
+                ulSplit = ulLoop;
+                if ( !Regex_Emit( pDfa, pulMax, pNodes, pNode->ulLeft )) return 0;
+            }
+            ulEnd = pDfa->ulInsts;
+            while ( ulSplit != REGEX_INSTS_MAX ) {
+                ulLoop = pDfa->pInsts[ ulSplit ].x;
+                pDfa->pInsts[ ulSplit ].x = pNode->fLazy ? ulEnd : ulSplit + 1;
+                pDfa->pInsts[ ulSplit ].y = pNode->fLazy ? ulSplit + 1 : ulEnd;
+                ulSplit = ulLoop;
+            }
+            return 1;
+    }
+    return 0;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Regex_Program()                                                           *
+ *                                                                           *
+ * Compiles the parse tree into one direction's program, and allocates the   *
+ * work space needed to build its DFA.                                       *
+ * ------------------------------------------------------------------------- */
+int Regex_Program( PREGEXDFA pDfa, PREGEXNODE pNodes, unsigned long ulRoot, int fReverse )
+{
+    unsigned long ulMax = 0;
+
+    pDfa->fReverse = fReverse;
+    pDfa->ulStart  = 0;
+    if ( !Regex_Emit( pDfa, &ulMax, pNodes, ulRoot ) ||
+         ( Regex_EmitInst( pDfa, &ulMax, OP_MATCH, 0, 0 ) == REGEX_INSTS_MAX ))
+        return 0;
+
+    pDfa->pulList  = (unsigned long *) malloc( pDfa->ulInsts * sizeof( unsigned long ));
+    pDfa->pulNew   = (unsigned long *) malloc( pDfa->ulInsts * sizeof( unsigned long ));
+    pDfa->pulStack = (unsigned long *) malloc(( 2 * pDfa->ulInsts + 2 ) * sizeof( unsigned long ));
+    pDfa->pulMark  = (unsigned long *) calloc( pDfa->ulInsts, sizeof( unsigned long ));
+    if ( !pDfa->pulList || !pDfa->pulNew || !pDfa->pulStack || !pDfa->pulMark )
+        return 0;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Regex_BuildClasses()                                                      *
+ *                                                                           *
+ * Divides the code units into classes which belong to exactly the same      *
+ * sets (LF and CR, which matter to ^ and $, always get classes of their     *
+ * own), and fills in the class of every code unit.                          *
+ * ------------------------------------------------------------------------- */
+int Regex_BuildClasses( PREGEX pRegex )
+{
+    unsigned char  *pbStart,            // Does a new segment start at each code unit?
+                   *pbSignatures,       // Set membership of each class so far
+                   *pbSig,
+                   *pbNew;
+    unsigned long  cbSig,
+                   ulChar,
+                   ulClass,
+                   i, j;
+    unsigned short *pusRep;
+
+    pbStart = (unsigned char *) calloc( 65536, 1 );
+    cbSig   = pRegex->ulSets + 2;
+    pbSig   = (unsigned char *) malloc( cbSig );
+    pbSignatures = NULL;
+    if ( !pbStart || !pbSig ) goto fail;
+
+    pbStart[ 0 ] = 1;
+    pbStart[ CHAR_LF ] = pbStart[ CHAR_LF + 1 ] = 1;
+    pbStart[ CHAR_CR ] = pbStart[ CHAR_CR + 1 ] = 1;
+    for ( i = 0; i < pRegex->ulSets; i++ ) {
+        for ( j = 0; j < pRegex->pSets[ i ].ulCount; j++ ) {
+            pbStart[ pRegex->pRanges[ pRegex->pSets[ i ].ulFirst + j ].usLow ] = 1;
+            ulChar = (unsigned long) pRegex->pRanges[ pRegex->pSets[ i ].ulFirst + j ].usHigh + 1;
+            if ( ulChar < 65536 ) pbStart[ ulChar ] = 1;
+        }
+    }
+
+    /* Give each segment the class of the first earlier segment with the same
+     * membership, or a new class if there is none.
+     */
+    pRegex->ulClasses = 0;
+    ulClass = 0;
+    for ( ulChar = 0; ulChar < 65536; ulChar++ ) {
+        if ( pbStart[ ulChar ] ) {
+            for ( i = 0; i < pRegex->ulSets; i++ )
+                pbSig[ i ] = (unsigned char) Regex_InSet( pRegex, i, (unsigned short) ulChar );
+            pbSig[ i ]     = ( ulChar == CHAR_LF );
+            pbSig[ i + 1 ] = ( ulChar == CHAR_CR );
+            for ( ulClass = 0; ulClass < pRegex->ulClasses; ulClass++ )
+                if ( !memcmp( pbSignatures + ulClass * cbSig, pbSig, cbSig )) break;
+            if ( ulClass == pRegex->ulClasses ) {
+                pbNew = (unsigned char *) realloc( pbSignatures, ( ulClass + 1 ) * cbSig );
+                if ( !pbNew ) goto fail;
+                pbSignatures = pbNew;
+                pusRep = (unsigned short *) realloc( pRegex->pusRep, ( ulClass + 1 ) * sizeof( unsigned short ));
+                if ( !pusRep ) goto fail;
+                pRegex->pusRep = pusRep;
+                memcpy( pbSignatures + ulClass * cbSig, pbSig, cbSig );
+                pRegex->pusRep[ ulClass ] = (unsigned short) ulChar;
+                pRegex->ulClasses++;
+            }
+        }
+        pRegex->ausClass[ ulChar ] = (unsigned short) ulClass;
+    }
+
+    free( pbSignatures );
+    free( pbSig );
+    free( pbStart );
+    return 1;
+
+fail:
+    free( pbSignatures );
+    free( pbSig );
+    free( pbStart );
+    return 0;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Regex_InSet()                                                             *
+ *                                                                           *
+ * Returns 1 if the character belongs to the given set.                      *
+ * ------------------------------------------------------------------------- */
+int Regex_InSet( PREGEX pRegex, unsigned long ulSet, unsigned short usChar )
+{
+    PREGEXRANGE   pRange;
+    unsigned long i;
+
+    pRange = pRegex->pRanges + pRegex->pSets[ ulSet ].ulFirst;
+    for ( i = 0; i < pRegex->pSets[ ulSet ].ulCount; i++, pRange++ )
+        if (( usChar >= pRange->usLow ) && ( usChar <= pRange->usHigh )) return 1;
+    return 0;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Regex_CharContext()                                                       *
+ *                                                                           *
+ * Returns the kind of character (CTX_* constant) as far as ^ and $ care.    *
+ * ------------------------------------------------------------------------- */
+unsigned long Regex_CharContext( unsigned short usChar )
+{
+    if ( usChar == CHAR_LF ) return CTX_LF;
+    if ( usChar == CHAR_CR ) return CTX_CR;
+    return CTX_OTHER;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Regex_UnitContext()                                                       *
+ *                                                                           *
+ * Returns the kind of the character at the given byte position in the       *
+ * text, or CTX_EDGE if the position is outside it.                          *
+ * ------------------------------------------------------------------------- */
+unsigned long Regex_UnitContext( EDITORTEXT text, unsigned long ulPosition, unsigned long cbText )
+{
+    unsigned short usChar;
+
+    if (( ulPosition == TEXT_INVALID_POSITION ) || ( ulPosition + sizeof( usChar ) > cbText ))
+        return CTX_EDGE;
+    if ( TextSequence( text, (unsigned char *) &usChar, ulPosition, sizeof( usChar )) != sizeof( usChar ))
+        return CTX_EDGE;
+    return Regex_CharContext( usChar );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Regex_AssertHolds()                                                       *
+ *                                                                           *
+ * Returns 1 if ^ (OP_BOL) or $ (OP_EOL) holds between characters of the     *
+ * given kinds, in text order.  A CR LF pair counts as one line break.       *
+ * ------------------------------------------------------------------------- */
+int Regex_AssertHolds( unsigned long ulOp, unsigned long ulBefore, unsigned long ulAfter )
+{
+    if ( ulOp == OP_BOL )
+        return (( ulBefore == CTX_EDGE ) || ( ulBefore == CTX_LF ) ||
+                (( ulBefore == CTX_CR ) && ( ulAfter != CTX_LF )));
+    return (( ulAfter == CTX_EDGE ) || ( ulAfter == CTX_CR ) ||
+            (( ulAfter == CTX_LF ) && ( ulBefore != CTX_CR )));
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Regex_Follow()                                                            *
+ *                                                                           *
+ * Adds the instructions reachable from ulPC without consuming a character   *
+ * to a thread list, in order of preference, skipping any already added in   *
+ * the current generation.  Splits and jumps are followed.  ^ and $ are      *
+ * followed if fEval is set and they hold between characters of the given    *
+ * kinds; if fEval is not set (because the next character is not known yet)  *
+ * they are added to the list to be evaluated later.                         *
+ * ------------------------------------------------------------------------- */
+void Regex_Follow( PREGEXDFA pDfa, unsigned long *pulList, unsigned long *pulCount, unsigned long ulPC, int fEval, unsigned long ulBefore, unsigned long ulAfter )
+{
+    PREGEXINST    pInst;
+    unsigned long ulDepth;
+
+    pDfa->pulStack[ 0 ] = ulPC;
+    ulDepth = 1;
+    while ( ulDepth ) {
+        ulPC = pDfa->pulStack[ --ulDepth ];
+        if ( pDfa->pulMark[ ulPC ] == pDfa->ulGeneration ) continue;
+        pDfa->pulMark[ ulPC ] = pDfa->ulGeneration;
+
+        pInst = pDfa->pInsts + ulPC;
+        switch ( pInst->ulOp ) {
+            case OP_JUMP:
+                pDfa->pulStack[ ulDepth++ ] = pInst->x;
+                break;
+
+            case OP_SPLIT:
+                pDfa->pulStack[ ulDepth++ ] = pInst->y;
+                pDfa->pulStack[ ulDepth++ ] = pInst->x;
+                break;
+
+            case OP_BOL:
+            case OP_EOL:
+                if ( !fEval )
+                    pulList[ (*pulCount)++ ] = ulPC;
+                else if ( Regex_AssertHolds( pInst->ulOp, ulBefore, ulAfter ))
+                    pDfa->pulStack[ ulDepth++ ] = ulPC + 1;
+                break;
+
+            default:
+                pulList[ (*pulCount)++ ] = ulPC;
+                break;
+        }
+    }
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Regex_ScanForward()                                                       *
+ *                                                                           *
+ * Runs the forward DFA from ulPosition until it dies or the text ends, and  *
+ * returns the end of the preferred match, or TEXT_INVALID_POSITION.         *
+ * ------------------------------------------------------------------------- */
+unsigned long Regex_ScanForward( PREGEX pRegex, EDITORTEXT text, unsigned long ulPosition, unsigned long cbText )
+{
+    PREGEXDFA      pDfa = &(pRegex->forward);
+    PDFASTATE      pState,
+                   pNext;
+    TEXTSPAN       aSpans[ 2 ];
+    unsigned short *pus,
+                   *pusStart,
+                   *pusEnd;
+    unsigned long  ulFound,
+                   ulSpans,
+                   cbSpan,
+                   cbSpans,
+                   ulClass,
+                   i;
+
+    pState = Dfa_Start( pRegex, pDfa, ( ulPosition ? Regex_UnitContext( text, ulPosition - 2, cbText ) : CTX_EDGE ));
+    if ( !pState ) return TEXT_INVALID_POSITION;
+
+    ulFound = TEXT_INVALID_POSITION;
+    while ( ulPosition < cbText ) {
+        ulSpans = TextGetSpans( text, ulPosition, cbText - ulPosition, aSpans, aSpans + 1 );
+        cbSpans = 0;
+        for ( i = 0; i < ulSpans; i++ ) {
+            cbSpan = aSpans[ i ].cb;
+            if ( cbSpan > cbText - ulPosition ) cbSpan = cbText - ulPosition;
+            pusStart = (unsigned short *) aSpans[ i ].pch;
+            pusEnd   = pusStart + ( cbSpan / 2 );
+            for ( pus = pusStart; pus < pusEnd; pus++ ) {
+                ulClass = pRegex->ausClass[ *pus ];
+                pNext   = pState->apNext[ ulClass ];
+                if ( !pNext && !( pNext = Dfa_Step( pRegex, pDfa, pState, ulClass )))
+                    return TEXT_INVALID_POSITION;
+                pState = pNext;
+                if ( pState->flState ) {
+                    if ( pState->flState & DFA_MATCHED )
+                        ulFound = ulPosition + ( pus - pusStart ) * 2;
+                    if ( pState->flState & DFA_DEAD ) return ulFound;
+                }
+            }
+            ulPosition += cbSpan;
+            cbSpans    += cbSpan;
+        }
+        if ( !cbSpans ) break;
+    }
+
+    if ( Dfa_Final( pDfa, pState, CTX_EDGE )) ulFound = cbText;
+    return ulFound;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Regex_ScanReverse()                                                       *
+ *                                                                           *
+ * Runs the reverse DFA backwards from ulEnd (where a match is known to end) *
+ * as far as ulPosition, and returns the earliest position at which a match  *
+ * ending at ulEnd starts.                                                   *
+ * ------------------------------------------------------------------------- */
+unsigned long Regex_ScanReverse( PREGEX pRegex, EDITORTEXT text, unsigned long ulPosition, unsigned long ulEnd, unsigned long cbText )
+{
+    PREGEXDFA      pDfa = &(pRegex->reverse);
+    PDFASTATE      pState,
+                   pNext;
+    TEXTSPAN       aSpans[ 2 ];
+    unsigned short *pus,
+                   *pusStart;
+    unsigned long  ulStart,
+                   ulFrom,
+                   ulSpans,
+                   cbSpans,
+                   cbSpan[ 2 ],
+                   ulClass,
+                   ulPos;
+    long           i;
+
+    pState = Dfa_Start( pRegex, pDfa, Regex_UnitContext( text, ulEnd, cbText ));
+    if ( !pState ) return ulEnd;
+
+    ulStart = ulEnd;
+    ulPos   = ulEnd;
+    while ( ulPos > ulPosition ) {
+
+        /* Find a chunk just before ulPos which the spans returned cover
+         * completely (some models may return less than was asked for).
+         */
+        ulFrom = ( ulPos - ulPosition > REVERSE_CHUNK ) ? ulPos - REVERSE_CHUNK : ulPosition;
+        for (;;) {
+            ulSpans = TextGetSpans( text, ulFrom, ulPos - ulFrom, aSpans, aSpans + 1 );
+            cbSpans = 0;
+            for ( i = 0; i < (long) ulSpans; i++ ) {
+                cbSpan[ i ] = aSpans[ i ].cb;
+                if ( cbSpan[ i ] > ulPos - ulFrom - cbSpans ) cbSpan[ i ] = ulPos - ulFrom - cbSpans;
+                cbSpans += cbSpan[ i ];
+            }
+            if ( !cbSpans ) return ulStart;
+            if ( cbSpans >= ulPos - ulFrom ) break;
+            ulFrom += cbSpans;
+        }
+
+        for ( i = (long) ulSpans - 1; i >= 0; i-- ) {
+            pusStart = (unsigned short *) aSpans[ i ].pch;
+            for ( pus = pusStart + ( cbSpan[ i ] / 2 ); pus > pusStart; ) {
+                pus--;
+                ulClass = pRegex->ausClass[ *pus ];
+                pNext   = pState->apNext[ ulClass ];
+                if ( !pNext && !( pNext = Dfa_Step( pRegex, pDfa, pState, ulClass )))
+                    return ulStart;
+                pState = pNext;
+                if ( pState->flState ) {
+                    if ( pState->flState & DFA_MATCHED ) ulStart = ulPos;
+                    if ( pState->flState & DFA_DEAD ) return ulStart;
+                }
+                ulPos -= 2;
+            }
+        }
+    }
+
+    if ( Dfa_Final( pDfa, pState, ( ulPosition ? Regex_UnitContext( text, ulPosition - 2, cbText ) : CTX_EDGE )))
+        ulStart = ulPosition;
+    return ulStart;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Dfa_Flush()                                                               *
+ *                                                                           *
+ * Frees all of the cached states of a DFA.                                  *
+ * ------------------------------------------------------------------------- */
+void Dfa_Flush( PREGEXDFA pDfa )
+{
+    PDFASTATE     pState,
+                  pNext;
+    unsigned long i;
+
+    for ( i = 0; i < DFA_HASH_SIZE; i++ ) {
+        for ( pState = pDfa->apHash[ i ]; pState; pState = pNext ) {
+            pNext = pState->pHashNext;
+            free( pState );
+        }
+        pDfa->apHash[ i ] = NULL;
+    }
+    pDfa->cbCache = 0;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Dfa_State()                                                               *
+ *                                                                           *
+ * Returns the cached state with the given threads, context and match flag   *
+ * (DFA_MATCHED or 0), creating it if necessary.  If the cache has grown too *
+ * large it is flushed first, in which case pfFlushed is set (and any state  *
+ * pointers the caller holds are no longer valid).  Returns NULL if there is *
+ * not enough memory.                                                        *
+ * ------------------------------------------------------------------------- */
+PDFASTATE Dfa_State( PREGEX pRegex, PREGEXDFA pDfa, unsigned long *pulThreads, unsigned long ulThreads, unsigned long ulContext, int fInject, unsigned long flMatch, int *pfFlushed )
+{
+    PDFASTATE     pState;
+    unsigned long ulHash,
+                  cbState,
+                  i;
+
+    // FNV-1a hash of the key
+    ulHash = 2166136261UL ^ ( ulContext | ( fInject << 2 ) | ( flMatch << 3 ));
+    for ( i = 0; i < ulThreads; i++ )
+        ulHash = ( ulHash ^ pulThreads[ i ] ) * 16777619UL;
+
+    for ( pState = pDfa->apHash[ ulHash % DFA_HASH_SIZE ]; pState; pState = pState->pHashNext ) {
+        if (( pState->ulHash == ulHash ) && ( pState->ulThreads == ulThreads ) &&
+            ( pState->ulContext == ulContext ) && ( pState->fInject == fInject ) &&
+            (( pState->flState & DFA_MATCHED ) == flMatch ) &&
+            !memcmp( pState->pulThreads, pulThreads, ulThreads * sizeof( unsigned long )))
+            return pState;
+    }
+
+    cbState = sizeof( DFASTATE ) +
+              pRegex->ulClasses * sizeof( PDFASTATE ) +
+              ulThreads * sizeof( unsigned long );
+    if ( pDfa->cbCache + cbState > REGEX_CACHE_LIMIT ) {
+        Dfa_Flush( pDfa );
+        *pfFlushed = 1;
+    }
+    pState = (PDFASTATE) calloc( 1, cbState );
+    if ( !pState ) return NULL;
+    pState->apNext     = (PDFASTATE *)( pState + 1 );
+    pState->pulThreads = (unsigned long *)( pState->apNext + pRegex->ulClasses );
+    memcpy( pState->pulThreads, pulThreads, ulThreads * sizeof( unsigned long ));
+    pState->ulThreads  = ulThreads;
+    pState->ulHash     = ulHash;
+    pState->ulContext  = ulContext;
+    pState->fInject    = fInject;
+    pState->flState    = flMatch | (( !ulThreads && !fInject ) ? DFA_DEAD : 0 );
+
+    pState->pHashNext = pDfa->apHash[ ulHash % DFA_HASH_SIZE ];
+    pDfa->apHash[ ulHash % DFA_HASH_SIZE ] = pState;
+    pDfa->cbCache += cbState;
+    return pState;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Dfa_Start()                                                               *
+ *                                                                           *
+ * Returns the DFA's starting state, given the kind of character preceding   *
+ * the starting position (in the direction of the scan).                     *
+ * ------------------------------------------------------------------------- */
+PDFASTATE Dfa_Start( PREGEX pRegex, PREGEXDFA pDfa, unsigned long ulContext )
+{
+    unsigned long ulThreads = 0;
+    int           fFlushed  = 0;
+
+    pDfa->ulGeneration++;
+    Regex_Follow( pDfa, pDfa->pulNew, &ulThreads, pDfa->ulStart, 0, 0, 0 );
+    return Dfa_State( pRegex, pDfa, pDfa->pulNew, ulThreads, ulContext, !pDfa->fReverse, 0, &fFlushed );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Dfa_Step()                                                                *
+ *                                                                           *
+ * Works out (and caches) the transition from a state on a character of the  *
+ * given class.  The new state is flagged DFA_MATCHED if a match ends just   *
+ * before the character.                                                     *
+ *                                                                           *
+ * First the pending ^ and $ instructions are evaluated, now that the next   *
+ * character is known.  Then each thread, in order of preference, either     *
+ * matches, consumes the character or dies.  In the forward direction, the   *
+ * threads after a match are less preferred than it and are dropped, and no  *
+ * new attempts are started once something has matched.                      *
+ * ------------------------------------------------------------------------- */
+PDFASTATE Dfa_Step( PREGEX pRegex, PREGEXDFA pDfa, PDFASTATE pState, unsigned long ulClass )
+{
+    PDFASTATE      pNext;
+    PREGEXINST     pInst;
+    unsigned short usChar;
+    unsigned long  ulContext,
+                   ulBefore,
+                   ulAfter,
+                   ulList,
+                   ulNew,
+                   i;
+    int            fMatch,
+                   fInject,
+                   fFlushed;
+
+    usChar    = pRegex->pusRep[ ulClass ];
+    ulContext = Regex_CharContext( usChar );
+    ulBefore  = pDfa->fReverse ? ulContext : pState->ulContext;
+    ulAfter   = pDfa->fReverse ? pState->ulContext : ulContext;
+
+    ulList = 0;
+    pDfa->ulGeneration++;
+    for ( i = 0; i < pState->ulThreads; i++ )
+        Regex_Follow( pDfa, pDfa->pulList, &ulList, pState->pulThreads[ i ], 1, ulBefore, ulAfter );
+
+    fMatch = 0;
+    ulNew  = 0;
+    pDfa->ulGeneration++;
+    for ( i = 0; i < ulList; i++ ) {
+        pInst = pDfa->pInsts + pDfa->pulList[ i ];
+        if ( pInst->ulOp == OP_MATCH ) {
+            fMatch = 1;
+            if ( !pDfa->fReverse ) break;
+        }
+        else if (( pInst->ulOp == OP_SET ) && Regex_InSet( pRegex, pInst->x, usChar ))
+            Regex_Follow( pDfa, pDfa->pulNew, &ulNew, pDfa->pulList[ i ] + 1, 0, 0, 0 );
+    }
+    fInject = pState->fInject && !fMatch;
+    if ( fInject )
+        Regex_Follow( pDfa, pDfa->pulNew, &ulNew, pDfa->ulStart, 0, 0, 0 );
+
+    fFlushed = 0;
+    pNext = Dfa_State( pRegex, pDfa, pDfa->pulNew, ulNew, ulContext, fInject,
+                       fMatch ? DFA_MATCHED : 0, &fFlushed );
+    if ( pNext && !fFlushed ) pState->apNext[ ulClass ] = pNext;
+    return pNext;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Dfa_Final()                                                               *
+ *                                                                           *
+ * Returns 1 if a match ends at the state, given the kind of character which *
+ * follows it (in the direction of the scan), or CTX_EDGE at the end of the  *
+ * text.  Used where the scan stops without consuming another character.     *
+ * ------------------------------------------------------------------------- */
+int Dfa_Final( PREGEXDFA pDfa, PDFASTATE pState, unsigned long ulContext )
+{
+    unsigned long ulList,
+                  i;
+
+    ulList = 0;
+    pDfa->ulGeneration++;
+    for ( i = 0; i < pState->ulThreads; i++ )
+        Regex_Follow( pDfa, pDfa->pulList, &ulList, pState->pulThreads[ i ], 1,
+                      pDfa->fReverse ? ulContext : pState->ulContext,
+                      pDfa->fReverse ? pState->ulContext : ulContext );
+    for ( i = 0; i < ulList; i++ )
+        if ( pDfa->pInsts[ pDfa->pulList[ i ]].ulOp == OP_MATCH ) return 1;
+    return 0;
+}
+
+
+
+// ===========================================================================
+// PUBLIC FUNCTIONS
+// ===========================================================================
+
+
+/* ------------------------------------------------------------------------- *
+ * Regex_Compile()                                                           *
+ * ------------------------------------------------------------------------- */
+int Regex_Compile( TEXTREGEX *pRegex, const unsigned short *pusPattern, unsigned long ulLength, unsigned long flOptions, unsigned long *pulError )
+{
+    REGEXPARSE    parse;
+    PREGEX        pNew;
+    unsigned long ulRoot;
+
+    if ( !pRegex ) return 0;
+    *pRegex = NULL;
+    if ( pulError ) *pulError = 0;
+    if ( !pusPattern && ulLength ) return 0;
+
+    memset( &parse, 0, sizeof( parse ));
+    parse.pus       = pusPattern;
+    parse.ulLength  = ulLength;
+    parse.flOptions = flOptions;
+    ulRoot = Regex_ParseAlt( &parse );
+    if ( !parse.fError && !PARSE_END( &parse )) parse.fError = 1;      // unmatched ')'
+    if ( parse.fError ) {
+        if ( pulError ) *pulError = parse.ulPos;
+        goto fail;
+    }
+
+    pNew = (PREGEX) calloc( 1, sizeof( REGEX ));
+    if ( !pNew ) goto fail;
+    pNew->pRanges = parse.pRanges;
+    pNew->pSets   = parse.pSets;
+    pNew->ulSets  = parse.ulSets;
+    parse.pRanges = NULL;
+    parse.pSets   = NULL;
+
+    if ( !Regex_Program( &(pNew->forward), parse.pNodes, ulRoot, 0 ) ||
+         !Regex_Program( &(pNew->reverse), parse.pNodes, ulRoot, 1 ) ||
+         !Regex_BuildClasses( pNew ))
+    {
+        if ( pulError ) *pulError = ulLength;
+        Regex_Free( (TEXTREGEX *) &pNew );
+        goto fail;
+    }
+
+    free( parse.pNodes );
+    *pRegex = (TEXTREGEX) pNew;
+    return 1;
+
+fail:
+    free( parse.pNodes );
+    free( parse.pRanges );
+    free( parse.pSets );
+    return 0;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Regex_Free()                                                              *
+ * ------------------------------------------------------------------------- */
+int Regex_Free( TEXTREGEX *pRegex )
+{
+    PREGEX    pFree;
+    PREGEXDFA pDfa;
+    int       i;
+
+    if ( !pRegex || !*pRegex ) return 0;
+    pFree = (PREGEX) *pRegex;
+    for ( i = 0; i < 2; i++ ) {
+        pDfa = i ? &(pFree->reverse) : &(pFree->forward);
+        Dfa_Flush( pDfa );
+        free( pDfa->pInsts );
+        free( pDfa->pulList );
+        free( pDfa->pulNew );
+        free( pDfa->pulStack );
+        free( pDfa->pulMark );
+    }
+    free( pFree->pusRep );
+    free( pFree->pRanges );
+    free( pFree->pSets );
+    free( pFree );
+    *pRegex = NULL;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Regex_Search()                                                            *
+ *                                                                           *
+ * The forward scan finds where the preferred match ends; the reverse scan   *
+ * then finds where it starts.  Both read the text in place.                 *
+ * ------------------------------------------------------------------------- */
+unsigned long Regex_Search( TEXTREGEX regex, EDITORTEXT text, unsigned long ulPosition, unsigned long *pcbMatch )
+{
+    PREGEX        pRegex = (PREGEX) regex;
+    unsigned long cbText,
+                  ulEnd,
+                  ulStart;
+
+    if ( pcbMatch ) *pcbMatch = 0;
+    if ( !pRegex || !text ) return TEXT_INVALID_POSITION;
+
+    cbText = TextLength( text ) & ~1UL;
+    if ( ulPosition & 1 ) ulPosition++;
+    if ( ulPosition > cbText ) return TEXT_INVALID_POSITION;
+
+    ulEnd = Regex_ScanForward( pRegex, text, ulPosition, cbText );
+    if ( ulEnd == TEXT_INVALID_POSITION ) return TEXT_INVALID_POSITION;
+    ulStart = Regex_ScanReverse( pRegex, text, ulPosition, ulEnd, cbText );
+
+    if ( pcbMatch ) *pcbMatch = ulEnd - ulStart;
+    return ulStart;
+}
+
@@ -0,0 +1,101 @@
+/*****************************************************************************
+ * textre.h                                                                  *
+ *                                                                           *
+ * Interface to the regular expression search for UCS-2 text held in a text  *
+ * object (see textseq.h).                                                   *
+ *                                                                           *
+ * A pattern is compiled once, and may then be used to search any number of  *
+ * texts.  Searching reads the text in place, one span at a time (including  *
+ * either side of the gap), and runs a DFA over the UCS-2 code units, so it  *
+ * never copies the text and takes constant time per character.  The DFA's   *
+ * states are built on demand as the text requires them, and are cached      *
+ * with the pattern; if the cache outgrows REGEX_CACHE_LIMIT it is emptied   *
+ * and refilled.                                                             *
+ *                                                                           *
+ * The following syntax is supported:                                        *
+ *                                                                           *
+ *   c          the character c, unless it is one of  \ . [ ] ( ) | * + ? {  *
+ *              ^ $                                                          *
+ *   \c         the character c (where c is not one of those below)          *
+ *   \n \r \t   line feed, carriage return, tab                              *
+ *   \uXXXX     the character with hex code XXXX                             *
+ *   \d \w \s   a digit, word character or white space (ASCII only)          *
+ *   \D \W \S   any character other than the above                           *
+ *   .          any character other than a line break                        *
+ *   [...]      any character in the set (ranges such as a-z and the         *
+ *              escapes above may be used); [^...] negates the set           *
+ *   ^ $        the start or end of a line (or of the text)                  *
+ *   (...)      grouping; (?:...) is accepted as a synonym                   *
+ *   a|b        a or b                                                       *
+ *   * + ?      zero or more, one or more, zero or one of the preceding item *
+ *   {m} {m,} {m,n}  between m and n of the preceding item                   *
+ *   *? +? ?? {m,n}? the same, but matching as few as possible               *
+ *                                                                           *
+ * Matches follow the usual (Perl) rules: the match which starts first is    *
+ * found, and of those starting there, the one which the pattern prefers.    *
+ * A line break is an LF, a CR, or a CR LF pair.                             *
+ *                                                                           *
+ * textseq.h must be included before this file.                              *
+ *                                                                           *
+ *****************************************************************************/
+
+
+// ---------------------------------------------------------------------------
+// DATA TYPES
+//
+
+typedef void * TEXTREGEX;
+
+
+// ---------------------------------------------------------------------------
+// CONSTANTS
+//
+
+#define REGEX_IGNORECASE        0x1         // letters match either case (ASCII only)
+
+#define REGEX_CACHE_LIMIT       0x80000     // memory for cached DFA states (per direction)
+
+
+// ---------------------------------------------------------------------------
+// FUNCTION DECLARATIONS
+//
+
+/* ------------------------------------------------------------------------- *
+ * Regex_Compile()                                                           *
+ *                                                                           *
+ * Compiles a pattern of ulLength UCS-2 characters, with any of the REGEX_*  *
+ * option flags.  Returns 0 if the pattern is invalid (or too large), in     *
+ * which case pulError (if not NULL) receives the offset, in characters, at  *
+ * which the problem was found.  The compiled pattern should be freed with   *
+ * Regex_Free() when no longer required.                                     *
+ * ------------------------------------------------------------------------- */
+int Regex_Compile( TEXTREGEX *pRegex, const unsigned short *pusPattern, unsigned long ulLength, unsigned long flOptions, unsigned long *pulError );
+
+
+/* ------------------------------------------------------------------------- *
+ * Regex_Free()                                                              *
+ *                                                                           *
+ * Frees a compiled pattern and its DFA cache.                               *
+ * ------------------------------------------------------------------------- */
+int Regex_Free( TEXTREGEX *pRegex );
+
+
+/* ------------------------------------------------------------------------- *
+ * Regex_Search()                                                            *
+ *                                                                           *
+ * Finds the first match of the pattern in UCS-2 text, starting at or after  *
+ * the given byte position.  Returns the byte position at which the match    *
+ * starts, or TEXT_INVALID_POSITION if there is none; the length of the      *
+ * match in bytes (which may be 0) is returned in pcbMatch.  To find the     *
+ * next match, search again from the end of this one (or from 2 bytes        *
+ * further on, if it was empty).                                             *
+ *                                                                           *
+ * The characters before and after the search range are taken into account   *
+ * for ^ and $, so (for example) ^ does not match at ulPosition unless a     *
+ * line starts there.                                                        *
+ *                                                                           *
+ * A compiled pattern holds the DFA cache, so it must only be used by one    *
+ * thread at a time.                                                         *
+ * ------------------------------------------------------------------------- */
+unsigned long Regex_Search( TEXTREGEX regex, EDITORTEXT text, unsigned long ulPosition, unsigned long *pcbMatch );
+
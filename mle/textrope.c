@@ -0,0 +1,1054 @@
+/*****************************************************************************
+ * textrope.c                                                                *
+ *                                                                           *
+ * Implements the 'rope' text model: a balanced tree (in the style of a      *
+ * B-tree) whose leaves hold short runs of text, and whose branch nodes each *
+ * cache the total byte length and number of hard line breaks found beneath  *
+ * them.  Locating a byte offset, a line number, or the offset at which a    *
+ * given line starts therefore only requires a walk from the root down to a  *
+ * single leaf, i.e. O(log n) regardless of the size of the text.            *
+ *                                                                           *
+ * Like the other models, the rope stores the text as a plain sequence of    *
+ * bytes.  The line-break counts, however, are necessarily based on some     *
+ * interpretation of those bytes: they treat the text as a sequence of       *
+ * wchar_t units (as TextWCharAt() does), and count line breaks exactly as   *
+ * the editor control does - i.e. any of LF, VT, FF, CR, LS (U+2028) or PS   *
+ * (U+2029), with a CR immediately followed by an LF counting as one break.  *
+ * The counts are only meaningful if text is always inserted and deleted in  *
+ * whole units (which textctl.c does); the stored text itself is correct in  *
+ * any case.                                                                 *
+ *                                                                           *
+ * A CR-LF pair may be split across two leaves.  To allow for this, each     *
+ * node also records whether its text starts with an LF or ends with a CR,   *
+ * and these flags are used to avoid counting such a pair twice whenever the *
+ * counts of adjacent nodes are combined.                                    *
+ *                                                                           *
+ * Nodes may be shared between trees, so that a snapshot of the text (see    *
+ * TextSnapshot) only needs to take a reference to the root.  Each node      *
+ * counts the references to it (from parent branches or from a rope's root), *
+ * and a node with more than one is never modified: before an edit descends  *
+ * into it, it is replaced in its parent by a private copy.  An edit thus    *
+ * copies only the nodes along its own path, and the snapshot is unaffected. *
+ * Only the rope which makes an edit ever adds references, so a node with a  *
+ * single reference cannot be acquired by anyone else, and its owner may     *
+ * modify or free it without further ado once atomic_read() says so.         *
+ *                                                                           *
+ * The functions in this file are not called directly by applications; they  *
+ * are reached through the public Text*() functions in textseq.c.            *
+ *                                                                           *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <stddef.h>
+
+#include "debug.h"
+#include "textseq.h"
+#include "textimpl.h"
+
+
+// ---------------------------------------------------------------------------
+// CONSTANTS
+//
+#define ROPE_LEAF_MAX       4096    // maximum number of bytes in a leaf
+#define ROPE_FANOUT         16      // maximum number of children of a branch
+
+#define ROPE_UNIT           sizeof( wchar_t )   // size of a character unit
+
+// Node flags
+#define ROPE_LEAF           0x1     // node is a leaf
+#define ROPE_STARTS_LF      0x2     // node's text starts with an LF
+#define ROPE_ENDS_CR        0x4     // node's text ends with a CR
+
+
+// ---------------------------------------------------------------------------
+// TYPEDEFS
+//
+
+// Information common to both types of node.
+//
+typedef struct _rope_node {
+    unsigned long  cbLength,        // Number of bytes in (or below) this node
+                   ulBreaks;        // Number of line breaks in (or below) it
+    volatile unsigned long ulRefs;  // Number of references to this node
+    unsigned short fsFlags,         // Node flags (ROPE_*)
+                   usCount;         // Number of children (branches only)
+} ROPENODE, *PROPENODE;
+
+
+// A branch node.
+//
+typedef struct _rope_branch {
+    ROPENODE  node;
+    PROPENODE apChildren[ ROPE_FANOUT ];
+} ROPEBRANCH, *PROPEBRANCH;
+
+
+// A leaf node.
+//
+typedef struct _rope_leaf {
+    ROPENODE      node;
+    unsigned char achData[ ROPE_LEAF_MAX ];
+} ROPELEAF, *PROPELEAF;
+
+
+// The internal implementation (rope) of the text data structure.
+//
+typedef struct _rope {
+    TEXTHDR       hdr;              // Common model header
+    PROPENODE     pRoot;            // Root of the tree
+    PROPELEAF     pLastLeaf;        // Most recently located leaf (or NULL)
+    unsigned long ulLastStart;      // Text position at which that leaf starts
+} ROPE, *PROPE;
+
+
+
+// ---------------------------------------------------------------------------
+// MACROS
+//
+
+#define ISLEAF( node )      ( (node)->fsFlags & ROPE_LEAF )
+#define BRANCH( node )      ((PROPEBRANCH)(node))
+#define LEAF( node )        ((PROPELEAF)(node))
+
+// Number of line breaks in a node, excluding a leading LF if the preceding
+// text ends in a CR (in which case the CR has already been counted).
+#define EFFECTIVE_BREAKS( node, prevcr ) \
+  ( (node)->ulBreaks - ((( prevcr ) && ( (node)->fsFlags & ROPE_STARTS_LF )) ? 1 : 0 ))
+
+
+// ---------------------------------------------------------------------------
+// FUNCTION DECLARATIONS
+//
+
+// Internal
+PROPEBRANCH   Rope_CreateBranch( PTEXTALLOCATOR pAlloc );
+PROPELEAF     Rope_CreateLeaf( PTEXTALLOCATOR pAlloc );
+void          Rope_CopyNode( PROPENODE pNode, unsigned char *pchText, unsigned long ulPosition, unsigned long ulLength );
+void          Rope_CountLeaf( PROPELEAF pLeaf );
+int           Rope_DeleteNode( PTEXTALLOCATOR pAlloc, PROPENODE pNode, unsigned long ulPosition, unsigned long ulLength );
+PROPELEAF     Rope_FindLeaf( PROPE pRope, unsigned long ulPosition, unsigned long *pulStart );
+int           Rope_InsertNode( PTEXTALLOCATOR pAlloc, PROPENODE pNode, unsigned char *pch, unsigned long ulPosition, unsigned long ulLength, PROPENODE *ppSplit );
+void          Rope_ReleaseNode( PTEXTALLOCATOR pAlloc, PROPENODE pNode );
+PROPENODE     Rope_UnshareNode( PTEXTALLOCATOR pAlloc, PROPENODE *ppNode );
+void          Rope_UpdateBranch( PROPEBRANCH pBranch );
+wchar_t       Rope_UnitAt( PROPE pRope, unsigned long ulPosition );
+
+// Model implementation
+unsigned char Rope_ByteAt( PROPE pRope, unsigned long ulPosition );
+int           Rope_Clear( PROPE pRope );
+int           Rope_Delete( PROPE pRope, unsigned long ulPosition, unsigned long ulLength );
+int           Rope_Destroy( PROPE pRope );
+int           Rope_Init( PROPE pRope, unsigned char *pchText, unsigned long cbText );
+int           Rope_Insert( PROPE pRope, unsigned char *pch, unsigned long ulPosition, unsigned long ulLength );
+unsigned long Rope_Length( PROPE pRope );
+unsigned long Rope_LineFromOffset( PROPE pRope, unsigned long ulPosition );
+unsigned long Rope_LineOffset( PROPE pRope, unsigned long ulLine );
+unsigned long Rope_Sequence( PROPE pRope, unsigned char *pchText, unsigned long ulPosition, unsigned long ulLength );
+int           Rope_GetSpans( PROPE pRope, unsigned long ulPosition, unsigned long ulLength, PTEXTSPAN pSpan1, PTEXTSPAN pSpan2 );
+int           Rope_Snapshot( PROPE pRope, PROPE pSnapshot );
+
+
+// ---------------------------------------------------------------------------
+// MODEL TABLE
+//
+
+const TEXTMODEL RopeModel = {
+    sizeof( ROPE ),
+    (PFNTEXTBYTEAT)         Rope_ByteAt,
+    (PFNTEXTCLEAR)          Rope_Clear,
+    (PFNTEXTDELETE)         Rope_Delete,
+    (PFNTEXTDESTROY)        Rope_Destroy,
+    (PFNTEXTINIT)           Rope_Init,
+    (PFNTEXTINSERT)         Rope_Insert,
+    (PFNTEXTLENGTH)         Rope_Length,
+    (PFNTEXTSEQUENCE)       Rope_Sequence,
+    (PFNTEXTLINEFROMOFFSET) Rope_LineFromOffset,
+    (PFNTEXTLINEOFFSET)     Rope_LineOffset,
+    (PFNTEXTGETSPANS)       Rope_GetSpans,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    (PFNTEXTSNAPSHOT)       Rope_Snapshot,
+    NULL
+};
+
+
+
+// ===========================================================================
+// INTERNAL FUNCTIONS
+// ===========================================================================
+
+
+/* ------------------------------------------------------------------------- *
+ * Rope_CreateBranch()                                                       *
+ *                                                                           *
+ * Allocates a new, empty branch node.                                       *
+ * ------------------------------------------------------------------------- */
+PROPEBRANCH Rope_CreateBranch( PTEXTALLOCATOR pAlloc )
+{
+    PROPEBRANCH pBranch;
+
+    pBranch = (PROPEBRANCH) allocate_small( pAlloc, sizeof( ROPEBRANCH ));
+    if ( pBranch ) pBranch->node.ulRefs = 1;
+    return pBranch;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Rope_CreateLeaf()                                                         *
+ *                                                                           *
+ * Allocates a new, empty leaf node.                                         *
+ *                                                                           *
+ * Nodes are small and numerous, so they are allocated with allocate_small() *
+ * rather than allocate_memory() (which, under OS/2, would otherwise commit  *
+ * a separate 64 kB memory object for each one).                             *
+ * ------------------------------------------------------------------------- */
+PROPELEAF Rope_CreateLeaf( PTEXTALLOCATOR pAlloc )
+{
+    PROPELEAF pLeaf;
+
+    pLeaf = (PROPELEAF) allocate_small( pAlloc, sizeof( ROPELEAF ));
+    if ( pLeaf ) {
+        pLeaf->node.fsFlags = ROPE_LEAF;
+        pLeaf->node.ulRefs  = 1;
+    }
+    return pLeaf;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Rope_CopyNode()                                                           *
+ *                                                                           *
+ * Copies the given range of text (which must lie within the node) from the  *
+ * node and its descendants into the output buffer.                          *
+ * ------------------------------------------------------------------------- */
+void Rope_CopyNode( PROPENODE pNode, unsigned char *pchText, unsigned long ulPosition, unsigned long ulLength )
+{
+    PROPENODE     pChild;
+    unsigned long ulChunk;
+    unsigned short i;
+
+    if ( ISLEAF( pNode )) {
+        memcpy( pchText, LEAF( pNode )->achData + ulPosition, ulLength );
+        return;
+    }
+
+    for ( i = 0; ulLength && ( i < pNode->usCount ); i++ ) {
+        pChild = BRANCH( pNode )->apChildren[ i ];
+        if ( ulPosition >= pChild->cbLength ) {
+            ulPosition -= pChild->cbLength;
+            continue;
+        }
+        ulChunk = pChild->cbLength - ulPosition;
+        if ( ulChunk > ulLength ) ulChunk = ulLength;
+        Rope_CopyNode( pChild, pchText, ulPosition, ulChunk );
+        pchText   += ulChunk;
+        ulLength  -= ulChunk;
+        ulPosition = 0;
+    }
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Rope_CountLeaf()                                                          *
+ *                                                                           *
+ * Recalculates the number of line breaks in a leaf, and sets its LF/CR      *
+ * edge flags.                                                               *
+ * ------------------------------------------------------------------------- */
+void Rope_CountLeaf( PROPELEAF pLeaf )
+{
+    unsigned long ulUnits,
+                  ulBreaks,
+                  i;
+    wchar_t       wc, wcNext;
+
+    pLeaf->node.fsFlags = ROPE_LEAF;
+    ulUnits  = pLeaf->node.cbLength / ROPE_UNIT;
+    ulBreaks = 0;
+    if ( !ulUnits ) {
+        pLeaf->node.ulBreaks = 0;
+        return;
+    }
+
+    memcpy( &wcNext, pLeaf->achData, ROPE_UNIT );
+    if ( wcNext == 0xA ) pLeaf->node.fsFlags |= ROPE_STARTS_LF;
+    for ( i = 0; i < ulUnits; i++ ) {
+        wc = wcNext;
+        if (( i + 1 ) < ulUnits )
+            memcpy( &wcNext, pLeaf->achData + (( i + 1 ) * ROPE_UNIT ), ROPE_UNIT );
+        else wcNext = 0;
+        if ( ! IS_LINEBREAK( wc )) continue;
+        if (( wc == 0xD ) && ( wcNext == 0xA )) continue;
+        ulBreaks++;
+    }
+    if ( wc == 0xD ) pLeaf->node.fsFlags |= ROPE_ENDS_CR;
+    pLeaf->node.ulBreaks = ulBreaks;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Rope_DeleteNode()                                                         *
+ *                                                                           *
+ * Deletes the given range of text (which must lie within the node) from the *
+ * node and its descendants.  Any children which become empty are freed, and *
+ * adjacent children which are small enough to be combined are merged.  The  *
+ * node itself must not be shared.                                           *
+ * ------------------------------------------------------------------------- */
+int Rope_DeleteNode( PTEXTALLOCATOR pAlloc, PROPENODE pNode, unsigned long ulPosition, unsigned long ulLength )
+{
+    PROPEBRANCH   pBranch;
+    PROPENODE     pChild, pNext;
+    unsigned long ulChunk;
+    unsigned short i, j;
+
+    if ( ISLEAF( pNode )) {
+        memmove( LEAF( pNode )->achData + ulPosition,
+                 LEAF( pNode )->achData + ulPosition + ulLength,
+                 pNode->cbLength - ulPosition - ulLength );
+        pNode->cbLength -= ulLength;
+        Rope_CountLeaf( LEAF( pNode ));
+        return 1;
+    }
+
+    pBranch = BRANCH( pNode );
+    for ( i = 0; ulLength && ( i < pNode->usCount ); i++ ) {
+        pChild = pBranch->apChildren[ i ];
+        if ( ulPosition >= pChild->cbLength ) {
+            ulPosition -= pChild->cbLength;
+            continue;
+        }
+        ulChunk = pChild->cbLength - ulPosition;
+        if ( ulChunk > ulLength ) ulChunk = ulLength;
+        pChild = Rope_UnshareNode( pAlloc, pBranch->apChildren + i );
+        if ( !pChild || ! Rope_DeleteNode( pAlloc, pChild, ulPosition, ulChunk ))
+            return 0;
+        ulLength  -= ulChunk;
+        ulPosition = 0;
+    }
+
+    // Remove any children which are now empty
+    for ( i = 0, j = 0; i < pNode->usCount; i++ ) {
+        pChild = pBranch->apChildren[ i ];
+        if ( pChild->cbLength ) pBranch->apChildren[ j++ ] = pChild;
+        else Rope_ReleaseNode( pAlloc, pChild );
+    }
+    pNode->usCount = j;
+
+    // Merge adjacent children where they will fit into a single node (the
+    // right-hand one's children gain the left-hand one as a new parent)
+    for ( i = 0; ( i + 1 ) < pNode->usCount; ) {
+        pChild = pBranch->apChildren[ i ];
+        pNext  = pBranch->apChildren[ i + 1 ];
+        if ( ISLEAF( pChild ) && ISLEAF( pNext ) &&
+             (( pChild->cbLength + pNext->cbLength ) <= ROPE_LEAF_MAX ))
+        {
+            pChild = Rope_UnshareNode( pAlloc, pBranch->apChildren + i );
+            if ( !pChild ) return 0;
+            memcpy( LEAF( pChild )->achData + pChild->cbLength,
+                    LEAF( pNext )->achData, pNext->cbLength );
+            pChild->cbLength += pNext->cbLength;
+            Rope_CountLeaf( LEAF( pChild ));
+        }
+        else if ( !ISLEAF( pChild ) && !ISLEAF( pNext ) &&
+                  (( pChild->usCount + pNext->usCount ) <= ROPE_FANOUT ))
+        {
+            pChild = Rope_UnshareNode( pAlloc, pBranch->apChildren + i );
+            if ( !pChild ) return 0;
+            for ( j = 0; j < pNext->usCount; j++ ) {
+                BRANCH( pChild )->apChildren[ pChild->usCount++ ] = BRANCH( pNext )->apChildren[ j ];
+                atomic_increment( &(BRANCH( pNext )->apChildren[ j ]->ulRefs ));
+            }
+            Rope_UpdateBranch( BRANCH( pChild ));
+        }
+        else {
+            i++;
+            continue;
+        }
+        Rope_ReleaseNode( pAlloc, pNext );
+        for ( j = i + 1; ( j + 1 ) < pNode->usCount; j++ )
+            pBranch->apChildren[ j ] = pBranch->apChildren[ j + 1 ];
+        pNode->usCount--;
+    }
+
+    Rope_UpdateBranch( pBranch );
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Rope_FindLeaf()                                                           *
+ *                                                                           *
+ * Returns the leaf containing the given text position, and the position at  *
+ * which that leaf starts.  The position must be less than the text length.  *
+ * ------------------------------------------------------------------------- */
+PROPELEAF Rope_FindLeaf( PROPE pRope, unsigned long ulPosition, unsigned long *pulStart )
+{
+    PROPENODE      pNode,
+                   pChild;
+    unsigned long  ulStart;
+    unsigned short i;
+
+    if ( pRope->pLastLeaf &&
+         ( ulPosition >= pRope->ulLastStart ) &&
+         ( ulPosition < ( pRope->ulLastStart + pRope->pLastLeaf->node.cbLength )))
+    {
+        *pulStart = pRope->ulLastStart;
+        return pRope->pLastLeaf;
+    }
+
+    pNode   = pRope->pRoot;
+    ulStart = 0;
+    while ( !ISLEAF( pNode )) {
+        for ( i = 0; i < pNode->usCount; i++ ) {
+            pChild = BRANCH( pNode )->apChildren[ i ];
+            if ( ulPosition < ( ulStart + pChild->cbLength )) break;
+            ulStart += pChild->cbLength;
+        }
+        if ( i == pNode->usCount ) return NULL;
+        pNode = pChild;
+    }
+
+    pRope->pLastLeaf   = LEAF( pNode );
+    pRope->ulLastStart = ulStart;
+    *pulStart = ulStart;
+    return LEAF( pNode );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Rope_InsertNode()                                                         *
+ *                                                                           *
+ * Inserts text (no more than ROPE_LEAF_MAX bytes) into the node at the      *
+ * given position relative to the node's start.  If the node overflows, it   *
+ * is split in two and the new right-hand node is returned in ppSplit (to be *
+ * inserted by the caller immediately after this one); otherwise ppSplit is  *
+ * set to NULL.  The node itself must not be shared.                         *
+ * ------------------------------------------------------------------------- */
+int Rope_InsertNode( PTEXTALLOCATOR pAlloc, PROPENODE pNode, unsigned char *pch, unsigned long ulPosition, unsigned long ulLength, PROPENODE *ppSplit )
+{
+    PROPEBRANCH    pBranch,
+                   pNewBranch;
+    PROPELEAF      pLeaf,
+                   pNewLeaf;
+    PROPENODE      pChild,
+                   pSplit,
+                   apAll[ ROPE_FANOUT + 1 ];
+    unsigned char  achAll[ ROPE_LEAF_MAX * 2 ];
+    unsigned long  cbAll,
+                   cbHalf;
+    unsigned short i, usAll, usHalf;
+
+    *ppSplit = NULL;
+
+    if ( ISLEAF( pNode )) {
+        pLeaf = LEAF( pNode );
+        if (( pNode->cbLength + ulLength ) <= ROPE_LEAF_MAX ) {
+            memmove( pLeaf->achData + ulPosition + ulLength,
+                     pLeaf->achData + ulPosition,
+                     pNode->cbLength - ulPosition );
+            memcpy( pLeaf->achData + ulPosition, pch, ulLength );
+            pNode->cbLength += ulLength;
+            Rope_CountLeaf( pLeaf );
+            return 1;
+        }
+
+        // Not enough room: split the combined text between two leaves
+        pNewLeaf = Rope_CreateLeaf( pAlloc );
+        if ( !pNewLeaf ) return 0;
+        memcpy( achAll, pLeaf->achData, ulPosition );
+        memcpy( achAll + ulPosition, pch, ulLength );
+        memcpy( achAll + ulPosition + ulLength, pLeaf->achData + ulPosition,
+                pNode->cbLength - ulPosition );
+        cbAll  = pNode->cbLength + ulLength;
+        cbHalf = (( cbAll / 2 ) / ROPE_UNIT ) * ROPE_UNIT;
+        if (( cbAll - cbHalf ) > ROPE_LEAF_MAX ) cbHalf = cbAll - ROPE_LEAF_MAX;
+        memcpy( pLeaf->achData, achAll, cbHalf );
+        memcpy( pNewLeaf->achData, achAll + cbHalf, cbAll - cbHalf );
+        pNode->cbLength = cbHalf;
+        pNewLeaf->node.cbLength = cbAll - cbHalf;
+        Rope_CountLeaf( pLeaf );
+        Rope_CountLeaf( pNewLeaf );
+        *ppSplit = (PROPENODE) pNewLeaf;
+        return 1;
+    }
+
+    // Find the child into which the text goes (appending to the end of a
+    // child in preference to prepending to the start of the next one)
+    pBranch = BRANCH( pNode );
+    for ( i = 0; ( i + 1 ) < pNode->usCount; i++ ) {
+        pChild = pBranch->apChildren[ i ];
+        if ( ulPosition <= pChild->cbLength ) break;
+        ulPosition -= pChild->cbLength;
+    }
+    pChild = Rope_UnshareNode( pAlloc, pBranch->apChildren + i );
+    if ( !pChild ) return 0;
+    if ( ! Rope_InsertNode( pAlloc, pChild, pch, ulPosition, ulLength, &pSplit )) return 0;
+
+    if ( pSplit ) {
+        if ( pNode->usCount < ROPE_FANOUT ) {
+            memmove( pBranch->apChildren + i + 2, pBranch->apChildren + i + 1,
+                     ( pNode->usCount - i - 1 ) * sizeof( PROPENODE ));
+            pBranch->apChildren[ i + 1 ] = pSplit;
+            pNode->usCount++;
+        }
+        else {
+            // This branch is full as well: split it in two
+            pNewBranch = Rope_CreateBranch( pAlloc );
+            if ( !pNewBranch ) return 0;
+            memcpy( apAll, pBranch->apChildren, ( i + 1 ) * sizeof( PROPENODE ));
+            apAll[ i + 1 ] = pSplit;
+            memcpy( apAll + i + 2, pBranch->apChildren + i + 1,
+                    ( pNode->usCount - i - 1 ) * sizeof( PROPENODE ));
+            usAll  = pNode->usCount + 1;
+            usHalf = usAll / 2;
+            memcpy( pBranch->apChildren, apAll, usHalf * sizeof( PROPENODE ));
+            memcpy( pNewBranch->apChildren, apAll + usHalf,
+                    ( usAll - usHalf ) * sizeof( PROPENODE ));
+            pNode->usCount = usHalf;
+            pNewBranch->node.usCount = usAll - usHalf;
+            Rope_UpdateBranch( pNewBranch );
+            *ppSplit = (PROPENODE) pNewBranch;
+        }
+    }
+
+    Rope_UpdateBranch( pBranch );
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Rope_ReleaseNode()                                                        *
+ *                                                                           *
+ * Releases a reference to a node.  If that was the last reference, the node *
+ * is freed and its references to its children are released in turn.         *
+ * ------------------------------------------------------------------------- */
+void Rope_ReleaseNode( PTEXTALLOCATOR pAlloc, PROPENODE pNode )
+{
+    unsigned short i;
+
+    if ( !pNode ) return;
+    if (( atomic_read( &(pNode->ulRefs) ) > 1 ) && atomic_decrement( &(pNode->ulRefs) ))
+        return;
+    if ( !ISLEAF( pNode ))
+        for ( i = 0; i < pNode->usCount; i++ )
+            Rope_ReleaseNode( pAlloc, BRANCH( pNode )->apChildren[ i ] );
+    free_small( pAlloc, pNode );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Rope_UnshareNode()                                                        *
+ *                                                                           *
+ * Makes sure that the node referred to by *ppNode (a child pointer, or a    *
+ * rope's root) may be modified.  If the node is shared with another tree,   *
+ * it is replaced by a private copy, which takes new references to the same  *
+ * children, and the reference to the original is released.  Returns the     *
+ * node which may now be modified, or NULL if there was not enough memory.   *
+ * ------------------------------------------------------------------------- */
+PROPENODE Rope_UnshareNode( PTEXTALLOCATOR pAlloc, PROPENODE *ppNode )
+{
+    PROPENODE      pNode = *ppNode,
+                   pCopy;
+    unsigned short i;
+
+    if ( atomic_read( &(pNode->ulRefs) ) == 1 ) return pNode;
+
+    if ( ISLEAF( pNode )) {
+        pCopy = (PROPENODE) allocate_small( pAlloc, sizeof( ROPELEAF ));
+        if ( !pCopy ) return NULL;
+        memcpy( pCopy, pNode, offsetof( ROPELEAF, achData ) + pNode->cbLength );
+    }
+    else {
+        pCopy = (PROPENODE) allocate_small( pAlloc, sizeof( ROPEBRANCH ));
+        if ( !pCopy ) return NULL;
+        memcpy( pCopy, pNode, sizeof( ROPEBRANCH ));
+        for ( i = 0; i < pNode->usCount; i++ )
+            atomic_increment( &(BRANCH( pNode )->apChildren[ i ]->ulRefs ));
+    }
+    pCopy->ulRefs = 1;
+
+    Rope_ReleaseNode( pAlloc, pNode );
+    *ppNode = pCopy;
+    return pCopy;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Rope_UpdateBranch()                                                       *
+ *                                                                           *
+ * Recalculates a branch's cached length, line-break count and edge flags    *
+ * from those of its children.                                               *
+ * ------------------------------------------------------------------------- */
+void Rope_UpdateBranch( PROPEBRANCH pBranch )
+{
+    PROPENODE      pChild;
+    unsigned long  cbLength,
+                   ulBreaks;
+    unsigned short fsFlags,
+                   i;
+    int            fPrevCR,
+                   fFirst;
+
+    cbLength = 0;
+    ulBreaks = 0;
+    fsFlags  = 0;
+    fPrevCR  = 0;
+    fFirst   = 1;
+    for ( i = 0; i < pBranch->node.usCount; i++ ) {
+        pChild = pBranch->apChildren[ i ];
+        if ( !pChild->cbLength ) continue;
+        if ( fFirst && ( pChild->fsFlags & ROPE_STARTS_LF ))
+            fsFlags |= ROPE_STARTS_LF;
+        fFirst = 0;
+        cbLength += pChild->cbLength;
+        ulBreaks += EFFECTIVE_BREAKS( pChild, fPrevCR );
+        fPrevCR = pChild->fsFlags & ROPE_ENDS_CR;
+    }
+    if ( fPrevCR ) fsFlags |= ROPE_ENDS_CR;
+
+    pBranch->node.cbLength = cbLength;
+    pBranch->node.ulBreaks = ulBreaks;
+    pBranch->node.fsFlags  = fsFlags;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Rope_UnitAt()                                                             *
+ *                                                                           *
+ * Returns the character unit (wchar_t) starting at the given byte position, *
+ * or 0 if there is no complete unit there.                                  *
+ * ------------------------------------------------------------------------- */
+wchar_t Rope_UnitAt( PROPE pRope, unsigned long ulPosition )
+{
+    wchar_t wc;
+
+    if ( Rope_Sequence( pRope, (unsigned char *) &wc, ulPosition, ROPE_UNIT ) != ROPE_UNIT )
+        return 0;
+    return wc;
+}
+
+
+// ===========================================================================
+// MODEL IMPLEMENTATION
+// ===========================================================================
+
+
+/* ------------------------------------------------------------------------- *
+ * Rope_ByteAt                                                               *
+ *                                                                           *
+ * Returns the byte at the given text position.  If the position is invalid, *
+ * 0 (a null-byte) is returned.                                              *
+ * ------------------------------------------------------------------------- */
+unsigned char Rope_ByteAt( PROPE pRope, unsigned long ulPosition )
+{
+    PROPELEAF     pLeaf;
+    unsigned long ulStart;
+
+    if ( !pRope->pRoot || ( ulPosition >= pRope->pRoot->cbLength )) return 0;
+    pLeaf = Rope_FindLeaf( pRope, ulPosition, &ulStart );
+    if ( !pLeaf ) return 0;
+    return ( pLeaf->achData[ ulPosition - ulStart ] );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Rope_Clear()                                                              *
+ *                                                                           *
+ * Erases the current text contents, leaving a single empty leaf.            *
+ * ------------------------------------------------------------------------- */
+int Rope_Clear( PROPE pRope )
+{
+    return Rope_Init( pRope, NULL, 0 );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Rope_Delete                                                               *
+ *                                                                           *
+ * Deletes one or more bytes from the sequence, starting at the specified    *
+ * position.                                                                 *
+ * ------------------------------------------------------------------------- */
+int Rope_Delete( PROPE pRope, unsigned long ulPosition, unsigned long ulLength )
+{
+    PROPENODE pRoot;
+
+    if ( !pRope->pRoot || ( ulPosition >= pRope->pRoot->cbLength )) return 0;
+    if ( ulLength > ( pRope->pRoot->cbLength - ulPosition ))
+        ulLength = pRope->pRoot->cbLength - ulPosition;
+    if ( !ulLength ) return 1;
+
+    pRope->pLastLeaf = NULL;
+    pRoot = Rope_UnshareNode( pRope->hdr.pAllocator, &(pRope->pRoot) );
+    if ( !pRoot || ! Rope_DeleteNode( pRope->hdr.pAllocator, pRoot, ulPosition, ulLength )) return 0;
+
+    // Remove any redundant levels from the top of the tree
+    while ( !ISLEAF( pRoot ) && ( pRoot->usCount < 2 )) {
+        if ( pRoot->usCount ) {
+            pRope->pRoot = BRANCH( pRoot )->apChildren[ 0 ];
+            atomic_increment( &(pRope->pRoot->ulRefs) );
+            Rope_ReleaseNode( pRope->hdr.pAllocator, pRoot );
+        }
+        else {
+            Rope_ReleaseNode( pRope->hdr.pAllocator, pRoot );
+            pRope->pRoot = (PROPENODE) Rope_CreateLeaf( pRope->hdr.pAllocator );
+            if ( !pRope->pRoot ) return 0;
+        }
+        pRoot = pRope->pRoot;
+    }
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Rope_Destroy()                                                            *
+ *                                                                           *
+ * Frees the entire tree and zeroes the rest of the data structure.          *
+ * ------------------------------------------------------------------------- */
+int Rope_Destroy( PROPE pRope )
+{
+    Rope_ReleaseNode( pRope->hdr.pAllocator, pRope->pRoot );
+    pRope->pRoot       = NULL;
+    pRope->pLastLeaf   = NULL;
+    pRope->ulLastStart = 0;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Rope_Init()                                                               *
+ *                                                                           *
+ * Initializes the text data structure.  If any text is specified, the tree  *
+ * is built directly from the bottom up: the text is divided among as many   *
+ * leaves as necessary (leaving some free space in each one), which are then *
+ * grouped under successive levels of branches until a single root remains.  *
+ * ------------------------------------------------------------------------- */
+int Rope_Init( PROPE pRope, unsigned char *pchText, unsigned long cbText )
+{
+    PROPENODE     *apLevel;
+    PROPEBRANCH   pBranch;
+    PROPELEAF     pLeaf;
+    unsigned long ulNodes,
+                  ulChunk,
+                  cbFill,
+                  i, j;
+
+    Rope_Destroy( pRope );
+
+    if ( !cbText || !pchText ) {
+        pRope->pRoot = (PROPENODE) Rope_CreateLeaf( pRope->hdr.pAllocator );
+        return ( pRope->pRoot ? 1 : 0 );
+    }
+
+    // Fill each leaf to three-quarters capacity, to leave room for edits
+    cbFill  = (( ROPE_LEAF_MAX * 3 / 4 ) / ROPE_UNIT ) * ROPE_UNIT;
+    ulNodes = ( cbText + cbFill - 1 ) / cbFill;
+    apLevel = (PROPENODE *) allocate_small( pRope->hdr.pAllocator, ulNodes * sizeof( PROPENODE ));
+    if ( !apLevel ) return 0;
+
+    for ( i = 0, j = 0; i < ulNodes; i++ ) {
+        pLeaf = Rope_CreateLeaf( pRope->hdr.pAllocator );
+        if ( !pLeaf ) {
+            // Only the leaves created so far are valid, and none is adopted
+            ulNodes = i;
+            i = 0;
+            goto cleanup;
+        }
+        ulChunk = ( cbText - ( i * cbFill ) > cbFill ) ? cbFill : cbText - ( i * cbFill );
+        memcpy( pLeaf->achData, pchText + ( i * cbFill ), ulChunk );
+        pLeaf->node.cbLength = ulChunk;
+        Rope_CountLeaf( pLeaf );
+        apLevel[ i ] = (PROPENODE) pLeaf;
+    }
+
+    // Now build each level of branches on top of the one below it
+    while ( ulNodes > 1 ) {
+        for ( i = 0, j = 0; i < ulNodes; i += ROPE_FANOUT, j++ ) {
+            pBranch = Rope_CreateBranch( pRope->hdr.pAllocator );
+            if ( !pBranch ) goto cleanup;
+            pBranch->node.usCount = ( ulNodes - i > ROPE_FANOUT ) ? ROPE_FANOUT : ulNodes - i;
+            memcpy( pBranch->apChildren, apLevel + i,
+                    pBranch->node.usCount * sizeof( PROPENODE ));
+            Rope_UpdateBranch( pBranch );
+            apLevel[ j ] = (PROPENODE) pBranch;
+        }
+        ulNodes = j;
+    }
+
+    pRope->pRoot = apLevel[ 0 ];
+    free_small( pRope->hdr.pAllocator, apLevel );
+    return 1;
+
+cleanup:
+    // Entries [0,j) are the new branches of the current level, which own all
+    // the nodes they adopted; entries [i,ulNodes) have not been adopted yet.
+    // Entries in between are stale copies of adopted nodes, and are skipped.
+    while ( j ) Rope_ReleaseNode( pRope->hdr.pAllocator, apLevel[ --j ] );
+    for ( ; i < ulNodes; i++ ) Rope_ReleaseNode( pRope->hdr.pAllocator, apLevel[ i ] );
+    free_small( pRope->hdr.pAllocator, apLevel );
+    return 0;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Rope_Insert                                                               *
+ *                                                                           *
+ * Inserts one or more bytes into the sequence at the specified position.    *
+ * Large insertions are broken up into leaf-sized pieces, each of which is   *
+ * inserted in turn.                                                         *
+ * ------------------------------------------------------------------------- */
+int Rope_Insert( PROPE pRope, unsigned char *pch, unsigned long ulPosition, unsigned long ulLength )
+{
+    PROPEBRANCH   pBranch;
+    PROPENODE     pRoot,
+                  pSplit;
+    unsigned long ulChunk;
+
+    // Make sure the buffer exists
+    if ( !pRope || !pRope->pRoot ) return 0;
+
+    // Don't allow adding items more than one position past the end of the array
+    if ( ulPosition > pRope->pRoot->cbLength ) return 0;
+
+    pRope->pLastLeaf = NULL;
+    while ( ulLength ) {
+        ulChunk = ( ulLength > ROPE_LEAF_MAX ) ? ROPE_LEAF_MAX : ulLength;
+        pRoot = Rope_UnshareNode( pRope->hdr.pAllocator, &(pRope->pRoot) );
+        if ( !pRoot || ! Rope_InsertNode( pRope->hdr.pAllocator, pRoot, pch, ulPosition, ulChunk, &pSplit ))
+            return 0;
+
+        // If the root was split, add a new level to the top of the tree
+        if ( pSplit ) {
+            pBranch = Rope_CreateBranch( pRope->hdr.pAllocator );
+            if ( !pBranch ) return 0;
+            pBranch->apChildren[ 0 ] = pRope->pRoot;
+            pBranch->apChildren[ 1 ] = pSplit;
+            pBranch->node.usCount = 2;
+            Rope_UpdateBranch( pBranch );
+            pRope->pRoot = (PROPENODE) pBranch;
+        }
+        pch        += ulChunk;
+        ulPosition += ulChunk;
+        ulLength   -= ulChunk;
+    }
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Rope_Length()                                                             *
+ *                                                                           *
+ * Returns the length of the text.                                           *
+ * ------------------------------------------------------------------------- */
+unsigned long Rope_Length( PROPE pRope )
+{
+    if ( !pRope || !pRope->pRoot ) return 0;
+    return ( pRope->pRoot->cbLength );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Rope_LineFromOffset                                                       *
+ *                                                                           *
+ * Returns the (0-based) number of the line containing the given position.   *
+ * This is the number of line breaks which end at or before the position.    *
+ * ------------------------------------------------------------------------- */
+unsigned long Rope_LineFromOffset( PROPE pRope, unsigned long ulPosition )
+{
+    PROPENODE      pNode,
+                   pChild;
+    PROPELEAF      pLeaf;
+    unsigned long  ulLine,
+                   ulOffset,
+                   ulUnits,
+                   i;
+    unsigned short c;
+    wchar_t        wc, wcNext;
+    int            fPrevCR;
+
+    if ( !pRope->pRoot ) return 0;
+    if ( ulPosition >= pRope->pRoot->cbLength ) return pRope->pRoot->ulBreaks;
+
+    // Descend to the leaf, adding up the breaks in everything before it
+    pNode   = pRope->pRoot;
+    ulLine  = 0;
+    fPrevCR = 0;
+    while ( !ISLEAF( pNode )) {
+        for ( c = 0; c < pNode->usCount; c++ ) {
+            pChild = BRANCH( pNode )->apChildren[ c ];
+            if ( ulPosition < pChild->cbLength ) break;
+            ulPosition -= pChild->cbLength;
+            ulLine += EFFECTIVE_BREAKS( pChild, fPrevCR );
+            if ( pChild->cbLength ) fPrevCR = pChild->fsFlags & ROPE_ENDS_CR;
+        }
+        if ( c == pNode->usCount ) return ulLine;
+        pNode = pChild;
+    }
+
+    // Now count the breaks within the leaf which end before the position
+    pLeaf    = LEAF( pNode );
+    ulOffset = ulPosition;
+    ulUnits  = pNode->cbLength / ROPE_UNIT;
+    for ( i = 0; ( i < ulUnits ) && ((( i + 1 ) * ROPE_UNIT ) <= ulOffset ); i++ ) {
+        memcpy( &wc, pLeaf->achData + ( i * ROPE_UNIT ), ROPE_UNIT );
+        if ( ! IS_LINEBREAK( wc )) continue;
+        if ( !i && fPrevCR && ( wc == 0xA )) continue;
+        if (( wc == 0xD ) && (( i + 1 ) < ulUnits )) {
+            memcpy( &wcNext, pLeaf->achData + (( i + 1 ) * ROPE_UNIT ), ROPE_UNIT );
+            if ( wcNext == 0xA ) continue;
+        }
+        ulLine++;
+    }
+
+    /* If the position is the LF of a CR-LF pair whose CR ended the previous
+     * leaf, that CR was counted as a break above; but the break does not
+     * actually end until after the LF.
+     */
+    if ( !ulOffset && fPrevCR && ( pNode->fsFlags & ROPE_STARTS_LF ) && ulLine )
+        ulLine--;
+
+    return ulLine;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Rope_LineOffset                                                           *
+ *                                                                           *
+ * Returns the position at which the given (0-based) line starts, i.e. the   *
+ * position immediately following the end of the ulLine'th line break.       *
+ * Returns TEXT_INVALID_POSITION if there is no such line.                   *
+ * ------------------------------------------------------------------------- */
+unsigned long Rope_LineOffset( PROPE pRope, unsigned long ulLine )
+{
+    PROPENODE      pNode,
+                   pChild;
+    PROPELEAF      pLeaf;
+    unsigned long  ulStart,
+                   ulEffective,
+                   ulUnits,
+                   ulEnd,
+                   i;
+    unsigned short c;
+    wchar_t        wc, wcNext;
+    int            fPrevCR;
+
+    if ( !ulLine ) return 0;
+    if ( !pRope->pRoot || ( ulLine > pRope->pRoot->ulBreaks ))
+        return TEXT_INVALID_POSITION;
+
+    // Descend to the leaf containing the ulLine'th break
+    pNode   = pRope->pRoot;
+    ulStart = 0;
+    fPrevCR = 0;
+    while ( !ISLEAF( pNode )) {
+        for ( c = 0; c < pNode->usCount; c++ ) {
+            pChild = BRANCH( pNode )->apChildren[ c ];
+            ulEffective = EFFECTIVE_BREAKS( pChild, fPrevCR );
+            if ( ulLine <= ulEffective ) break;
+            ulLine  -= ulEffective;
+            ulStart += pChild->cbLength;
+            if ( pChild->cbLength ) fPrevCR = pChild->fsFlags & ROPE_ENDS_CR;
+        }
+        if ( c == pNode->usCount ) return TEXT_INVALID_POSITION;
+        pNode = pChild;
+    }
+
+    // Now find the break within the leaf
+    pLeaf   = LEAF( pNode );
+    ulUnits = pNode->cbLength / ROPE_UNIT;
+    wcNext  = 0;
+    for ( i = 0; i < ulUnits; i++ ) {
+        memcpy( &wc, pLeaf->achData + ( i * ROPE_UNIT ), ROPE_UNIT );
+        if ( ! IS_LINEBREAK( wc )) continue;
+        if ( !i && fPrevCR && ( wc == 0xA )) continue;
+        if (( wc == 0xD ) && (( i + 1 ) < ulUnits )) {
+            memcpy( &wcNext, pLeaf->achData + (( i + 1 ) * ROPE_UNIT ), ROPE_UNIT );
+            if ( wcNext == 0xA ) continue;
+        }
+        if ( --ulLine ) continue;
+
+        // Found it; if it's a CR ending the leaf, check for an LF following
+        ulEnd = ulStart + (( i + 1 ) * ROPE_UNIT );
+        if (( wc == 0xD ) && ( Rope_UnitAt( pRope, ulEnd ) == 0xA ))
+            ulEnd += ROPE_UNIT;
+        return ulEnd;
+    }
+
+    return TEXT_INVALID_POSITION;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Rope_Sequence                                                             *
+ *                                                                           *
+ * Writes a character sequence (string) of the requested length, starting at *
+ * at the specified position.  Returns the number of bytes written (which    *
+ * may be less than the requested length if the end of the text is reached.) *
+ * ------------------------------------------------------------------------- */
+unsigned long Rope_Sequence( PROPE pRope, unsigned char *pchText, unsigned long ulPosition, unsigned long ulLength )
+{
+    if ( !pchText || !pRope->pRoot ) return 0;
+    if ( ulPosition >= pRope->pRoot->cbLength ) return 0;
+    if ( ulLength > ( pRope->pRoot->cbLength - ulPosition ))
+        ulLength = pRope->pRoot->cbLength - ulPosition;
+
+    Rope_CopyNode( pRope->pRoot, pchText, ulPosition, ulLength );
+    return ulLength;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Rope_GetSpans                                                             *
+ *                                                                           *
+ * Returns the text of the leaf containing the given position (from that     *
+ * position onwards) and of the leaf following it, up to the requested       *
+ * length.                                                                   *
+ * ------------------------------------------------------------------------- */
+int Rope_GetSpans( PROPE pRope, unsigned long ulPosition, unsigned long ulLength, PTEXTSPAN pSpan1, PTEXTSPAN pSpan2 )
+{
+    PROPELEAF     pLeaf;
+    unsigned long ulStart;
+
+    if ( !pRope->pRoot || ( ulPosition >= pRope->pRoot->cbLength )) return 0;
+    if ( ulLength > ( pRope->pRoot->cbLength - ulPosition ))
+        ulLength = pRope->pRoot->cbLength - ulPosition;
+
+    pLeaf = Rope_FindLeaf( pRope, ulPosition, &ulStart );
+    if ( !pLeaf ) return 0;
+    pSpan1->pch = pLeaf->achData + ( ulPosition - ulStart );
+    pSpan1->cb  = pLeaf->node.cbLength - ( ulPosition - ulStart );
+    if ( pSpan1->cb >= ulLength ) {
+        pSpan1->cb = ulLength;
+        return 1;
+    }
+
+    ulPosition = ulStart + pLeaf->node.cbLength;
+    pLeaf = Rope_FindLeaf( pRope, ulPosition, &ulStart );
+    if ( !pLeaf ) return 1;
+    pSpan2->pch = pLeaf->achData;
+    pSpan2->cb  = pLeaf->node.cbLength;
+    if ( pSpan2->cb > ( ulLength - pSpan1->cb ))
+        pSpan2->cb = ulLength - pSpan1->cb;
+    return 2;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Rope_Snapshot                                                             *
+ *                                                                           *
+ * Makes the (new, empty) snapshot rope share the tree of the given rope, by *
+ * taking another reference to its root.                                     *
+ * ------------------------------------------------------------------------- */
+int Rope_Snapshot( PROPE pRope, PROPE pSnapshot )
+{
+    if ( !pRope->pRoot ) return 0;
+    atomic_increment( &(pRope->pRoot->ulRefs) );
+    pSnapshot->pRoot       = pRope->pRoot;
+    pSnapshot->pLastLeaf   = NULL;
+    pSnapshot->ulLastStart = 0;
+    return 1;
+}
+
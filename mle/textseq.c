@@ -1,10 +1,10 @@
 /*****************************************************************************
  * textseq.c                                                                 *
  *                                                                           *
- * Implements a text editor data model.  The current implementation is a     *
- * 'gap' (or split) buffer, based on the theory described by Charles Crowley *
- * in his paper "Data Structures for Text Sequences" (1998, University of    *
- * New Mexico).                                                              *
+ * Implements the public interface to the text editor data model.  The       *
+ * actual text storage is provided by one of several model implementations   *
+ * (see textimpl.h); the functions in this file simply pass each request on  *
+ * to whichever model the text object was created with.                      *
  *                                                                           *
  * Note that we make no assumptions about how the buffer contents will be    *
  * interpreted.  Matters of character width (whether fixed-width or MBCS),   *
@@ -15,7 +15,8 @@
  * how to deal with them accordingly.                                        *
  *                                                                           *
  * All references to 'characters' in this file refer to single bytes (char), *
- * with the sole exception of TextWCharAt() which uses the wchar_t type.     *
+ * except in TextWCharAt(), the TextIter*() functions and the line functions *
+ * which use the wchar_t type.                                               *
  *                                                                           *
  * This file attempts to be platform-agnostic in order to make it easier to  *
  * reuse in other applications.  Platform-specific types and APIs should be  *
@@ -28,12 +29,16 @@
 #include <stddef.h>
 
 #include "debug.h"
+#include "textseq.h"
+#include "textimpl.h"
 
 #ifdef __OS2__
 #define INCL_DOSERRORS
+#define INCL_DOSFILEMGR
+#define INCL_DOSPROCESS
 #include <os2.h>
 
-PVOID allocate_memory( size_t size )
+PVOID system_allocate( size_t size )
 {
     APIRET rc;
     PVOID  pObj;
@@ -43,14 +48,177 @@ PVOID allocate_memory( size_t size )
     return pObj;
 }
 
-void free_memory( PVOID pObj )
+void system_free( PVOID pObj )
 {
     DosFreeMem( pObj );
 }
 
+// There is no way to resize a DosAllocMem object, so copy to a new one
+PVOID system_reallocate( PVOID pObj, size_t cbOld, size_t cbNew )
+{
+    PVOID pNew;
+
+    pNew = system_allocate( cbNew );
+    if ( !pNew ) return NULL;
+    if ( pObj ) {
+        memcpy( pNew, pObj, ( cbOld < cbNew ) ? cbOld : cbNew );
+        DosFreeMem( pObj );
+    }
+    return pNew;
+}
+
+// OS/2 has no file mapping, so read the whole file into a private object
+int map_file( const char *pszFile, void **ppView, unsigned long *pcbView )
+{
+    APIRET      rc;
+    HFILE       hf;
+    ULONG       ulAction,
+                cbRead;
+    FILESTATUS3 fs3;
+    PVOID       pView;
+
+    *ppView  = NULL;
+    *pcbView = 0;
+    rc = DosOpen( (PSZ) pszFile, &hf, &ulAction, 0L, FILE_NORMAL,
+                  OPEN_ACTION_FAIL_IF_NEW | OPEN_ACTION_OPEN_IF_EXISTS,
+                  OPEN_SHARE_DENYWRITE | OPEN_ACCESS_READONLY, NULL );
+    if ( rc != NO_ERROR ) return 0;
+
+    rc = DosQueryFileInfo( hf, FIL_STANDARD, &fs3, sizeof( fs3 ));
+    if (( rc != NO_ERROR ) || ( fs3.cbFile >= TEXT_INVALID_POSITION )) {
+        DosClose( hf );
+        return 0;
+    }
+    if ( fs3.cbFile ) {
+        pView = system_allocate( fs3.cbFile );
+        if ( !pView ) {
+            DosClose( hf );
+            return 0;
+        }
+        rc = DosRead( hf, pView, fs3.cbFile, &cbRead );
+        if (( rc != NO_ERROR ) || ( cbRead != fs3.cbFile )) {
+            DosFreeMem( pView );
+            DosClose( hf );
+            return 0;
+        }
+        *ppView  = pView;
+        *pcbView = fs3.cbFile;
+    }
+    DosClose( hf );
+    return 1;
+}
+
+void unmap_file( void *pView, unsigned long cbView )
+{
+    if ( pView ) DosFreeMem( pView );
+}
+
+int open_file( const char *pszFile, unsigned long *phFile, unsigned long *pcbFile )
+{
+    APIRET      rc;
+    HFILE       hf;
+    ULONG       ulAction;
+    FILESTATUS3 fs3;
+
+    rc = DosOpen( (PSZ) pszFile, &hf, &ulAction, 0L, FILE_NORMAL,
+                  OPEN_ACTION_FAIL_IF_NEW | OPEN_ACTION_OPEN_IF_EXISTS,
+                  OPEN_SHARE_DENYWRITE | OPEN_ACCESS_READONLY, NULL );
+    if ( rc != NO_ERROR ) return 0;
+    rc = DosQueryFileInfo( hf, FIL_STANDARD, &fs3, sizeof( fs3 ));
+    if (( rc != NO_ERROR ) || ( fs3.cbFile >= TEXT_INVALID_POSITION )) {
+        DosClose( hf );
+        return 0;
+    }
+    *phFile  = hf;
+    *pcbFile = fs3.cbFile;
+    return 1;
+}
+
+// DosSetFilePtr only takes a signed offset, so this is limited to 2 GB
+unsigned long read_file( unsigned long hFile, unsigned long ulOffset, void *pBuffer, unsigned long cb )
+{
+    ULONG ulPos,
+          cbRead;
+
+    if ( DosSetFilePtr( (HFILE) hFile, (LONG) ulOffset, FILE_BEGIN, &ulPos ) != NO_ERROR )
+        return 0;
+    if ( DosRead( (HFILE) hFile, pBuffer, cb, &cbRead ) != NO_ERROR )
+        return 0;
+    return cbRead;
+}
+
+int create_file( const char *pszFile, unsigned long *phFile )
+{
+    APIRET rc;
+    HFILE  hf;
+    ULONG  ulAction;
+
+    rc = DosOpen( (PSZ) pszFile, &hf, &ulAction, 0L, FILE_NORMAL,
+                  OPEN_ACTION_CREATE_IF_NEW | OPEN_ACTION_REPLACE_IF_EXISTS,
+                  OPEN_SHARE_DENYREADWRITE | OPEN_ACCESS_WRITEONLY, NULL );
+    if ( rc != NO_ERROR ) return 0;
+    *phFile = hf;
+    return 1;
+}
+
+// There is no gather-write, so the spans are written one at a time
+int write_file( unsigned long hFile, PTEXTSPAN pSpans, unsigned long ulSpans )
+{
+    ULONG cbWritten,
+          i;
+
+    for ( i = 0; i < ulSpans; i++ ) {
+        if ( !pSpans[ i ].cb ) continue;
+        if (( DosWrite( (HFILE) hFile, pSpans[ i ].pch, pSpans[ i ].cb, &cbWritten ) != NO_ERROR ) ||
+            ( cbWritten != pSpans[ i ].cb ))
+            return 0;
+    }
+    return 1;
+}
+
+void close_file( unsigned long hFile )
+{
+    DosClose( (HFILE) hFile );
+}
+
+// The compiler has no atomic arithmetic, so briefly suspend the other threads
+unsigned long atomic_increment( volatile unsigned long *pulValue )
+{
+    unsigned long ulNew;
+
+    DosEnterCritSec();
+    ulNew = ++(*pulValue);
+    DosExitCritSec();
+    return ulNew;
+}
+
+unsigned long atomic_decrement( volatile unsigned long *pulValue )
+{
+    unsigned long ulNew;
+
+    DosEnterCritSec();
+    ulNew = --(*pulValue);
+    DosExitCritSec();
+    return ulNew;
+}
+
+// Loads are never reordered with other memory accesses on x86
+unsigned long atomic_read( volatile unsigned long *pulValue )
+{
+    return *pulValue;
+}
+
 #else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
-void *allocate_memory( size_t size )
+#define WRITE_VECTOR_MAX    16      // most spans passed to one writev() call
+
+void *system_allocate( size_t size )
 {
     void *pObj;
     pObj = (void *) malloc( size );
@@ -58,447 +226,1648 @@ void *allocate_memory( size_t size )
     return pObj;
 }
 
-void free_memory( void *pObj )
-{
-    free( pObj );
+void system_free( void *pObj )
+{
+    free( pObj );
+}
+
+// Note that unlike system_allocate(), the new space is not cleared
+void *system_reallocate( void *pObj, size_t cbOld, size_t cbNew )
+{
+    if ( pObj && ( cbNew == cbOld )) return pObj;
+    return realloc( pObj, cbNew );
+}
+
+// Pages are only read from the file as they are first accessed
+int map_file( const char *pszFile, void **ppView, unsigned long *pcbView )
+{
+    struct stat st;
+    void        *pView;
+    int         fd;
+
+    *ppView  = NULL;
+    *pcbView = 0;
+    fd = open( pszFile, O_RDONLY );
+    if ( fd == -1 ) return 0;
+    if (( fstat( fd, &st ) == -1 ) ||
+        ( (unsigned long long) st.st_size >= TEXT_INVALID_POSITION ))
+    {
+        close( fd );
+        return 0;
+    }
+    if ( st.st_size ) {
+        pView = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        if ( pView == MAP_FAILED ) {
+            close( fd );
+            return 0;
+        }
+        *ppView  = pView;
+        *pcbView = st.st_size;
+    }
+    close( fd );        // the mapping remains valid
+    return 1;
+}
+
+void unmap_file( void *pView, unsigned long cbView )
+{
+    if ( pView ) munmap( pView, cbView );
+}
+
+int open_file( const char *pszFile, unsigned long *phFile, unsigned long *pcbFile )
+{
+    struct stat st;
+    int         fd;
+
+    fd = open( pszFile, O_RDONLY );
+    if ( fd == -1 ) return 0;
+    if (( fstat( fd, &st ) == -1 ) ||
+        ( (unsigned long long) st.st_size >= TEXT_INVALID_POSITION ))
+    {
+        close( fd );
+        return 0;
+    }
+    *phFile  = (unsigned long) fd;
+    *pcbFile = st.st_size;
+    return 1;
+}
+
+unsigned long read_file( unsigned long hFile, unsigned long ulOffset, void *pBuffer, unsigned long cb )
+{
+    unsigned long cbTotal = 0;
+    ssize_t       cbRead;
+
+    while ( cbTotal < cb ) {
+        cbRead = pread( (int) hFile, (char *) pBuffer + cbTotal, cb - cbTotal, ulOffset + cbTotal );
+        if ( cbRead <= 0 ) break;
+        cbTotal += cbRead;
+    }
+    return cbTotal;
+}
+
+int create_file( const char *pszFile, unsigned long *phFile )
+{
+    int fd;
+
+    fd = open( pszFile, O_WRONLY | O_CREAT | O_TRUNC, 0666 );
+    if ( fd == -1 ) return 0;
+    *phFile = (unsigned long) fd;
+    return 1;
+}
+
+int write_file( unsigned long hFile, PTEXTSPAN pSpans, unsigned long ulSpans )
+{
+    struct iovec  aiov[ WRITE_VECTOR_MAX ];
+    unsigned long ulCount,
+                  i;
+    ssize_t       cbWritten;
+
+    while ( ulSpans ) {
+        ulCount = ( ulSpans > WRITE_VECTOR_MAX ) ? WRITE_VECTOR_MAX : ulSpans;
+        for ( i = 0; i < ulCount; i++ ) {
+            aiov[ i ].iov_base = pSpans[ i ].pch;
+            aiov[ i ].iov_len  = pSpans[ i ].cb;
+        }
+        pSpans  += ulCount;
+        ulSpans -= ulCount;
+
+        i = 0;
+        while ( i < ulCount ) {
+            cbWritten = writev( (int) hFile, aiov + i, ulCount - i );
+            if ( cbWritten < 0 ) {
+                if ( errno == EINTR ) continue;
+                return 0;
+            }
+            // Skip whatever was written, which may end partway through a span
+            while (( i < ulCount ) && ( (size_t) cbWritten >= aiov[ i ].iov_len )) {
+                cbWritten -= aiov[ i ].iov_len;
+                i++;
+            }
+            if ( i < ulCount ) {
+                aiov[ i ].iov_base = (char *) aiov[ i ].iov_base + cbWritten;
+                aiov[ i ].iov_len -= cbWritten;
+            }
+        }
+    }
+    return 1;
+}
+
+void close_file( unsigned long hFile )
+{
+    close( (int) hFile );
+}
+
+unsigned long atomic_increment( volatile unsigned long *pulValue )
+{
+    return __sync_add_and_fetch( pulValue, 1 );
+}
+
+unsigned long atomic_decrement( volatile unsigned long *pulValue )
+{
+    return __sync_sub_and_fetch( pulValue, 1 );
+}
+
+unsigned long atomic_read( volatile unsigned long *pulValue )
+{
+    return __atomic_load_n( pulValue, __ATOMIC_ACQUIRE );
+}
+
+#endif
+
+
+// ---------------------------------------------------------------------------
+// MACROS
+//
+
+// Return the model function table of a text object
+#define TEXTMODEL( text )   ( ((PTEXTHDR)(text))->pModel )
+
+
+// ---------------------------------------------------------------------------
+// CONSTANTS
+//
+
+#define ITER_WINDOW_SIZE    0x10000 // how far back an iterator looks for a span
+#define SEARCH_SKIP_MIN     8       // shortest pattern searched with a skip table
+#define SEARCH_STITCH_SIZE  256     // default buffer for matches across spans
+#define REPLACE_CHUNK_SIZE  0x10000 // bytes copied at a time by TextReplaceAll()
+#define BREAK_BATCH_SIZE    256     // line breaks passed to PFNTEXTBREAKS at a time
+
+
+// ---------------------------------------------------------------------------
+// TYPEDEFS
+//
+
+// A search pattern prepared by PrepareSearch()
+typedef struct _search_pattern {
+    const unsigned char *pch;               // the pattern
+    unsigned long       cb,                 // length of the pattern in bytes
+                        cbUnit,             // matches must start on a multiple of this
+                        ulKey,              // offset of the byte used to look up shifts
+                        aulShift[ 256 ];    // shift for each possible value of that byte
+} SEARCHPATTERN, *PSEARCHPATTERN;
+
+// Line breaks found by TextReplaceAll(), waiting to be passed on
+typedef struct _break_batch {
+    PFNTEXTBREAKS pfnBreaks;                    // where to pass them
+    void          *pUser;                       // caller's data for pfnBreaks
+    unsigned long ulScanned,                    // position up to which the text has been scanned
+                  ulBreaks,                     // number of breaks held
+                  aulBreaks[ BREAK_BATCH_SIZE ];// position following each break
+} BREAKBATCH, *PBREAKBATCH;
+
+
+// ---------------------------------------------------------------------------
+// GLOBAL DATA
+//
+
+PTEXTALLOCATOR pDefaultAllocator = NULL;    // see TextSetDefaultAllocator()
+
+
+// ---------------------------------------------------------------------------
+// FUNCTION DECLARATIONS
+//
+
+int           IterFetch( PTEXTITER pIter, unsigned long ulPosition, int fBackward );
+unsigned long ScanLineBreaks( EDITORTEXT text, unsigned long ulPosition, unsigned long ulLimit, unsigned long ulMax, unsigned long *pulEnd );
+int           ScanNewBreaks( PBREAKBATCH pBatch, const unsigned char *pchText, unsigned long cbText, int fEnd );
+void          ReleaseMapping( EDITORTEXT text );
+int           SortEdits( PTEXTEDIT pEdits, unsigned long ulCount, PTEXTALLOCATOR pAlloc );
+void          PrepareSearch( PSEARCHPATTERN pSearch, const unsigned char *pchPattern, unsigned long cbPattern, unsigned long cbUnit );
+unsigned long SearchBlock( PSEARCHPATTERN pSearch, const unsigned char *pchBlock, unsigned long cbBlock, unsigned long ulFirst );
+int           WriteSpans( void *pUser, PTEXTSPAN pSpans, unsigned long ulSpans );
+
+
+// ===========================================================================
+// INTERNAL FUNCTIONS
+// ===========================================================================
+
+
+/* ------------------------------------------------------------------------- *
+ * allocate_memory()                                                         *
+ *                                                                           *
+ * Allocates a block of cleared memory from the given allocator, or from the *
+ * system if pAlloc is NULL.  The allocator's counters are updated here, so  *
+ * that they cover every allocator alike.                                    *
+ * ------------------------------------------------------------------------- */
+void *allocate_memory( PTEXTALLOCATOR pAlloc, size_t size )
+{
+    void *pObj;
+
+    if ( !pAlloc ) return system_allocate( size );
+
+    pAlloc->ulAllocs++;
+    pAlloc->cbRequested += size;
+    pObj = pAlloc->pfnAlloc( pAlloc->pUser, size );
+    if ( !pObj ) {
+        pAlloc->ulFailures++;
+        return NULL;
+    }
+    memset( pObj, 0, size );
+    return pObj;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * free_memory()                                                             *
+ *                                                                           *
+ * Frees a block obtained from allocate_memory() or reallocate_memory() with *
+ * the same allocator.                                                       *
+ * ------------------------------------------------------------------------- */
+void free_memory( PTEXTALLOCATOR pAlloc, void *pObj )
+{
+    if ( !pAlloc ) {
+        system_free( pObj );
+        return;
+    }
+    pAlloc->ulFrees++;
+    pAlloc->pfnFree( pAlloc->pUser, pObj );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * reallocate_memory()                                                       *
+ *                                                                           *
+ * Resizes a block, keeping as much of its contents as will fit; any new     *
+ * space is not necessarily cleared.  An allocator without a pfnRealloc      *
+ * function has the block copied to a new one.  If this fails, the old       *
+ * block is left as it was.                                                  *
+ * ------------------------------------------------------------------------- */
+void *reallocate_memory( PTEXTALLOCATOR pAlloc, void *pObj, size_t cbOld, size_t cbNew )
+{
+    void *pNew;
+
+    if ( !pAlloc ) return system_reallocate( pObj, cbOld, cbNew );
+    if ( !pObj ) return allocate_memory( pAlloc, cbNew );
+
+    pAlloc->ulReallocs++;
+    pAlloc->cbRequested += cbNew;
+    if ( pAlloc->pfnRealloc )
+        pNew = pAlloc->pfnRealloc( pAlloc->pUser, pObj, cbOld, cbNew );
+    else {
+        pNew = pAlloc->pfnAlloc( pAlloc->pUser, cbNew );
+        if ( pNew ) {
+            memcpy( pNew, pObj, ( cbOld < cbNew ) ? cbOld : cbNew );
+            pAlloc->pfnFree( pAlloc->pUser, pObj );
+        }
+    }
+    if ( !pNew ) pAlloc->ulFailures++;
+    return pNew;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * allocate_small()                                                          *
+ *                                                                           *
+ * Like allocate_memory(), but for small objects, which the system allocator *
+ * takes from the C runtime heap.  An application's allocator gets every     *
+ * request alike.                                                            *
+ * ------------------------------------------------------------------------- */
+void *allocate_small( PTEXTALLOCATOR pAlloc, size_t size )
+{
+    if ( !pAlloc ) return calloc( 1, size );
+    return allocate_memory( pAlloc, size );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * free_small()                                                              *
+ *                                                                           *
+ * Frees an object obtained from allocate_small() with the same allocator.   *
+ * ------------------------------------------------------------------------- */
+void free_small( PTEXTALLOCATOR pAlloc, void *pObj )
+{
+    if ( !pAlloc ) {
+        free( pObj );
+        return;
+    }
+    free_memory( pAlloc, pObj );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * next_buffer_size()                                                        *
+ *                                                                           *
+ * Applies the text object's growth policy to calculate the new size of a    *
+ * buffer which must be enlarged to hold at least cbRequired bytes.  Models  *
+ * should use this whenever they enlarge a buffer, so that the cost of       *
+ * copying is amortized over the total amount of text added.                 *
+ * ------------------------------------------------------------------------- */
+unsigned long next_buffer_size( PTEXTHDR pHdr, unsigned long cbCurrent, unsigned long cbRequired )
+{
+    unsigned long cbIncrement,
+                  cbNew;
+
+    cbIncrement = ( cbCurrent / 100 ) * ( pHdr->usGrowPercent - 100 );
+    if ( pHdr->cbGrowLimit && ( cbIncrement > pHdr->cbGrowLimit ))
+        cbIncrement = pHdr->cbGrowLimit;
+    if ( cbIncrement < GROWTH_MINIMUM ) cbIncrement = GROWTH_MINIMUM;
+
+    cbNew = cbCurrent + cbIncrement;
+    if ( cbNew < cbCurrent ) cbNew = 0xFFFFFFFF;    // overflow
+    return ( cbNew > cbRequired ) ? cbNew : cbRequired;
+}
+
+
+
+/* ------------------------------------------------------------------------- *
+ * ReleaseMapping()                                                          *
+ *                                                                           *
+ * Releases the file view (if any) which was given to the model as its       *
+ * initial contents by TextInitFromFile().  Must only be called once the     *
+ * model has stopped referring to it.                                        *
+ * ------------------------------------------------------------------------- */
+void ReleaseMapping( EDITORTEXT text )
+{
+    PTEXTHDR pHdr = (PTEXTHDR) text;
+
+    if ( !pHdr->pMapped ) return;
+    unmap_file( pHdr->pMapped, pHdr->cbMapped );
+    pHdr->pMapped  = NULL;
+    pHdr->cbMapped = 0;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * SortEdits()                                                               *
+ *                                                                           *
+ * Sorts an array of edits into ascending order of position.  The sort is    *
+ * stable, so that several insertions at the same position are made in the   *
+ * order given.  Since the edits will usually have been generated in order   *
+ * already (e.g. by a search), we check for that first; otherwise a merge    *
+ * sort is used, which requires a temporary copy of the array (taken from    *
+ * the text object's allocator).                                             *
+ * ------------------------------------------------------------------------- */
+int SortEdits( PTEXTEDIT pEdits, unsigned long ulCount, PTEXTALLOCATOR pAlloc )
+{
+    PTEXTEDIT     pTemp,
+                  pFrom,
+                  pTo,
+                  pSwap;
+    unsigned long ulWidth,
+                  ulLeft,
+                  ulMid,
+                  ulRight,
+                  i, j, k;
+
+    for ( i = 1; i < ulCount; i++ )
+        if ( pEdits[ i ].ulPosition < pEdits[ i-1 ].ulPosition ) break;
+    if ( i >= ulCount ) return 1;
+
+    pTemp = (PTEXTEDIT) allocate_memory( pAlloc, ulCount * sizeof( TEXTEDIT ));
+    if ( !pTemp ) return 0;
+
+    pFrom = pEdits;
+    pTo   = pTemp;
+    for ( ulWidth = 1; ulWidth < ulCount; ulWidth *= 2 ) {
+        for ( ulLeft = 0; ulLeft < ulCount; ulLeft += 2 * ulWidth ) {
+            ulMid   = ( ulLeft + ulWidth < ulCount ) ? ulLeft + ulWidth : ulCount;
+            ulRight = ( ulMid + ulWidth < ulCount ) ? ulMid + ulWidth : ulCount;
+            i = ulLeft;
+            j = ulMid;
+            for ( k = ulLeft; k < ulRight; k++ ) {
+                if (( i < ulMid ) &&
+                    (( j >= ulRight ) || ( pFrom[ i ].ulPosition <= pFrom[ j ].ulPosition )))
+                    pTo[ k ] = pFrom[ i++ ];
+                else
+                    pTo[ k ] = pFrom[ j++ ];
+            }
+        }
+        pSwap = pFrom;
+        pFrom = pTo;
+        pTo   = pSwap;
+    }
+    if ( pFrom != pEdits ) memcpy( pEdits, pFrom, ulCount * sizeof( TEXTEDIT ));
+
+    free_memory( pAlloc, pTemp );
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * IterFetch()                                                               *
+ *                                                                           *
+ * Points an iterator at the span which holds the character starting at the  *
+ * given position (or, if fBackward is set, the character ending there).     *
+ * Going forward, the span starts at the position and runs to the next span  *
+ * boundary.  Going back, there is no way to ask the model where the span    *
+ * containing the position begins, so we ask for a window of text before     *
+ * the position and use whichever span reaches it.                           *
+ *                                                                           *
+ * Returns 1 if the character lies wholly within the span.  Otherwise it     *
+ * straddles two spans (or is outside the text), and returns 0.              *
+ * ------------------------------------------------------------------------- */
+int IterFetch( PTEXTITER pIter, unsigned long ulPosition, int fBackward )
+{
+    TEXTSPAN      aSpans[ 2 ];
+    unsigned long ulSpans,
+                  ulStart,
+                  cbFound,
+                  i;
+
+    pIter->pch      = NULL;
+    pIter->ulSpan   = ulPosition;
+    pIter->cbSpan   = 0;
+    pIter->ulOffset = 0;
+
+    if ( !fBackward ) {
+        if ( ulPosition >= pIter->cbText ) return 0;
+        ulSpans = TextGetSpans( pIter->text, ulPosition, pIter->cbText - ulPosition,
+                                aSpans, aSpans + 1 );
+        if ( !ulSpans ) return 0;
+        pIter->pch    = aSpans[ 0 ].pch;
+        pIter->cbSpan = aSpans[ 0 ].cb;
+        return ( pIter->cbSpan >= sizeof( wchar_t ));
+    }
+
+    ulStart = ( ulPosition > ITER_WINDOW_SIZE ) ? ulPosition - ITER_WINDOW_SIZE : 0;
+    while ( ulStart < ulPosition ) {
+        ulSpans = TextGetSpans( pIter->text, ulStart, ulPosition - ulStart,
+                                aSpans, aSpans + 1 );
+        cbFound = 0;
+        for ( i = 0; i < ulSpans; i++ ) {
+            if (( ulStart + aSpans[ i ].cb ) >= ulPosition ) {
+                pIter->pch      = aSpans[ i ].pch;
+                pIter->ulSpan   = ulStart;
+                pIter->cbSpan   = aSpans[ i ].cb;
+                pIter->ulOffset = ulPosition - ulStart;
+                return ( pIter->ulOffset >= sizeof( wchar_t ));
+            }
+            ulStart += aSpans[ i ].cb;
+            cbFound += aSpans[ i ].cb;
+        }
+        if ( !cbFound ) break;
+    }
+    return 0;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * ScanLineBreaks()                                                          *
+ *                                                                           *
+ * Generic line-break scanner for models which do not index line breaks.     *
+ * Reads the text with an iterator starting at ulPosition, and counts line   *
+ * breaks which end at or before ulLimit, stopping once ulMax breaks have    *
+ * been found.  If the position follows a CR and starts with an LF, the pair *
+ * counts as a break ending after the LF.                                    *
+ *                                                                           *
+ * ARGUMENTS:                                                                *
+ *   EDITORTEXT    text      : The text object.                              *
+ *   unsigned long ulPosition: Byte position at which to start scanning.     *
+ *   unsigned long ulLimit   : Only breaks ending at or before this count.   *
+ *   unsigned long ulMax     : Stop after finding this many breaks.          *
+ *   unsigned long *pulEnd   : Receives the end of the last break found,     *
+ *                             or TEXT_INVALID_POSITION if none.             *
+ *                                                                           *
+ * RETURNS: unsigned long                                                    *
+ *   The number of line breaks found.                                        *
+ * ------------------------------------------------------------------------- */
+unsigned long ScanLineBreaks( EDITORTEXT text, unsigned long ulPosition, unsigned long ulLimit, unsigned long ulMax, unsigned long *pulEnd )
+{
+    TEXTITER      iter;
+    unsigned long cbText,
+                  cbScan,
+                  ulStart,
+                  ulBreaks,
+                  ulEnd,
+                  ulBreakEnd,
+                  ulUnit;
+    wchar_t       wc;
+    int           fPendingCR,
+                  fDone;
+
+    ulBreaks = 0;
+    ulEnd    = TEXT_INVALID_POSITION;
+    ulStart  = ulPosition;
+    cbText   = TextLength( text );
+
+    // A break is only resolved by the unit following it, so read one extra
+    if (( ulLimit < cbText ) && (( cbText - ulLimit ) > sizeof( wchar_t )))
+        cbScan = ulLimit + sizeof( wchar_t );
+    else
+        cbScan = cbText;
+
+    // Start from the unit before the position, to see if it is a CR
+    fPendingCR = 0;
+    fDone      = ( ulMax == 0 );
+    if (( ulPosition >= sizeof( wchar_t )) && ( ulPosition <= cbText )) {
+        TextIterInit( &iter, text, ulPosition - sizeof( wchar_t ));
+        fPendingCR = TextIterNext( &iter, &wc ) && ( wc == 0xD );
+    }
+    else if ( ! TextIterInit( &iter, text, ulPosition ))
+        fDone = 1;
+
+    while ( !fDone && (( TextIterPosition( &iter ) + sizeof( wchar_t )) <= cbScan ) &&
+            TextIterNext( &iter, &wc ))
+    {
+        ulUnit     = TextIterPosition( &iter ) - sizeof( wchar_t );
+        ulBreakEnd = TEXT_INVALID_POSITION;
+
+        if ( fPendingCR ) {
+            // The preceding CR ends either here, or after this LF
+            fPendingCR = 0;
+            if ( wc == 0xA )
+                ulBreakEnd = ulUnit + sizeof( wchar_t );
+            else if ( ulUnit > ulStart )
+                ulBreakEnd = ulUnit;
+        }
+        if ( ulBreakEnd != TEXT_INVALID_POSITION ) {
+            if ( ulBreakEnd > ulLimit ) { fDone = 1; continue; }
+            ulEnd = ulBreakEnd;
+            if ( ++ulBreaks >= ulMax ) { fDone = 1; continue; }
+            if ( wc == 0xA ) continue;
+        }
+
+        if ( wc == 0xD )
+            fPendingCR = 1;
+        else if ( IS_LINEBREAK( wc )) {
+            if (( ulUnit + sizeof( wchar_t )) > ulLimit ) { fDone = 1; continue; }
+            ulEnd = ulUnit + sizeof( wchar_t );
+            if ( ++ulBreaks >= ulMax ) fDone = 1;
+        }
+    }
+
+    // A CR at the very end of the text is a break in its own right (unless
+    // it was before the starting position)
+    if ( !fDone && fPendingCR && ( TextIterPosition( &iter ) >= cbText ) &&
+         ( cbText > ulStart ) && ( cbText <= ulLimit )) {
+        ulEnd = cbText;
+        ulBreaks++;
+    }
+
+    if ( pulEnd ) *pulEnd = ulEnd;
+    return ulBreaks;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * ScanNewBreaks()                                                           *
+ *                                                                           *
+ * Finds the hard line breaks in a contiguous block of text which is being   *
+ * built up, from where the previous call left off to cbText, and adds the   *
+ * position following each to the batch, which is passed on whenever it is   *
+ * full.  The rules are those of ScanLineBreaks().  A CR in the last unit so *
+ * far cannot be resolved until the next unit is written, so it is left for  *
+ * the next call; fEnd indicates that the text is complete, in which case    *
+ * the CR is a break in its own right and the rest of the batch is passed    *
+ * on.  Returns 0 if pfnBreaks asked for the operation to be abandoned.      *
+ * ------------------------------------------------------------------------- */
+int ScanNewBreaks( PBREAKBATCH pBatch, const unsigned char *pchText, unsigned long cbText, int fEnd )
+{
+    unsigned long ulUnit;
+    wchar_t       wc;
+
+    for ( ulUnit = pBatch->ulScanned;
+          ( ulUnit + sizeof( wchar_t )) <= cbText;
+          ulUnit += sizeof( wchar_t ))
+    {
+        memcpy( &wc, pchText + ulUnit, sizeof( wchar_t ));
+        if ( !IS_LINEBREAK( wc )) continue;
+        if ( wc == 0xD ) {
+            if (( ulUnit + 2 * sizeof( wchar_t )) <= cbText ) {
+                memcpy( &wc, pchText + ulUnit + sizeof( wchar_t ), sizeof( wchar_t ));
+                if ( wc == 0xA ) ulUnit += sizeof( wchar_t );
+            }
+            else if ( !fEnd ) break;
+        }
+        pBatch->aulBreaks[ pBatch->ulBreaks++ ] = ulUnit + sizeof( wchar_t );
+        if ( pBatch->ulBreaks == BREAK_BATCH_SIZE ) {
+            if ( ! pBatch->pfnBreaks( pBatch->pUser, pBatch->aulBreaks, pBatch->ulBreaks ))
+                return 0;
+            pBatch->ulBreaks = 0;
+        }
+    }
+    pBatch->ulScanned = ulUnit;
+
+    if ( fEnd && pBatch->ulBreaks ) {
+        if ( ! pBatch->pfnBreaks( pBatch->pUser, pBatch->aulBreaks, pBatch->ulBreaks ))
+            return 0;
+        pBatch->ulBreaks = 0;
+    }
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * PrepareSearch()                                                           *
+ *                                                                           *
+ * Sets up a pattern for SearchBlock(), building its Horspool shift table.   *
+ *                                                                           *
+ * Matches may only start at multiples of cbUnit, so every shift is also a   *
+ * multiple of cbUnit, and the byte which selects the shift is the first     *
+ * byte of the pattern's last unit rather than its very last byte.  With     *
+ * UCS-2 text the last byte is usually the high byte of a character, which   *
+ * is the same (0) for most of a Latin text and would make for tiny shifts.  *
+ * ------------------------------------------------------------------------- */
+void PrepareSearch( PSEARCHPATTERN pSearch, const unsigned char *pchPattern, unsigned long cbPattern, unsigned long cbUnit )
+{
+    unsigned long i;
+
+    pSearch->pch    = pchPattern;
+    pSearch->cb     = cbPattern;
+    pSearch->cbUnit = cbUnit;
+    pSearch->ulKey  = ( cbPattern - 1 ) - (( cbPattern - 1 ) % cbUnit );
+    for ( i = 0; i < 256; i++ )
+        pSearch->aulShift[ i ] = pSearch->ulKey + cbUnit;
+    for ( i = 0; i < pSearch->ulKey; i += cbUnit )
+        pSearch->aulShift[ pchPattern[ i ]] = pSearch->ulKey - i;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * SearchBlock()                                                             *
+ *                                                                           *
+ * Finds the first occurrence of a prepared pattern within a contiguous      *
+ * block of memory, considering only offsets ulFirst, ulFirst + cbUnit, and  *
+ * so on.  Returns its offset within the block, or TEXT_INVALID_POSITION.    *
+ *                                                                           *
+ * Short patterns give a skip table little to work with, so for those we     *
+ * scan for the pattern's first byte with memchr() instead; the C library's  *
+ * memchr() is generally vectorized, using whatever the CPU supports.        *
+ * ------------------------------------------------------------------------- */
+unsigned long SearchBlock( PSEARCHPATTERN pSearch, const unsigned char *pchBlock, unsigned long cbBlock, unsigned long ulFirst )
+{
+    const unsigned char *pchFound;
+    unsigned long       ulLast,
+                        ulOffset;
+    unsigned char       chKey;
+
+    if (( cbBlock < pSearch->cb ) || ( ulFirst > cbBlock - pSearch->cb ))
+        return TEXT_INVALID_POSITION;
+    ulLast = cbBlock - pSearch->cb;     // last offset at which a match can start
+
+    if ( pSearch->cb < SEARCH_SKIP_MIN ) {
+        ulOffset = ulFirst;
+        while ( ulOffset <= ulLast ) {
+            pchFound = (const unsigned char *) memchr( pchBlock + ulOffset, pSearch->pch[ 0 ],
+                                                       ulLast - ulOffset + 1 );
+            if ( !pchFound ) break;
+            ulOffset = pchFound - pchBlock;
+            if ((( ulOffset - ulFirst ) % pSearch->cbUnit == 0 ) &&
+                !memcmp( pchFound, pSearch->pch, pSearch->cb ))
+                return ulOffset;
+            ulOffset++;
+        }
+        return TEXT_INVALID_POSITION;
+    }
+
+    chKey = pSearch->pch[ pSearch->ulKey ];
+    for ( ulOffset = ulFirst; ulOffset <= ulLast;
+          ulOffset += pSearch->aulShift[ pchBlock[ ulOffset + pSearch->ulKey ]] )
+    {
+        if (( pchBlock[ ulOffset + pSearch->ulKey ] == chKey ) &&
+            !memcmp( pchBlock + ulOffset, pSearch->pch, pSearch->cb ))
+            return ulOffset;
+    }
+    return TEXT_INVALID_POSITION;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * WriteSpans()                                                              *
+ *                                                                           *
+ * TextExport() sink used by TextSaveToFile(); pUser points to the handle of *
+ * the file being written.                                                   *
+ * ------------------------------------------------------------------------- */
+int WriteSpans( void *pUser, PTEXTSPAN pSpans, unsigned long ulSpans )
+{
+    return write_file( *((unsigned long *) pUser ), pSpans, ulSpans );
+}
+
+
+
+// ===========================================================================
+// PUBLIC FUNCTIONS
+// ===========================================================================
+
+
+/* ------------------------------------------------------------------------- *
+ * TextAllocMemory()                                                         *
+ *                                                                           *
+ * Allocates working storage from an allocator.                              *
+ * ------------------------------------------------------------------------- */
+void *TextAllocMemory( PTEXTALLOCATOR pAlloc, unsigned long cb )
+{
+    return allocate_memory( pAlloc, cb );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * TextApplyEdits()                                                          *
+ *                                                                           *
+ * Applies a batch of non-overlapping edits in one operation.  The edits are *
+ * sorted and checked here, and their shifts calculated; the model then      *
+ * applies them all at once if it can.  Otherwise they are applied singly,   *
+ * starting from the end so that the positions of the remaining edits are    *
+ * unaffected.                                                               *
+ * ------------------------------------------------------------------------- */
+int TextApplyEdits( EDITORTEXT text, PTEXTEDIT pEdits, unsigned long ulCount )
+{
+    PTEXTHDR      pHdr;
+    unsigned long cbText,
+                  cbNewText,
+                  i;
+    long          lShift;
+
+    if ( !text || ( ulCount && !pEdits )) return 0;
+    if ( ((PTEXTHDR) text)->fSnapshot ) return 0;
+    if ( !ulCount ) return 1;
+    if ( ! SortEdits( pEdits, ulCount, ((PTEXTHDR) text)->pAllocator )) return 0;
+    pHdr = (PTEXTHDR) text;
+
+    cbText = TextLength( text );
+    lShift = 0;
+    for ( i = 0; i < ulCount; i++ ) {
+        if (( pEdits[ i ].ulPosition > cbText ) ||
+            ( pEdits[ i ].cbDelete > ( cbText - pEdits[ i ].ulPosition )))
+            return 0;
+        if ( i && (( pEdits[ i-1 ].ulPosition + pEdits[ i-1 ].cbDelete ) > pEdits[ i ].ulPosition ))
+            return 0;
+        if ( !pEdits[ i ].pchInsert ) pEdits[ i ].cbInsert = 0;
+        if ( !IS_ELEMENTS( pHdr, pEdits[ i ].ulPosition ) ||
+             !IS_ELEMENTS( pHdr, pEdits[ i ].cbDelete ) ||
+             !IS_ELEMENTS( pHdr, pEdits[ i ].cbInsert ))
+            return 0;
+        lShift += (long) pEdits[ i ].cbInsert - (long) pEdits[ i ].cbDelete;
+        pEdits[ i ].lShift = lShift;
+    }
+    cbNewText = cbText + lShift;
+
+#ifdef DEBUG_LOG
+fprintf(dbg, "Applying %u edits (text length %u -> %u)\n", ulCount, cbText, cbNewText );
+#endif
+
+    if ( TEXTMODEL( text )->pfnApplyEdits )
+        return TEXTMODEL( text )->pfnApplyEdits( text, pEdits, ulCount, cbNewText );
+
+    for ( i = ulCount; i > 0; i-- ) {
+        if ( pEdits[ i-1 ].cbDelete &&
+             ! TEXTMODEL( text )->pfnDelete( text, pEdits[ i-1 ].ulPosition, pEdits[ i-1 ].cbDelete ))
+            return 0;
+        if ( pEdits[ i-1 ].cbInsert &&
+             ! TEXTMODEL( text )->pfnInsert( text, pEdits[ i-1 ].pchInsert,
+                                             pEdits[ i-1 ].ulPosition, pEdits[ i-1 ].cbInsert ))
+            return 0;
+    }
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * TextByteAt                                                                *
+ *                                                                           *
+ * Returns the byte at the given text position.  If the position is invalid, *
+ * 0 (a null-byte) is returned.                                              *
+ * ------------------------------------------------------------------------- */
+unsigned char TextByteAt( EDITORTEXT text, unsigned long ulPosition )
+{
+    return TEXTMODEL( text )->pfnByteAt( text, ulPosition );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * TextClearContents()                                                       *
+ *                                                                           *
+ * Erases the current text contents (but keeps the buffer allocated).        *
+ * ------------------------------------------------------------------------- */
+int TextClearContents( EDITORTEXT text )
+{
+    int rc;
+
+    if ( ((PTEXTHDR) text)->fSnapshot ) return 0;
+    rc = TEXTMODEL( text )->pfnClear( text );
+    ReleaseMapping( text );
+    return rc;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * TextCreate()                                                              *
+ *                                                                           *
+ * Creates a new text data structure.  The actual buffer is not allocated;   *
+ * use TextInitContents() to allocate the buffer.  The data structure should *
+ * be deallocated with TextFree() when no longer required.                   *
+ * ------------------------------------------------------------------------- */
+int TextCreate( EDITORTEXT *pText )
+{
+    return TextCreateModel( pText, TEXT_MODEL_GAPBUFFER );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * TextCreateModel()                                                         *
+ *                                                                           *
+ * Creates a new text data structure which uses the specified model and the  *
+ * current default allocator.                                                *
+ * ------------------------------------------------------------------------- */
+int TextCreateModel( EDITORTEXT *pText, int iModel )
+{
+    return TextCreateWithAllocator( pText, iModel, pDefaultAllocator );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * TextCreateWithAllocator()                                                 *
+ *                                                                           *
+ * Creates a new text data structure which uses the specified model, in      *
+ * memory from the given allocator.  The model gets the rest of its memory   *
+ * from the same one, through hdr.pAllocator.                                *
+ * ------------------------------------------------------------------------- */
+int TextCreateWithAllocator( EDITORTEXT *pText, int iModel, PTEXTALLOCATOR pAlloc )
+{
+    const TEXTMODEL *pModel;
+    PTEXTHDR        pHdr;
+
+    if ( pAlloc && ( !pAlloc->pfnAlloc || !pAlloc->pfnFree )) return 0;
+
+    switch ( iModel ) {
+        case TEXT_MODEL_GAPBUFFER:  pModel = &GapBufferModel;  break;
+        case TEXT_MODEL_PIECETABLE: pModel = &PieceTableModel; break;
+        case TEXT_MODEL_ROPE:       pModel = &RopeModel;       break;
+        case TEXT_MODEL_PAGED:      pModel = &PagedModel;      break;
+        case TEXT_MODEL_UTF8:       pModel = &Utf8Model;       break;
+        case TEXT_MODEL_BLOCK:      pModel = &BlockModel;      break;
+        default:                    return 0;
+    }
+
+    pHdr = (PTEXTHDR) allocate_memory( pAlloc, pModel->cbText );
+    if ( !pHdr ) return 0;
+    pHdr->pModel        = pModel;
+    pHdr->iModel        = iModel;
+    pHdr->usGrowPercent = GROWTH_DEFAULT_PERCENT;
+    pHdr->cbGrowLimit   = GROWTH_DEFAULT_LIMIT;
+    pHdr->pMapped       = NULL;
+    pHdr->cbMapped      = 0;
+    pHdr->cbCacheLimit  = PAGE_DEFAULT_LIMIT;
+    pHdr->fSnapshot     = 0;
+    pHdr->cbElement     = ( iModel == TEXT_MODEL_UTF8 ) ? 2 : 1;
+    pHdr->pAllocator    = pAlloc;
+    *pText = pHdr;
+    return 1;
 }
 
-#endif
 
+/* ------------------------------------------------------------------------- *
+ * TextDelete                                                                *
+ *                                                                           *
+ * Deletes one or more bytes from the sequence, starting at the specified    *
+ * position.                                                                 *
+ * ------------------------------------------------------------------------- */
+int TextDelete( EDITORTEXT text, unsigned long ulPosition, unsigned long ulLength )
+{
+    if ( ((PTEXTHDR) text)->fSnapshot ) return 0;
+    if ( !IS_ELEMENTS( (PTEXTHDR) text, ulPosition ) ||
+         !IS_ELEMENTS( (PTEXTHDR) text, ulLength ))
+        return 0;
+    return TEXTMODEL( text )->pfnDelete( text, ulPosition, ulLength );
+}
 
-// ---------------------------------------------------------------------------
-// CONSTANTS
-//
-#define INITIAL_BUF_SIZE 8192   // default initial buffer size (including gap)
 
-#define BUF_INC_DEFAULT  8192   // default buffer size increment
-#define BUF_INC_MEDIUM  16384   // increment for when buffer > BUF_MAX_SMALL
-#define BUF_INC_LARGE   32768   // incremement for when buffer > BUF_MAX_MEDIUM
+/* ------------------------------------------------------------------------- *
+ * TextDestroyContents()                                                     *
+ *                                                                           *
+ * Destroys the text buffer and zeroes the rest of the data structure.       *
+ * ------------------------------------------------------------------------- */
+int TextDestroyContents( EDITORTEXT text )
+{
+    int rc;
 
-#define BUF_MAX_SMALL   0xFFFF  // cutoff of a 'small' sized buffer
-#define BUF_MAX_MEDIUM  0x3FFFF // cutoff of a 'medium' sized buffer
+    rc = TEXTMODEL( text )->pfnDestroy( text );
+    ReleaseMapping( text );
+    return rc;
+}
 
 
-// ---------------------------------------------------------------------------
-// TYPEDEFS
-//
+/* ------------------------------------------------------------------------- *
+ * TextElementAt()                                                           *
+ *                                                                           *
+ * Since an element never straddles two spans, it can be loaded straight     *
+ * from the span which contains it.                                          *
+ * ------------------------------------------------------------------------- */
+unsigned long TextElementAt( EDITORTEXT text, unsigned long ulIndex )
+{
+    TEXTSPAN      span1,
+                  span2;
+    unsigned long cbElement;
+
+    if ( !text ) return 0;
+    cbElement = ((PTEXTHDR) text)->cbElement;
+    if (( TextGetSpans( text, ulIndex * cbElement, cbElement, &span1, &span2 ) != 1 ) ||
+        ( span1.cb < cbElement ))
+        return 0;
+    switch ( cbElement ) {
+        case 2:  return *((unsigned short *) span1.pch );
+        case 4:  return *((unsigned int *) span1.pch );
+        default: return *( span1.pch );
+    }
+}
 
-// The internal implementation (gap buffer) of the text data structure.
-// (EDITORTEXT is the public type name to be used by external code.)
-//
-typedef struct _text_sequence {
-    unsigned char *pchContents;     // The actual text buffer
-    unsigned long ulSize,           // Total allocated buffer size
-                  ulSp1Len,         // Length of text before the gap (span 1)
-                  ulSp2Len,         // Length of text after the gap (span 2)
-                  ulGapLen;         // Length of the gap
-    /* ------------------------------------------------------------- *
-     * NOTES: Total text length             == ulSp1Len + ulSp2Len   *
-     *        Position of the pre-gap text  == 0                     *
-     *        Position of the gap           == ulSp1Len              *
-     *        Position of the post-gap text == ulSp1Len + ulGapLen   *
-     * ------------------------------------------------------------- */
-} TEXT, *PTEXT, *EDITORTEXT;
 
+/* ------------------------------------------------------------------------- *
+ * TextExport()                                                              *
+ *                                                                           *
+ * Hands the range to the sink one TextGetSpans() call at a time, trimming   *
+ * the last spans to the end of the range.                                   *
+ * ------------------------------------------------------------------------- */
+unsigned long TextExport( EDITORTEXT text, unsigned long ulPosition, unsigned long ulLength, PFNTEXTSINK pfnSink, void *pUser )
+{
+    TEXTSPAN      aSpans[ 2 ];
+    unsigned long cbText,
+                  cbDone,
+                  cbSpans,
+                  ulSpans,
+                  i;
+
+    if ( !text || !pfnSink ) return 0;
+    cbText = TextLength( text );
+    if ( ulPosition >= cbText ) return 0;
+    if ( ulLength > cbText - ulPosition ) ulLength = cbText - ulPosition;
+
+    cbDone = 0;
+    while ( cbDone < ulLength ) {
+        ulSpans = TextGetSpans( text, ulPosition + cbDone, ulLength - cbDone,
+                                aSpans, aSpans + 1 );
+        cbSpans = 0;
+        for ( i = 0; i < ulSpans; i++ ) {
+            if ( aSpans[ i ].cb > ulLength - cbDone - cbSpans )
+                aSpans[ i ].cb = ulLength - cbDone - cbSpans;
+            cbSpans += aSpans[ i ].cb;
+        }
+        if ( !cbSpans ) break;
+        if ( ! pfnSink( pUser, aSpans, ulSpans )) break;
+        cbDone += cbSpans;
+    }
+    return cbDone;
+}
 
 
-// ---------------------------------------------------------------------------
-// MACROS
-//
+/* ------------------------------------------------------------------------- *
+ * TextFree()                                                                *
+ *                                                                           *
+ * Frees the text data structure.  The buffer will be freed if necessary.    *
+ * ------------------------------------------------------------------------- */
+int TextFree( EDITORTEXT *pText )
+{
+    PTEXTALLOCATOR pAlloc;
 
-// Return the absolute buffer position of the requested character position
-#define TEXTPOS2ABS( text, pos ) \
-  (( (pos) < (text).ulSp1Len ) ? (pos) : ((text).ulGapLen + (pos) ))
+    if ( !(*pText) ) return 0;
+    pAlloc = ((PTEXTHDR) *pText)->pAllocator;
+    TextDestroyContents( *pText );
+    free_memory( pAlloc, *pText );
+    return 1;
+}
 
-// Return the length of the text
-#define TEXTLEN( text )     ( (text).ulSp1Len + (text).ulSp2Len )
 
-// Return the buffer position following the last character
-#define TEXTEND( text ) \
-  ( (text).ulSp1Len + (text).ulGapLen + (text).ulSp2Len )
+/* ------------------------------------------------------------------------- *
+ * TextFreeMemory()                                                          *
+ *                                                                           *
+ * Frees working storage obtained from TextAllocMemory().                    *
+ * ------------------------------------------------------------------------- */
+void TextFreeMemory( PTEXTALLOCATOR pAlloc, void *pObj )
+{
+    if ( pObj ) free_memory( pAlloc, pObj );
+}
 
 
-// ---------------------------------------------------------------------------
-// FUNCTION DECLARATIONS
-//
+/* ------------------------------------------------------------------------- *
+ * TextGetSpans()                                                            *
+ *                                                                           *
+ * Returns up to two spans providing direct access to the text at the given  *
+ * position.  The number of spans filled in is returned.                     *
+ * ------------------------------------------------------------------------- */
+int TextGetSpans( EDITORTEXT text, unsigned long ulPosition, unsigned long ulLength, PTEXTSPAN pSpan1, PTEXTSPAN pSpan2 )
+{
+    pSpan1->pch = NULL;
+    pSpan1->cb  = 0;
+    pSpan2->pch = NULL;
+    pSpan2->cb  = 0;
+    if ( !text || !ulLength ) return 0;
+    return TEXTMODEL( text )->pfnGetSpans( text, ulPosition, ulLength, pSpan1, pSpan2 );
+}
 
-// Internal
-int ExpandBuffer( PTEXT pText, unsigned long cbRequested );
-int MoveGap( PTEXT pText, unsigned long ulPosition );
-int ResetGap( PTEXT pText, unsigned long cbRequired );
 
-// Public
-unsigned char TextByteAt( PTEXT pText, unsigned long ulPosition );
-int           TextClearContents( PTEXT pText );
-int           TextCreate( PTEXT *ppText );
-int           TextDelete( PTEXT pText, unsigned long ulPosition, unsigned long ulLength );
-int           TextDestroyContents( PTEXT pText );
-int           TextFree( PTEXT *ppText );
-int           TextInitContents( PTEXT pText, unsigned char *pchText, unsigned long cbText );
-int           TextInsert( PTEXT pText, unsigned char *pch, unsigned long ulPosition, unsigned long ulLength );
-unsigned long TextLength( PTEXT pText );
-unsigned long TextSequence( PTEXT pText, unsigned char *pchText, unsigned long ulPosition, unsigned long ulLength );
-wchar_t       TextWCharAt( PTEXT pText, unsigned long ulPosition );
+/* ------------------------------------------------------------------------- *
+ * TextGetView()                                                             *
+ *                                                                           *
+ * Returns a single pointer to the given range of text, or NULL if the model *
+ * cannot provide one.                                                       *
+ * ------------------------------------------------------------------------- */
+unsigned char *TextGetView( EDITORTEXT text, unsigned long ulPosition, unsigned long ulLength )
+{
+    TEXTSPAN span1,
+             span2;
+    unsigned long cbText;
 
+    if ( !text ) return NULL;
+    cbText = TextLength( text );
+    if ( ulPosition >= cbText ) return NULL;
+    if ( ulLength > ( cbText - ulPosition )) ulLength = cbText - ulPosition;
 
+    if ( TEXTMODEL( text )->pfnGetView )
+        return TEXTMODEL( text )->pfnGetView( text, ulPosition, ulLength );
 
-// ===========================================================================
-// INTERNAL FUNCTIONS
-// ===========================================================================
+    // Otherwise, see if the range happens to be contiguous already
+    if ( !TextGetSpans( text, ulPosition, ulLength, &span1, &span2 )) return NULL;
+    return ( span1.cb >= ulLength ) ? span1.pch : NULL;
+}
 
 
 /* ------------------------------------------------------------------------- *
- * ExpandBuffer()                                                            *
- *                                                                           *
- * Increases the size of the text buffer, to the requested size if one is    *
- * specified, or else by a default increment.  The contents and offsets of   *
- * the buffer are preserved as they were when the function was called.       *
+ * TextInitContents()                                                        *
  *                                                                           *
- * The size of the default increment varies depending on the total buffer    *
- * size.  For buffers up to 64 kB, the increment is 8 kB; if the buffer is   *
- * between 64 and 256 kB, the increment is 16 Kb; for larger buffers, the    *
- * increment will be 32 kB.                                                  *
+ * Initializes the text data structure.  Populates it with the specified     *
+ * text, if any; otherwise allocates an empty buffer.                        *
  * ------------------------------------------------------------------------- */
-int ExpandBuffer( PTEXT pText, unsigned long cbRequested )
+int TextInitContents( EDITORTEXT text, unsigned char *pchText, unsigned long cbText )
 {
-    unsigned long ulCurrentSize,
-                  ulDefInc,
-                  ulNewSize;
-    unsigned char *pchNew;
-
+    int rc;
 
-    ulCurrentSize = pText->ulSize;
-    if ( cbRequested && ( cbRequested <= ulCurrentSize ))
-        return 1;
+    if ( ((PTEXTHDR) text)->fSnapshot ) return 0;
+    if ( !IS_ELEMENTS( (PTEXTHDR) text, cbText )) return 0;
+    rc = TEXTMODEL( text )->pfnInit( text, pchText, cbText );
+    ReleaseMapping( text );
+    return rc;
+}
 
-    if (( ! pText->pchContents ) || ( ! ulCurrentSize ))
-        if ( ! TextInitContents( pText, NULL, 0 )) return 0;
 
-    if ( ulCurrentSize <= BUF_MAX_SMALL )       ulDefInc = BUF_INC_DEFAULT;
-    else if ( ulCurrentSize <= BUF_MAX_MEDIUM ) ulDefInc = BUF_INC_MEDIUM;
-    else                                        ulDefInc = BUF_INC_LARGE;
+/* ------------------------------------------------------------------------- *
+ * TextInitFromFile()                                                        *
+ *                                                                           *
+ * Initializes the text data structure with the contents of a file.  The     *
+ * file is mapped into memory; if the model can use the mapping in place we  *
+ * keep it until the text is next cleared, destroyed or re-initialized.      *
+ * Otherwise the model takes a copy and the mapping is released at once.     *
+ * Models which read the file themselves are simply given its name.          *
+ * ------------------------------------------------------------------------- */
+int TextInitFromFile( EDITORTEXT text, const char *pszFile )
+{
+    PTEXTHDR      pHdr = (PTEXTHDR) text;
+    void          *pView;
+    unsigned long cbView;
+    int           rc;
+
+    if ( !text || !pszFile ) return 0;
+    if ( pHdr->fSnapshot ) return 0;
+
+    if ( TEXTMODEL( text )->pfnInitFile ) {
+        rc = TEXTMODEL( text )->pfnInitFile( text, pszFile );
+        ReleaseMapping( text );
+        if ( rc && !IS_ELEMENTS( pHdr, TextLength( text ))) {
+            TextDestroyContents( text );
+            rc = 0;
+        }
+        return rc;
+    }
 
-    ulNewSize = cbRequested ? ( cbRequested + ulDefInc ): ( ulCurrentSize + ulDefInc );
+    if ( ! map_file( pszFile, &pView, &cbView )) return 0;
+    if ( !IS_ELEMENTS( pHdr, cbView )) {
+        unmap_file( pView, cbView );
+        return 0;
+    }
 
 #ifdef DEBUG_LOG
-fprintf(dbg, "Increasing buffer to %u bytes (%u requested)\n", ulNewSize, cbRequested );
+fprintf(dbg, "Mapped file %s (%u bytes)\n", pszFile, cbView );
 #endif
 
-    pchNew = allocate_memory( ulNewSize );
-    if ( pchNew == NULL ) return 0;
-
-    memcpy( pchNew, pText->pchContents, pText->ulSize );
-    free_memory( pText->pchContents );
-    pText->pchContents = pchNew;
-    pText->ulSize = ulNewSize;
-//    pText->pchContents = (unsigned char *) realloc( pText->pchContents, ulNewSize );
-//    if ( pText->pchContents == NULL ) return 0;
-
-    return 1;
+    if ( TEXTMODEL( text )->pfnInitShared && pView ) {
+        rc = TEXTMODEL( text )->pfnInitShared( text, (unsigned char *) pView, cbView );
+        ReleaseMapping( text );         // the previous file, if any
+        if ( rc ) {
+            pHdr->pMapped  = pView;
+            pHdr->cbMapped = cbView;
+        }
+        else unmap_file( pView, cbView );
+    }
+    else {
+        rc = TextInitContents( text, (unsigned char *) pView, cbView );
+        unmap_file( pView, cbView );
+    }
+    return rc;
 }
 
 
 /* ------------------------------------------------------------------------- *
- * MoveGap()                                                                 *
+ * TextInsert                                                                *
  *                                                                           *
- * Moves the current position of the gap within the text buffer.             *
+ * Inserts one or more bytes into the sequence at the specified position.    *
  * ------------------------------------------------------------------------- */
-int MoveGap( PTEXT pText, unsigned long ulPosition )
+int TextInsert( EDITORTEXT text, unsigned char *pch, unsigned long ulPosition, unsigned long ulLength )
 {
-    unsigned long ulGapStart,   // New starting position of the gap
-                  ulShift,      // Number of bytes to shift
-                  ulOldSp1Len,  // Old length of the pre-gap text
-                  ulSource,     // Starting source index of bytes to move
-                  ulTarget;     // Starting destination index of bytes to move
-    long i;
+    if ( !text || ((PTEXTHDR) text)->fSnapshot ) return 0;
+    if ( !IS_ELEMENTS( (PTEXTHDR) text, ulPosition ) ||
+         !IS_ELEMENTS( (PTEXTHDR) text, ulLength ))
+        return 0;
+    return TEXTMODEL( text )->pfnInsert( text, pch, ulPosition, ulLength );
+}
 
-    if ( ulPosition > pText->ulSize ) return 0;
 
-    ulGapStart  = ulPosition;
-    ulOldSp1Len = pText->ulSp1Len;
+/* ------------------------------------------------------------------------- *
+ * TextIterInit()                                                            *
+ *                                                                           *
+ * Sets up an iterator at the given position.  No span is fetched until the  *
+ * first character is read, since only then do we know in which direction    *
+ * the iterator is going.                                                    *
+ * ------------------------------------------------------------------------- */
+int TextIterInit( PTEXTITER pIter, EDITORTEXT text, unsigned long ulPosition )
+{
+    if ( !pIter || !text ) return 0;
+    pIter->text     = text;
+    pIter->pch      = NULL;
+    pIter->cbSpan   = 0;
+    pIter->cbText   = TextLength( text );
+    return TextIterSeek( pIter, ulPosition );
+}
 
-//printf("Moving gap to %u\n", ulPosition );
 
-    // shift gap to the right
-    if ( ulGapStart > ulOldSp1Len ) {
-        ulShift  = ulGapStart - ulOldSp1Len;
-        ulSource = ulOldSp1Len + pText->ulGapLen;   // (old) start of post-gap text
-        ulTarget = ulOldSp1Len;                     // (old) start of gap
-        for ( i = 0; i < ulShift; i++ ) {
-            pText->pchContents[ ulTarget+i ] = pText->pchContents[ ulSource+i ];
-            pText->pchContents[ ulSource+i ] = 0;
-        }
-        pText->ulSp1Len = ulGapStart;
-        pText->ulSp2Len -= ulShift;
-    }
-    // shift gap to the left
-    else if ( ulGapStart < ulOldSp1Len ) {
-        ulShift  = ulOldSp1Len - ulGapStart;
-        ulSource = ulGapStart;                      // (new) start of gap
-        ulTarget = ulGapStart + pText->ulGapLen;    // (new) start of post-gap text
-        for ( i = ulShift-1; i >= 0; i-- ) {
-            pText->pchContents[ ulTarget+i ] = pText->pchContents[ ulSource+i ];
-            pText->pchContents[ ulSource+i ] = 0;
+/* ------------------------------------------------------------------------- *
+ * TextIterNext()                                                            *
+ *                                                                           *
+ * Reads a character forwards.  Normally it is simply taken from the current *
+ * span; a new span is only fetched when the current one runs out.  A        *
+ * character which straddles two spans is copied out instead.                *
+ * ------------------------------------------------------------------------- */
+int TextIterNext( PTEXTITER pIter, wchar_t *pwc )
+{
+    unsigned long ulPosition;
+
+    if (( pIter->ulOffset + sizeof( wchar_t )) > pIter->cbSpan ) {
+        ulPosition = pIter->ulSpan + pIter->ulOffset;
+        if (( ulPosition + sizeof( wchar_t )) > pIter->cbText ) return 0;
+        if ( ! IterFetch( pIter, ulPosition, 0 )) {
+            if ( TextSequence( pIter->text, (unsigned char *) pwc, ulPosition,
+                               sizeof( wchar_t )) != sizeof( wchar_t ))
+                return 0;
+            IterFetch( pIter, ulPosition + sizeof( wchar_t ), 0 );
+            return 1;
         }
-        pText->ulSp1Len = ulGapStart;
-        pText->ulSp2Len += ulShift;
     }
-
+    memcpy( pwc, pIter->pch + pIter->ulOffset, sizeof( wchar_t ));
+    pIter->ulOffset += sizeof( wchar_t );
     return 1;
 }
 
 
 /* ------------------------------------------------------------------------- *
- * ResetGap()                                                                *
+ * TextIterPosition()                                                        *
  *                                                                           *
- * Resets the gap by shifting the post-gap text back until the gap is either *
- * 50% of the total buffer, or the minimum required size plus a standard     *
- * increment.  To be called whenever the gap is about to fill up.  If there  *
- * is insufficient space in the buffer to shift the subsequent text in this  *
- * way, the buffer itself is expanded (and the gap size retargeted to 50% of *
- * the new buffer size).                                                     *
+ * Returns the iterator's current byte position in the text.                 *
  * ------------------------------------------------------------------------- */
-int ResetGap( PTEXT pText, unsigned long cbRequired )
+unsigned long TextIterPosition( PTEXTITER pIter )
 {
-    unsigned long cbNewGap,     // New gap length
-                  ulSource,     // Starting source index of bytes to move
-                  ulTarget;     // Starting destination index of bytes to move
-    long i;
+    return pIter->ulSpan + pIter->ulOffset;
+}
 
-    cbNewGap = pText->ulSize / 2;
-    while ( cbNewGap < ( cbRequired + BUF_INC_DEFAULT )) cbNewGap *= 2;
-    if ( pText->ulGapLen >= cbNewGap ) return 1;    // nothing to do
 
-    if (( cbNewGap + TEXTLEN( *pText )) > pText->ulSize ) {
-        if ( ! ExpandBuffer( pText, 0 )) return 0;
-        cbNewGap = pText->ulSize / 2;
+/* ------------------------------------------------------------------------- *
+ * TextIterPrev()                                                            *
+ *                                                                           *
+ * Reads a character backwards; the mirror image of TextIterNext().          *
+ * ------------------------------------------------------------------------- */
+int TextIterPrev( PTEXTITER pIter, wchar_t *pwc )
+{
+    unsigned long ulPosition;
+
+    if ( pIter->ulOffset < sizeof( wchar_t )) {
+        ulPosition = pIter->ulSpan + pIter->ulOffset;
+        if ( ulPosition < sizeof( wchar_t )) return 0;
+        if ( ! IterFetch( pIter, ulPosition, 1 )) {
+            if ( TextSequence( pIter->text, (unsigned char *) pwc, ulPosition - sizeof( wchar_t ),
+                               sizeof( wchar_t )) != sizeof( wchar_t ))
+                return 0;
+            IterFetch( pIter, ulPosition - sizeof( wchar_t ), 1 );
+            return 1;
+        }
     }
+    pIter->ulOffset -= sizeof( wchar_t );
+    memcpy( pwc, pIter->pch + pIter->ulOffset, sizeof( wchar_t ));
+    return 1;
+}
 
-#ifdef DEBUG_LOG
-fprintf(dbg, "Expanding gap to %u bytes (%u requested)\n", cbNewGap, cbRequired );
-#endif
 
-    ulSource = pText->ulSp1Len + pText->ulGapLen;   // old start of post-gap text
-    ulTarget = pText->ulSp1Len + cbNewGap;          // new start of post-gap text
-    for ( i = pText->ulSp2Len-1; i >= 0; i-- ) {
-        pText->pchContents[ ulTarget+i ] = pText->pchContents[ ulSource+i ];
-        pText->pchContents[ ulSource+i ] = 0;
+/* ------------------------------------------------------------------------- *
+ * TextIterSeek()                                                            *
+ *                                                                           *
+ * Moves the iterator.  The current span is kept if it contains the new      *
+ * position (including its very end); otherwise it is dropped, and a new     *
+ * one is fetched when the next character is read.                           *
+ * ------------------------------------------------------------------------- */
+int TextIterSeek( PTEXTITER pIter, unsigned long ulPosition )
+{
+    if ( ulPosition > pIter->cbText ) return 0;
+    if ( pIter->pch && ( ulPosition >= pIter->ulSpan ) &&
+         (( ulPosition - pIter->ulSpan ) <= pIter->cbSpan ))
+    {
+        pIter->ulOffset = ulPosition - pIter->ulSpan;
+    }
+    else {
+        pIter->pch      = NULL;
+        pIter->ulSpan   = ulPosition;
+        pIter->cbSpan   = 0;
+        pIter->ulOffset = 0;
     }
-
-    pText->ulGapLen = cbNewGap;
     return 1;
 }
 
 
-// ===========================================================================
-// PUBLIC FUNCTIONS
-// ===========================================================================
+/* ------------------------------------------------------------------------- *
+ * TextIterSpan()                                                            *
+ *                                                                           *
+ * Returns the rest of the current span, fetching the next one first if the  *
+ * iterator has reached its end.                                             *
+ * ------------------------------------------------------------------------- */
+unsigned long TextIterSpan( PTEXTITER pIter, unsigned char **ppch )
+{
+    if ( pIter->ulOffset >= pIter->cbSpan ) {
+        IterFetch( pIter, pIter->ulSpan + pIter->ulOffset, 0 );
+        if ( !pIter->cbSpan ) return 0;
+    }
+    *ppch = pIter->pch + pIter->ulOffset;
+    return pIter->cbSpan - pIter->ulOffset;
+}
 
 
 /* ------------------------------------------------------------------------- *
- * TextByteAt                                                                *
+ * TextLength()                                                              *
  *                                                                           *
- * Returns the byte at the given text position.  If the position is invalid, *
- * 0 (a null-byte) is returned.                                              *
+ * Returns the length of the text within the buffer.                         *
  * ------------------------------------------------------------------------- */
-unsigned char TextByteAt( PTEXT pText, unsigned long ulPosition )
+unsigned long TextLength( EDITORTEXT text )
 {
-    if ( ulPosition >= TEXTLEN( *pText )) return 0;
-    return ( pText->pchContents[ TEXTPOS2ABS(*pText, ulPosition) ] );
+    if ( !text ) return 0;
+    return TEXTMODEL( text )->pfnLength( text );
 }
 
 
 /* ------------------------------------------------------------------------- *
- * TextClearContents()                                                       *
+ * TextLineCount()                                                           *
  *                                                                           *
- * Erases the current text contents (but keeps the buffer allocated).        *
+ * Returns the number of lines in the text (one plus the number of breaks).  *
  * ------------------------------------------------------------------------- */
-int TextClearContents( PTEXT pText )
+unsigned long TextLineCount( EDITORTEXT text )
 {
-    memset( pText->pchContents, 0, pText->ulSize );
-    pText->ulSp1Len = 0;
-    pText->ulSp2Len = 0;
-    return 1;
+    if ( !text ) return 0;
+    return TextLineFromOffset( text, TextLength( text )) + 1;
 }
 
 
 /* ------------------------------------------------------------------------- *
- * TextCreate()                                                              *
+ * TextLineFromOffset()                                                      *
  *                                                                           *
- * Creates a new text data structure.  The actual buffer is not allocated;   *
- * use TextInitContents() to allocate the buffer.  The data structure should *
- * be deallocated with TextFree() when no longer required.                   *
+ * Returns the (0-based) number of the line containing the given position.   *
  * ------------------------------------------------------------------------- */
-int TextCreate( PTEXT *ppText )
+unsigned long TextLineFromOffset( EDITORTEXT text, unsigned long ulPosition )
 {
-    PTEXT pText;
-    pText = (PTEXT) allocate_memory( sizeof( TEXT ));
-    if ( !pText ) return 0;
-    *ppText = pText;
-    return 1;
+    if ( !text ) return 0;
+    if ( TEXTMODEL( text )->pfnLineFromOffset )
+        return TEXTMODEL( text )->pfnLineFromOffset( text, ulPosition );
+    return ScanLineBreaks( text, 0, ulPosition, TEXT_INVALID_POSITION, NULL );
 }
 
 
 /* ------------------------------------------------------------------------- *
- * TextDelete                                                                *
+ * TextLineOffset()                                                          *
  *                                                                           *
- * Deletes one or more bytes from the sequence, starting at the specified    *
- * position.                                                                 *
+ * Returns the position at which the given (0-based) line starts, or         *
+ * TEXT_INVALID_POSITION if there is no such line.                           *
  * ------------------------------------------------------------------------- */
-int TextDelete( PTEXT pText, unsigned long ulPosition, unsigned long ulLength )
+unsigned long TextLineOffset( EDITORTEXT text, unsigned long ulLine )
 {
-    int i;
-
-    // Ensure that the deleted bytes are always immediately following the gap
-    if ( ulPosition != pText->ulSp1Len )
-        if ( ! MoveGap( pText, ulPosition )) return 0;
+    unsigned long ulEnd;
+
+    if ( !text ) return TEXT_INVALID_POSITION;
+    if ( !ulLine ) return 0;
+    if ( TEXTMODEL( text )->pfnLineOffset )
+        return TEXTMODEL( text )->pfnLineOffset( text, ulLine );
+    if ( ScanLineBreaks( text, 0, TEXT_INVALID_POSITION, ulLine, &ulEnd ) < ulLine )
+        return TEXT_INVALID_POSITION;
+    return ulEnd;
+}
 
-    // Now zeroize the bytes
-    for ( i = 0; i < ulLength; i++ )
-        pText->pchContents[ TEXTPOS2ABS(*pText, ulPosition+i) ] = 0;
-    pText->ulGapLen += ulLength;
-    pText->ulSp2Len -= ulLength;
 
-    return 1;
+/* ------------------------------------------------------------------------- *
+ * TextNextLineBreak()                                                       *
+ *                                                                           *
+ * Returns the position just after the first line break which ends after     *
+ * the given position, or TEXT_INVALID_POSITION if there is none.  Models    *
+ * with a line index look this up directly; for the others we only have to   *
+ * scan forward to the end of the current line.                              *
+ * ------------------------------------------------------------------------- */
+unsigned long TextNextLineBreak( EDITORTEXT text, unsigned long ulPosition )
+{
+    unsigned long ulEnd;
+
+    if ( !text ) return TEXT_INVALID_POSITION;
+    if ( TEXTMODEL( text )->pfnLineOffset && TEXTMODEL( text )->pfnLineFromOffset )
+        return TextLineOffset( text, TextLineFromOffset( text, ulPosition ) + 1 );
+    if ( !ScanLineBreaks( text, ulPosition, TEXT_INVALID_POSITION, 1, &ulEnd ))
+        return TEXT_INVALID_POSITION;
+    return ulEnd;
 }
 
 
 /* ------------------------------------------------------------------------- *
- * TextDestroyContents()                                                     *
+ * TextQueryDefaultAllocator()                                               *
  *                                                                           *
- * Destroys the text buffer and zeroes the rest of the data structure.       *
+ * Returns the allocator used by text objects created from now on.           *
  * ------------------------------------------------------------------------- */
-int TextDestroyContents( PTEXT pText )
+PTEXTALLOCATOR TextQueryDefaultAllocator( void )
 {
-    if ( pText->pchContents != NULL ) free_memory( pText->pchContents );
-    pText->pchContents = NULL;
-    pText->ulSize      = 0;
-    pText->ulSp1Len    = 0;
-    pText->ulSp2Len    = 0;
-    pText->ulGapLen    = 0;
-    return 1;
+    return pDefaultAllocator;
 }
 
 
 /* ------------------------------------------------------------------------- *
- * TextFree()                                                                *
+ * TextQueryModel()                                                          *
  *                                                                           *
- * Frees the text data structure.  The buffer will be freed if necessary.    *
+ * Returns the model (TEXT_MODEL_* constant) used by the text object.        *
  * ------------------------------------------------------------------------- */
-int TextFree( PTEXT *ppText )
+int TextQueryModel( EDITORTEXT text )
 {
-    if ( !(*ppText) ) return 0;
-    TextDestroyContents( *ppText );
-    free_memory( *ppText );
-    return 1;
+    return ((PTEXTHDR) text)->iModel;
 }
 
 
 /* ------------------------------------------------------------------------- *
- * TextInitContents()                                                        *
+ * TextQueryStats()                                                          *
  *                                                                           *
- * Initializes the text data structure.  Populates it with the specified     *
- * text, if any; otherwise allocates an empty buffer.                        *
+ * Returns statistics about the text object.  Anything the model does not    *
+ * keep track of is returned as 0.                                           *
  * ------------------------------------------------------------------------- */
-int TextInitContents( PTEXT pText, unsigned char *pchText, unsigned long cbText )
+int TextQueryStats( EDITORTEXT text, PTEXTSTATS pStats )
 {
-    if ( pText->pchContents ) TextDestroyContents( pText );
+    if ( !text || !pStats ) return 0;
+    memset( pStats, 0, sizeof( TEXTSTATS ));
+    if ( !TEXTMODEL( text )->pfnQueryStats ) return 1;
+    return TEXTMODEL( text )->pfnQueryStats( text, pStats );
+}
 
-    if ( cbText && pchText ) {
-        unsigned long ulInitial = INITIAL_BUF_SIZE;
-        while ( ulInitial < ( cbText + BUF_INC_DEFAULT )) ulInitial *= 2;
-        pText->pchContents = (unsigned char *) allocate_memory( ulInitial );
-        if ( pText->pchContents == NULL ) return 0;
-        memcpy( pText->pchContents, pchText, cbText );
-        pText->ulSize   = ulInitial;
-        pText->ulSp1Len = cbText;
-        pText->ulSp2Len = 0;
-        pText->ulGapLen = BUF_INC_DEFAULT;
-    }
-    else {
-        pText->pchContents = (unsigned char *) allocate_memory( INITIAL_BUF_SIZE );
-        if ( pText->pchContents == NULL ) return 0;
-        pText->ulSize   = INITIAL_BUF_SIZE;
-        pText->ulSp1Len = 0;
-        pText->ulSp2Len = 0;
-        pText->ulGapLen = INITIAL_BUF_SIZE / 2;
-    }
 
+/* ------------------------------------------------------------------------- *
+ * TextReleaseSnapshot()                                                     *
+ *                                                                           *
+ * Frees a snapshot.  The model releases its share of the storage; whatever  *
+ * the original text no longer uses is freed along with it.                  *
+ * ------------------------------------------------------------------------- */
+int TextReleaseSnapshot( EDITORTEXT *pSnapshot )
+{
+    if ( !pSnapshot || !(*pSnapshot) ) return 0;
+    if ( !((PTEXTHDR) *pSnapshot)->fSnapshot ) return 0;
+    TEXTMODEL( *pSnapshot )->pfnDestroy( *pSnapshot );
+    free_memory( ((PTEXTHDR) *pSnapshot)->pAllocator, *pSnapshot );
+    *pSnapshot = NULL;
     return 1;
 }
 
 
 /* ------------------------------------------------------------------------- *
- * TextInsert                                                                *
+ * TextReplaceAll()                                                          *
  *                                                                           *
- * Inserts one or more bytes into the sequence at the specified position.    *
+ * All of the occurrences are found first, so that the size of the new text  *
+ * is known.  The new text is then built from start to finish: each run of   *
+ * unchanged text is copied across a chunk at a time, so that it is still    *
+ * in the cache when it is scanned for line breaks, followed by the          *
+ * replacement.  The old contents are only discarded once the new text is    *
+ * complete, so a failure along the way leaves the text intact.              *
  * ------------------------------------------------------------------------- */
-int TextInsert( PTEXT pText, unsigned char *pch, unsigned long ulPosition, unsigned long ulLength )
+unsigned long TextReplaceAll( EDITORTEXT text, const unsigned char *pchPattern, unsigned long cbPattern, const unsigned char *pchReplace, unsigned long cbReplace, unsigned long cbUnit, PFNTEXTBREAKS pfnBreaks, void *pUser )
 {
-    // Make sure the buffer exists
-    if ( !pText || !pText->pchContents || !pText->ulSize )
-        return 0;
+    PTEXTALLOCATOR pAlloc;
+    BREAKBATCH     batch;
+    unsigned char  *pchNew;
+    unsigned long  *pulFound,    // Positions of the occurrences
+                   *pulMore,
+                   ulFound,      // Number of occurrences
+                   ulMax,        // Room in pulFound
+                   ulPos,
+                   cbText,
+                   cbNewText,
+                   cbBuffer,     // Size of the new buffer
+                   ulOld,        // Current position in the old text
+                   ulNew,        // Current position in the new text
+                   ulEnd,        // End of the current unchanged run
+                   cbCopy,
+                   i;
+    int            fOK;
+
+    if ( !text || !pchPattern || !cbPattern || ( cbReplace && !pchReplace ))
+        return TEXT_INVALID_POSITION;
+    if ( ((PTEXTHDR) text)->fSnapshot ) return TEXT_INVALID_POSITION;
+    if ( !cbUnit ) cbUnit = ((PTEXTHDR) text)->cbElement;
+    pAlloc = ((PTEXTHDR) text)->pAllocator;
+
+    // Every occurrence replaced must be a whole number of elements
+    if ( !IS_ELEMENTS( (PTEXTHDR) text, cbUnit ) ||
+         !IS_ELEMENTS( (PTEXTHDR) text, cbPattern ) ||
+         !IS_ELEMENTS( (PTEXTHDR) text, cbReplace ))
+        return TEXT_INVALID_POSITION;
+
+    pulFound = NULL;
+    ulFound  = 0;
+    ulMax    = 0;
+    ulPos    = TextSearch( text, pchPattern, cbPattern, 0, cbUnit );
+    while ( ulPos != TEXT_INVALID_POSITION ) {
+        if ( ulFound == ulMax ) {
+            ulMax   = ulMax ? ulMax * 2 : 1024;
+            pulMore = (unsigned long *) reallocate_memory( pAlloc, pulFound,
+                                                           ulFound * sizeof( unsigned long ),
+                                                           ulMax * sizeof( unsigned long ));
+            if ( !pulMore ) {
+                if ( pulFound ) free_memory( pAlloc, pulFound );
+                return TEXT_INVALID_POSITION;
+            }
+            pulFound = pulMore;
+        }
+        pulFound[ ulFound++ ] = ulPos;
+        ulPos = TextSearch( text, pchPattern, cbPattern, ulPos + cbPattern, cbUnit );
+    }
+    if ( !ulFound ) return 0;
 
-    // Don't allow adding items more than one position past the end of the array
-    if ( ulPosition > TEXTLEN( *pText )) return 0;
+    cbText = TextLength( text );
+    if ( cbReplace < cbPattern )
+        cbNewText = cbText - ulFound * ( cbPattern - cbReplace );
+    else if (( cbReplace - cbPattern ) <= ( TEXT_INVALID_POSITION - 1 - cbText ) / ulFound )
+        cbNewText = cbText + ulFound * ( cbReplace - cbPattern );
+    else {
+        free_memory( pAlloc, pulFound );
+        return TEXT_INVALID_POSITION;
+    }
 
-/*
 #ifdef DEBUG_LOG
-fprintf(dbg, "Inserting %u bytes at position %u\n", ulLength, ulPosition );
-fprintf(dbg, " Buffer size:   %u\n", pText->ulSize );
-fprintf(dbg, " Span 1 length: %u\n", pText->ulSp1Len );
-fprintf(dbg, " Gap length:    %u\n", pText->ulGapLen );
-fprintf(dbg, " Span 2 length: %u\n", pText->ulSp2Len );
-fprintf(dbg, " Text size:     %u\n", TEXTLEN( *pText ));
-fprintf(dbg, " First free:    %u\n", TEXTEND( *pText ));
+fprintf(dbg, "Replacing %u occurrences (text length %u -> %u)\n", ulFound, cbText, cbNewText );
 #endif
-*/
 
-    if (( TEXTPOS2ABS( *pText, ulPosition ) == TEXTEND( *pText )) &&
-          (( TEXTEND( *pText ) + ulLength ) < pText->ulSize ) && pText->ulSp2Len )
-    {
-        /* A cheap but useful optimization: if the insert position is just
-         * after the last value, and there's enough space left at the end of
-         * the buffer, then don't bother moving the gap - just append the new
-         * data to the post-gap text.
-         */
-        unsigned long cbAddr = TEXTPOS2ABS( *pText, ulPosition );
-
-        if ( ulLength == 1 )
-            pText->pchContents[ cbAddr ] = *pch;
-        else
-            memcpy( pText->pchContents + cbAddr, pch, ulLength );
-        pText->ulSp2Len += ulLength;
+    // A model which adopts the buffer gets some room to grow in as well
+    if ( TEXTMODEL( text )->pfnAdopt )
+        cbBuffer = next_buffer_size( (PTEXTHDR) text, cbNewText, cbNewText );
+    else
+        cbBuffer = cbNewText ? cbNewText : 1;
+    pchNew = (unsigned char *) allocate_memory( pAlloc, cbBuffer );
+    if ( !pchNew ) {
+        free_memory( pAlloc, pulFound );
+        return TEXT_INVALID_POSITION;
     }
 
-    else {
-        // TODO Optimize somehow by combining MoveGap and ResetGap when appropriate
-        if ( ulPosition != pText->ulSp1Len )
-            if ( ! MoveGap( pText, ulPosition )) return 0;
-        if ( pText->ulGapLen <= ulLength )
-            if ( ! ResetGap( pText, ulLength )) return 0;
-
-        if ( ulLength == 1 )
-            pText->pchContents[ ulPosition ] = *pch;
+    batch.pfnBreaks = pfnBreaks;
+    batch.pUser     = pUser;
+    batch.ulScanned = 0;
+    batch.ulBreaks  = 0;
+
+    fOK   = 1;
+    ulOld = 0;
+    ulNew = 0;
+    for ( i = 0; fOK && ( i <= ulFound ); i++ ) {
+        ulEnd = ( i < ulFound ) ? pulFound[ i ] : cbText;
+        while ( fOK && ( ulOld < ulEnd )) {
+            cbCopy = ulEnd - ulOld;
+            if ( cbCopy > REPLACE_CHUNK_SIZE ) cbCopy = REPLACE_CHUNK_SIZE;
+            cbCopy = TextSequence( text, pchNew + ulNew, ulOld, cbCopy );
+            if ( !cbCopy ) fOK = 0;
+            ulOld += cbCopy;
+            ulNew += cbCopy;
+            if ( fOK && pfnBreaks ) fOK = ScanNewBreaks( &batch, pchNew, ulNew, 0 );
+        }
+        if ( fOK && ( i < ulFound )) {
+            if ( cbReplace ) memcpy( pchNew + ulNew, pchReplace, cbReplace );
+            ulNew += cbReplace;
+            ulOld += cbPattern;
+        }
+    }
+    if ( fOK && pfnBreaks ) fOK = ScanNewBreaks( &batch, pchNew, ulNew, 1 );
+    free_memory( pAlloc, pulFound );
+
+    if ( fOK ) {
+        if ( TEXTMODEL( text )->pfnAdopt &&
+             TEXTMODEL( text )->pfnAdopt( text, pchNew, cbNewText, cbBuffer ))
+            pchNew = NULL;
         else
-            memcpy( pText->pchContents + ulPosition, pch, ulLength );
-        pText->ulSp1Len += ulLength;
-        pText->ulGapLen -= ulLength;
+            fOK = TEXTMODEL( text )->pfnInit( text, pchNew, cbNewText );
+        ReleaseMapping( text );
     }
+    if ( pchNew ) free_memory( pAlloc, pchNew );
 
-    return 1;
+    return fOK ? ulFound : TEXT_INVALID_POSITION;
 }
 
 
 /* ------------------------------------------------------------------------- *
- * TextLength()                                                              *
+ * TextReserve()                                                             *
  *                                                                           *
- * Returns the length of the text within the buffer.                         *
+ * Pre-sizes the text object's buffers to hold the given number of bytes.    *
+ * ------------------------------------------------------------------------- */
+int TextReserve( EDITORTEXT text, unsigned long cbText )
+{
+    if ( !text || ((PTEXTHDR) text)->fSnapshot ) return 0;
+    if ( !TEXTMODEL( text )->pfnReserve ) return 1;
+    return TEXTMODEL( text )->pfnReserve( text, cbText );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * TextSaveToFile()                                                          *
+ * ------------------------------------------------------------------------- */
+int TextSaveToFile( EDITORTEXT text, const char *pszFile )
+{
+    unsigned long hFile,
+                  cbText;
+    int           fOK;
+
+    if ( !text || !pszFile ) return 0;
+    if ( ! create_file( pszFile, &hFile )) return 0;
+    cbText = TextLength( text );
+    fOK = ( TextExport( text, 0, cbText, WriteSpans, &hFile ) == cbText );
+    close_file( hFile );
+    return fOK;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * TextSearch()                                                              *
+ *                                                                           *
+ * Each span is searched in place.  A match which crosses from one span      *
+ * into the next is found by searching a small 'stitch' buffer, holding the  *
+ * last cbPattern-1 bytes before the span followed by the first cbPattern-1  *
+ * bytes of the span; any match in there must start before the span.  Since  *
+ * all matches are the same length, the first one found is also the first    *
+ * in the text.                                                              *
  * ------------------------------------------------------------------------- */
-unsigned long TextLength( PTEXT pText )
+unsigned long TextSearch( EDITORTEXT text, const unsigned char *pchPattern, unsigned long cbPattern, unsigned long ulPosition, unsigned long cbUnit )
 {
-    if ( !pText ) return 0;
-    return ( TEXTLEN(*pText) );
+    SEARCHPATTERN search;
+    TEXTSPAN      aSpans[ 2 ];
+    unsigned char achStitch[ SEARCH_STITCH_SIZE ],
+                  *pchStitch;
+    unsigned long cbText,
+                  cbCarry,              // bytes before the current span, in pchStitch
+                  cbHead,               // bytes of the current span appended to them
+                  cbSpans,
+                  ulSpans,
+                  ulStart,              // text position of the current span
+                  ulFound,
+                  i;
+
+    if ( !text || !pchPattern || !cbPattern ) return TEXT_INVALID_POSITION;
+    if ( !cbUnit ) cbUnit = ((PTEXTHDR) text)->cbElement;
+    if ( ulPosition % cbUnit ) ulPosition += cbUnit - ( ulPosition % cbUnit );
+    cbText = TextLength( text );
+    if (( ulPosition >= cbText ) || ( cbPattern > cbText - ulPosition ))
+        return TEXT_INVALID_POSITION;
+
+    if ( 2 * ( cbPattern - 1 ) <= SEARCH_STITCH_SIZE )
+        pchStitch = achStitch;
+    else if ( !( pchStitch = (unsigned char *) allocate_small( ((PTEXTHDR) text)->pAllocator,
+                                                               2 * ( cbPattern - 1 ))))
+        return TEXT_INVALID_POSITION;
+
+    PrepareSearch( &search, pchPattern, cbPattern, cbUnit );
+    ulFound = TEXT_INVALID_POSITION;
+    cbCarry = 0;
+    ulStart = ulPosition;
+    while (( ulFound == TEXT_INVALID_POSITION ) && ( ulStart < cbText )) {
+        ulSpans = TextGetSpans( text, ulStart, cbText - ulStart, aSpans, aSpans + 1 );
+        cbSpans = 0;
+        for ( i = 0; ( i < ulSpans ) && ( ulFound == TEXT_INVALID_POSITION ); i++ ) {
+            if ( !aSpans[ i ].cb ) continue;
+
+            // Look for a match starting before this span and ending within it
+            if ( cbCarry ) {
+                cbHead = ( aSpans[ i ].cb < cbPattern - 1 ) ? aSpans[ i ].cb : cbPattern - 1;
+                memcpy( pchStitch + cbCarry, aSpans[ i ].pch, cbHead );
+                ulFound = SearchBlock( &search, pchStitch, cbCarry + cbHead,
+                                       ( cbUnit - (( ulStart - cbCarry ) % cbUnit )) % cbUnit );
+                if ( ulFound != TEXT_INVALID_POSITION ) {
+                    ulFound += ulStart - cbCarry;
+                    break;
+                }
+            }
+
+            // Then look within the span itself
+            ulFound = SearchBlock( &search, aSpans[ i ].pch, aSpans[ i ].cb,
+                                   ( cbUnit - ( ulStart % cbUnit )) % cbUnit );
+            if ( ulFound != TEXT_INVALID_POSITION ) {
+                ulFound += ulStart;
+                break;
+            }
+
+            // Keep the last cbPattern-1 bytes so far for the next stitch
+            if ( aSpans[ i ].cb >= cbPattern - 1 ) {
+                cbCarry = cbPattern - 1;
+                memcpy( pchStitch, aSpans[ i ].pch + aSpans[ i ].cb - cbCarry, cbCarry );
+            }
+            else {
+                memcpy( pchStitch + cbCarry, aSpans[ i ].pch, aSpans[ i ].cb );
+                cbCarry += aSpans[ i ].cb;
+                if ( cbCarry > cbPattern - 1 ) {
+                    memmove( pchStitch, pchStitch + cbCarry - ( cbPattern - 1 ), cbPattern - 1 );
+                    cbCarry = cbPattern - 1;
+                }
+            }
+            ulStart += aSpans[ i ].cb;
+            cbSpans += aSpans[ i ].cb;
+        }
+        if ( !cbSpans ) break;
+    }
+
+    if ( pchStitch != achStitch ) free_small( ((PTEXTHDR) text)->pAllocator, pchStitch );
+    return ulFound;
 }
 
 
@@ -509,20 +1878,98 @@ unsigned long TextLength( PTEXT pText )
  * at the specified position.  Returns the number of bytes written (which    *
  * may be less than the requested length if the end of the text is reached.) *
  * ------------------------------------------------------------------------- */
-unsigned long TextSequence( PTEXT pText, unsigned char *pchText, unsigned long ulPosition, unsigned long ulLength )
+unsigned long TextSequence( EDITORTEXT text, unsigned char *pchText, unsigned long ulPosition, unsigned long ulLength )
 {
-    unsigned long ulOffset;
-    unsigned long i;
+    return TEXTMODEL( text )->pfnSequence( text, pchText, ulPosition, ulLength );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * TextSnapshot()                                                            *
+ *                                                                           *
+ * Creates a read-only snapshot of the text, if the model supports it.  The  *
+ * snapshot is a new object of the same model, which the model then points   *
+ * at the storage of the original.                                           *
+ * ------------------------------------------------------------------------- */
+int TextSnapshot( EDITORTEXT text, EDITORTEXT *pSnapshot )
+{
+    EDITORTEXT snapshot;
 
-    if ( !pchText ) return 0;
-    if ( ulPosition >= TEXTLEN( *pText )) return 0;
+    if ( !text || !pSnapshot ) return 0;
+    if ( !TEXTMODEL( text )->pfnSnapshot ) return 0;
+    if ( ! TextCreateWithAllocator( &snapshot, ((PTEXTHDR) text)->iModel,
+                                    ((PTEXTHDR) text)->pAllocator ))
+        return 0;
 
-    for ( i = 0; i < ulLength; i++ ) {
-        ulOffset = TEXTPOS2ABS( *pText, ulPosition + i );
-        if ( ulOffset >= TEXTEND( *pText )) break;
-        pchText[ i ] = pText->pchContents[ ulOffset ];
+    if ( ! TEXTMODEL( text )->pfnSnapshot( text, snapshot )) {
+        free_memory( ((PTEXTHDR) text)->pAllocator, snapshot );
+        return 0;
     }
-    return i;
+    ((PTEXTHDR) snapshot)->fSnapshot = 1;
+    ((PTEXTHDR) snapshot)->cbElement = ((PTEXTHDR) text)->cbElement;
+    *pSnapshot = snapshot;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * TextSetCacheLimit()                                                       *
+ *                                                                           *
+ * Sets the memory budget for the paged model's page cache, or for the       *
+ * block model's hot set.                                                    *
+ * ------------------------------------------------------------------------- */
+int TextSetCacheLimit( EDITORTEXT text, unsigned long cbLimit )
+{
+    if ( !text ) return 0;
+    ((PTEXTHDR) text)->cbCacheLimit = cbLimit;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * TextSetDefaultAllocator()                                                 *
+ *                                                                           *
+ * Sets the allocator used by text objects created from now on.              *
+ * ------------------------------------------------------------------------- */
+int TextSetDefaultAllocator( PTEXTALLOCATOR pAlloc )
+{
+    if ( pAlloc && ( !pAlloc->pfnAlloc || !pAlloc->pfnFree )) return 0;
+    pDefaultAllocator = pAlloc;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * TextSetElementSize()                                                      *
+ *                                                                           *
+ * Sets the element size of the text object.  The text already present must  *
+ * be a whole number of elements (which it always is if it is empty); after  *
+ * that, the checks in the editing functions keep it so.  The UTF-8 model    *
+ * holds UCS-2 units, so its element size is always 2.                       *
+ * ------------------------------------------------------------------------- */
+int TextSetElementSize( EDITORTEXT text, unsigned long cbElement )
+{
+    if ( !text ) return 0;
+    if (( cbElement != 1 ) && ( cbElement != 2 ) && ( cbElement != 4 )) return 0;
+    if (( ((PTEXTHDR) text)->iModel == TEXT_MODEL_UTF8 ) && ( cbElement != 2 )) return 0;
+    if ( TextLength( text ) % cbElement ) return 0;
+    ((PTEXTHDR) text)->cbElement = cbElement;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * TextSetGrowth()                                                           *
+ *                                                                           *
+ * Sets the buffer growth policy of the text object.                         *
+ * ------------------------------------------------------------------------- */
+int TextSetGrowth( EDITORTEXT text, unsigned short usPercent, unsigned long cbLimit )
+{
+    if ( !text ) return 0;
+    if (( usPercent <= 100 ) || ( usPercent > GROWTH_MAX_PERCENT )) return 0;
+    ((PTEXTHDR) text)->usGrowPercent = usPercent;
+    ((PTEXTHDR) text)->cbGrowLimit   = cbLimit;
+    return 1;
 }
 
 
@@ -534,12 +1981,18 @@ unsigned long TextSequence( PTEXT pText, unsigned char *pchText, unsigned long u
  * internally converted into bytes accordingly.  If the position is invalid, *
  * 0 (a null character) is returned.                                         *
  * ------------------------------------------------------------------------- */
-wchar_t TextWCharAt( PTEXT pText, unsigned long ulPosition )
+wchar_t TextWCharAt( EDITORTEXT text, unsigned long ulPosition )
 {
+    wchar_t wc;
+
+    if ( text && ((PTEXTHDR) text)->cbElement == sizeof( wchar_t ))
+        return (wchar_t) TextElementAt( text, ulPosition );
+
     ulPosition *= sizeof( wchar_t );
-    if ( ulPosition >= TEXTLEN( *pText )) return 0;
-    return ( (wchar_t)(pText->pchContents[ TEXTPOS2ABS(*pText, ulPosition) ]) );
+    if ( TextSequence( text, (unsigned char *) &wc, ulPosition,
+                       sizeof( wchar_t )) != sizeof( wchar_t ))
+        return 0;
+    return wc;
 }
 
 
-
@@ -2,11 +2,14 @@
  * textseq.h                                                                 *
  *                                                                           *
  * Interface to the text sequence buffer.  The implementation details are    *
- * deliberately hidden from the caller with the idea that this may make it   *
- * easier to replace the implementation some day if desired.  (The current   *
- * implementation, in textseq.c, is a gap buffer model - but it should be    *
- * possible to change this to something else like piece-tables, without      *
- * having to change the interface.)                                          *
+ * deliberately hidden from the caller, so that the underlying model can be  *
+ * changed without having to change the interface.  Six models are           *
+ * currently available: a gap buffer (textgap.c), which is the default, a    *
+ * piece table (textpt.c), a rope (textrope.c), a paged piece table for      *
+ * files larger than memory (textpt.c and textpage.c), a UTF-8 store for     *
+ * UCS-2 text (textutf8.c), and a block store which compresses the parts of  *
+ * a very large text not in use (textblock.c).  The model is chosen when the *
+ * text object is created; use TextCreateModel() to request a specific one.  *
  *                                                                           *
  * The buffer is treated as a sequence of bytes, no more and no less.  NO    *
  * assumptions are made about how these bytes are organized or interpreted.  *
@@ -15,12 +18,40 @@
  * cares about such things, it is up to the application to worry about it    *
  * after retrieving the values from the buffer.)                             *
  *                                                                           *
- * The only context in which buffer items are not treated as type char is    *
- * the TextWCharAt() function, which takes and returns values of type        *
- * wchar_t (however that is defined by the current compiler).  This is       *
- * provided as a convenience for applications which need to retrieve single  *
+ * The only contexts in which buffer items are not treated as type char are  *
+ * the TextWCharAt() function and the TextIter*() functions, which read      *
+ * values of type wchar_t (however that is defined by the current compiler). *
+ * These are provided as a convenience for applications which need to read   *
  * UCS-2 values from the buffer.                                             *
  *                                                                           *
+ * An application which only ever stores text in fixed-size units (such as   *
+ * UCS-2) can tell the text object so with TextSetElementSize().  Positions  *
+ * and lengths are still given in bytes, but the text object then refuses    *
+ * any edit which would split an element, so every element lies whole and    *
+ * aligned within one span of the buffer.  Code which reads the buffer in    *
+ * place can then load each element directly, without having to allow for    *
+ * one straddling the gap.                                                   *
+ *                                                                           *
+ * The UTF-8 model is the exception to the rule above: it holds UCS-2 text   *
+ * (in native byte order), and stores each unit in one to three bytes of     *
+ * UTF-8, which halves the memory used by mostly-ASCII text.  Positions and  *
+ * lengths are still given in bytes of UCS-2, so the text looks the same to  *
+ * the caller as under any other model; its element size is always 2.        *
+ *                                                                           *
+ * The line functions (TextLineCount() etc.) likewise interpret the buffer   *
+ * as a sequence of wchar_t values, and count any of LF, VT, FF, CR, LS or   *
+ * PS as a line break (a CR followed by an LF being a single break).  These  *
+ * are O(log n) under the rope model; the other models have to scan the text *
+ * to answer them.                                                           *
+ *                                                                           *
+ * By default, text objects get their memory from the system.  An            *
+ * application may supply its own allocator (a TEXTALLOCATOR) instead,       *
+ * either for every text object created from then on, with                   *
+ * TextSetDefaultAllocator(), or for one object, with                        *
+ * TextCreateWithAllocator().  All of the object's memory, including that of *
+ * the object itself, then comes from the allocator.  Two allocators which   *
+ * suit many short-lived text objects are provided in textmem.c.             *
+ *                                                                           *
  *****************************************************************************/
 
 
@@ -30,6 +61,85 @@
 
 typedef void * EDITORTEXT;
 
+// A run of text addressed directly within the buffer (see TextGetSpans)
+typedef struct _text_span {
+    unsigned char *pch;             // First byte of the run
+    unsigned long  cb;              // Number of bytes in the run
+} TEXTSPAN, *PTEXTSPAN;
+
+// Receives successive runs of text from TextExport(); returns 0 to stop it
+typedef int (*PFNTEXTSINK)( void *pUser, PTEXTSPAN pSpans, unsigned long ulSpans );
+
+// Receives successive line break positions from TextReplaceAll(); returns 0 to abandon it
+typedef int (*PFNTEXTBREAKS)( void *pUser, unsigned long *pulBreaks, unsigned long ulBreaks );
+
+// A single edit within a batch (see TextApplyEdits)
+typedef struct _text_edit {
+    unsigned long  ulPosition;      // Where the edit applies (in the text before the batch)
+    unsigned long  cbDelete;        // Number of bytes to delete there
+    unsigned char *pchInsert;       // Text to insert in their place (or NULL)
+    unsigned long  cbInsert;        // Number of bytes to insert
+    long           lShift;          // Returned: shift of the text following the edit
+} TEXTEDIT, *PTEXTEDIT;
+
+// A cursor for reading the text one wchar_t at a time (see TextIterInit)
+typedef struct _text_iter {
+    EDITORTEXT     text;            // The text being read
+    unsigned char *pch;             // Span of text containing the position (or NULL)
+    unsigned long  ulSpan,          // Text position at which the span starts
+                   cbSpan,          // Length of the span
+                   ulOffset,        // Current position, relative to the span
+                   cbText;          // Length of the text
+} TEXTITER, *PTEXTITER;
+
+// Statistics about a text object (see TextQueryStats)
+typedef struct _text_stats {
+    unsigned long ulPageHits,       // Page requests satisfied from the cache
+                  ulPageMisses,     // Page requests which read the file
+                  ulPagesResident,  // Pages currently held in the cache
+                  ulPagesMax,       // Most pages the cache will hold
+                  cbPage,           // Size of one page
+                  cbCompressed,     // Memory holding compressed text (block model)
+                  cbUncompressed;   // Length of that text when uncompressed
+} TEXTSTATS, *PTEXTSTATS;
+
+
+// Memory allocation functions supplied by the application (see TEXTALLOCATOR)
+typedef void *(*PFNTEXTALLOC)( void *pUser, unsigned long cb );
+typedef void  (*PFNTEXTFREE)( void *pUser, void *pObj );
+typedef void *(*PFNTEXTREALLOC)( void *pUser, void *pObj, unsigned long cbOld, unsigned long cbNew );
+
+// An allocator from which text objects get their memory.  The counters are
+// kept by the text functions, which do not serialize access to them.
+typedef struct _text_allocator {
+    PFNTEXTALLOC   pfnAlloc;        // Allocates a block (which need not be cleared)
+    PFNTEXTFREE    pfnFree;         // Frees a block
+    PFNTEXTREALLOC pfnRealloc;      // Resizes a block, keeping its contents (or NULL)
+    void           *pUser;          // Caller's data passed to the functions
+    unsigned long  ulAllocs,        // Returned: number of blocks allocated
+                   ulReallocs,      // Returned: number of blocks resized
+                   ulFrees,         // Returned: number of blocks freed
+                   ulFailures,      // Returned: number of requests which failed
+                   cbRequested,     // Returned: total bytes requested
+                   cbReserved;      // Memory obtained from the system (if known)
+} TEXTALLOCATOR, *PTEXTALLOCATOR;
+
+
+// ---------------------------------------------------------------------------
+// CONSTANTS
+//
+
+// Text models supported by TextCreateModel()
+#define TEXT_MODEL_GAPBUFFER    0       // gap (split) buffer
+#define TEXT_MODEL_PIECETABLE   1       // piece table
+#define TEXT_MODEL_ROPE         2       // rope (balanced tree)
+#define TEXT_MODEL_PAGED        3       // piece table paged from a file
+#define TEXT_MODEL_UTF8         4       // UCS-2 text stored as UTF-8
+#define TEXT_MODEL_BLOCK        5       // blocks compressed when not in use
+
+// Value returned by the line functions to indicate no such position
+#define TEXT_INVALID_POSITION   0xFFFFFFFF
+
 
 // ---------------------------------------------------------------------------
 // FUNCTION DECLARATIONS
@@ -44,17 +154,124 @@ typedef void * EDITORTEXT;
 unsigned char TextByteAt( EDITORTEXT text, unsigned long ulPosition );
 
 
+/* ------------------------------------------------------------------------- *
+ * TextSetGrowth()                                                           *
+ *                                                                           *
+ * Sets the policy by which the text object enlarges its buffers.  Whenever  *
+ * a buffer is too small it is grown geometrically, to usPercent percent of  *
+ * its current size (default 200, i.e. doubled, maximum 1000), but by no     *
+ * more than cbLimit bytes at a time (default 32 MB; 0 means no limit).      *
+ * ------------------------------------------------------------------------- */
+int TextSetGrowth( EDITORTEXT text, unsigned short usPercent, unsigned long cbLimit );
+
+
+/* ------------------------------------------------------------------------- *
+ * TextSetCacheLimit()                                                       *
+ *                                                                           *
+ * Sets the maximum amount of memory (in bytes) which the paged model may    *
+ * use to cache file pages (default 4 MB).  Takes effect the next time a     *
+ * file is opened with TextInitFromFile().  Under the block model, this is   *
+ * instead the memory which may be held by uncompressed blocks (the hot      *
+ * set), and takes effect at once.  Ignored by the other models.             *
+ * ------------------------------------------------------------------------- */
+int TextSetCacheLimit( EDITORTEXT text, unsigned long cbLimit );
+
+
+/* ------------------------------------------------------------------------- *
+ * TextSetElementSize()                                                      *
+ *                                                                           *
+ * Declares that the text consists of elements of cbElement bytes each (1,   *
+ * the default, 2 or 4).  From then on, any insertion, deletion or other     *
+ * edit whose position or length is not a multiple of cbElement fails, as    *
+ * does initializing the text with a partial element at the end.  Returns 0  *
+ * if the size is invalid, or if the current text is not a whole number of   *
+ * elements.  The UTF-8 model only accepts 2, which is also its default.     *
+ * ------------------------------------------------------------------------- */
+int TextSetElementSize( EDITORTEXT text, unsigned long cbElement );
+
+
+/* ------------------------------------------------------------------------- *
+ * TextSetDefaultAllocator()                                                 *
+ *                                                                           *
+ * Sets the allocator from which text objects created by TextCreate() and    *
+ * TextCreateModel() (and line buffers set up by LineBuffer_Init()) get      *
+ * their memory.  Objects which already exist keep the allocator they were   *
+ * created with.  NULL restores the default, which takes memory from the     *
+ * system.  The allocator must remain valid until every object created from  *
+ * it has been freed.                                                        *
+ * ------------------------------------------------------------------------- */
+int TextSetDefaultAllocator( PTEXTALLOCATOR pAlloc );
+
+
+/* ------------------------------------------------------------------------- *
+ * TextQueryDefaultAllocator()                                               *
+ *                                                                           *
+ * Returns the allocator set by TextSetDefaultAllocator(), or NULL if text   *
+ * objects are taking their memory from the system.                          *
+ * ------------------------------------------------------------------------- */
+PTEXTALLOCATOR TextQueryDefaultAllocator( void );
+
+
+/* ------------------------------------------------------------------------- *
+ * TextElementAt()                                                           *
+ *                                                                           *
+ * Returns the element (see TextSetElementSize) at the given element index,  *
+ * i.e. at byte position ulIndex * cbElement, read directly from the buffer. *
+ * If the index is invalid, 0 is returned.                                   *
+ * ------------------------------------------------------------------------- */
+unsigned long TextElementAt( EDITORTEXT text, unsigned long ulIndex );
+
+
 /* ------------------------------------------------------------------------- *
  * TextWCharAt                                                               *
  *                                                                           *
  * Returns the wide-character type (wchar_t) at the given position.  The     *
  * position in this case is also assumed to be a wchar_t offset, and is      *
  * internally converted into bytes accordingly.  If the position is invalid, *
- * 0 (a null character) is returned.                                         *
+ * 0 (a null character) is returned.  This is quickest if the element size   *
+ * of the text is sizeof( wchar_t ).                                         *
  * ------------------------------------------------------------------------- */
 wchar_t TextWCharAt( EDITORTEXT text, unsigned long ulPosition );
 
 
+/* ------------------------------------------------------------------------- *
+ * TextAllocMemory()                                                         *
+ *                                                                           *
+ * Allocates cb bytes of cleared memory from the given allocator (or from    *
+ * the system, if pAlloc is NULL), and counts it in the allocator's          *
+ * statistics.  This is for working storage which belongs with a text        *
+ * object, so that it comes from the same place.  The memory must be freed   *
+ * with TextFreeMemory(), passing the same allocator.                        *
+ * ------------------------------------------------------------------------- */
+void *TextAllocMemory( PTEXTALLOCATOR pAlloc, unsigned long cb );
+
+
+/* ------------------------------------------------------------------------- *
+ * TextApplyEdits()                                                          *
+ *                                                                           *
+ * Applies a batch of edits (replacements, deletions and/or insertions) in a *
+ * single operation.  Every edit's position refers to the text as it was     *
+ * before the batch, so the caller does not need to adjust the positions of  *
+ * later edits to account for earlier ones.  The edits may be given in any   *
+ * order, but they may not overlap (although an edit may begin where the     *
+ * previous one ends).                                                       *
+ *                                                                           *
+ * On return, the array has been sorted into ascending order of position,    *
+ * and each edit's lShift field holds the total change in length caused by   *
+ * that edit and all edits before it.  In other words, text which followed   *
+ * the deleted range of edit n has moved by pEdits[n].lShift bytes.  This    *
+ * map can be used to adjust other position indexes (for example with        *
+ * LineBuffer_ApplyEdits()) in one pass.                                     *
+ *                                                                           *
+ * Under the gap buffer model, the whole batch costs a single copy of the    *
+ * text, instead of a gap movement per edit.                                 *
+ *                                                                           *
+ * Returns 0 if the edits overlap or extend past the end of the text (in     *
+ * which case nothing is changed), or if memory could not be allocated.      *
+ * ------------------------------------------------------------------------- */
+int TextApplyEdits( EDITORTEXT text, PTEXTEDIT pEdits, unsigned long ulCount );
+
+
 /* ------------------------------------------------------------------------- *
  * TextClearContents()                                                       *
  *                                                                           *
@@ -73,6 +290,26 @@ int TextClearContents( EDITORTEXT text );
 int TextCreate( EDITORTEXT *pText );
 
 
+/* ------------------------------------------------------------------------- *
+ * TextCreateModel()                                                         *
+ *                                                                           *
+ * Creates a new text data structure which uses the specified model (one of  *
+ * the TEXT_MODEL_* constants).  Otherwise identical to TextCreate().        *
+ * ------------------------------------------------------------------------- */
+int TextCreateModel( EDITORTEXT *pText, int iModel );
+
+
+/* ------------------------------------------------------------------------- *
+ * TextCreateWithAllocator()                                                 *
+ *                                                                           *
+ * Creates a new text data structure which uses the specified model, and     *
+ * gets all of its memory from pAlloc (or from the system, if pAlloc is      *
+ * NULL) rather than from the default allocator.  Otherwise identical to     *
+ * TextCreateModel().  Snapshots of the text use the same allocator.         *
+ * ------------------------------------------------------------------------- */
+int TextCreateWithAllocator( EDITORTEXT *pText, int iModel, PTEXTALLOCATOR pAlloc );
+
+
 /* ------------------------------------------------------------------------- *
  * TextDelete                                                                *
  *                                                                           *
@@ -90,6 +327,23 @@ int TextDelete( EDITORTEXT text, unsigned long ulPosition, unsigned long ulLengt
 int TextDestroyContents( EDITORTEXT text );
 
 
+/* ------------------------------------------------------------------------- *
+ * TextExport()                                                              *
+ *                                                                           *
+ * Passes a range of text to a sink function, without copying it.  The sink  *
+ * is called repeatedly with the spans which make up the next part of the    *
+ * range (see TextGetSpans), in order, until the range has been covered or   *
+ * the sink returns 0.  Under the gap buffer model, the whole range normally *
+ * arrives in a single call, as one span on either side of the gap.          *
+ *                                                                           *
+ * The spans are only valid for the duration of the call, and the sink must  *
+ * not call any other Text*() function on the same text object.              *
+ *                                                                           *
+ * Returns the number of bytes which were accepted by the sink.              *
+ * ------------------------------------------------------------------------- */
+unsigned long TextExport( EDITORTEXT text, unsigned long ulPosition, unsigned long ulLength, PFNTEXTSINK pfnSink, void *pUser );
+
+
 /* ------------------------------------------------------------------------- *
  * TextFree()                                                                *
  *                                                                           *
@@ -98,6 +352,46 @@ int TextDestroyContents( EDITORTEXT text );
 int TextFree( EDITORTEXT *pText );
 
 
+/* ------------------------------------------------------------------------- *
+ * TextFreeMemory()                                                          *
+ *                                                                           *
+ * Frees memory obtained from TextAllocMemory().                             *
+ * ------------------------------------------------------------------------- */
+void TextFreeMemory( PTEXTALLOCATOR pAlloc, void *pObj );
+
+
+/* ------------------------------------------------------------------------- *
+ * TextGetSpans()                                                            *
+ *                                                                           *
+ * Provides direct access to a range of text without copying it.  Returns    *
+ * up to two spans (pointer/length pairs) which together hold the text from  *
+ * the given position onwards; unused spans are set to NULL/0.  The return   *
+ * value is the number of spans filled in.                                   *
+ *                                                                           *
+ * Under the gap buffer model, the two spans always cover the entire range   *
+ * requested (up to the end of the text): one on either side of the gap.     *
+ * Other models may return less than the requested length, in which case the *
+ * caller should call again from the end of the last span.                   *
+ *                                                                           *
+ * The pointers are only valid until the text is next modified, and the text *
+ * must not be written through them.  Under the paged, UTF-8 and block       *
+ * models, they are only valid until the next call to any Text*() function.  *
+ * ------------------------------------------------------------------------- */
+int TextGetSpans( EDITORTEXT text, unsigned long ulPosition, unsigned long ulLength, PTEXTSPAN pSpan1, PTEXTSPAN pSpan2 );
+
+
+/* ------------------------------------------------------------------------- *
+ * TextGetView()                                                             *
+ *                                                                           *
+ * Like TextGetSpans(), but returns a single pointer to the entire range (up *
+ * to the end of the text), for callers which need one flat string.  Under   *
+ * the gap buffer model, this moves the gap out of the range if necessary    *
+ * (which invalidates any spans previously obtained).  Other models return   *
+ * NULL if the range is not already stored contiguously.                     *
+ * ------------------------------------------------------------------------- */
+unsigned char *TextGetView( EDITORTEXT text, unsigned long ulPosition, unsigned long ulLength );
+
+
 /* ------------------------------------------------------------------------- *
  * TextInitContents()                                                        *
  *                                                                           *
@@ -107,6 +401,29 @@ int TextFree( EDITORTEXT *pText );
 int TextInitContents( EDITORTEXT text, unsigned char *pchText, unsigned long cbText );
 
 
+/* ------------------------------------------------------------------------- *
+ * TextInitFromFile()                                                        *
+ *                                                                           *
+ * Initializes the text data structure with the contents of the named file.  *
+ *                                                                           *
+ * Where the platform supports it, the file is mapped read-only into memory  *
+ * rather than read.  Under the piece table model the mapping is then used   *
+ * directly as the original text, so that only those parts of the file       *
+ * which are actually accessed are ever paged in, and only edited text is    *
+ * stored in private memory.  This makes it the preferred way of opening     *
+ * very large, mostly read-only files.  Other models copy the contents into  *
+ * their own buffer as with TextInitContents().                              *
+ *                                                                           *
+ * Under the paged model, the file is instead read in fixed-size pages as    *
+ * they are needed, and only a limited number of pages (see                  *
+ * TextSetCacheLimit) are kept in memory at any one time.                    *
+ *                                                                           *
+ * The file should not be modified by anyone else while the text object is   *
+ * using it.  Returns 0 if the file could not be opened or is too large.     *
+ * ------------------------------------------------------------------------- */
+int TextInitFromFile( EDITORTEXT text, const char *pszFile );
+
+
 /* ------------------------------------------------------------------------- *
  * TextInsert                                                                *
  *                                                                           *
@@ -115,6 +432,72 @@ int TextInitContents( EDITORTEXT text, unsigned char *pchText, unsigned long cbT
 int TextInsert( EDITORTEXT text, unsigned char *pch, unsigned long ulPosition, unsigned long ulLength );
 
 
+/* ------------------------------------------------------------------------- *
+ * TextIterInit()                                                            *
+ *                                                                           *
+ * Sets up an iterator for reading the text, one wchar_t character at a      *
+ * time, forwards or backwards from the given byte position.  The iterator   *
+ * keeps a pointer into the buffer, so each character costs little more      *
+ * than a memory read; it only goes back to the text object when it steps    *
+ * off the end of a span (e.g. across the gap).                              *
+ *                                                                           *
+ * The iterator must be set up again (with TextIterInit) once the text has   *
+ * been modified.  Under the paged, UTF-8 and block models the same applies  *
+ * after any other call on the text object.  Returns 0 if the position is    *
+ * past the end.                                                             *
+ * ------------------------------------------------------------------------- */
+int TextIterInit( PTEXTITER pIter, EDITORTEXT text, unsigned long ulPosition );
+
+
+/* ------------------------------------------------------------------------- *
+ * TextIterNext()                                                            *
+ *                                                                           *
+ * Returns the character at the iterator's position in pwc, and moves the    *
+ * iterator past it.  Returns 0 if there is no complete character left.      *
+ * ------------------------------------------------------------------------- */
+int TextIterNext( PTEXTITER pIter, wchar_t *pwc );
+
+
+/* ------------------------------------------------------------------------- *
+ * TextIterPosition()                                                        *
+ *                                                                           *
+ * Returns the iterator's current byte position in the text.                 *
+ * ------------------------------------------------------------------------- */
+unsigned long TextIterPosition( PTEXTITER pIter );
+
+
+/* ------------------------------------------------------------------------- *
+ * TextIterPrev()                                                            *
+ *                                                                           *
+ * Moves the iterator back by one character, and returns that character in   *
+ * pwc.  Returns 0 if the iterator is at the start of the text.              *
+ * ------------------------------------------------------------------------- */
+int TextIterPrev( PTEXTITER pIter, wchar_t *pwc );
+
+
+/* ------------------------------------------------------------------------- *
+ * TextIterSeek()                                                            *
+ *                                                                           *
+ * Moves the iterator to another byte position.  This is cheap if the new    *
+ * position is in the span the iterator is already reading.  Returns 0 if    *
+ * the position is past the end of the text.                                 *
+ * ------------------------------------------------------------------------- */
+int TextIterSeek( PTEXTITER pIter, unsigned long ulPosition );
+
+
+/* ------------------------------------------------------------------------- *
+ * TextIterSpan()                                                            *
+ *                                                                           *
+ * Returns the number of bytes which can be read directly from the buffer,   *
+ * starting at the iterator's position, and sets ppch to point to them.  It  *
+ * is the rest of the current span, so it never crosses the gap.  This lets  *
+ * a caller process a run of text in place.  The iterator does not move, so  *
+ * use TextIterSeek to skip past what was processed.  Returns 0 at the end   *
+ * of the text.                                                              *
+ * ------------------------------------------------------------------------- */
+unsigned long TextIterSpan( PTEXTITER pIter, unsigned char **ppch );
+
+
 /* ------------------------------------------------------------------------- *
  * TextLength()                                                              *
  *                                                                           *
@@ -123,6 +506,145 @@ int TextInsert( EDITORTEXT text, unsigned char *pch, unsigned long ulPosition, u
 unsigned long TextLength( EDITORTEXT text );
 
 
+/* ------------------------------------------------------------------------- *
+ * TextLineCount()                                                           *
+ *                                                                           *
+ * Returns the number of lines in the text, i.e. one plus the number of hard *
+ * line breaks.                                                              *
+ * ------------------------------------------------------------------------- */
+unsigned long TextLineCount( EDITORTEXT text );
+
+
+/* ------------------------------------------------------------------------- *
+ * TextLineFromOffset()                                                      *
+ *                                                                           *
+ * Returns the (0-based) number of the line which contains the given byte    *
+ * position.  Positions past the end of the text are in the last line.       *
+ * ------------------------------------------------------------------------- */
+unsigned long TextLineFromOffset( EDITORTEXT text, unsigned long ulPosition );
+
+
+/* ------------------------------------------------------------------------- *
+ * TextLineOffset()                                                          *
+ *                                                                           *
+ * Returns the byte position at which the given (0-based) line starts, or    *
+ * TEXT_INVALID_POSITION if there is no such line.                           *
+ * ------------------------------------------------------------------------- */
+unsigned long TextLineOffset( EDITORTEXT text, unsigned long ulLine );
+
+
+/* ------------------------------------------------------------------------- *
+ * TextNextLineBreak()                                                       *
+ *                                                                           *
+ * Returns the byte position at which the first line following the given     *
+ * position starts (i.e. the position just after the next line break), or    *
+ * TEXT_INVALID_POSITION if there are no more line breaks.  This is intended *
+ * for enumerating lines in sequence, and is efficient for all models.       *
+ * ------------------------------------------------------------------------- */
+unsigned long TextNextLineBreak( EDITORTEXT text, unsigned long ulPosition );
+
+
+/* ------------------------------------------------------------------------- *
+ * TextQueryModel()                                                          *
+ *                                                                           *
+ * Returns the model (TEXT_MODEL_* constant) used by the text object.        *
+ * ------------------------------------------------------------------------- */
+int TextQueryModel( EDITORTEXT text );
+
+
+/* ------------------------------------------------------------------------- *
+ * TextQueryStats()                                                          *
+ *                                                                           *
+ * Fills in a TEXTSTATS structure with information about the text object.    *
+ * Fields which do not apply to its model (such as the page counters for     *
+ * anything other than the paged model) are set to 0.  Under the block       *
+ * model, cbCompressed and cbUncompressed show the memory saved by           *
+ * compression: the text in the compressed blocks would take cbUncompressed  *
+ * bytes, but actually takes cbCompressed.                                   *
+ * ------------------------------------------------------------------------- */
+int TextQueryStats( EDITORTEXT text, PTEXTSTATS pStats );
+
+
+/* ------------------------------------------------------------------------- *
+ * TextReleaseSnapshot()                                                     *
+ *                                                                           *
+ * Frees a snapshot created by TextSnapshot().  This may be called from the  *
+ * thread which was reading the snapshot, even while the original text is    *
+ * being modified by another thread.                                         *
+ * ------------------------------------------------------------------------- */
+int TextReleaseSnapshot( EDITORTEXT *pSnapshot );
+
+
+/* ------------------------------------------------------------------------- *
+ * TextReplaceAll()                                                          *
+ *                                                                           *
+ * Replaces every occurrence of a sequence of bytes with another (which may  *
+ * be empty), and returns the number of replacements made.  Occurrences are  *
+ * found as by TextSearch(), from the start of the text, and do not overlap. *
+ *                                                                           *
+ * Rather than editing the text once per occurrence, the new text is built   *
+ * in a fresh buffer in a single pass, which then replaces the old contents  *
+ * (under the gap buffer model, without being copied again).  The cost is    *
+ * therefore about that of copying the text once, however many occurrences   *
+ * there are.                                                                *
+ *                                                                           *
+ * If pfnBreaks is not NULL, the new text is also scanned for hard line      *
+ * breaks as it is built (in the same way as TextNextLineBreak), and the     *
+ * position following each one is passed to pfnBreaks, in ascending order    *
+ * and in batches.  This allows a line index to be rebuilt without scanning  *
+ * the text again.  If pfnBreaks returns 0, the replacement is abandoned and *
+ * the text is left unchanged.  It is not called at all if there are no      *
+ * occurrences, since the text is then unchanged anyway.                     *
+ *                                                                           *
+ * Returns TEXT_INVALID_POSITION (and leaves the text unchanged) on error,   *
+ * e.g. if memory could not be allocated.                                    *
+ * ------------------------------------------------------------------------- */
+unsigned long TextReplaceAll( EDITORTEXT text, const unsigned char *pchPattern, unsigned long cbPattern, const unsigned char *pchReplace, unsigned long cbReplace, unsigned long cbUnit, PFNTEXTBREAKS pfnBreaks, void *pUser );
+
+
+/* ------------------------------------------------------------------------- *
+ * TextReserve()                                                             *
+ *                                                                           *
+ * Informs the text object that it is about to hold (at least) the given     *
+ * total number of bytes, so that any buffers can be enlarged once to the    *
+ * exact size required rather than repeatedly as the text grows.  Should be  *
+ * called after TextInitContents(), e.g. before pasting or importing a large *
+ * amount of text of known size.                                             *
+ * ------------------------------------------------------------------------- */
+int TextReserve( EDITORTEXT text, unsigned long cbText );
+
+
+/* ------------------------------------------------------------------------- *
+ * TextSaveToFile()                                                          *
+ *                                                                           *
+ * Writes the text to the given file, replacing its contents.  The text is   *
+ * written directly from the buffer (with a vectored write where the system  *
+ * supports one), so no copy of it is made.                                  *
+ *                                                                           *
+ * The file must not be one which the text object (or a snapshot of it) is   *
+ * still reading from, as after TextInitFromFile() under the piece table or  *
+ * paged models; save to a new file and rename it instead.                   *
+ * ------------------------------------------------------------------------- */
+int TextSaveToFile( EDITORTEXT text, const char *pszFile );
+
+
+/* ------------------------------------------------------------------------- *
+ * TextSearch()                                                              *
+ *                                                                           *
+ * Finds the first occurrence of a sequence of bytes in the text, at or      *
+ * after the given position, and returns the position at which it starts,    *
+ * or TEXT_INVALID_POSITION if there is none.  Only matches starting at a    *
+ * multiple of cbUnit bytes are considered, so UCS-2 text should be searched *
+ * with a cbUnit of 2, so that (for example) a search for "AB" can't match   *
+ * the last half of one character and the first half of the next.  A cbUnit  *
+ * of 0 means the element size of the text (see TextSetElementSize).         *
+ *                                                                           *
+ * The text is searched in place, including across the gap or between        *
+ * pieces, so the search is about as fast as a scan through memory.          *
+ * ------------------------------------------------------------------------- */
+unsigned long TextSearch( EDITORTEXT text, const unsigned char *pchPattern, unsigned long cbPattern, unsigned long ulPosition, unsigned long cbUnit );
+
+
 /* ------------------------------------------------------------------------- *
  * TextSequence                                                              *
  *                                                                           *
@@ -135,3 +657,23 @@ unsigned long TextLength( EDITORTEXT text );
 unsigned long TextSequence( EDITORTEXT text, unsigned char *pchText, unsigned long ulPosition, unsigned long ulLength );
 
 
+/* ------------------------------------------------------------------------- *
+ * TextSnapshot()                                                            *
+ *                                                                           *
+ * Creates a new, read-only text object holding the current contents of the  *
+ * text.  Later changes to the original text do not affect the snapshot, so  *
+ * it can be saved, searched or measured by another thread while the user    *
+ * continues editing, without any locking.  (Each snapshot should only be    *
+ * read by one thread at a time; take one snapshot per thread if need be.)   *
+ * Any of the functions which read text may be used on the snapshot; those   *
+ * which modify text will fail.  Free it with TextReleaseSnapshot().         *
+ *                                                                           *
+ * Taking a snapshot does not copy the text, so it is only supported by      *
+ * models whose storage can be shared: currently just the rope model, where  *
+ * it takes constant time.  The original and the snapshot then share all of  *
+ * their nodes; each subsequent edit to the original copies only the nodes   *
+ * on the path to the change.  Returns 0 for the other models.               *
+ * ------------------------------------------------------------------------- */
+int TextSnapshot( EDITORTEXT text, EDITORTEXT *pSnapshot );
+
+
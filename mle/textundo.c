@@ -0,0 +1,551 @@
+/*****************************************************************************
+ * textundo.c                                                                *
+ *                                                                           *
+ * Implements the undo/redo journal (see textundo.h).                        *
+ *                                                                           *
+ * The journal consists of two fixed-size ring buffers: one of entries, each *
+ * describing a single insertion or deletion, and one holding the text that  *
+ * each entry inserted or deleted.  Both are filled in order, so the oldest  *
+ * entry's text is always at the start of the text ring and the newest       *
+ * entry's text at the end.  An entry's text may wrap around the end of the  *
+ * ring.                                                                     *
+ *                                                                           *
+ * Entries which belong to the same undo step share a group number.  Typing  *
+ * (or forward-deleting) at adjoining positions simply extends the newest    *
+ * entry.  Backspacing cannot be recorded that way, since each deletion      *
+ * comes before the text already recorded, so it adds a new entry to the     *
+ * same group instead.                                                       *
+ *                                                                           *
+ * The first ulDone entries have been applied to the text; any beyond that   *
+ * have been undone, and are available for redo until the next new edit.     *
+ *                                                                           *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <stddef.h>
+
+#include "debug.h"
+#include "textseq.h"
+#include "textimpl.h"
+#include "textundo.h"
+
+
+// ---------------------------------------------------------------------------
+// CONSTANTS
+//
+
+#define JOURNAL_INSERT      1       // entry records an insertion
+#define JOURNAL_DELETE      2       // entry records a deletion
+
+
+// ---------------------------------------------------------------------------
+// TYPEDEFS
+//
+
+// A single recorded edit.
+//
+typedef struct _journal_entry {
+    unsigned long  ulGroup,         // Undo step to which the entry belongs
+                   ulPosition,      // Position of the edit in the text
+                   cb,              // Number of bytes inserted or deleted
+                   ulText;          // Offset of those bytes in the text ring
+    unsigned short fsType;          // JOURNAL_INSERT or JOURNAL_DELETE
+} JOURNALENTRY, *PJOURNALENTRY;
+
+
+// The journal itself.
+//
+typedef struct _text_journal {
+    PJOURNALENTRY pEntries;         // Ring of entries
+    unsigned long ulEntriesMax,     // Capacity of the entry ring
+                  ulFirst,          // Index of the oldest entry
+                  ulCount,          // Number of entries in use
+                  ulDone;           // Number of entries currently applied
+    unsigned char *pchRing;         // Ring of entry text
+    unsigned long cbRing,           // Capacity of the text ring
+                  ulRingStart,      // Offset of the oldest entry's text
+                  cbRingUsed;       // Number of bytes in use
+    unsigned long ulGroup,          // Group number of the newest step
+                  cbGroup;          // Number of bytes in the newest step
+    int           fSealed,          // Newest step may not be extended
+                  fGrouped,         // Every edit joins the newest step
+                  fOverflow;        // Grouped step did not fit; not recorded
+} JOURNAL, *PJOURNAL;
+
+
+// ---------------------------------------------------------------------------
+// MACROS
+//
+
+// Return the entry at the given index (counting from the oldest)
+#define ENTRY( j, i )       ( (j)->pEntries + ((( j)->ulFirst + ( i )) % (j)->ulEntriesMax ))
+
+// Return the offset at which the next text will be stored in the ring
+#define RINGTAIL( j )       ((( j)->ulRingStart + (j)->cbRingUsed ) % (j)->cbRing )
+
+
+// ---------------------------------------------------------------------------
+// FUNCTION DECLARATIONS
+//
+
+void Journal_AddChange( PJOURNALCHANGE pChange, unsigned short fsType, unsigned long ulPosition, unsigned long ulLength );
+void Journal_DropOldest( PJOURNAL pJournal );
+void Journal_DropRedo( PJOURNAL pJournal );
+int  Journal_Record( PJOURNAL pJournal, EDITORTEXT text, unsigned short fsType, unsigned char *pch, unsigned long ulPosition, unsigned long ulLength );
+int  Journal_Replay( PJOURNAL pJournal, EDITORTEXT text, PJOURNALENTRY pEntry );
+void Journal_StoreText( PJOURNAL pJournal, EDITORTEXT text, unsigned char *pch, unsigned long ulPosition, unsigned long ulLength );
+
+
+// ===========================================================================
+// INTERNAL FUNCTIONS
+// ===========================================================================
+
+
+/* ------------------------------------------------------------------------- *
+ * Journal_AddChange()                                                       *
+ *                                                                           *
+ * Widens the range described by pChange to take in an edit which has just   *
+ * been made to the text (fsType being what was actually done, which is the  *
+ * opposite of the entry's type when undoing).  Any unchanged text between   *
+ * the range and the edit becomes part of the range, counting as both        *
+ * removed and inserted.  Does nothing if pChange is NULL.                   *
+ * ------------------------------------------------------------------------- */
+void Journal_AddChange( PJOURNALCHANGE pChange, unsigned short fsType, unsigned long ulPosition, unsigned long ulLength )
+{
+    unsigned long ulEnd,            // End of the range in the current text
+                  ulReach;          // End of the text the edit touched
+
+    if ( !pChange ) return;
+
+    ulEnd = pChange->ulPosition + pChange->cbInserted;
+    if ( ulPosition < pChange->ulPosition ) {
+        pChange->cbRemoved += pChange->ulPosition - ulPosition;
+        pChange->ulPosition = ulPosition;
+    }
+    ulReach = ( fsType == JOURNAL_DELETE ) ? ulPosition + ulLength : ulPosition;
+    if ( ulReach > ulEnd ) {
+        pChange->cbRemoved += ulReach - ulEnd;
+        ulEnd = ulReach;
+    }
+    if ( fsType == JOURNAL_INSERT )
+        ulEnd += ulLength;
+    else
+        ulEnd -= ulLength;
+    pChange->cbInserted = ulEnd - pChange->ulPosition;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Journal_DropOldest()                                                      *
+ *                                                                           *
+ * Discards the oldest undo step (all entries in the oldest group), freeing  *
+ * its space in both rings.                                                  *
+ * ------------------------------------------------------------------------- */
+void Journal_DropOldest( PJOURNAL pJournal )
+{
+    PJOURNALENTRY pEntry;
+    unsigned long ulGroup;
+
+    if ( !pJournal->ulCount ) return;
+    ulGroup = ENTRY( pJournal, 0 )->ulGroup;
+    while ( pJournal->ulCount && ( ENTRY( pJournal, 0 )->ulGroup == ulGroup )) {
+        pEntry = ENTRY( pJournal, 0 );
+        pJournal->ulRingStart = ( pJournal->ulRingStart + pEntry->cb ) % pJournal->cbRing;
+        pJournal->cbRingUsed -= pEntry->cb;
+        pJournal->ulFirst = ( pJournal->ulFirst + 1 ) % pJournal->ulEntriesMax;
+        pJournal->ulCount--;
+        if ( pJournal->ulDone ) pJournal->ulDone--;
+    }
+    if ( !pJournal->ulCount ) pJournal->ulRingStart = 0;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Journal_DropRedo()                                                        *
+ *                                                                           *
+ * Discards any undone entries, which can no longer be redone once a new     *
+ * edit has been made.  Since they are the newest entries, their text is at  *
+ * the end of the ring.                                                      *
+ * ------------------------------------------------------------------------- */
+void Journal_DropRedo( PJOURNAL pJournal )
+{
+    while ( pJournal->ulCount > pJournal->ulDone ) {
+        pJournal->cbRingUsed -= ENTRY( pJournal, pJournal->ulCount - 1 )->cb;
+        pJournal->ulCount--;
+    }
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Journal_StoreText()                                                       *
+ *                                                                           *
+ * Appends text to the ring, either from the given buffer or (if pch is      *
+ * NULL) from the given range of the text object.  The caller must already   *
+ * have made room for it.                                                    *
+ * ------------------------------------------------------------------------- */
+void Journal_StoreText( PJOURNAL pJournal, EDITORTEXT text, unsigned char *pch, unsigned long ulPosition, unsigned long ulLength )
+{
+    unsigned long ulTail,
+                  cbFirst;
+
+    ulTail  = RINGTAIL( pJournal );
+    cbFirst = pJournal->cbRing - ulTail;
+    if ( cbFirst > ulLength ) cbFirst = ulLength;
+
+    if ( pch ) {
+        memcpy( pJournal->pchRing + ulTail, pch, cbFirst );
+        memcpy( pJournal->pchRing, pch + cbFirst, ulLength - cbFirst );
+    }
+    else {
+        TextSequence( text, pJournal->pchRing + ulTail, ulPosition, cbFirst );
+        TextSequence( text, pJournal->pchRing, ulPosition + cbFirst, ulLength - cbFirst );
+    }
+    pJournal->cbRingUsed += ulLength;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Journal_Record()                                                          *
+ *                                                                           *
+ * Records an edit which is about to be made (in the case of a deletion) or  *
+ * has just been made (in the case of an insertion).  The edit is coalesced  *
+ * with the newest step if possible.  If the edit is too large to fit in the *
+ * journal at all, the journal is cleared instead, since the earlier steps   *
+ * could no longer be undone correctly.                                      *
+ * ------------------------------------------------------------------------- */
+int Journal_Record( PJOURNAL pJournal, EDITORTEXT text, unsigned short fsType, unsigned char *pch, unsigned long ulPosition, unsigned long ulLength )
+{
+    PJOURNALENTRY pEntry;
+    int           fSameStep;
+
+    if ( pJournal->fOverflow ) return 1;
+    Journal_DropRedo( pJournal );
+
+    pEntry    = pJournal->ulCount ? ENTRY( pJournal, pJournal->ulCount - 1 ) : NULL;
+    fSameStep = ( pEntry && !pJournal->fSealed &&
+                  ( pEntry->ulGroup == pJournal->ulGroup ) &&
+                  ( pEntry->fsType == fsType ) &&
+                  (( pJournal->cbGroup + ulLength ) <= JOURNAL_COALESCE_MAX ));
+
+    // Typing or forward-deleting: extend the newest entry
+    if ( fSameStep &&
+         ( ulPosition == (( fsType == JOURNAL_INSERT ) ? pEntry->ulPosition + pEntry->cb : pEntry->ulPosition )) &&
+         (( pJournal->cbRingUsed + ulLength ) <= pJournal->cbRing ))
+    {
+        Journal_StoreText( pJournal, text, pch, ulPosition, ulLength );
+        pEntry->cb += ulLength;
+        pJournal->cbGroup += ulLength;
+        return 1;
+    }
+
+    // Backspacing (or any edit within a group) continues the same step with
+    // a new entry; anything else starts a new step
+    if (( !pJournal->fGrouped || pJournal->fSealed ) &&
+        ( !fSameStep || ( fsType != JOURNAL_DELETE ) ||
+          (( ulPosition + ulLength ) != pEntry->ulPosition )))
+    {
+        pJournal->ulGroup++;
+        pJournal->cbGroup = 0;
+    }
+    pJournal->fSealed = 0;
+
+    if ( ulLength > pJournal->cbRing ) {
+#ifdef DEBUG_LOG
+fprintf(dbg, "Edit of %u bytes is too large for the undo journal\n", ulLength );
+#endif
+        Journal_Clear( pJournal );
+        pJournal->fOverflow = pJournal->fGrouped;
+        return 1;
+    }
+    while ((( pJournal->cbRingUsed + ulLength ) > pJournal->cbRing ) ||
+           ( pJournal->ulCount >= pJournal->ulEntriesMax ))
+    {
+        // A group which has filled the whole journal can't be kept either
+        if ( ENTRY( pJournal, 0 )->ulGroup == pJournal->ulGroup ) {
+            Journal_Clear( pJournal );
+            pJournal->fOverflow = pJournal->fGrouped;
+            return 1;
+        }
+        Journal_DropOldest( pJournal );
+    }
+
+    pEntry = ENTRY( pJournal, pJournal->ulCount );
+    pEntry->ulGroup    = pJournal->ulGroup;
+    pEntry->ulPosition = ulPosition;
+    pEntry->cb         = ulLength;
+    pEntry->ulText     = RINGTAIL( pJournal );
+    pEntry->fsType     = fsType;
+    Journal_StoreText( pJournal, text, pch, ulPosition, ulLength );
+
+    pJournal->ulCount++;
+    pJournal->ulDone   = pJournal->ulCount;
+    pJournal->cbGroup += ulLength;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Journal_Replay()                                                          *
+ *                                                                           *
+ * Inserts the text recorded by an entry back into the text object, at the   *
+ * position recorded.  The text may be split across the end of the ring.     *
+ * ------------------------------------------------------------------------- */
+int Journal_Replay( PJOURNAL pJournal, EDITORTEXT text, PJOURNALENTRY pEntry )
+{
+    unsigned long cbFirst;
+
+    cbFirst = pJournal->cbRing - pEntry->ulText;
+    if ( cbFirst > pEntry->cb ) cbFirst = pEntry->cb;
+
+    if ( ! TextInsert( text, pJournal->pchRing + pEntry->ulText, pEntry->ulPosition, cbFirst ))
+        return 0;
+    if ( cbFirst < pEntry->cb )
+        return TextInsert( text, pJournal->pchRing, pEntry->ulPosition + cbFirst, pEntry->cb - cbFirst );
+    return 1;
+}
+
+
+// ===========================================================================
+// PUBLIC FUNCTIONS
+// ===========================================================================
+
+
+/* ------------------------------------------------------------------------- *
+ * Journal_CanRedo()                                                         *
+ * ------------------------------------------------------------------------- */
+int Journal_CanRedo( TEXTJOURNAL journal )
+{
+    if ( !journal ) return 0;
+    return ( ((PJOURNAL) journal)->ulDone < ((PJOURNAL) journal)->ulCount );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Journal_CanUndo()                                                         *
+ * ------------------------------------------------------------------------- */
+int Journal_CanUndo( TEXTJOURNAL journal )
+{
+    if ( !journal ) return 0;
+    return ( ((PJOURNAL) journal)->ulDone > 0 );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Journal_Clear()                                                           *
+ *                                                                           *
+ * Discards all entries.                                                     *
+ * ------------------------------------------------------------------------- */
+int Journal_Clear( TEXTJOURNAL journal )
+{
+    PJOURNAL pJournal = (PJOURNAL) journal;
+
+    if ( !pJournal ) return 0;
+    pJournal->ulFirst     = 0;
+    pJournal->ulCount     = 0;
+    pJournal->ulDone      = 0;
+    pJournal->ulRingStart = 0;
+    pJournal->cbRingUsed  = 0;
+    pJournal->cbGroup     = 0;
+    pJournal->fSealed     = 1;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Journal_Create()                                                          *
+ *                                                                           *
+ * Creates a new journal.  A quarter of the memory budget is used for the    *
+ * entry ring, and the rest for the text ring.                               *
+ * ------------------------------------------------------------------------- */
+int Journal_Create( TEXTJOURNAL *pJournal, unsigned long cbLimit )
+{
+    PJOURNAL pNew;
+
+    if ( !cbLimit ) cbLimit = JOURNAL_DEFAULT_LIMIT;
+    if ( cbLimit < JOURNAL_MINIMUM_LIMIT ) cbLimit = JOURNAL_MINIMUM_LIMIT;
+
+    pNew = (PJOURNAL) allocate_memory( NULL, sizeof( JOURNAL ));
+    if ( !pNew ) return 0;
+    pNew->ulEntriesMax = ( cbLimit / 4 ) / sizeof( JOURNALENTRY );
+    pNew->cbRing       = cbLimit - ( pNew->ulEntriesMax * sizeof( JOURNALENTRY ));
+    pNew->pEntries     = (PJOURNALENTRY) allocate_memory( NULL, pNew->ulEntriesMax * sizeof( JOURNALENTRY ));
+    pNew->pchRing      = (unsigned char *) allocate_memory( NULL, pNew->cbRing );
+    if ( !pNew->pEntries || !pNew->pchRing ) {
+        Journal_Free( (TEXTJOURNAL *) &pNew );
+        return 0;
+    }
+    pNew->ulGroup = 0;
+    Journal_Clear( pNew );
+
+    *pJournal = pNew;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Journal_Delete()                                                          *
+ *                                                                           *
+ * Records a deletion and then makes it.  The deleted text has to be copied  *
+ * into the journal first, while it still exists.                            *
+ * ------------------------------------------------------------------------- */
+int Journal_Delete( TEXTJOURNAL journal, EDITORTEXT text, unsigned long ulPosition, unsigned long ulLength )
+{
+    unsigned long cbText;
+
+    if ( !journal ) return TextDelete( text, ulPosition, ulLength );
+
+    cbText = TextLength( text );
+    if ( ulPosition >= cbText ) return 0;
+    if ( ulLength > ( cbText - ulPosition )) ulLength = cbText - ulPosition;
+    if ( !ulLength ) return 1;
+
+    Journal_Record( (PJOURNAL) journal, text, JOURNAL_DELETE, NULL, ulPosition, ulLength );
+    if ( ! TextDelete( text, ulPosition, ulLength )) {
+        Journal_Clear( journal );
+        return 0;
+    }
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Journal_Free()                                                            *
+ * ------------------------------------------------------------------------- */
+int Journal_Free( TEXTJOURNAL *pJournal )
+{
+    PJOURNAL pOld = (PJOURNAL) *pJournal;
+
+    if ( !pOld ) return 0;
+    if ( pOld->pEntries ) free_memory( NULL, pOld->pEntries );
+    if ( pOld->pchRing )  free_memory( NULL, pOld->pchRing );
+    free_memory( NULL, pOld );
+    *pJournal = NULL;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Journal_Group()                                                           *
+ *                                                                           *
+ * Starts or ends a group.  Starting one seals the current step, so that the *
+ * group begins a step of its own.                                           *
+ * ------------------------------------------------------------------------- */
+int Journal_Group( TEXTJOURNAL journal, int fGroup )
+{
+    PJOURNAL pJournal = (PJOURNAL) journal;
+
+    if ( !pJournal ) return 0;
+    pJournal->fSealed   = 1;
+    pJournal->fGrouped  = fGroup;
+    pJournal->fOverflow = 0;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Journal_Insert()                                                          *
+ *                                                                           *
+ * Makes an insertion and then records it.                                   *
+ * ------------------------------------------------------------------------- */
+int Journal_Insert( TEXTJOURNAL journal, EDITORTEXT text, unsigned char *pch, unsigned long ulPosition, unsigned long ulLength )
+{
+    if ( ! TextInsert( text, pch, ulPosition, ulLength )) return 0;
+    if ( !journal || !ulLength ) return 1;
+    return Journal_Record( (PJOURNAL) journal, text, JOURNAL_INSERT, pch, ulPosition, ulLength );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Journal_Redo()                                                            *
+ *                                                                           *
+ * Reapplies each entry of the oldest undone step, in the original order,    *
+ * gathering the range of text they change as it goes.                       *
+ * ------------------------------------------------------------------------- */
+int Journal_Redo( TEXTJOURNAL journal, EDITORTEXT text, unsigned long *pulPosition, PJOURNALCHANGE pChange )
+{
+    PJOURNAL      pJournal = (PJOURNAL) journal;
+    PJOURNALENTRY pEntry;
+    unsigned long ulGroup;
+
+    if ( !Journal_CanRedo( journal )) return 0;
+
+    pEntry  = ENTRY( pJournal, pJournal->ulDone );
+    ulGroup = pEntry->ulGroup;
+    if ( pChange ) {
+        pChange->ulPosition = pEntry->ulPosition;
+        pChange->cbRemoved  = 0;
+        pChange->cbInserted = 0;
+    }
+    while (( pJournal->ulDone < pJournal->ulCount ) &&
+           ( ENTRY( pJournal, pJournal->ulDone )->ulGroup == ulGroup ))
+    {
+        pEntry = ENTRY( pJournal, pJournal->ulDone );
+        if ( pEntry->fsType == JOURNAL_INSERT ) {
+            if ( ! Journal_Replay( pJournal, text, pEntry )) return 0;
+            if ( pulPosition ) *pulPosition = pEntry->ulPosition + pEntry->cb;
+        }
+        else {
+            if ( ! TextDelete( text, pEntry->ulPosition, pEntry->cb )) return 0;
+            if ( pulPosition ) *pulPosition = pEntry->ulPosition;
+        }
+        Journal_AddChange( pChange, pEntry->fsType, pEntry->ulPosition, pEntry->cb );
+        pJournal->ulDone++;
+    }
+    pJournal->fSealed = 1;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Journal_Seal()                                                            *
+ * ------------------------------------------------------------------------- */
+int Journal_Seal( TEXTJOURNAL journal )
+{
+    if ( !journal ) return 0;
+    ((PJOURNAL) journal)->fSealed = 1;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Journal_Undo()                                                            *
+ *                                                                           *
+ * Reverses each entry of the newest applied step, in reverse order,         *
+ * gathering the range of text they change as it goes.                       *
+ * ------------------------------------------------------------------------- */
+int Journal_Undo( TEXTJOURNAL journal, EDITORTEXT text, unsigned long *pulPosition, PJOURNALCHANGE pChange )
+{
+    PJOURNAL      pJournal = (PJOURNAL) journal;
+    PJOURNALENTRY pEntry;
+    unsigned long ulGroup;
+
+    if ( !Journal_CanUndo( journal )) return 0;
+
+    pEntry  = ENTRY( pJournal, pJournal->ulDone - 1 );
+    ulGroup = pEntry->ulGroup;
+    if ( pChange ) {
+        pChange->ulPosition = pEntry->ulPosition;
+        pChange->cbRemoved  = 0;
+        pChange->cbInserted = 0;
+    }
+    while ( pJournal->ulDone &&
+            ( ENTRY( pJournal, pJournal->ulDone - 1 )->ulGroup == ulGroup ))
+    {
+        pEntry = ENTRY( pJournal, pJournal->ulDone - 1 );
+        if ( pEntry->fsType == JOURNAL_INSERT ) {
+            if ( ! TextDelete( text, pEntry->ulPosition, pEntry->cb )) return 0;
+            if ( pulPosition ) *pulPosition = pEntry->ulPosition;
+            Journal_AddChange( pChange, JOURNAL_DELETE, pEntry->ulPosition, pEntry->cb );
+        }
+        else {
+            if ( ! Journal_Replay( pJournal, text, pEntry )) return 0;
+            if ( pulPosition ) *pulPosition = pEntry->ulPosition + pEntry->cb;
+            Journal_AddChange( pChange, JOURNAL_INSERT, pEntry->ulPosition, pEntry->cb );
+        }
+        pJournal->ulDone--;
+    }
+    pJournal->fSealed = 1;
+    return 1;
+}
+
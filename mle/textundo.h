@@ -0,0 +1,160 @@
+/*****************************************************************************
+ * textundo.h                                                                *
+ *                                                                           *
+ * Interface to the undo/redo journal for the text sequence buffer.          *
+ *                                                                           *
+ * Rather than taking snapshots of the text, the journal records each edit   *
+ * (insertion or deletion) made through it, along with the text which was    *
+ * inserted or deleted.  Undoing or redoing an edit therefore only costs as  *
+ * much as the edit itself.                                                  *
+ *                                                                           *
+ * Consecutive edits of the same kind at adjoining positions (such as typing *
+ * or backspacing over a run of characters) are coalesced into a single undo *
+ * step, until the journal is sealed with Journal_Seal() or the step reaches *
+ * JOURNAL_COALESCE_MAX bytes.                                               *
+ *                                                                           *
+ * The journal occupies a fixed amount of memory, specified when it is       *
+ * created.  When it is full, the oldest undo steps are discarded to make    *
+ * room for new ones.                                                        *
+ *                                                                           *
+ * All changes to the text must go through the journal while it is in use;   *
+ * if the text is modified in any other way (e.g. with TextInitContents),    *
+ * the journal must be cleared.                                              *
+ *                                                                           *
+ * textseq.h must be included before this file.                              *
+ *                                                                           *
+ *****************************************************************************/
+
+
+// ---------------------------------------------------------------------------
+// DATA TYPES
+//
+
+typedef void * TEXTJOURNAL;
+
+// The part of the text changed by an undo or redo step (see Journal_Undo).
+// The cbRemoved bytes which were at ulPosition before the step have been
+// replaced by the cbInserted bytes now there.
+typedef struct _journal_change {
+    unsigned long ulPosition;       // Where the changed text starts
+    unsigned long cbRemoved;        // Number of bytes of the old text replaced
+    unsigned long cbInserted;       // Number of bytes now in their place
+} JOURNALCHANGE, *PJOURNALCHANGE;
+
+
+// ---------------------------------------------------------------------------
+// CONSTANTS
+//
+
+#define JOURNAL_DEFAULT_LIMIT   0x100000    // default memory budget (1 MB)
+#define JOURNAL_MINIMUM_LIMIT   0x4000      // smallest permitted budget
+#define JOURNAL_COALESCE_MAX    0x1000      // largest coalesced undo step
+
+
+// ---------------------------------------------------------------------------
+// FUNCTION DECLARATIONS
+//
+
+/* ------------------------------------------------------------------------- *
+ * Journal_CanRedo()                                                         *
+ *                                                                           *
+ * Returns 1 if there is an undone step which can be redone, 0 otherwise.    *
+ * ------------------------------------------------------------------------- */
+int Journal_CanRedo( TEXTJOURNAL journal );
+
+
+/* ------------------------------------------------------------------------- *
+ * Journal_CanUndo()                                                         *
+ *                                                                           *
+ * Returns 1 if there is a step which can be undone, 0 otherwise.            *
+ * ------------------------------------------------------------------------- */
+int Journal_CanUndo( TEXTJOURNAL journal );
+
+
+/* ------------------------------------------------------------------------- *
+ * Journal_Clear()                                                           *
+ *                                                                           *
+ * Discards all undo and redo steps.                                         *
+ * ------------------------------------------------------------------------- */
+int Journal_Clear( TEXTJOURNAL journal );
+
+
+/* ------------------------------------------------------------------------- *
+ * Journal_Create()                                                          *
+ *                                                                           *
+ * Creates a new, empty journal which will use at most cbLimit bytes of      *
+ * memory (0 means JOURNAL_DEFAULT_LIMIT).  It should be freed with          *
+ * Journal_Free() when no longer required.                                   *
+ * ------------------------------------------------------------------------- */
+int Journal_Create( TEXTJOURNAL *pJournal, unsigned long cbLimit );
+
+
+/* ------------------------------------------------------------------------- *
+ * Journal_Delete()                                                          *
+ *                                                                           *
+ * Deletes one or more bytes from the text (as TextDelete), and records the  *
+ * deletion.                                                                 *
+ * ------------------------------------------------------------------------- */
+int Journal_Delete( TEXTJOURNAL journal, EDITORTEXT text, unsigned long ulPosition, unsigned long ulLength );
+
+
+/* ------------------------------------------------------------------------- *
+ * Journal_Free()                                                            *
+ *                                                                           *
+ * Frees the journal.                                                        *
+ * ------------------------------------------------------------------------- */
+int Journal_Free( TEXTJOURNAL *pJournal );
+
+
+/* ------------------------------------------------------------------------- *
+ * Journal_Group()                                                           *
+ *                                                                           *
+ * With fGroup set to 1, starts gathering all following edits into a single  *
+ * undo step, regardless of their size or position (for example, to import   *
+ * a large block of text in several pieces).  Calling it again with fGroup   *
+ * set to 0 ends the step.  If the step turns out to be too large for the    *
+ * journal, the journal is cleared and the rest of the step is not recorded. *
+ * ------------------------------------------------------------------------- */
+int Journal_Group( TEXTJOURNAL journal, int fGroup );
+
+
+/* ------------------------------------------------------------------------- *
+ * Journal_Insert()                                                          *
+ *                                                                           *
+ * Inserts one or more bytes into the text (as TextInsert), and records the  *
+ * insertion.                                                                *
+ * ------------------------------------------------------------------------- */
+int Journal_Insert( TEXTJOURNAL journal, EDITORTEXT text, unsigned char *pch, unsigned long ulPosition, unsigned long ulLength );
+
+
+/* ------------------------------------------------------------------------- *
+ * Journal_Redo()                                                            *
+ *                                                                           *
+ * Repeats the most recently undone step.  The position at which the step    *
+ * ended (i.e. where the cursor should go) is returned in pulPosition, and   *
+ * the range of text which it changed in pChange (either may be NULL).       *
+ * Returns 0 if there is nothing to redo.                                    *
+ * ------------------------------------------------------------------------- */
+int Journal_Redo( TEXTJOURNAL journal, EDITORTEXT text, unsigned long *pulPosition, PJOURNALCHANGE pChange );
+
+
+/* ------------------------------------------------------------------------- *
+ * Journal_Seal()                                                            *
+ *                                                                           *
+ * Ends the current undo step, so that the next edit will not be coalesced   *
+ * with it.  Should be called whenever the user does something which breaks  *
+ * a run of typing, such as moving the cursor.                               *
+ * ------------------------------------------------------------------------- */
+int Journal_Seal( TEXTJOURNAL journal );
+
+
+/* ------------------------------------------------------------------------- *
+ * Journal_Undo()                                                            *
+ *                                                                           *
+ * Reverses the most recent step.  The position at which the undone edit     *
+ * began (i.e. where the cursor should go) is returned in pulPosition, and   *
+ * the range of text which was changed back in pChange (either may be NULL). *
+ * Returns 0 if there is nothing to undo.                                    *
+ * ------------------------------------------------------------------------- */
+int Journal_Undo( TEXTJOURNAL journal, EDITORTEXT text, unsigned long *pulPosition, PJOURNALCHANGE pChange );
+
@@ -0,0 +1,693 @@
+/*****************************************************************************
+ * textutf8.c                                                                *
+ *                                                                           *
+ * Implements the UTF-8 text model, which stores UCS-2 text in UTF-8 form.   *
+ * Text which is mostly ASCII then takes about half the memory it would as   *
+ * UCS-2, at the cost of having to convert it on the way in and out.         *
+ *                                                                           *
+ * To the caller, the text looks exactly as it does under the other models:  *
+ * a sequence of UCS-2 units, addressed by byte position.  (The element size *
+ * of the text is therefore always 2; see TextSetElementSize.)  Each unit is *
+ * encoded on its own, in one to three bytes; surrogates are not combined,   *
+ * so any sequence of units, valid UTF-16 or not, is stored unchanged.       *
+ *                                                                           *
+ * The UTF-8 bytes themselves are held in a gap buffer (a text object of the *
+ * gap buffer model, used through the public Text*() functions).  To find    *
+ * the byte offset at which a given unit is stored, we keep a sparse index   *
+ * of checkpoints: the positions (in both units and bytes) of a unit about   *
+ * every UTF8_MARK_INTERVAL bytes, from which the offset can be reached by   *
+ * counting no more than a few kilobytes of bytes.  The checkpoints after an *
+ * edit are simply shifted by the change in length, and the stretch around   *
+ * the edit is re-marked only if it has grown too long.  The last position   *
+ * located is also remembered, so that a run of lookups moving forward       *
+ * through the text (as in reading or typing) each cost about O(1).          *
+ *                                                                           *
+ * Reading is done through a window of up to UTF8_WINDOW_UNITS units decoded *
+ * from the text, so TextGetSpans() returns at most that much at a time, and *
+ * its pointers (like those of the paged model) only remain valid until the  *
+ * next call on the text object.                                             *
+ *                                                                           *
+ * The functions in this file are not called directly by applications; they  *
+ * are reached through the public Text*() functions in textseq.c.            *
+ *                                                                           *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <stddef.h>
+
+#include "debug.h"
+#include "textseq.h"
+#include "textimpl.h"
+
+
+// ---------------------------------------------------------------------------
+// CONSTANTS
+//
+#define UTF8_MARK_INTERVAL  4096    // bytes of UTF-8 text between checkpoints
+#define UTF8_MARK_INITIAL   64      // initial room for checkpoints
+#define UTF8_WINDOW_UNITS   0x2000  // most units decoded at a time for reading
+#define UTF8_FILL_UNITS     256     // fewest units decoded at a time
+#define UTF8_ENCODE_UNITS   1024    // units encoded at a time for writing
+
+#define UTF8_UNIT           2       // size of a UCS-2 unit
+
+
+// ---------------------------------------------------------------------------
+// TYPEDEFS
+//
+
+// A checkpoint: the byte offset at which a given unit is stored.
+//
+typedef struct _utf8_mark {
+    unsigned long ulUnit,           // Index of the unit
+                  ulByte;           // Offset of its first byte
+} UTF8MARK, *PUTF8MARK;
+
+
+// The internal implementation (UTF-8) of the text data structure.
+//
+typedef struct _utf8_text {
+    TEXTHDR        hdr;             // Common model header
+    EDITORTEXT     bytes;           // The UTF-8 text (a gap buffer)
+    unsigned long  ulUnits;         // Length of the text in units
+    PUTF8MARK      pMarks;          // Checkpoints, in ascending order
+    unsigned long  ulMarks,         // Number of checkpoints (the first is 0/0)
+                   ulMaxMarks;      // Room in pMarks
+    UTF8MARK       last;            // Most recently located unit
+    unsigned short *pusWindow;      // Text decoded for reading
+    unsigned long  ulWinUnit,       // First unit held in the window
+                   ulWinByte,       // Offset at which that unit is stored
+                   ulWinUnits;      // Number of units held (0 = none)
+} UTF8TEXT, *PUTF8TEXT;
+
+
+
+// ---------------------------------------------------------------------------
+// MACROS
+//
+
+// Is this byte the first (or only) byte of an encoded unit?
+#define UTF8_LEAD( b )      ((( b ) & 0xC0 ) != 0x80 )
+
+
+// ---------------------------------------------------------------------------
+// FUNCTION DECLARATIONS
+//
+
+// Internal
+unsigned long Utf8_Decode( PUTF8TEXT pText, unsigned long ulByte, unsigned short *pusOut, unsigned long ulUnits, unsigned long *pulEnd );
+unsigned long Utf8_Encode( unsigned char *pch, unsigned long ulUnits, unsigned char *pchOut );
+int           Utf8_Fill( PUTF8TEXT pText, unsigned long ulUnit, unsigned long ulUnits );
+unsigned long Utf8_FindMark( PUTF8TEXT pText, unsigned long ulUnit );
+unsigned long Utf8_Locate( PUTF8TEXT pText, unsigned long ulUnit );
+int           Utf8_Remark( PUTF8TEXT pText, unsigned long ulUnit );
+unsigned long Utf8_Skip( PUTF8TEXT pText, unsigned long ulByte, unsigned long ulUnits );
+
+// Model implementation
+unsigned char Utf8_ByteAt( PUTF8TEXT pText, unsigned long ulPosition );
+int           Utf8_Clear( PUTF8TEXT pText );
+int           Utf8_Delete( PUTF8TEXT pText, unsigned long ulPosition, unsigned long ulLength );
+int           Utf8_Destroy( PUTF8TEXT pText );
+int           Utf8_Init( PUTF8TEXT pText, unsigned char *pchText, unsigned long cbText );
+int           Utf8_Insert( PUTF8TEXT pText, unsigned char *pch, unsigned long ulPosition, unsigned long ulLength );
+unsigned long Utf8_Length( PUTF8TEXT pText );
+unsigned long Utf8_Sequence( PUTF8TEXT pText, unsigned char *pchText, unsigned long ulPosition, unsigned long ulLength );
+int           Utf8_GetSpans( PUTF8TEXT pText, unsigned long ulPosition, unsigned long ulLength, PTEXTSPAN pSpan1, PTEXTSPAN pSpan2 );
+int           Utf8_Reserve( PUTF8TEXT pText, unsigned long cbText );
+
+
+// ---------------------------------------------------------------------------
+// MODEL TABLE
+//
+
+const TEXTMODEL Utf8Model = {
+    sizeof( UTF8TEXT ),
+    (PFNTEXTBYTEAT)   Utf8_ByteAt,
+    (PFNTEXTCLEAR)    Utf8_Clear,
+    (PFNTEXTDELETE)   Utf8_Delete,
+    (PFNTEXTDESTROY)  Utf8_Destroy,
+    (PFNTEXTINIT)     Utf8_Init,
+    (PFNTEXTINSERT)   Utf8_Insert,
+    (PFNTEXTLENGTH)   Utf8_Length,
+    (PFNTEXTSEQUENCE) Utf8_Sequence,
+    NULL,
+    NULL,
+    (PFNTEXTGETSPANS) Utf8_GetSpans,
+    NULL,
+    (PFNTEXTRESERVE)  Utf8_Reserve,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL
+};
+
+
+
+// ===========================================================================
+// INTERNAL FUNCTIONS
+// ===========================================================================
+
+
+/* ------------------------------------------------------------------------- *
+ * Utf8_Decode()                                                             *
+ *                                                                           *
+ * Decodes up to ulUnits units, starting with the one stored at ulByte, into *
+ * pusOut.  Returns the number of units decoded (fewer at the end of the     *
+ * text), and the offset of the byte following the last one in pulEnd.       *
+ * ------------------------------------------------------------------------- */
+unsigned long Utf8_Decode( PUTF8TEXT pText, unsigned long ulByte, unsigned short *pusOut, unsigned long ulUnits, unsigned long *pulEnd )
+{
+    TEXTSPAN       aSpans[ 2 ];
+    unsigned char  *pch;
+    unsigned long  cbText,
+                   ulSpans,
+                   ulDone,
+                   cb,
+                   i, j;
+    unsigned short usUnit;
+    int            iMore;           // continuation bytes still to come
+
+    cbText = TextLength( pText->bytes );
+    ulDone = 0;
+    usUnit = 0;
+    iMore  = 0;
+    while (( ulDone < ulUnits ) && ( ulByte < cbText )) {
+        ulSpans = TextGetSpans( pText->bytes, ulByte, cbText - ulByte, aSpans, aSpans + 1 );
+        if ( !ulSpans ) break;
+        for ( i = 0; ( i < ulSpans ) && ( ulDone < ulUnits ); i++ ) {
+            pch = aSpans[ i ].pch;
+            cb  = aSpans[ i ].cb;
+            for ( j = 0; ( j < cb ) && ( ulDone < ulUnits ); j++ ) {
+                if ( iMore ) {
+                    usUnit = ( usUnit << 6 ) | ( pch[ j ] & 0x3F );
+                    if ( --iMore ) continue;
+                }
+                else if ( pch[ j ] < 0x80 ) {
+                    // Copy a run of ASCII in one go
+                    while (( j < cb ) && ( pch[ j ] < 0x80 ) && ( ulDone < ulUnits ))
+                        pusOut[ ulDone++ ] = pch[ j++ ];
+                    j--;
+                    continue;
+                }
+                else if ( pch[ j ] < 0xE0 ) {
+                    usUnit = pch[ j ] & 0x1F;
+                    iMore  = 1;
+                    continue;
+                }
+                else {
+                    usUnit = pch[ j ] & 0x0F;
+                    iMore  = 2;
+                    continue;
+                }
+                pusOut[ ulDone++ ] = usUnit;
+            }
+            ulByte += j;
+        }
+    }
+    if ( pulEnd ) *pulEnd = ulByte;
+    return ulDone;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Utf8_Encode()                                                             *
+ *                                                                           *
+ * Encodes ulUnits UCS-2 units (which need not be aligned) into pchOut,      *
+ * which must have room for three bytes per unit.  Returns the number of     *
+ * bytes produced.                                                           *
+ * ------------------------------------------------------------------------- */
+unsigned long Utf8_Encode( unsigned char *pch, unsigned long ulUnits, unsigned char *pchOut )
+{
+    unsigned short usUnit;
+    unsigned long  cbOut,
+                   i;
+
+    cbOut = 0;
+    for ( i = 0; i < ulUnits; i++ ) {
+        memcpy( &usUnit, pch + ( i * UTF8_UNIT ), UTF8_UNIT );
+        if ( usUnit < 0x80 )
+            pchOut[ cbOut++ ] = (unsigned char) usUnit;
+        else if ( usUnit < 0x800 ) {
+            pchOut[ cbOut++ ] = (unsigned char)( 0xC0 | ( usUnit >> 6 ));
+            pchOut[ cbOut++ ] = (unsigned char)( 0x80 | ( usUnit & 0x3F ));
+        }
+        else {
+            pchOut[ cbOut++ ] = (unsigned char)( 0xE0 | ( usUnit >> 12 ));
+            pchOut[ cbOut++ ] = (unsigned char)( 0x80 | (( usUnit >> 6 ) & 0x3F ));
+            pchOut[ cbOut++ ] = (unsigned char)( 0x80 | ( usUnit & 0x3F ));
+        }
+    }
+    return cbOut;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Utf8_Fill()                                                               *
+ *                                                                           *
+ * Makes sure that the window holds the given unit and, as far as possible,  *
+ * the ulUnits units from there on.  If it does not, the text is decoded     *
+ * from that unit onwards: as much as was asked for, but at least            *
+ * UTF8_FILL_UNITS and at most UTF8_WINDOW_UNITS (so that reading a single   *
+ * character does not cost a whole window).  Returns 0 if the unit does not  *
+ * exist.                                                                    *
+ * ------------------------------------------------------------------------- */
+int Utf8_Fill( PUTF8TEXT pText, unsigned long ulUnit, unsigned long ulUnits )
+{
+    unsigned long ulByte;
+
+    if ( ulUnit >= pText->ulUnits ) return 0;
+    if ( ulUnits > ( pText->ulUnits - ulUnit )) ulUnits = pText->ulUnits - ulUnit;
+    if ( ulUnits > UTF8_WINDOW_UNITS ) ulUnits = UTF8_WINDOW_UNITS;
+    if (( ulUnit >= pText->ulWinUnit ) &&
+        (( ulUnit - pText->ulWinUnit ) < pText->ulWinUnits ) &&
+        ((( ulUnit - pText->ulWinUnit ) + ulUnits <= pText->ulWinUnits ) ||
+         ( pText->ulWinUnits == UTF8_WINDOW_UNITS )))
+        return 1;
+
+    if ( ulUnits < UTF8_FILL_UNITS ) ulUnits = UTF8_FILL_UNITS;
+    if ( ulUnits > ( pText->ulUnits - ulUnit )) ulUnits = pText->ulUnits - ulUnit;
+    ulByte = Utf8_Locate( pText, ulUnit );
+    pText->ulWinUnit  = ulUnit;
+    pText->ulWinByte  = ulByte;
+    pText->ulWinUnits = Utf8_Decode( pText, ulByte, pText->pusWindow, ulUnits, &ulByte );
+
+    // The next window along can start where this one left off
+    pText->last.ulUnit = ulUnit + pText->ulWinUnits;
+    pText->last.ulByte = ulByte;
+    return ( pText->ulWinUnits != 0 );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Utf8_FindMark()                                                           *
+ *                                                                           *
+ * Returns the index of the last checkpoint at or before the given unit.     *
+ * ------------------------------------------------------------------------- */
+unsigned long Utf8_FindMark( PUTF8TEXT pText, unsigned long ulUnit )
+{
+    unsigned long ulLow,
+                  ulHigh,
+                  ulMid;
+
+    ulLow  = 0;
+    ulHigh = pText->ulMarks;
+    while (( ulHigh - ulLow ) > 1 ) {
+        ulMid = ( ulLow + ulHigh ) / 2;
+        if ( pText->pMarks[ ulMid ].ulUnit <= ulUnit ) ulLow = ulMid;
+        else ulHigh = ulMid;
+    }
+    return ulLow;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Utf8_Locate()                                                             *
+ *                                                                           *
+ * Returns the byte offset at which the given unit is stored (or the length  *
+ * of the UTF-8 text, if the unit is just past the end).  We count forward   *
+ * from the nearest checkpoint before the unit, or from the last unit we     *
+ * located, or the start of the window, if either of those is nearer still.  *
+ * ------------------------------------------------------------------------- */
+unsigned long Utf8_Locate( PUTF8TEXT pText, unsigned long ulUnit )
+{
+    UTF8MARK start;
+
+    start = pText->pMarks[ Utf8_FindMark( pText, ulUnit ) ];
+    if (( pText->last.ulUnit <= ulUnit ) && ( pText->last.ulUnit >= start.ulUnit ))
+        start = pText->last;
+    if ( pText->ulWinUnits &&
+         ( pText->ulWinUnit <= ulUnit ) && ( pText->ulWinUnit > start.ulUnit ))
+    {
+        start.ulUnit = pText->ulWinUnit;
+        start.ulByte = pText->ulWinByte;
+    }
+
+    pText->last.ulUnit = ulUnit;
+    pText->last.ulByte = Utf8_Skip( pText, start.ulByte, ulUnit - start.ulUnit );
+    return pText->last.ulByte;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Utf8_Remark()                                                             *
+ *                                                                           *
+ * Checks the stretch of text between the checkpoints on either side of the  *
+ * given unit, and if it has grown longer than twice the normal interval     *
+ * (e.g. because text was inserted there), adds checkpoints within it at the *
+ * normal interval.  This takes a single pass over the stretch.              *
+ * ------------------------------------------------------------------------- */
+int Utf8_Remark( PUTF8TEXT pText, unsigned long ulUnit )
+{
+    TEXTSPAN      aSpans[ 2 ];
+    PUTF8MARK     pMarks;
+    unsigned char *pch;
+    unsigned long ulFirst,          // Checkpoint starting the stretch
+                  ulEnd,            // Byte offset at which the stretch ends
+                  ulRoom,           // Most checkpoints which may be added
+                  ulNext,           // Where the next checkpoint is due
+                  ulByte,
+                  ulSpans,
+                  i, j, k;
+
+    ulFirst = Utf8_FindMark( pText, ulUnit );
+    ulEnd   = (( ulFirst + 1 ) < pText->ulMarks ) ?
+                pText->pMarks[ ulFirst + 1 ].ulByte : TextLength( pText->bytes );
+    if (( ulEnd - pText->pMarks[ ulFirst ].ulByte ) <= ( 2 * UTF8_MARK_INTERVAL ))
+        return 1;
+
+    // Make room for the new checkpoints after the first one
+    ulRoom = ( ulEnd - pText->pMarks[ ulFirst ].ulByte ) / UTF8_MARK_INTERVAL;
+    if (( pText->ulMarks + ulRoom ) > pText->ulMaxMarks ) {
+        i = ( pText->ulMarks + ulRoom ) * 2;
+        pMarks = (PUTF8MARK) reallocate_memory( pText->hdr.pAllocator, pText->pMarks,
+                                                pText->ulMaxMarks * sizeof( UTF8MARK ),
+                                                i * sizeof( UTF8MARK ));
+        if ( !pMarks ) return 0;
+        pText->pMarks     = pMarks;
+        pText->ulMaxMarks = i;
+    }
+    pMarks = pText->pMarks;
+    memmove( pMarks + ulFirst + 1 + ulRoom, pMarks + ulFirst + 1,
+             ( pText->ulMarks - ulFirst - 1 ) * sizeof( UTF8MARK ));
+
+    // Walk through the stretch, counting units, and mark one every so often
+    k      = ulFirst + 1;
+    ulUnit = pMarks[ ulFirst ].ulUnit;
+    ulByte = pMarks[ ulFirst ].ulByte;
+    ulNext = ulByte + UTF8_MARK_INTERVAL;
+    while ( ulByte < ulEnd ) {
+        ulSpans = TextGetSpans( pText->bytes, ulByte, ulEnd - ulByte, aSpans, aSpans + 1 );
+        if ( !ulSpans ) break;
+        for ( i = 0; i < ulSpans; i++ ) {
+            pch = aSpans[ i ].pch;
+            for ( j = 0; j < aSpans[ i ].cb; j++ ) {
+                if ( !UTF8_LEAD( pch[ j ] )) continue;
+                if ((( ulByte + j ) >= ulNext ) && ( k < ( ulFirst + 1 + ulRoom ))) {
+                    pMarks[ k ].ulUnit = ulUnit;
+                    pMarks[ k ].ulByte = ulByte + j;
+                    ulNext = ulByte + j + UTF8_MARK_INTERVAL;
+                    k++;
+                }
+                ulUnit++;
+            }
+            ulByte += aSpans[ i ].cb;
+        }
+    }
+
+    // Close up any room left over
+    memmove( pMarks + k, pMarks + ulFirst + 1 + ulRoom,
+             ( pText->ulMarks - ulFirst - 1 ) * sizeof( UTF8MARK ));
+    pText->ulMarks += k - ( ulFirst + 1 );
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Utf8_Skip()                                                               *
+ *                                                                           *
+ * Returns the byte offset of the unit ulUnits after the one stored at       *
+ * ulByte (or the length of the UTF-8 text, if that is past the end).        *
+ * ------------------------------------------------------------------------- */
+unsigned long Utf8_Skip( PUTF8TEXT pText, unsigned long ulByte, unsigned long ulUnits )
+{
+    TEXTSPAN      aSpans[ 2 ];
+    unsigned char *pch;
+    unsigned long cbText,
+                  ulSpans,
+                  i, j;
+
+    cbText = TextLength( pText->bytes );
+    while ( ulByte < cbText ) {
+        ulSpans = TextGetSpans( pText->bytes, ulByte, cbText - ulByte, aSpans, aSpans + 1 );
+        if ( !ulSpans ) break;
+        for ( i = 0; i < ulSpans; i++ ) {
+            pch = aSpans[ i ].pch;
+            for ( j = 0; j < aSpans[ i ].cb; j++ ) {
+                if ( !UTF8_LEAD( pch[ j ] )) continue;
+                if ( !ulUnits ) return ulByte + j;
+                ulUnits--;
+            }
+            ulByte += aSpans[ i ].cb;
+        }
+    }
+    return cbText;
+}
+
+
+
+// ===========================================================================
+// MODEL IMPLEMENTATION
+// ===========================================================================
+
+
+/* ------------------------------------------------------------------------- *
+ * Utf8_ByteAt()                                                             *
+ * ------------------------------------------------------------------------- */
+unsigned char Utf8_ByteAt( PUTF8TEXT pText, unsigned long ulPosition )
+{
+    if ( !pText->bytes || ! Utf8_Fill( pText, ulPosition / UTF8_UNIT, 1 )) return 0;
+    return ((unsigned char *) pText->pusWindow )[ ulPosition - ( pText->ulWinUnit * UTF8_UNIT )];
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Utf8_Clear()                                                              *
+ * ------------------------------------------------------------------------- */
+int Utf8_Clear( PUTF8TEXT pText )
+{
+    if ( !pText->bytes ) return 0;
+    pText->ulUnits    = 0;
+    pText->ulMarks    = 1;
+    pText->last       = pText->pMarks[ 0 ];
+    pText->ulWinUnits = 0;
+    return TextClearContents( pText->bytes );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Utf8_Delete()                                                             *
+ *                                                                           *
+ * Deletes the units from the UTF-8 text, then drops the checkpoints which   *
+ * fell within them and shifts back those which followed.                    *
+ * ------------------------------------------------------------------------- */
+int Utf8_Delete( PUTF8TEXT pText, unsigned long ulPosition, unsigned long ulLength )
+{
+    unsigned long ulUnit,
+                  ulCount,
+                  ulByte,
+                  ulEnd,
+                  i, j;
+
+    if ( !pText->bytes ) return 0;
+    if (( ulPosition % UTF8_UNIT ) || ( ulLength % UTF8_UNIT )) return 0;
+    ulUnit  = ulPosition / UTF8_UNIT;
+    ulCount = ulLength / UTF8_UNIT;
+    if ( ulUnit > pText->ulUnits ) return 0;
+    if ( ulCount > ( pText->ulUnits - ulUnit )) ulCount = pText->ulUnits - ulUnit;
+    if ( !ulCount ) return 1;
+
+    ulByte = Utf8_Locate( pText, ulUnit );
+    ulEnd  = Utf8_Skip( pText, ulByte, ulCount );
+    if ( ! TextDelete( pText->bytes, ulByte, ulEnd - ulByte )) return 0;
+
+    i = Utf8_FindMark( pText, ulUnit ) + 1;
+    for ( j = i; ( j < pText->ulMarks ) && ( pText->pMarks[ j ].ulUnit <= ( ulUnit + ulCount )); j++ );
+    memmove( pText->pMarks + i, pText->pMarks + j, ( pText->ulMarks - j ) * sizeof( UTF8MARK ));
+    pText->ulMarks -= j - i;
+    for ( ; i < pText->ulMarks; i++ ) {
+        pText->pMarks[ i ].ulUnit -= ulCount;
+        pText->pMarks[ i ].ulByte -= ulEnd - ulByte;
+    }
+
+    pText->ulUnits    -= ulCount;
+    pText->ulWinUnits  = 0;
+    pText->last.ulUnit = ulUnit;
+    pText->last.ulByte = ulByte;
+    return Utf8_Remark( pText, ulUnit );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Utf8_Destroy()                                                            *
+ * ------------------------------------------------------------------------- */
+int Utf8_Destroy( PUTF8TEXT pText )
+{
+    if ( pText->bytes ) TextFree( &(pText->bytes) );
+    if ( pText->pMarks ) free_memory( pText->hdr.pAllocator, pText->pMarks );
+    if ( pText->pusWindow ) free_memory( pText->hdr.pAllocator, pText->pusWindow );
+    pText->bytes      = NULL;
+    pText->pMarks     = NULL;
+    pText->pusWindow  = NULL;
+    pText->ulUnits    = 0;
+    pText->ulMarks    = 0;
+    pText->ulMaxMarks = 0;
+    pText->ulWinUnits = 0;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Utf8_Init()                                                               *
+ *                                                                           *
+ * Sets up the gap buffer (with the same growth policy as the text object),  *
+ * the checkpoints and the window, then inserts the initial text.  Since     *
+ * the text is usually mostly ASCII, the buffer is sized for one byte per    *
+ * unit to begin with.                                                       *
+ * ------------------------------------------------------------------------- */
+int Utf8_Init( PUTF8TEXT pText, unsigned char *pchText, unsigned long cbText )
+{
+    if ( cbText % UTF8_UNIT ) return 0;
+    if ( !pText->bytes ) {
+        if ( ! TextCreateWithAllocator( &(pText->bytes), TEXT_MODEL_GAPBUFFER,
+                                        pText->hdr.pAllocator ))
+            return 0;
+        pText->pMarks    = (PUTF8MARK) allocate_memory( pText->hdr.pAllocator, UTF8_MARK_INITIAL * sizeof( UTF8MARK ));
+        pText->pusWindow = (unsigned short *) allocate_memory( pText->hdr.pAllocator, UTF8_WINDOW_UNITS * UTF8_UNIT );
+        pText->ulMaxMarks = UTF8_MARK_INITIAL;
+        if ( !pText->pMarks || !pText->pusWindow ) {
+            Utf8_Destroy( pText );
+            return 0;
+        }
+    }
+    TextSetGrowth( pText->bytes, pText->hdr.usGrowPercent, pText->hdr.cbGrowLimit );
+    if ( ! TextInitContents( pText->bytes, NULL, 0 )) return 0;
+    TextReserve( pText->bytes, cbText / UTF8_UNIT );
+
+    pText->ulUnits          = 0;
+    pText->ulMarks          = 1;
+    pText->pMarks[ 0 ].ulUnit = 0;
+    pText->pMarks[ 0 ].ulByte = 0;
+    pText->last             = pText->pMarks[ 0 ];
+    pText->ulWinUnits       = 0;
+    if ( !pchText || !cbText ) return 1;
+    return Utf8_Insert( pText, pchText, 0, cbText );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Utf8_Insert()                                                             *
+ *                                                                           *
+ * Encodes the new text into the UTF-8 text a piece at a time (each piece    *
+ * going in just after the last, i.e. at the gap), then shifts the           *
+ * checkpoints which follow it and re-marks the stretch it went into.        *
+ * ------------------------------------------------------------------------- */
+int Utf8_Insert( PUTF8TEXT pText, unsigned char *pch, unsigned long ulPosition, unsigned long ulLength )
+{
+    unsigned char achOut[ UTF8_ENCODE_UNITS * 3 ];
+    unsigned long ulUnit,
+                  ulCount,
+                  ulChunk,
+                  ulByte,
+                  cbDone,
+                  cbOut,
+                  i;
+
+    if ( !pText->bytes ) return 0;
+    if (( ulPosition % UTF8_UNIT ) || ( ulLength % UTF8_UNIT )) return 0;
+    ulUnit  = ulPosition / UTF8_UNIT;
+    ulCount = ulLength / UTF8_UNIT;
+    if ( ulUnit > pText->ulUnits ) return 0;
+    if ( !ulCount ) return 1;
+
+    ulByte = Utf8_Locate( pText, ulUnit );
+    cbDone = 0;
+    for ( i = 0; i < ulCount; i += ulChunk ) {
+        ulChunk = ulCount - i;
+        if ( ulChunk > UTF8_ENCODE_UNITS ) ulChunk = UTF8_ENCODE_UNITS;
+        cbOut = Utf8_Encode( pch + ( i * UTF8_UNIT ), ulChunk, achOut );
+        if ( ! TextInsert( pText->bytes, achOut, ulByte + cbDone, cbOut )) {
+            // Take out whatever did go in, so the text is unchanged
+            TextDelete( pText->bytes, ulByte, cbDone );
+            pText->ulWinUnits = 0;
+            return 0;
+        }
+        cbDone += cbOut;
+    }
+
+    for ( i = Utf8_FindMark( pText, ulUnit ) + 1; i < pText->ulMarks; i++ ) {
+        pText->pMarks[ i ].ulUnit += ulCount;
+        pText->pMarks[ i ].ulByte += cbDone;
+    }
+
+    pText->ulUnits    += ulCount;
+    pText->ulWinUnits  = 0;
+    pText->last.ulUnit = ulUnit + ulCount;
+    pText->last.ulByte = ulByte + cbDone;
+    return Utf8_Remark( pText, ulUnit );
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Utf8_Length()                                                             *
+ * ------------------------------------------------------------------------- */
+unsigned long Utf8_Length( PUTF8TEXT pText )
+{
+    return pText->ulUnits * UTF8_UNIT;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Utf8_Sequence()                                                           *
+ * ------------------------------------------------------------------------- */
+unsigned long Utf8_Sequence( PUTF8TEXT pText, unsigned char *pchText, unsigned long ulPosition, unsigned long ulLength )
+{
+    unsigned long cbText,
+                  cbDone,
+                  ulOffset,
+                  cbChunk;
+
+    cbText = pText->ulUnits * UTF8_UNIT;
+    if ( !pText->bytes || ( ulPosition >= cbText )) return 0;
+    if ( ulLength > ( cbText - ulPosition )) ulLength = cbText - ulPosition;
+
+    for ( cbDone = 0; cbDone < ulLength; cbDone += cbChunk ) {
+        if ( ! Utf8_Fill( pText, ( ulPosition + cbDone ) / UTF8_UNIT,
+                          ( ulLength - cbDone + UTF8_UNIT - 1 ) / UTF8_UNIT )) break;
+        ulOffset = ( ulPosition + cbDone ) - ( pText->ulWinUnit * UTF8_UNIT );
+        cbChunk  = ( pText->ulWinUnits * UTF8_UNIT ) - ulOffset;
+        if ( cbChunk > ( ulLength - cbDone )) cbChunk = ulLength - cbDone;
+        memcpy( pchText + cbDone, ((unsigned char *) pText->pusWindow ) + ulOffset, cbChunk );
+    }
+    return cbDone;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Utf8_GetSpans()                                                           *
+ *                                                                           *
+ * Returns a single span, in the window, which may be shorter than the       *
+ * range requested.                                                          *
+ * ------------------------------------------------------------------------- */
+int Utf8_GetSpans( PUTF8TEXT pText, unsigned long ulPosition, unsigned long ulLength, PTEXTSPAN pSpan1, PTEXTSPAN pSpan2 )
+{
+    unsigned long ulOffset;
+
+    if ( !pText->bytes || ( ulPosition >= ( pText->ulUnits * UTF8_UNIT ))) return 0;
+    if ( ! Utf8_Fill( pText, ulPosition / UTF8_UNIT, ( ulLength + UTF8_UNIT - 1 ) / UTF8_UNIT )) return 0;
+
+    ulOffset = ulPosition - ( pText->ulWinUnit * UTF8_UNIT );
+    pSpan1->pch = ((unsigned char *) pText->pusWindow ) + ulOffset;
+    pSpan1->cb  = ( pText->ulWinUnits * UTF8_UNIT ) - ulOffset;
+    if ( pSpan1->cb > ulLength ) pSpan1->cb = ulLength;
+
+    // Only the decoding window is addressable, so there is never a second span
+    pSpan2->pch = NULL;
+    pSpan2->cb  = 0;
+    return 1;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Utf8_Reserve()                                                            *
+ *                                                                           *
+ * Reserves one byte of UTF-8 text per unit.                                 *
+ * ------------------------------------------------------------------------- */
+int Utf8_Reserve( PUTF8TEXT pText, unsigned long cbText )
+{
+    if ( !pText->bytes ) return 0;
+    return TextReserve( pText->bytes, cbText / UTF8_UNIT );
+}
+